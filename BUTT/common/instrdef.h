@@ -32,6 +32,12 @@
  Revision:
  
     11/19/15        Initial Creation
+    10/17/26        Atomic load bits
+    10/17/26        Future bit on async calls
+    10/17/26        Schedule of parallel loops
+    10/17/26        Barrier waits
+    10/17/26        Channel format
+    10/17/26        Single channel bit
 
 **/
 
@@ -47,6 +53,40 @@
 #define INDIRECT_OFFSET_TYPE_REGISTER   0
 #define INDIRECT_OFFSET_TYPE_CONSTANT   1
 
+//
+// AtomicLoad is set on instructions reading an atomic variable, AtomicStore
+// on stores writing one. The VM makes those loads acquire and those stores
+// release.
+//
+
+//
+// Future is set on async calls whose thread is joined later. The VM leaves a
+// handle to the thread in RRV for them.
+//
+
+//
+// A parallel loop pops the first index, the bound, the stride and the chunk
+// size of the loop off the stack, pushed in that order, and calls its body
+// for each chunk with the first index and the bound of the chunk. Schedule
+// says how the chunks are handed out, a chunk size of 0 leaves their size
+// to the VM.
+//
+
+#define LOOP_SCHEDULE_STATIC    0
+#define LOOP_SCHEDULE_DYNAMIC   1
+#define LOOP_SCHEDULE_GUIDED    2
+
+#define LOOP_PARAMETER_COUNT        4
+#define LOOP_BODY_PARAMETER_COUNT   2
+
+//
+// A channel is a global named by its offset in the global data. Every send
+// and receive carries the number of values the channel holds, less one, and
+// whether the channel was declared to have a single sender and receiver.
+//
+
+#define CHANNEL_MAX_SIZE        (1 << 20)
+
 //
 // 64 bit instructions.
 //
@@ -71,7 +111,7 @@ typedef struct _INSTRUCTION {
             int64_t  LtRegisterOffset      : 14;
             int64_t  RtRegisterOffset      : 14;
             int64_t  DtRegisterOffset      : 14;
-            uint64_t                       : 1;
+            uint64_t AtomicLoad            : 1;
         } Arith;
         
         //
@@ -98,7 +138,7 @@ typedef struct _INSTRUCTION {
             uint64_t AtomicStore           : 1;
             int64_t  RtRegisterOffset      : 23;
             int64_t  DtRegisterOffset      : 23;
-            uint64_t                       : 1;
+            uint64_t AtomicLoad            : 1;
         } Store;
         
         //
@@ -111,7 +151,9 @@ typedef struct _INSTRUCTION {
             uint64_t Register               : 5;
             int64_t  RegisterOffset         : 32;
             uint64_t ZeroRegister           : 5;
-            uint64_t                        : 15;
+            uint64_t Future                 : 1;
+            uint64_t Schedule               : 2;
+            uint64_t                        : 12;
         } Jump;
         
         //
@@ -125,16 +167,29 @@ typedef struct _INSTRUCTION {
         } Return;
         
         //
-        // Stack push & pop
+        // Stack push & pop, and barrier waits
         //
         
         struct {
             uint64_t Opcode                 : 6;
             uint64_t Register               : 5;
             int64_t  RegisterOffset         : 32;
-            uint64_t                        : 21;
+            uint64_t AtomicLoad             : 1;
+            uint64_t                        : 20;
         } Stack;
         
+        //
+        // Channels
+        //
+        
+        struct {
+            uint64_t Opcode                 : 6;
+            uint64_t Register               : 5;
+            int64_t  ChannelOffset          : 32;
+            uint64_t Capacity               : 20;
+            uint64_t Single                 : 1;
+        } Channel;
+        
         //
         // I/O
         //
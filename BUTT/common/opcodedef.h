@@ -32,6 +32,12 @@
  Revision:
  
     11/19/15        Initial Creation
+    10/17/26        Atomic read-modify-write
+    10/17/26        Thread joins
+    10/17/26        Parallel loops
+    10/17/26        Reductions
+    10/17/26        Barriers
+    10/17/26        Channels
 
 **/
 
@@ -129,6 +135,67 @@ typedef enum _OPCODES {
     OPC_PRINT       = 39,
     OPC_READ        = 40,
     
+    //
+    // Atomic read-modify-write. Lt is the atomic variable, Rt the operand and
+    // Dt the register receiving the new value. Compare and swap takes the 
+    // expected value in Dt and leaves the old value of the variable there.
+    //
+    
+    OPC_AADD        = 41,
+    OPC_ASUB        = 42,
+    OPC_AOR         = 43,
+    OPC_AAND        = 44,
+    OPC_AXOR        = 45,
+    OPC_ACAS        = 46,
+    
+    //
+    // Thread joins. Lt holds the handle of an async call, Dt is the register
+    // receiving the return value of the thread once it has finished.
+    //
+    
+    OPC_JOIN        = 47,
+    
+    //
+    // Parallel loops. The target is the body of the loop, see instrdef.h.
+    //
+    
+    OPC_PFOR        = 48,
+    
+    //
+    // Reductions. The update opcodes take the same operands as the atomic
+    // ones, Lt being the global reduction variable, but fold the operand into
+    // a copy private to the thread, and leave the operand itself in Dt. The
+    // copy is folded into the variable when the thread finishes, or when a
+    // parallel loop it runs is done. The first thread has no copy and 
+    // updates the variable itself. RMIN and RMAX keep the least or the 
+    // greatest signed value, the variable starting out as the other end.
+    //
+    
+    OPC_RADD        = 49,
+    OPC_RSUB        = 50,
+    OPC_ROR         = 51,
+    OPC_RAND        = 52,
+    OPC_RXOR        = 53,
+    OPC_RMIN        = 54,
+    OPC_RMAX        = 55,
+    
+    //
+    // Barriers, in the stack format. WAIT names a global barrier variable
+    // holding the count of threads that meet there, and returns once that
+    // many have arrived.
+    //
+    
+    OPC_WAIT        = 56,
+    
+    //
+    // Channels, in the channel format. SEND puts the value in Register into
+    // the channel, RECV takes the oldest value out of it into Register. Each
+    // waits while the channel is full or empty.
+    //
+    
+    OPC_SEND        = 57,
+    OPC_RECV        = 58,
+    
     OPC_ERR         = 63
 } OPCODES;
 
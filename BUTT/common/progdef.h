@@ -32,6 +32,7 @@
  Revision:
  
     11/19/15        Initial Creation
+    10/17/26        Version 1.1, function symbols carry stack depth
 
 **/
 
@@ -43,7 +44,7 @@
 
 #define HEADER_MAGIC_NUMBER     0xC403
 #define COMPILER_VERSION_MAJOR  0x0001
-#define COMPILER_VERSION_MINOR  0x0000
+#define COMPILER_VERSION_MINOR  0x0001
 #define HEADER_SIZE_BYTES       0x40
 
 typedef struct _PROGRAM_HEADER {
@@ -32,15 +32,26 @@
  Revision:
  
     11/19/15        Initial Creation
+    10/17/26        Stack depth of each function
 
 **/
 
 #ifndef __SYMDEF_H__
 #define __SYMDEF_H__
 
+//
+// StackDepth is the most stack a call to the function takes below its return
+// address, in bytes, counting every call it makes in turn. Functions that
+// can recurse, or move the stack in ways the translator can't follow, have
+// no bound.
+//
+
+#define SYMBOL_STACK_UNBOUNDED  0xFFFFFFFFUL
+
 typedef struct _FUNCTION_SYMBOL {
     unsigned long FunctionAddress;
     unsigned long ParameterCount;
+    unsigned long StackDepth;
 } FUNCTION_SYMBOL, *PFUNCTION_SYMBOL;
 
 #endif // __SYMDEF_H__
\ No newline at end of file
@@ -0,0 +1,107 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    tracedef.h
+
+ Abstract:
+
+    This module defines the binary trace file format written by the VM and
+    read back by the trace decoder.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+
+**/
+
+#ifndef __TRACEDEF_H__
+#define __TRACEDEF_H__
+
+#include <assert.h>
+#include <inttypes.h>
+
+#define TRACE_MAGIC_NUMBER      0x54524333
+#define TRACE_VERSION           0x0001
+#define TRACE_RECORD_SIZE_BYTES 0x20
+
+//
+// Trace levels. Every trace point belongs to one of these and compiles to
+// nothing when the VM is built with a lower TRACE_LEVEL.
+//
+
+#define TRACE_LEVEL_NONE        0
+#define TRACE_LEVEL_CONTROL     1       // Jumps, calls, returns, threads
+#define TRACE_LEVEL_MEMORY      2       // Stores, pushes, pops
+#define TRACE_LEVEL_INSTRUCTION 3       // Every fetch and every operation
+
+typedef enum _TRACE_TYPE {
+    TRACE_TYPE_THREAD_START = 0,        // Value[0] = entry index
+    TRACE_TYPE_THREAD_END,
+    TRACE_TYPE_JUMP,                    // Value[0] = target index
+    TRACE_TYPE_BRANCH,                  // Value[0] = target, [1] = condition
+    TRACE_TYPE_CALL,                    // Value[0] = target, [1] = return, [2] = RSB
+    TRACE_TYPE_RETURN,                  // Value[0] = return, [1] = RSB, [2] = cleanup
+    TRACE_TYPE_STORE,                   // Value[0] = value, [1] = offset
+    TRACE_TYPE_PUSH,                    // Value[0] = value, [1] = RSB
+    TRACE_TYPE_POP,                     // Value[0] = value, [1] = RSB
+    TRACE_TYPE_FETCH,                   // Value[0] = dispatched opcode
+    TRACE_TYPE_ARITHMETIC,              // Value[0] = left, [1] = right, [2] = result, [3] = offset
+    TRACE_TYPE_RCOPYD,                  // Value[0] = value
+    TRACE_TYPE_MAX
+} TRACE_TYPE;
+
+//
+// Records are fixed size so writing one is a handful of stores, and so the
+// decoder can walk a file without any framing.
+//
+
+typedef struct _TRACE_RECORD {
+    uint64_t Timestamp;                         // 0x08
+    uint32_t Index;                             // 0x0C
+    uint16_t Type;                              // 0x0E
+    uint8_t Register;                           // 0x0F
+    uint8_t Reserved;                           // 0x10
+    int32_t Value[4];                           // 0x20
+} TRACE_RECORD, *PTRACE_RECORD;
+
+static_assert(sizeof(TRACE_RECORD) == TRACE_RECORD_SIZE_BYTES,
+              "sizeof(TRACE_RECORD) isn't TRACE_RECORD_SIZE_BYTES");
+
+//
+// A trace file is this header followed by RecordCount records, oldest
+// first. Written counts every record the thread produced, so anything past
+// RecordCount was overwritten in the ring before it was flushed.
+//
+
+typedef struct _TRACE_FILE_HEADER {
+    uint32_t MagicNumber;                       // 0x04
+    uint16_t Version;                           // 0x06
+    uint16_t Level;                             // 0x08
+    uint32_t ThreadId;                          // 0x0C
+    uint32_t RecordCount;                       // 0x10
+    uint64_t Written;                           // 0x18
+} TRACE_FILE_HEADER, *PTRACE_FILE_HEADER;
+
+#endif // __TRACEDEF_H__
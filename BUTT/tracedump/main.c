@@ -0,0 +1,242 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    main.c
+
+ Abstract:
+
+    Entry point for the trace decoder. Reads the binary trace files BUTVM
+    writes and prints them as text.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "../Common/def.h"
+#include "../Common/tracedef.h"
+
+#define REGISTER_NAME(R)    ((R) < REG_MAX ? _REGISTER_NAMES[(R)] : "???")
+
+VOID
+TracePrintRecord (
+    PTRACE_RECORD Record
+    )
+
+/*
+
+ Routine description:
+
+    This routine prints a single trace record.
+
+ Arguments:
+
+    Record - The record to print.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    printf("%016llX 0x%08X ",
+           (unsigned long long)Record->Timestamp,
+           (unsigned int)Record->Index);
+
+    switch(Record->Type) {
+        case TRACE_TYPE_THREAD_START:
+            printf("Thread start at 0x%X\n", (unsigned int)Record->Value[0]);
+            break;
+
+        case TRACE_TYPE_THREAD_END:
+            printf("Thread end\n");
+            break;
+
+        case TRACE_TYPE_JUMP:
+            printf("Target 0x%X\n", (unsigned int)Record->Value[0]);
+            break;
+
+        case TRACE_TYPE_BRANCH:
+            printf("Conditional Target 0x%X: %s\n",
+                   (unsigned int)Record->Value[0],
+                   Record->Value[1] == 0 ? "taken" : "not taken");
+            break;
+
+        case TRACE_TYPE_CALL:
+            printf("Call: 0x%X: Pushing RIP+1: 0x%X RSB: 0x%X\n",
+                   (unsigned int)Record->Value[0],
+                   (unsigned int)Record->Value[1],
+                   (unsigned int)Record->Value[2]);
+            break;
+
+        case TRACE_TYPE_RETURN:
+            printf("RETURN: RSB: 0x%X: Returning to 0x%X: Cleaning up 0x%X bytes\n",
+                   (unsigned int)Record->Value[1],
+                   (unsigned int)Record->Value[0],
+                   (unsigned int)Record->Value[2]);
+            break;
+
+        case TRACE_TYPE_STORE:
+            printf("Store: Storing %ld into %s + %ld\n",
+                   (long)Record->Value[0],
+                   REGISTER_NAME(Record->Register),
+                   (long)Record->Value[1]);
+            break;
+
+        case TRACE_TYPE_PUSH:
+            printf("Push: Pushing 0x%X RSB: 0x%X\n",
+                   (unsigned int)Record->Value[0],
+                   (unsigned int)Record->Value[1]);
+            break;
+
+        case TRACE_TYPE_POP:
+            printf("Pop: Popped 0x%X RSB: 0x%X\n",
+                   (unsigned int)Record->Value[0],
+                   (unsigned int)Record->Value[1]);
+            break;
+
+        case TRACE_TYPE_FETCH:
+            printf("Accessing instruction: opcode 0x%X\n",
+                   (unsigned int)Record->Value[0]);
+            break;
+
+        case TRACE_TYPE_ARITHMETIC:
+            printf("Arithmetic: Storing %ld OP %ld = %ld into %s + %ld\n",
+                   (long)Record->Value[0],
+                   (long)Record->Value[1],
+                   (long)Record->Value[2],
+                   REGISTER_NAME(Record->Register),
+                   (long)Record->Value[3]);
+            break;
+
+        case TRACE_TYPE_RCOPYD:
+            printf("Copying value 0x%X into %s\n",
+                   (unsigned int)Record->Value[0],
+                   REGISTER_NAME(Record->Register));
+            break;
+
+        default:
+            printf("Unknown record type 0x%X\n", (unsigned int)Record->Type);
+            break;
+    }
+}
+
+LONG
+TraceDumpFile (
+    PCHAR FileName
+    )
+
+/*
+
+ Routine description:
+
+    This routine decodes and prints one trace file.
+
+ Arguments:
+
+    FileName - Path of the trace file.
+
+ Return value:
+
+    0 on success, -1 otherwise.
+
+*/
+
+{
+    TRACE_FILE_HEADER Header;
+    TRACE_RECORD Record;
+    FILE *TraceFile;
+    ULONG i;
+    LONG RetVal;
+
+    RetVal = -1;
+    TraceFile = fopen(FileName, "rb");
+    if(TraceFile == NULL) {
+        fprintf(stderr, "%s: unable to open.\n", FileName);
+        return -1;
+    }
+
+    if(fread(&Header, sizeof(TRACE_FILE_HEADER), 1, TraceFile) != 1 ||
+       Header.MagicNumber != TRACE_MAGIC_NUMBER ||
+       Header.Version != TRACE_VERSION) {
+
+        fprintf(stderr, "%s: not a BUTVM trace file.\n", FileName);
+        goto TraceDumpFileEnd;
+    }
+
+    printf("###################### TRACE START ######################\n");
+    printf("File       : %s\n", FileName);
+    printf("Thread     : 0x%X\n", (unsigned int)Header.ThreadId);
+    printf("Level      : 0x%X\n", (unsigned int)Header.Level);
+    printf("Records    : 0x%X\n", (unsigned int)Header.RecordCount);
+    printf("Overwritten: 0x%llX\n",
+           (unsigned long long)(Header.Written - Header.RecordCount));
+
+    for(i=0; i<Header.RecordCount; ++i) {
+        if(fread(&Record, sizeof(TRACE_RECORD), 1, TraceFile) != 1) {
+            fprintf(stderr, "%s: truncated.\n", FileName);
+            goto TraceDumpFileEnd;
+        }
+
+        TracePrintRecord(&Record);
+    }
+
+    printf("####################### TRACE END #######################\n");
+    RetVal = 0;
+
+TraceDumpFileEnd:
+    fclose(TraceFile);
+    return RetVal;
+}
+
+INT
+main (
+    INT argc,
+    PCHAR *argv
+    )
+{
+    INT i;
+    INT RetVal;
+
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <trace file>...\n", argv[0]);
+        return 1;
+    }
+
+    RetVal = 0;
+    for(i=1; i<argc; ++i) {
+        if(TraceDumpFile(argv[i]) != 0) {
+            RetVal = 1;
+        }
+    }
+
+    return RetVal;
+}
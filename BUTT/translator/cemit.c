@@ -0,0 +1,2881 @@
+/**
+
+ Copyright 2015 Omar Carey.
+ 
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ Translation Unit:
+    
+    cemit.c
+    
+ Abstract:
+    
+    This module implements the C backend, which emits a program as a standalone 
+    C file instead of a VM binary.
+    
+ Author:
+    
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+ 
+    10/17/26        Initial Creation
+    10/17/26        Acquire loads and release stores of atomic variables
+    10/17/26        Atomic read-modify-write
+    10/17/26        Thread joins
+    10/17/26        Parallel loops and the values their bodies capture
+    10/17/26        RGD only declared where it is read
+    10/17/26        Reductions into per thread copies
+    10/17/26        Barriers
+    10/17/26        Channels
+    10/17/26        Reads into globals
+    10/17/26        Single channels
+
+**/
+
+#include "cemit.h"
+#include "register.h"
+#include "opcodes.h"
+#include "errors.h"
+#include "../Common/instrdef.h"
+#include "../Common/registerdef.h"
+#include "../Common/symdef.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+
+#define CEMIT_EXPRESSION_SIZE   128
+
+//
+// A region is a run of instructions emitted as one C function. Region 0 is
+// the start block, every other region is a BUTT function running up to the
+// next one.
+//
+
+typedef struct _CEMIT_REGION {
+    unsigned long Start;
+    unsigned long End;
+    unsigned long ParameterCount;
+    unsigned long RegisterMask;
+} CEMIT_REGION, *PCEMIT_REGION;
+
+//
+// Each channel found in the program, by its offset in the global data.
+//
+
+typedef struct _CEMIT_CHANNEL {
+    long Offset;
+    unsigned long Capacity;
+    unsigned Single;
+} CEMIT_CHANNEL, *PCEMIT_CHANNEL;
+
+typedef struct _CEMIT_REDUCTION {
+    long Offset;
+    OPCODES Opcode;
+} CEMIT_REDUCTION, *PCEMIT_REDUCTION;
+
+typedef struct _CEMIT_PROGRAM {
+    FILE *OutFile;
+    PINSTRUCTION *Instructions;
+    unsigned long InstructionCount;
+    PCEMIT_REGION Regions;
+    unsigned long RegionCount;
+    unsigned long CurrentRegion;
+    unsigned char *Labels;
+    long *Barriers;
+    unsigned long BarrierCount;
+    PCEMIT_CHANNEL Channels;
+    unsigned long ChannelCount;
+    PCEMIT_REDUCTION Reductions;
+    unsigned long ReductionCount;
+    int Failed;
+} CEMIT_PROGRAM, *PCEMIT_PROGRAM;
+
+//
+// The runtime every emitted program starts with. Only depends on the C
+// library and the host threads.
+//
+
+static const char CEmitRuntime[] =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "#include <stdint.h>\n"
+    "#ifdef _WIN32\n"
+    "#include <windows.h>\n"
+    "#else\n"
+    "#include <pthread.h>\n"
+    "#include <sched.h>\n"
+    "#include <unistd.h>\n"
+    "#ifdef __linux__\n"
+    "#include <linux/futex.h>\n"
+    "#include <sys/syscall.h>\n"
+    "#endif\n"
+    "#endif\n"
+    "\n"
+    "#ifdef __GNUC__\n"
+    "#define BUTT_NORETURN           __attribute__((noreturn))\n"
+    "#define BUTT_UNUSED             __attribute__((unused))\n"
+    "#else\n"
+    "#define BUTT_NORETURN\n"
+    "#define BUTT_UNUSED\n"
+    "#endif\n"
+    "\n"
+    "//\n"
+    "// Stack addresses are compiled against the top of a fake single address\n"
+    "// space, Stack points at that top.\n"
+    "//\n"
+    "\n"
+    "#define BUTT_STACK(Register, Offset)                                        \\\n"
+    "    (Stack + (int32_t)((uint32_t)(Register) + (uint32_t)(Offset)))\n"
+    "\n"
+    "//\n"
+    "// Index registers point into the global data as well, which lies above\n"
+    "// the stack in that address space. The offset is not compiled against\n"
+    "// the stack top here.\n"
+    "//\n"
+    "\n"
+    "#define BUTT_INDEX(Register, Offset)                                        \\\n"
+    "    ((uint32_t)(Register) + (uint32_t)(Offset) >= BUTT_DATA_START ?        \\\n"
+    "     ButtGlobalData + ((uint32_t)(Register) + (uint32_t)(Offset) -         \\\n"
+    "                       BUTT_DATA_START) :                                  \\\n"
+    "     BUTT_STACK(Register, (uint32_t)(Offset) - BUTT_STACK_TOP))\n"
+    "\n"
+    "typedef struct _BUTT_THREAD BUTT_THREAD, *PBUTT_THREAD;\n"
+    "typedef struct _BUTT_LOOP BUTT_LOOP, *PBUTT_LOOP;\n"
+    "\n"
+    "typedef int32_t (*BUTT_FUNCTION)(PBUTT_THREAD Thread);\n"
+    "\n"
+    "//\n"
+    "// RST and RSB are handed from caller to callee and back through the\n"
+    "// thread, every other register is a local of the function using it.\n"
+    "//\n"
+    "\n"
+    "struct _BUTT_THREAD {\n"
+    "    char *Stack;\n"
+    "    char *StackBase;\n"
+    "    uint32_t Rst;\n"
+    "    uint32_t Rsb;\n"
+    "    BUTT_FUNCTION Function;\n"
+    "    int32_t ReturnValue;\n"
+    "    int32_t Done;\n"
+    "    PBUTT_THREAD Next;\n"
+    "    PBUTT_LOOP Loop;\n"
+    "    int64_t LoopChunk;\n"
+    "    int32_t *Reductions;\n"
+    "    int32_t First;\n"
+    "#ifdef _WIN32\n"
+    "    HANDLE Handle;\n"
+    "#else\n"
+    "    pthread_t Handle;\n"
+    "#endif\n"
+    "};\n"
+    "\n"
+    "//\n"
+    "// Kept in words so atomic variables are aligned.\n"
+    "//\n"
+    "\n"
+    "static BUTT_UNUSED int32_t ButtGlobalWords[BUTT_DATA_SIZE / sizeof(int32_t) + 2];\n"
+    "#define ButtGlobalData          ((char *)ButtGlobalWords)\n"
+    "\n"
+    "static PBUTT_THREAD ButtAsyncThreads;\n"
+    "\n"
+    "//\n"
+    "// Async calls that get joined hand out an index into the futures, plus one\n"
+    "// so zero is no thread. Their threads stay around until the program ends.\n"
+    "//\n"
+    "\n"
+    "static PBUTT_THREAD *ButtFutures;\n"
+    "static uint32_t ButtFutureCount;\n"
+    "static uint32_t ButtFutureCapacity;\n"
+    "\n"
+    "#define BUTT_CALL_ASYNC         0\n"
+    "#define BUTT_CALL_SYNC          1\n"
+    "#define BUTT_CALL_FUTURE        2\n"
+    "\n"
+    "#define BUTT_JOIN_SPIN          1024\n"
+    "#define BUTT_BARRIER_SPIN       4096\n"
+    "#define BUTT_CHANNEL_SPIN       1024\n"
+    "\n"
+    "#ifdef _WIN32\n"
+    "static CRITICAL_SECTION ButtAsyncLock;\n"
+    "#define BUTT_LOCK_INITIALIZE()  InitializeCriticalSection(&ButtAsyncLock)\n"
+    "#define BUTT_LOCK()             EnterCriticalSection(&ButtAsyncLock)\n"
+    "#define BUTT_UNLOCK()           LeaveCriticalSection(&ButtAsyncLock)\n"
+    "#else\n"
+    "static pthread_mutex_t ButtAsyncLock = PTHREAD_MUTEX_INITIALIZER;\n"
+    "#define BUTT_LOCK_INITIALIZE()  ((void)0)\n"
+    "#define BUTT_LOCK()             pthread_mutex_lock(&ButtAsyncLock)\n"
+    "#define BUTT_UNLOCK()           pthread_mutex_unlock(&ButtAsyncLock)\n"
+    "#endif\n"
+    "\n"
+    "static BUTT_NORETURN void\n"
+    "ButtFatal (\n"
+    "    const char *Error\n"
+    "    )\n"
+    "{\n"
+    "    printf(\"Error: %s\\n\", Error);\n"
+    "    exit(-1);\n"
+    "}\n"
+    "\n"
+    "static inline int32_t\n"
+    "ButtLoad (\n"
+    "    const char *Address\n"
+    "    )\n"
+    "{\n"
+    "    int32_t Value;\n"
+    "\n"
+    "    memcpy(&Value, Address, sizeof(int32_t));\n"
+    "    return Value;\n"
+    "}\n"
+    "\n"
+    "static inline void\n"
+    "ButtStore (\n"
+    "    char *Address,\n"
+    "    int32_t Value\n"
+    "    )\n"
+    "{\n"
+    "    memcpy(Address, &Value, sizeof(int32_t));\n"
+    "}\n"
+    "\n"
+    "//\n"
+    "// Atomic variables are read acquire and written release. MSVC gives\n"
+    "// volatile accesses those semantics.\n"
+    "//\n"
+    "\n"
+    "static inline BUTT_UNUSED int32_t\n"
+    "ButtLoadAcquire (\n"
+    "    const char *Address\n"
+    "    )\n"
+    "{\n"
+    "#ifdef __GNUC__\n"
+    "    return __atomic_load_n((const int32_t *)Address, __ATOMIC_ACQUIRE);\n"
+    "#else\n"
+    "    return *(volatile const int32_t *)Address;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static inline BUTT_UNUSED void\n"
+    "ButtStoreRelease (\n"
+    "    char *Address,\n"
+    "    int32_t Value\n"
+    "    )\n"
+    "{\n"
+    "#ifdef __GNUC__\n"
+    "    __atomic_store_n((int32_t *)Address, Value, __ATOMIC_RELEASE);\n"
+    "#else\n"
+    "    *(volatile int32_t *)Address = Value;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "//\n"
+    "// Read-modify-write of atomic variables, each a single hardware atomic.\n"
+    "// They return the new value, compare and swap the old one. The MSVC\n"
+    "// interlocked routines all return the old value.\n"
+    "//\n"
+    "\n"
+    "static inline BUTT_UNUSED int32_t\n"
+    "ButtAtomicAdd (\n"
+    "    char *Address,\n"
+    "    int32_t Value\n"
+    "    )\n"
+    "{\n"
+    "#ifdef __GNUC__\n"
+    "    return __atomic_add_fetch((int32_t *)Address, Value, __ATOMIC_SEQ_CST);\n"
+    "#else\n"
+    "    return (int32_t)((uint32_t)InterlockedExchangeAdd((volatile LONG *)Address, Value) +\n"
+    "                     (uint32_t)Value);\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static inline BUTT_UNUSED int32_t\n"
+    "ButtAtomicOr (\n"
+    "    char *Address,\n"
+    "    int32_t Value\n"
+    "    )\n"
+    "{\n"
+    "#ifdef __GNUC__\n"
+    "    return __atomic_or_fetch((int32_t *)Address, Value, __ATOMIC_SEQ_CST);\n"
+    "#else\n"
+    "    return InterlockedOr((volatile LONG *)Address, Value) | Value;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static inline BUTT_UNUSED int32_t\n"
+    "ButtAtomicAnd (\n"
+    "    char *Address,\n"
+    "    int32_t Value\n"
+    "    )\n"
+    "{\n"
+    "#ifdef __GNUC__\n"
+    "    return __atomic_and_fetch((int32_t *)Address, Value, __ATOMIC_SEQ_CST);\n"
+    "#else\n"
+    "    return InterlockedAnd((volatile LONG *)Address, Value) & Value;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static inline BUTT_UNUSED int32_t\n"
+    "ButtAtomicXor (\n"
+    "    char *Address,\n"
+    "    int32_t Value\n"
+    "    )\n"
+    "{\n"
+    "#ifdef __GNUC__\n"
+    "    return __atomic_xor_fetch((int32_t *)Address, Value, __ATOMIC_SEQ_CST);\n"
+    "#else\n"
+    "    return InterlockedXor((volatile LONG *)Address, Value) ^ Value;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static inline BUTT_UNUSED int32_t\n"
+    "ButtAtomicCompareSwap (\n"
+    "    char *Address,\n"
+    "    int32_t Expected,\n"
+    "    int32_t Desired\n"
+    "    )\n"
+    "{\n"
+    "#ifdef __GNUC__\n"
+    "    __atomic_compare_exchange_n((int32_t *)Address,\n"
+    "                                &Expected,\n"
+    "                                Desired,\n"
+    "                                0,\n"
+    "                                __ATOMIC_SEQ_CST,\n"
+    "                                __ATOMIC_SEQ_CST);\n"
+    "    return Expected;\n"
+    "#else\n"
+    "    return InterlockedCompareExchange((volatile LONG *)Address, Desired, Expected);\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED uint32_t\n"
+    "ButtPrint (\n"
+    "    char *Stack,\n"
+    "    uint32_t Rsb,\n"
+    "    uint32_t Count\n"
+    "    )\n"
+    "{\n"
+    "    uint32_t i;\n"
+    "\n"
+    "    //\n"
+    "    // Parameters are printed in the order they were pushed.\n"
+    "    //\n"
+    "\n"
+    "    for(i=Count; i>0; --i) {\n"
+    "        printf(\"PRINT: %d\\n\",\n"
+    "               (int)ButtLoad(BUTT_STACK(Rsb, (i - 1) * sizeof(int32_t) - BUTT_STACK_TOP)));\n"
+    "    }\n"
+    "\n"
+    "    return Rsb + Count * sizeof(int32_t);\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED uint32_t\n"
+    "ButtRead (\n"
+    "    char *Stack,\n"
+    "    uint32_t Rsb,\n"
+    "    uint32_t Count\n"
+    "    )\n"
+    "{\n"
+    "    uint32_t Address;\n"
+    "    uint32_t i;\n"
+    "\n"
+    "    for(i=Count; i>0; --i) {\n"
+    "        Address = ButtLoad(BUTT_STACK(Rsb, (i - 1) * sizeof(int32_t) - BUTT_STACK_TOP));\n"
+    "        printf(\"READ: \");\n"
+    "        if(scanf(\"%d\", (int *)BUTT_INDEX(Address, 0)) != 1) {\n"
+    "            ButtFatal(\"Unable to read an integer.\");\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    return Rsb + Count * sizeof(int32_t);\n"
+    "}\n"
+    "\n"
+    "//\n"
+    "// Each thread but the first keeps a copy of the reduction variables once\n"
+    "// it updates one, which only it touches. The copies are folded into the\n"
+    "// variables when the thread is done, and when it starts a parallel loop.\n"
+    "// Min and max fold with a compare and swap, the others with a single\n"
+    "// atomic.\n"
+    "//\n"
+    "\n"
+    "#define BUTT_REDUCE_ADD         0\n"
+    "#define BUTT_REDUCE_OR          1\n"
+    "#define BUTT_REDUCE_AND         2\n"
+    "#define BUTT_REDUCE_XOR         3\n"
+    "#define BUTT_REDUCE_MIN         4\n"
+    "#define BUTT_REDUCE_MAX         5\n"
+    "\n"
+    "static const uint32_t ButtReductionOffsets[BUTT_REDUCTION_COUNT + 1] = {\n"
+    "    BUTT_REDUCTION_OFFSETS\n"
+    "};\n"
+    "\n"
+    "static const int ButtReductionOperators[BUTT_REDUCTION_COUNT + 1] = {\n"
+    "    BUTT_REDUCTION_OPERATORS\n"
+    "};\n"
+    "\n"
+    "static BUTT_UNUSED int32_t\n"
+    "ButtReductionIdentity (\n"
+    "    int Operator\n"
+    "    )\n"
+    "{\n"
+    "    switch(Operator) {\n"
+    "    case BUTT_REDUCE_AND:\n"
+    "        return -1;\n"
+    "    case BUTT_REDUCE_MIN:\n"
+    "        return INT32_MAX;\n"
+    "    case BUTT_REDUCE_MAX:\n"
+    "        return INT32_MIN;\n"
+    "    default:\n"
+    "        return 0;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED void\n"
+    "ButtReductionApply (\n"
+    "    char *Address,\n"
+    "    int Operator,\n"
+    "    int32_t Value\n"
+    "    )\n"
+    "{\n"
+    "    int32_t Old;\n"
+    "    int32_t Seen;\n"
+    "\n"
+    "    switch(Operator) {\n"
+    "    case BUTT_REDUCE_ADD:\n"
+    "        ButtAtomicAdd(Address, Value);\n"
+    "        return;\n"
+    "    case BUTT_REDUCE_OR:\n"
+    "        ButtAtomicOr(Address, Value);\n"
+    "        return;\n"
+    "    case BUTT_REDUCE_AND:\n"
+    "        ButtAtomicAnd(Address, Value);\n"
+    "        return;\n"
+    "    case BUTT_REDUCE_XOR:\n"
+    "        ButtAtomicXor(Address, Value);\n"
+    "        return;\n"
+    "    }\n"
+    "\n"
+    "    Old = ButtLoadAcquire(Address);\n"
+    "    for(;;) {\n"
+    "        if((Operator == BUTT_REDUCE_MIN && Old <= Value) ||\n"
+    "           (Operator == BUTT_REDUCE_MAX && Old >= Value)) {\n"
+    "            return;\n"
+    "        }\n"
+    "\n"
+    "        Seen = ButtAtomicCompareSwap(Address, Old, Value);\n"
+    "        if(Seen == Old) {\n"
+    "            return;\n"
+    "        }\n"
+    "\n"
+    "        Old = Seen;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED void\n"
+    "ButtReduce (\n"
+    "    PBUTT_THREAD Thread,\n"
+    "    uint32_t Reduction,\n"
+    "    int32_t Value\n"
+    "    )\n"
+    "{\n"
+    "    int32_t *Copy;\n"
+    "    uint32_t i;\n"
+    "\n"
+    "    if(Thread->First != 0) {\n"
+    "        ButtReductionApply(ButtGlobalData + ButtReductionOffsets[Reduction],\n"
+    "                           ButtReductionOperators[Reduction],\n"
+    "                           Value);\n"
+    "        return;\n"
+    "    }\n"
+    "\n"
+    "    //\n"
+    "    // The copies take a cache line more than they need, so no other\n"
+    "    // allocation shares their last one.\n"
+    "    //\n"
+    "\n"
+    "    if(Thread->Reductions == NULL) {\n"
+    "        Thread->Reductions = malloc(BUTT_REDUCTION_COUNT * sizeof(int32_t) + 64);\n"
+    "        if(Thread->Reductions == NULL) {\n"
+    "            ButtFatal(\"Out of memory :(\");\n"
+    "        }\n"
+    "\n"
+    "        for(i=0; i<BUTT_REDUCTION_COUNT; ++i) {\n"
+    "            Thread->Reductions[i] = ButtReductionIdentity(ButtReductionOperators[i]);\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    Copy = &Thread->Reductions[Reduction];\n"
+    "    switch(ButtReductionOperators[Reduction]) {\n"
+    "    case BUTT_REDUCE_ADD:\n"
+    "        *Copy = (int32_t)((uint32_t)*Copy + (uint32_t)Value);\n"
+    "        break;\n"
+    "    case BUTT_REDUCE_OR:\n"
+    "        *Copy = *Copy | Value;\n"
+    "        break;\n"
+    "    case BUTT_REDUCE_AND:\n"
+    "        *Copy = *Copy & Value;\n"
+    "        break;\n"
+    "    case BUTT_REDUCE_XOR:\n"
+    "        *Copy = *Copy ^ Value;\n"
+    "        break;\n"
+    "    case BUTT_REDUCE_MIN:\n"
+    "        *Copy = Value < *Copy ? Value : *Copy;\n"
+    "        break;\n"
+    "    default:\n"
+    "        *Copy = Value > *Copy ? Value : *Copy;\n"
+    "        break;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static void\n"
+    "ButtReductionFold (\n"
+    "    PBUTT_THREAD Thread\n"
+    "    )\n"
+    "{\n"
+    "    uint32_t i;\n"
+    "\n"
+    "    if(Thread->Reductions == NULL) {\n"
+    "        return;\n"
+    "    }\n"
+    "\n"
+    "    for(i=0; i<BUTT_REDUCTION_COUNT; ++i) {\n"
+    "        if(Thread->Reductions[i] != ButtReductionIdentity(ButtReductionOperators[i])) {\n"
+    "            ButtReductionApply(ButtGlobalData + ButtReductionOffsets[i],\n"
+    "                               ButtReductionOperators[i],\n"
+    "                               Thread->Reductions[i]);\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    free(Thread->Reductions);\n"
+    "    Thread->Reductions = NULL;\n"
+    "}\n"
+    "\n"
+    "static void\n"
+    "ButtReductionsInitialize (\n"
+    "    void\n"
+    "    )\n"
+    "{\n"
+    "    uint32_t i;\n"
+    "\n"
+    "    //\n"
+    "    // Min and max start out as the identity of their operator, the\n"
+    "    // others at zero like any global.\n"
+    "    //\n"
+    "\n"
+    "    for(i=0; i<BUTT_REDUCTION_COUNT; ++i) {\n"
+    "        if(ButtReductionOperators[i] == BUTT_REDUCE_MIN ||\n"
+    "           ButtReductionOperators[i] == BUTT_REDUCE_MAX) {\n"
+    "            ButtStore(ButtGlobalData + ButtReductionOffsets[i],\n"
+    "                      ButtReductionIdentity(ButtReductionOperators[i]));\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static PBUTT_THREAD\n"
+    "ButtThreadCreate (\n"
+    "    BUTT_FUNCTION Function\n"
+    "    )\n"
+    "{\n"
+    "    PBUTT_THREAD Thread;\n"
+    "\n"
+    "    Thread = malloc(sizeof(BUTT_THREAD));\n"
+    "    if(Thread == NULL) {\n"
+    "        ButtFatal(\"Out of memory :(\");\n"
+    "    }\n"
+    "\n"
+    "    memset(Thread, 0, sizeof(BUTT_THREAD));\n"
+    "    Thread->StackBase = malloc(BUTT_STACK_SIZE + sizeof(int32_t));\n"
+    "    if(Thread->StackBase == NULL) {\n"
+    "        ButtFatal(\"Out of memory :(\");\n"
+    "    }\n"
+    "\n"
+    "    Thread->Stack = Thread->StackBase + BUTT_STACK_SIZE;\n"
+    "    Thread->Rst = BUTT_STACK_TOP;\n"
+    "    Thread->Rsb = BUTT_STACK_TOP;\n"
+    "    Thread->Function = Function;\n"
+    "    return Thread;\n"
+    "}\n"
+    "\n"
+    "static void\n"
+    "ButtThreadFree (\n"
+    "    PBUTT_THREAD Thread\n"
+    "    )\n"
+    "{\n"
+    "    free(Thread->StackBase);\n"
+    "    free(Thread);\n"
+    "}\n"
+    "\n"
+    "#ifdef _WIN32\n"
+    "static DWORD WINAPI\n"
+    "ButtThreadMain (\n"
+    "    LPVOID Param\n"
+    "    )\n"
+    "#else\n"
+    "static void *\n"
+    "ButtThreadMain (\n"
+    "    void *Param\n"
+    "    )\n"
+    "#endif\n"
+    "{\n"
+    "    PBUTT_THREAD Thread;\n"
+    "\n"
+    "    Thread = Param;\n"
+    "    Thread->ReturnValue = Thread->Function(Thread);\n"
+    "    ButtReductionFold(Thread);\n"
+    "#ifdef __GNUC__\n"
+    "    __atomic_store_n(&Thread->Done, 1, __ATOMIC_RELEASE);\n"
+    "#else\n"
+    "    *(volatile int32_t *)&Thread->Done = 1;\n"
+    "#endif\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "static void\n"
+    "ButtThreadStart (\n"
+    "    PBUTT_THREAD Thread\n"
+    "    )\n"
+    "{\n"
+    "#ifdef _WIN32\n"
+    "    Thread->Handle = CreateThread(NULL, 0, ButtThreadMain, Thread, 0, NULL);\n"
+    "    if(Thread->Handle == NULL) {\n"
+    "        ButtFatal(\"Unable to create a thread.\");\n"
+    "    }\n"
+    "#else\n"
+    "    if(pthread_create(&Thread->Handle, NULL, ButtThreadMain, Thread) != 0) {\n"
+    "        ButtFatal(\"Unable to create a thread.\");\n"
+    "    }\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static void\n"
+    "ButtThreadJoin (\n"
+    "    PBUTT_THREAD Thread\n"
+    "    )\n"
+    "{\n"
+    "#ifdef _WIN32\n"
+    "    WaitForSingleObject(Thread->Handle, INFINITE);\n"
+    "    CloseHandle(Thread->Handle);\n"
+    "#else\n"
+    "    pthread_join(Thread->Handle, NULL);\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED int32_t\n"
+    "ButtParallelCall (\n"
+    "    PBUTT_THREAD Caller,\n"
+    "    BUTT_FUNCTION Function,\n"
+    "    uint32_t ParameterCount,\n"
+    "    int Mode\n"
+    "    )\n"
+    "{\n"
+    "    PBUTT_THREAD Thread;\n"
+    "    uint32_t Size;\n"
+    "    int32_t ReturnValue;\n"
+    "\n"
+    "    //\n"
+    "    // The callee runs on a stack of its own, holding a copy of the\n"
+    "    // parameters and a dummy return address, just as a normal call would\n"
+    "    // have left them. The parameters are popped off the caller stack here\n"
+    "    // since the callee can't. A sync call waits for the callee and gets its\n"
+    "    // return value, an async one doesn't, but may get a future for it.\n"
+    "    //\n"
+    "\n"
+    "    Thread = ButtThreadCreate(Function);\n"
+    "    Size = ParameterCount * sizeof(int32_t);\n"
+    "    Thread->Rsb = Thread->Rsb - Size;\n"
+    "    memcpy(Thread->Stack + (int32_t)(Thread->Rsb - BUTT_STACK_TOP),\n"
+    "           Caller->Stack + (int32_t)(Caller->Rsb - BUTT_STACK_TOP),\n"
+    "           Size);\n"
+    "\n"
+    "    Thread->Rsb = Thread->Rsb - sizeof(int32_t);\n"
+    "    ButtStore(Thread->Stack + (int32_t)(Thread->Rsb - BUTT_STACK_TOP), 0);\n"
+    "    Caller->Rsb = Caller->Rsb + Size;\n"
+    "    ButtThreadStart(Thread);\n"
+    "    if(Mode != BUTT_CALL_SYNC) {\n"
+    "        ReturnValue = 0;\n"
+    "        BUTT_LOCK();\n"
+    "        Thread->Next = ButtAsyncThreads;\n"
+    "        ButtAsyncThreads = Thread;\n"
+    "        if(Mode == BUTT_CALL_FUTURE) {\n"
+    "            if(ButtFutureCount == ButtFutureCapacity) {\n"
+    "                ButtFutureCapacity = ButtFutureCapacity * 2 + 64;\n"
+    "                ButtFutures = realloc(ButtFutures,\n"
+    "                                      ButtFutureCapacity * sizeof(PBUTT_THREAD));\n"
+    "\n"
+    "                if(ButtFutures == NULL) {\n"
+    "                    ButtFatal(\"Out of memory :(\");\n"
+    "                }\n"
+    "            }\n"
+    "\n"
+    "            ButtFutures[ButtFutureCount] = Thread;\n"
+    "            ButtFutureCount = ButtFutureCount + 1;\n"
+    "            ReturnValue = (int32_t)ButtFutureCount;\n"
+    "        }\n"
+    "\n"
+    "        BUTT_UNLOCK();\n"
+    "        return ReturnValue;\n"
+    "    }\n"
+    "\n"
+    "    ButtThreadJoin(Thread);\n"
+    "    ReturnValue = Thread->ReturnValue;\n"
+    "    ButtThreadFree(Thread);\n"
+    "    return ReturnValue;\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED int32_t\n"
+    "ButtJoin (\n"
+    "    int32_t Handle\n"
+    "    )\n"
+    "{\n"
+    "    PBUTT_THREAD Thread;\n"
+    "    uint32_t Spin;\n"
+    "\n"
+    "    if(Handle == 0) {\n"
+    "        return 0;\n"
+    "    }\n"
+    "\n"
+    "    BUTT_LOCK();\n"
+    "    if((uint32_t)Handle > ButtFutureCount) {\n"
+    "        BUTT_UNLOCK();\n"
+    "        ButtFatal(\"Invalid thread.\");\n"
+    "    }\n"
+    "\n"
+    "    Thread = ButtFutures[Handle - 1];\n"
+    "    BUTT_UNLOCK();\n"
+    "\n"
+    "    //\n"
+    "    // Threads joined right after they were started are often close to done,\n"
+    "    // so spin a while before giving the processor up between looks.\n"
+    "    //\n"
+    "\n"
+    "    for(Spin = 0; ButtLoadAcquire((const char *)&Thread->Done) == 0; ++Spin) {\n"
+    "        if(Spin >= BUTT_JOIN_SPIN) {\n"
+    "#ifdef _WIN32\n"
+    "            SwitchToThread();\n"
+    "#else\n"
+    "            sched_yield();\n"
+    "#endif\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    return Thread->ReturnValue;\n"
+    "}\n"
+    "\n"
+    "//\n"
+    "// Each barrier counts the threads that have arrived in the current phase.\n"
+    "// The phase only moves on once the last thread arrives, so a thread reads\n"
+    "// it first and then waits for it to change. Waiting spins a while and then\n"
+    "// sleeps on the phase, on Linux in a futex.\n"
+    "//\n"
+    "\n"
+    "typedef struct _BUTT_BARRIER {\n"
+    "    int32_t Arrived;\n"
+    "    int32_t Phase;\n"
+    "} BUTT_BARRIER, *PBUTT_BARRIER;\n"
+    "\n"
+    "static BUTT_UNUSED BUTT_BARRIER ButtBarriers[BUTT_BARRIER_COUNT + 1];\n"
+    "\n"
+    "static BUTT_UNUSED void\n"
+    "ButtBarrierWait (\n"
+    "    char *Count,\n"
+    "    PBUTT_BARRIER Barrier\n"
+    "    )\n"
+    "{\n"
+    "    int32_t Phase;\n"
+    "    uint32_t Spin;\n"
+    "\n"
+    "    Phase = ButtLoadAcquire((const char *)&Barrier->Phase);\n"
+    "    if(ButtAtomicAdd((char *)&Barrier->Arrived, 1) >= ButtLoadAcquire(Count)) {\n"
+    "        ButtStoreRelease((char *)&Barrier->Arrived, 0);\n"
+    "        ButtAtomicAdd((char *)&Barrier->Phase, 1);\n"
+    "#ifdef __linux__\n"
+    "        syscall(SYS_futex, &Barrier->Phase, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);\n"
+    "#endif\n"
+    "        return;\n"
+    "    }\n"
+    "\n"
+    "    for(Spin = 0; ButtLoadAcquire((const char *)&Barrier->Phase) == Phase; ++Spin) {\n"
+    "        if(Spin < BUTT_BARRIER_SPIN) {\n"
+    "            continue;\n"
+    "        }\n"
+    "\n"
+    "#ifdef _WIN32\n"
+    "        SwitchToThread();\n"
+    "#elif defined(__linux__)\n"
+    "        syscall(SYS_futex, &Barrier->Phase, FUTEX_WAIT_PRIVATE, Phase, NULL, NULL, 0);\n"
+    "#else\n"
+    "        sched_yield();\n"
+    "#endif\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "//\n"
+    "// Each channel is a bounded ring of cells, each cell holding a value and\n"
+    "// twice the position it is next free at, plus one while it is full.\n"
+    "// Senders move the tail and receivers the head, each with a compare and\n"
+    "// swap, so a lone sender and receiver never touch the same counter. A\n"
+    "// channel declared single has one sender and one receiver, which own\n"
+    "// the tail and the head and publish them with a release, keeping the\n"
+    "// last they saw of the other end to look at it only when it seems full\n"
+    "// or empty. A thread finding the channel full or empty spins a while and\n"
+    "// then sleeps on the events of the channel, on Linux in a futex, which\n"
+    "// sends and receives only bump while someone sleeps.\n"
+    "//\n"
+    "\n"
+    "#ifdef __GNUC__\n"
+    "#define BUTT_LOAD64(A)          __atomic_load_n((A), __ATOMIC_ACQUIRE)\n"
+    "#define BUTT_STORE64(A, V)      __atomic_store_n((A), (V), __ATOMIC_RELEASE)\n"
+    "#define BUTT_FENCE()            __atomic_thread_fence(__ATOMIC_SEQ_CST)\n"
+    "#else\n"
+    "#define BUTT_LOAD64(A)          (*(volatile int64_t *)(A))\n"
+    "#define BUTT_STORE64(A, V)      (*(volatile int64_t *)(A) = (V))\n"
+    "#define BUTT_FENCE()            MemoryBarrier()\n"
+    "#endif\n"
+    "\n"
+    "typedef struct _BUTT_CHANNEL_CELL {\n"
+    "    int64_t Sequence;\n"
+    "    int32_t Value;\n"
+    "} BUTT_CHANNEL_CELL, *PBUTT_CHANNEL_CELL;\n"
+    "\n"
+    "typedef struct _BUTT_CHANNEL {\n"
+    "    int64_t Tail;\n"
+    "    int64_t HeadSeen;\n"
+    "    char TailPad[48];\n"
+    "    int64_t Head;\n"
+    "    int64_t TailSeen;\n"
+    "    char HeadPad[48];\n"
+    "    int32_t Event;\n"
+    "    int32_t Sleepers;\n"
+    "    int64_t Capacity;\n"
+    "    int32_t Single;\n"
+    "    PBUTT_CHANNEL_CELL Cells;\n"
+    "} BUTT_CHANNEL, *PBUTT_CHANNEL;\n"
+    "\n"
+    "static BUTT_UNUSED BUTT_CHANNEL ButtChannels[BUTT_CHANNEL_COUNT + 1];\n"
+    "static const uint32_t ButtChannelCapacities[BUTT_CHANNEL_COUNT + 1] = {\n"
+    "    BUTT_CHANNEL_CAPACITIES\n"
+    "};\n"
+    "\n"
+    "static const int32_t ButtChannelSingles[BUTT_CHANNEL_COUNT + 1] = {\n"
+    "    BUTT_CHANNEL_SINGLES\n"
+    "};\n"
+    "\n"
+    "static void\n"
+    "ButtChannelsInitialize (\n"
+    "    void\n"
+    "    )\n"
+    "{\n"
+    "    uint32_t Channel;\n"
+    "    uint32_t i;\n"
+    "\n"
+    "    for(Channel = 0; Channel < BUTT_CHANNEL_COUNT; ++Channel) {\n"
+    "        ButtChannels[Channel].Capacity = ButtChannelCapacities[Channel];\n"
+    "        ButtChannels[Channel].Single = ButtChannelSingles[Channel];\n"
+    "        ButtChannels[Channel].Cells = malloc(ButtChannelCapacities[Channel] *\n"
+    "                                             sizeof(BUTT_CHANNEL_CELL));\n"
+    "\n"
+    "        if(ButtChannels[Channel].Cells == NULL) {\n"
+    "            ButtFatal(\"Out of memory :(\");\n"
+    "        }\n"
+    "\n"
+    "        for(i=0; i<ButtChannelCapacities[Channel]; ++i) {\n"
+    "            ButtChannels[Channel].Cells[i].Sequence = 2 * (int64_t)i;\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static void\n"
+    "ButtChannelsFree (\n"
+    "    void\n"
+    "    )\n"
+    "{\n"
+    "    uint32_t Channel;\n"
+    "\n"
+    "    for(Channel = 0; Channel < BUTT_CHANNEL_COUNT; ++Channel) {\n"
+    "        free(ButtChannels[Channel].Cells);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED int\n"
+    "ButtChannelTrySingle (\n"
+    "    PBUTT_CHANNEL Channel,\n"
+    "    int32_t *Value,\n"
+    "    int Receive\n"
+    "    )\n"
+    "{\n"
+    "    int64_t Current;\n"
+    "\n"
+    "    if(Receive != 0) {\n"
+    "        Current = Channel->Head;\n"
+    "        if(Current == Channel->TailSeen) {\n"
+    "            Channel->TailSeen = BUTT_LOAD64(&Channel->Tail);\n"
+    "            if(Current == Channel->TailSeen) {\n"
+    "                return 0;\n"
+    "            }\n"
+    "        }\n"
+    "\n"
+    "        *Value = Channel->Cells[Current % Channel->Capacity].Value;\n"
+    "        BUTT_STORE64(&Channel->Head, Current + 1);\n"
+    "    } else {\n"
+    "        Current = Channel->Tail;\n"
+    "        if(Current - Channel->HeadSeen == Channel->Capacity) {\n"
+    "            Channel->HeadSeen = BUTT_LOAD64(&Channel->Head);\n"
+    "            if(Current - Channel->HeadSeen == Channel->Capacity) {\n"
+    "                return 0;\n"
+    "            }\n"
+    "        }\n"
+    "\n"
+    "        Channel->Cells[Current % Channel->Capacity].Value = *Value;\n"
+    "        BUTT_STORE64(&Channel->Tail, Current + 1);\n"
+    "    }\n"
+    "\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED int\n"
+    "ButtChannelTry (\n"
+    "    PBUTT_CHANNEL Channel,\n"
+    "    int32_t *Value,\n"
+    "    int Receive\n"
+    "    )\n"
+    "{\n"
+    "    PBUTT_CHANNEL_CELL Cell;\n"
+    "    int64_t *Position;\n"
+    "    int64_t Current;\n"
+    "    int64_t Difference;\n"
+    "\n"
+    "    if(Channel->Single != 0) {\n"
+    "        return ButtChannelTrySingle(Channel, Value, Receive);\n"
+    "    }\n"
+    "\n"
+    "    //\n"
+    "    // A sequence behind the one looked for means the channel is full or\n"
+    "    // empty, one ahead of it that another thread got the position first.\n"
+    "    //\n"
+    "\n"
+    "    Position = Receive ? &Channel->Head : &Channel->Tail;\n"
+    "    Current = BUTT_LOAD64(Position);\n"
+    "    for(;;) {\n"
+    "        Cell = &Channel->Cells[Current % Channel->Capacity];\n"
+    "        Difference = BUTT_LOAD64(&Cell->Sequence) - (2 * Current + Receive);\n"
+    "        if(Difference < 0) {\n"
+    "            return 0;\n"
+    "        }\n"
+    "\n"
+    "        if(Difference > 0) {\n"
+    "            Current = BUTT_LOAD64(Position);\n"
+    "            continue;\n"
+    "        }\n"
+    "\n"
+    "#ifdef __GNUC__\n"
+    "        if(__atomic_compare_exchange_n(Position,\n"
+    "                                       &Current,\n"
+    "                                       Current + 1,\n"
+    "                                       0,\n"
+    "                                       __ATOMIC_RELAXED,\n"
+    "                                       __ATOMIC_RELAXED)) {\n"
+    "            break;\n"
+    "        }\n"
+    "#else\n"
+    "        {\n"
+    "            int64_t Seen;\n"
+    "\n"
+    "            Seen = InterlockedCompareExchange64((volatile LONG64 *)Position,\n"
+    "                                                Current + 1,\n"
+    "                                                Current);\n"
+    "            if(Seen == Current) {\n"
+    "                break;\n"
+    "            }\n"
+    "\n"
+    "            Current = Seen;\n"
+    "        }\n"
+    "#endif\n"
+    "    }\n"
+    "\n"
+    "    if(Receive != 0) {\n"
+    "        *Value = Cell->Value;\n"
+    "        BUTT_STORE64(&Cell->Sequence, 2 * (Current + Channel->Capacity));\n"
+    "    } else {\n"
+    "        Cell->Value = *Value;\n"
+    "        BUTT_STORE64(&Cell->Sequence, 2 * Current + 1);\n"
+    "    }\n"
+    "\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED int32_t\n"
+    "ButtChannel (\n"
+    "    PBUTT_CHANNEL Channel,\n"
+    "    int32_t Value,\n"
+    "    int Receive\n"
+    "    )\n"
+    "{\n"
+    "    int32_t Event;\n"
+    "    uint32_t Spin;\n"
+    "\n"
+    "    for(Spin = 0; ButtChannelTry(Channel, &Value, Receive) == 0; ++Spin) {\n"
+    "        if(Spin < BUTT_CHANNEL_SPIN) {\n"
+    "            continue;\n"
+    "        }\n"
+    "\n"
+    "        //\n"
+    "        // Sleepers are counted before the last try, so whoever makes room\n"
+    "        // or a value after it sees them and bumps the event.\n"
+    "        //\n"
+    "\n"
+    "        Event = ButtLoadAcquire((const char *)&Channel->Event);\n"
+    "        ButtAtomicAdd((char *)&Channel->Sleepers, 1);\n"
+    "        if(ButtChannelTry(Channel, &Value, Receive) != 0) {\n"
+    "            ButtAtomicAdd((char *)&Channel->Sleepers, -1);\n"
+    "            break;\n"
+    "        }\n"
+    "\n"
+    "#ifdef _WIN32\n"
+    "        SwitchToThread();\n"
+    "#elif defined(__linux__)\n"
+    "        syscall(SYS_futex, &Channel->Event, FUTEX_WAIT_PRIVATE, Event, NULL, NULL, 0);\n"
+    "#else\n"
+    "        (void)Event;\n"
+    "        sched_yield();\n"
+    "#endif\n"
+    "        ButtAtomicAdd((char *)&Channel->Sleepers, -1);\n"
+    "    }\n"
+    "\n"
+    "    BUTT_FENCE();\n"
+    "    if(ButtLoadAcquire((const char *)&Channel->Sleepers) != 0) {\n"
+    "        ButtAtomicAdd((char *)&Channel->Event, 1);\n"
+    "#ifdef __linux__\n"
+    "        syscall(SYS_futex, &Channel->Event, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);\n"
+    "#endif\n"
+    "    }\n"
+    "\n"
+    "    return Value;\n"
+    "}\n"
+    "\n"
+    "//\n"
+    "// A parallel loop runs on one thread per processor at most, each taking\n"
+    "// chunks of the iterations until there are none left. Static loops hand\n"
+    "// the chunks out round robin, dynamic ones first come first served, and\n"
+    "// guided ones the same but in chunks shrinking with what is left.\n"
+    "//\n"
+    "\n"
+    "#define BUTT_LOOP_STATIC        0\n"
+    "#define BUTT_LOOP_DYNAMIC       1\n"
+    "#define BUTT_LOOP_GUIDED        2\n"
+    "\n"
+    "struct _BUTT_LOOP {\n"
+    "    BUTT_FUNCTION Function;\n"
+    "    int Schedule;\n"
+    "    uint32_t CaptureCount;\n"
+    "    int32_t *Captures;\n"
+    "    int64_t First;\n"
+    "    int64_t Bound;\n"
+    "    int64_t Stride;\n"
+    "    int64_t Count;\n"
+    "    int64_t Chunk;\n"
+    "    int64_t Runners;\n"
+    "    int64_t Next;\n"
+    "};\n"
+    "\n"
+    "static BUTT_UNUSED int\n"
+    "ButtLoopNext (\n"
+    "    PBUTT_LOOP Loop,\n"
+    "    PBUTT_THREAD Thread,\n"
+    "    int32_t *First,\n"
+    "    int32_t *Bound\n"
+    "    )\n"
+    "{\n"
+    "    int64_t Start;\n"
+    "    int64_t Size;\n"
+    "\n"
+    "    switch(Loop->Schedule) {\n"
+    "    case BUTT_LOOP_DYNAMIC:\n"
+    "#ifdef __GNUC__\n"
+    "        Start = __atomic_fetch_add(&Loop->Next, Loop->Chunk, __ATOMIC_RELAXED);\n"
+    "#else\n"
+    "        Start = InterlockedExchangeAdd64((volatile LONG64 *)&Loop->Next, Loop->Chunk);\n"
+    "#endif\n"
+    "        Size = Loop->Chunk;\n"
+    "        break;\n"
+    "\n"
+    "    case BUTT_LOOP_GUIDED:\n"
+    "#ifdef __GNUC__\n"
+    "        Start = __atomic_load_n(&Loop->Next, __ATOMIC_RELAXED);\n"
+    "#else\n"
+    "        Start = *(volatile int64_t *)&Loop->Next;\n"
+    "#endif\n"
+    "        for(;;) {\n"
+    "            if(Start >= Loop->Count) {\n"
+    "                return 0;\n"
+    "            }\n"
+    "\n"
+    "            Size = (Loop->Count - Start + Loop->Runners - 1) / Loop->Runners;\n"
+    "            if(Size < Loop->Chunk) {\n"
+    "                Size = Loop->Chunk;\n"
+    "            }\n"
+    "\n"
+    "#ifdef __GNUC__\n"
+    "            if(__atomic_compare_exchange_n(&Loop->Next,\n"
+    "                                           &Start,\n"
+    "                                           Start + Size,\n"
+    "                                           0,\n"
+    "                                           __ATOMIC_RELAXED,\n"
+    "                                           __ATOMIC_RELAXED)) {\n"
+    "                break;\n"
+    "            }\n"
+    "#else\n"
+    "            {\n"
+    "                int64_t Seen;\n"
+    "\n"
+    "                Seen = InterlockedCompareExchange64((volatile LONG64 *)&Loop->Next,\n"
+    "                                                    Start + Size,\n"
+    "                                                    Start);\n"
+    "                if(Seen == Start) {\n"
+    "                    break;\n"
+    "                }\n"
+    "\n"
+    "                Start = Seen;\n"
+    "            }\n"
+    "#endif\n"
+    "        }\n"
+    "\n"
+    "        break;\n"
+    "\n"
+    "    default:\n"
+    "        Start = Thread->LoopChunk * Loop->Chunk;\n"
+    "        Size = Loop->Chunk;\n"
+    "        Thread->LoopChunk = Thread->LoopChunk + Loop->Runners;\n"
+    "        break;\n"
+    "    }\n"
+    "\n"
+    "    if(Start >= Loop->Count) {\n"
+    "        return 0;\n"
+    "    }\n"
+    "\n"
+    "    *First = (int32_t)(Loop->First + Start * Loop->Stride);\n"
+    "    if(Size >= Loop->Count - Start) {\n"
+    "        *Bound = (int32_t)Loop->Bound;\n"
+    "    } else {\n"
+    "        *Bound = (int32_t)(Loop->First + (Start + Size) * Loop->Stride);\n"
+    "    }\n"
+    "\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED int32_t\n"
+    "ButtLoopRunner (\n"
+    "    PBUTT_THREAD Thread\n"
+    "    )\n"
+    "{\n"
+    "    char *Stack;\n"
+    "    int32_t First;\n"
+    "    int32_t Bound;\n"
+    "    uint32_t i;\n"
+    "\n"
+    "    //\n"
+    "    // The body takes the first index and the bound of a chunk, then the\n"
+    "    // captured values, and finds a dummy return address under them like\n"
+    "    // any parallel call.\n"
+    "    //\n"
+    "\n"
+    "    Stack = Thread->Stack;\n"
+    "    while(ButtLoopNext(Thread->Loop, Thread, &First, &Bound) != 0) {\n"
+    "        Thread->Rst = BUTT_STACK_TOP;\n"
+    "        Thread->Rsb = BUTT_STACK_TOP - (3 + Thread->Loop->CaptureCount) * sizeof(int32_t);\n"
+    "        for(i=0; i<Thread->Loop->CaptureCount; ++i) {\n"
+    "            ButtStore(BUTT_STACK(Thread->Rsb, (3 + i) * sizeof(int32_t) - BUTT_STACK_TOP),\n"
+    "                      Thread->Loop->Captures[i]);\n"
+    "        }\n"
+    "\n"
+    "        ButtStore(BUTT_STACK(Thread->Rsb, 2 * sizeof(int32_t) - BUTT_STACK_TOP), First);\n"
+    "        ButtStore(BUTT_STACK(Thread->Rsb, sizeof(int32_t) - BUTT_STACK_TOP), Bound);\n"
+    "        ButtStore(BUTT_STACK(Thread->Rsb, -BUTT_STACK_TOP), 0);\n"
+    "        Thread->Loop->Function(Thread);\n"
+    "    }\n"
+    "\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "static BUTT_UNUSED void\n"
+    "ButtParallelFor (\n"
+    "    PBUTT_THREAD Caller,\n"
+    "    BUTT_FUNCTION Function,\n"
+    "    int Schedule,\n"
+    "    uint32_t CaptureCount\n"
+    "    )\n"
+    "{\n"
+    "    BUTT_LOOP Loop;\n"
+    "    PBUTT_THREAD Threads[64];\n"
+    "    int32_t Captures[BUTT_PARAMETER_MAX + 1];\n"
+    "    int64_t Processors;\n"
+    "    int64_t Chunks;\n"
+    "    int64_t i;\n"
+    "    char *Stack;\n"
+    "\n"
+    "    //\n"
+    "    // The start, the bound, the captured values, the stride and the chunk\n"
+    "    // size were pushed in that order, a chunk size of zero picks one for\n"
+    "    // the schedule.\n"
+    "    //\n"
+    "\n"
+    "    Stack = Caller->Stack;\n"
+    "    memset(&Loop, 0, sizeof(BUTT_LOOP));\n"
+    "    Loop.Function = Function;\n"
+    "    Loop.Schedule = Schedule;\n"
+    "    Loop.CaptureCount = CaptureCount;\n"
+    "    Loop.Captures = Captures;\n"
+    "    Loop.Chunk = ButtLoad(BUTT_STACK(Caller->Rsb, -BUTT_STACK_TOP));\n"
+    "    Loop.Stride = ButtLoad(BUTT_STACK(Caller->Rsb, sizeof(int32_t) - BUTT_STACK_TOP));\n"
+    "    for(i=0; i<(int64_t)CaptureCount; ++i) {\n"
+    "        Captures[i] = ButtLoad(BUTT_STACK(Caller->Rsb,\n"
+    "                                          (1 + CaptureCount - i) * sizeof(int32_t) -\n"
+    "                                          BUTT_STACK_TOP));\n"
+    "    }\n"
+    "\n"
+    "    Caller->Rsb = Caller->Rsb + CaptureCount * sizeof(int32_t);\n"
+    "    Loop.Bound = ButtLoad(BUTT_STACK(Caller->Rsb, 2 * sizeof(int32_t) - BUTT_STACK_TOP));\n"
+    "    Loop.First = ButtLoad(BUTT_STACK(Caller->Rsb, 3 * sizeof(int32_t) - BUTT_STACK_TOP));\n"
+    "    Caller->Rsb = Caller->Rsb + 4 * sizeof(int32_t);\n"
+    "\n"
+    "    //\n"
+    "    // The updates the caller made to reduction variables are folded in,\n"
+    "    // the runners fold theirs before they are joined.\n"
+    "    //\n"
+    "\n"
+    "    ButtReductionFold(Caller);\n"
+    "    if(Loop.Bound <= Loop.First) {\n"
+    "        return;\n"
+    "    }\n"
+    "\n"
+    "    Loop.Count = (Loop.Bound - Loop.First + Loop.Stride - 1) / Loop.Stride;\n"
+    "#ifdef _WIN32\n"
+    "    {\n"
+    "        SYSTEM_INFO SystemInfo;\n"
+    "\n"
+    "        GetSystemInfo(&SystemInfo);\n"
+    "        Processors = SystemInfo.dwNumberOfProcessors;\n"
+    "    }\n"
+    "#else\n"
+    "    Processors = sysconf(_SC_NPROCESSORS_ONLN);\n"
+    "#endif\n"
+    "    if(Processors < 1) {\n"
+    "        Processors = 1;\n"
+    "    } else if(Processors > 64) {\n"
+    "        Processors = 64;\n"
+    "    }\n"
+    "\n"
+    "    if(Loop.Chunk <= 0) {\n"
+    "        Loop.Chunk = 1;\n"
+    "        if(Schedule == BUTT_LOOP_STATIC) {\n"
+    "            Loop.Chunk = (Loop.Count + Processors - 1) / Processors;\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    Chunks = (Loop.Count + Loop.Chunk - 1) / Loop.Chunk;\n"
+    "    Loop.Runners = Chunks < Processors ? Chunks : Processors;\n"
+    "    for(i=0; i<Loop.Runners; ++i) {\n"
+    "        Threads[i] = ButtThreadCreate(ButtLoopRunner);\n"
+    "        Threads[i]->Loop = &Loop;\n"
+    "        Threads[i]->LoopChunk = i;\n"
+    "        ButtThreadStart(Threads[i]);\n"
+    "    }\n"
+    "\n"
+    "    for(i=0; i<Loop.Runners; ++i) {\n"
+    "        ButtThreadJoin(Threads[i]);\n"
+    "        ButtThreadFree(Threads[i]);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static int\n"
+    "ButtRun (\n"
+    "    BUTT_FUNCTION Start\n"
+    "    )\n"
+    "{\n"
+    "    PBUTT_THREAD Thread;\n"
+    "    PBUTT_THREAD Joined;\n"
+    "\n"
+    "    BUTT_LOCK_INITIALIZE();\n"
+    "    ButtChannelsInitialize();\n"
+    "    ButtReductionsInitialize();\n"
+    "    Thread = ButtThreadCreate(Start);\n"
+    "    Thread->First = 1;\n"
+    "    Start(Thread);\n"
+    "    ButtThreadFree(Thread);\n"
+    "\n"
+    "    //\n"
+    "    // Async threads may start more of their own while we wait, and join\n"
+    "    // each other, so none is freed before all are done.\n"
+    "    //\n"
+    "\n"
+    "    Joined = NULL;\n"
+    "    for(;;) {\n"
+    "        BUTT_LOCK();\n"
+    "        Thread = ButtAsyncThreads;\n"
+    "        if(Thread != NULL) {\n"
+    "            ButtAsyncThreads = Thread->Next;\n"
+    "        }\n"
+    "\n"
+    "        BUTT_UNLOCK();\n"
+    "        if(Thread == NULL) {\n"
+    "            break;\n"
+    "        }\n"
+    "\n"
+    "        ButtThreadJoin(Thread);\n"
+    "        Thread->Next = Joined;\n"
+    "        Joined = Thread;\n"
+    "    }\n"
+    "\n"
+    "    while(Joined != NULL) {\n"
+    "        Thread = Joined;\n"
+    "        Joined = Thread->Next;\n"
+    "        ButtThreadFree(Thread);\n"
+    "    }\n"
+    "\n"
+    "    free(ButtFutures);\n"
+    "    ButtChannelsFree();\n"
+    "    return 0;\n"
+    "}\n";
+
+void
+CEmitPrint (
+    PCEMIT_PROGRAM Program,
+    const char *Format,
+    ...
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine writes formatted text to the output file. Nothing is written
+    while OutFile is NULL, which is how the first pass over the program goes.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Format - printf style format.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    va_list Arguments;
+    
+    if(Program->OutFile == NULL) {
+        return;
+    }
+    
+    va_start(Arguments, Format);
+    vfprintf(Program->OutFile, Format, Arguments);
+    va_end(Arguments);
+}
+
+void
+CEmitRegionName (
+    unsigned long Region,
+    char *Name
+    )
+{
+    if(Region == 0) {
+        sprintf(Name, "ButtStart");
+    } else {
+        sprintf(Name, "ButtFunction%lu", Region - 1);
+    }
+}
+
+long
+CEmitFindRegion (
+    PCEMIT_PROGRAM Program,
+    unsigned long Index
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine finds the region starting at an instruction.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Index - The instruction index.
+    
+ Return value:
+ 
+    The region, -1 if no region starts at Index.
+
+*/
+    
+{
+    unsigned long i;
+    
+    for(i=0; i<Program->RegionCount; ++i) {
+        if(Program->Regions[i].Start == Index) {
+            return (long)i;
+        }
+    }
+    
+    return -1;
+}
+
+int
+CEmitJumpTarget (
+    PCEMIT_PROGRAM Program,
+    unsigned long Index,
+    unsigned long *Target
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine resolves the target of a jump or call to an instruction 
+    index. Jumps are relative to RIP, calls are absolute.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Index - Index of the jump or call instruction.
+    
+    Target - Receives the index of the target instruction.
+    
+ Return value:
+ 
+    0 on success, -1 if the target isn't an instruction.
+
+*/
+    
+{
+    PINSTRUCTION Instruction;
+    long long Address;
+    
+    Instruction = Program->Instructions[Index];
+    if(Instruction->Jump.Register == REG_RIP) {
+        Address = (long long)(Index * PROGRAM_CODE_ALIGNMENT) + 
+                  Instruction->Jump.RegisterOffset;
+                  
+    } else if(Instruction->Jump.Register == REG_RCT) {
+        Address = (long long)Instruction->Jump.RegisterOffset - PROGRAM_CODE_START;
+    } else {
+        return -1;
+    }
+    
+    if(Address < 0 || 
+       (Address % PROGRAM_CODE_ALIGNMENT) != 0 ||
+       Address / PROGRAM_CODE_ALIGNMENT >= (long long)Program->InstructionCount) {
+        
+        return -1;
+    }
+    
+    *Target = (unsigned long)(Address / PROGRAM_CODE_ALIGNMENT);
+    return 0;
+}
+
+void
+CEmitUseRegister (
+    PCEMIT_PROGRAM Program,
+    unsigned long Register
+    )
+{
+    if(Register == REG_RIP) {
+        Program->Failed = 1;
+        return;
+    }
+    
+    Program->Regions[Program->CurrentRegion].RegisterMask |= 1UL << Register;
+}
+
+void
+CEmitLoadOperand (
+    PCEMIT_PROGRAM Program,
+    unsigned long Register,
+    long Offset,
+    int Atomic,
+    char *Expression
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine builds the C expression for the value of a register/offset
+    operand pair. RGD indexes global data, the other index registers index
+    the stack, RCT makes the offset a constant and everything else is the 
+    register itself.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Register - The operand register.
+    
+    Offset - The operand register offset.
+    
+    Atomic - Nonzero if the operand is an atomic variable.
+    
+    Expression - Receives the expression, CEMIT_EXPRESSION_SIZE bytes.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    if(Register >= REG_MAX) {
+        Program->Failed = 1;
+        sprintf(Expression, "0");
+        return;
+    }
+    
+    if(Register == REG_RGD) {
+        sprintf(Expression, 
+                "%s(ButtGlobalData + %ld)", 
+                Atomic ? "ButtLoadAcquire" : "ButtLoad",
+                Offset);
+                
+    } else if(IS_REGISTER_INDEX_IX(Register)) {
+        CEmitUseRegister(Program, Register);
+        sprintf(Expression, 
+                "%s(BUTT_INDEX(%s, %ld))",
+                Atomic ? "ButtLoadAcquire" : "ButtLoad",
+                _REGISTER_NAMES[Register],
+                Offset);
+                
+    } else if(IS_REGISTER_INDEX(Register)) {
+        CEmitUseRegister(Program, Register);
+        sprintf(Expression, 
+                "%s(BUTT_STACK(%s, %ld))",
+                Atomic ? "ButtLoadAcquire" : "ButtLoad",
+                _REGISTER_NAMES[Register],
+                Offset - PROGRAM_STACK_TOP);
+                
+    } else if(Register == REG_RCT) {
+        sprintf(Expression, "(int32_t)%ld", Offset);
+    } else {
+        CEmitUseRegister(Program, Register);
+        sprintf(Expression, "(int32_t)%s", _REGISTER_NAMES[Register]);
+    }
+}
+
+void
+CEmitStoreOperand (
+    PCEMIT_PROGRAM Program,
+    unsigned long Register,
+    long Offset,
+    int Atomic,
+    const char *Value
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine emits the store of a value into a register/offset operand 
+    pair, addressed as in CEmitLoadOperand.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Register - The operand register.
+    
+    Offset - The operand register offset.
+    
+    Atomic - Nonzero if the operand is an atomic variable.
+    
+    Value - C expression for the value to store.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    if(Register >= REG_MAX || Register == REG_RCT) {
+        Program->Failed = 1;
+        return;
+    }
+    
+    if(Register == REG_RGD) {
+        CEmitPrint(Program, 
+                   "    %s(ButtGlobalData + %ld, %s);\n", 
+                   Atomic ? "ButtStoreRelease" : "ButtStore",
+                   Offset, 
+                   Value);
+                   
+    } else if(IS_REGISTER_INDEX_IX(Register)) {
+        CEmitUseRegister(Program, Register);
+        CEmitPrint(Program,
+                   "    %s(BUTT_INDEX(%s, %ld), %s);\n",
+                   Atomic ? "ButtStoreRelease" : "ButtStore",
+                   _REGISTER_NAMES[Register],
+                   Offset,
+                   Value);
+                   
+    } else if(IS_REGISTER_INDEX(Register)) {
+        CEmitUseRegister(Program, Register);
+        CEmitPrint(Program,
+                   "    %s(BUTT_STACK(%s, %ld), %s);\n",
+                   Atomic ? "ButtStoreRelease" : "ButtStore",
+                   _REGISTER_NAMES[Register],
+                   Offset - PROGRAM_STACK_TOP,
+                   Value);
+                   
+    } else {
+        CEmitUseRegister(Program, Register);
+        CEmitPrint(Program, 
+                   "    %s = (uint32_t)(%s);\n", 
+                   _REGISTER_NAMES[Register], 
+                   Value);
+    }
+}
+
+void
+CEmitSaveStack (
+    PCEMIT_PROGRAM Program
+    )
+{
+    CEmitUseRegister(Program, REG_RST);
+    CEmitUseRegister(Program, REG_RSB);
+    CEmitPrint(Program, "    Thread->Rst = RST;\n");
+    CEmitPrint(Program, "    Thread->Rsb = RSB;\n");
+}
+
+void
+CEmitArithmetic (
+    PCEMIT_PROGRAM Program,
+    PINSTRUCTION Instruction
+    )
+{
+    char Left[CEMIT_EXPRESSION_SIZE];
+    char Right[CEMIT_EXPRESSION_SIZE];
+    char Value[3*CEMIT_EXPRESSION_SIZE];
+    
+    CEmitLoadOperand(Program, 
+                     Instruction->Arith.LtRegister, 
+                     Instruction->Arith.LtRegisterOffset, 
+                     Instruction->Arith.AtomicLoad,
+                     Left);
+                     
+    CEmitLoadOperand(Program, 
+                     Instruction->Arith.RtRegister, 
+                     Instruction->Arith.RtRegisterOffset, 
+                     Instruction->Arith.AtomicLoad,
+                     Right);
+    
+    //
+    // The VM wraps on overflow, so the arithmetic is done unsigned.
+    //
+    
+    switch(Instruction->Opcode) {
+        case OPC_ADDI:
+        case OPC_ADDF:
+            sprintf(Value, "(int32_t)((uint32_t)%s + (uint32_t)%s)", Left, Right);
+            break;
+            
+        case OPC_SUBI:
+        case OPC_SUBF:
+            sprintf(Value, "(int32_t)((uint32_t)%s - (uint32_t)%s)", Left, Right);
+            break;
+            
+        case OPC_MULI:
+        case OPC_MULF:
+            sprintf(Value, "(int32_t)((uint32_t)%s * (uint32_t)%s)", Left, Right);
+            break;
+            
+        case OPC_DIVI:
+        case OPC_DIVF:
+            sprintf(Value, "%s / %s", Left, Right);
+            break;
+            
+        case OPC_XOR:
+            sprintf(Value, "%s ^ %s", Left, Right);
+            break;
+            
+        case OPC_OR:
+            sprintf(Value, "%s | %s", Left, Right);
+            break;
+            
+        case OPC_AND:
+            sprintf(Value, "%s & %s", Left, Right);
+            break;
+            
+        case OPC_LOR:
+            sprintf(Value, "%s || %s", Left, Right);
+            break;
+            
+        case OPC_LAND:
+            sprintf(Value, "%s && %s", Left, Right);
+            break;
+            
+        case OPC_EQ:
+            sprintf(Value, "%s == %s", Left, Right);
+            break;
+            
+        case OPC_NEQ:
+            sprintf(Value, "%s != %s", Left, Right);
+            break;
+            
+        case OPC_LT:
+            sprintf(Value, "%s < %s", Left, Right);
+            break;
+            
+        case OPC_GT:
+            sprintf(Value, "%s > %s", Left, Right);
+            break;
+            
+        case OPC_LTE:
+            sprintf(Value, "%s <= %s", Left, Right);
+            break;
+            
+        case OPC_GTE:
+        default:
+            sprintf(Value, "%s >= %s", Left, Right);
+            break;
+    }
+    
+    CEmitStoreOperand(Program,
+                      Instruction->Arith.DtRegister,
+                      Instruction->Arith.DtRegisterOffset,
+                      0,
+                      Value);
+}
+
+void
+CEmitAtomic (
+    PCEMIT_PROGRAM Program,
+    PINSTRUCTION Instruction
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine emits an atomic read-modify-write of the variable Lt points
+    at. Compare and swap reads the expected value from Dt, the others leave
+    the new value there.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Instruction - The atomic instruction.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    char Address[CEMIT_EXPRESSION_SIZE];
+    char Right[CEMIT_EXPRESSION_SIZE];
+    char Destination[CEMIT_EXPRESSION_SIZE];
+    char Value[4*CEMIT_EXPRESSION_SIZE];
+    
+    if(Instruction->Arith.LtRegister == REG_RGD) {
+        sprintf(Address, 
+                "ButtGlobalData + %ld", 
+                (long)Instruction->Arith.LtRegisterOffset);
+                
+    } else if(IS_REGISTER_INDEX_IX(Instruction->Arith.LtRegister)) {
+        CEmitUseRegister(Program, Instruction->Arith.LtRegister);
+        sprintf(Address,
+                "BUTT_INDEX(%s, %ld)",
+                _REGISTER_NAMES[Instruction->Arith.LtRegister],
+                (long)Instruction->Arith.LtRegisterOffset);
+                
+    } else if(IS_REGISTER_INDEX(Instruction->Arith.LtRegister)) {
+        CEmitUseRegister(Program, Instruction->Arith.LtRegister);
+        sprintf(Address,
+                "BUTT_STACK(%s, %ld)",
+                _REGISTER_NAMES[Instruction->Arith.LtRegister],
+                (long)Instruction->Arith.LtRegisterOffset - PROGRAM_STACK_TOP);
+                
+    } else {
+        Program->Failed = 1;
+        return;
+    }
+    
+    CEmitLoadOperand(Program, 
+                     Instruction->Arith.RtRegister, 
+                     Instruction->Arith.RtRegisterOffset, 
+                     Instruction->Arith.AtomicLoad,
+                     Right);
+    
+    switch(Instruction->Opcode) {
+        case OPC_AADD:
+            sprintf(Value, "ButtAtomicAdd(%s, %s)", Address, Right);
+            break;
+            
+        case OPC_ASUB:
+            sprintf(Value, 
+                    "ButtAtomicAdd(%s, (int32_t)(0u - (uint32_t)%s))", 
+                    Address, 
+                    Right);
+                    
+            break;
+            
+        case OPC_AOR:
+            sprintf(Value, "ButtAtomicOr(%s, %s)", Address, Right);
+            break;
+            
+        case OPC_AAND:
+            sprintf(Value, "ButtAtomicAnd(%s, %s)", Address, Right);
+            break;
+            
+        case OPC_AXOR:
+            sprintf(Value, "ButtAtomicXor(%s, %s)", Address, Right);
+            break;
+            
+        case OPC_ACAS:
+        default:
+            CEmitLoadOperand(Program, 
+                             Instruction->Arith.DtRegister, 
+                             Instruction->Arith.DtRegisterOffset, 
+                             0,
+                             Destination);
+                             
+            sprintf(Value, 
+                    "ButtAtomicCompareSwap(%s, %s, %s)", 
+                    Address, 
+                    Destination, 
+                    Right);
+                    
+            break;
+    }
+    
+    CEmitStoreOperand(Program,
+                      Instruction->Arith.DtRegister,
+                      Instruction->Arith.DtRegisterOffset,
+                      0,
+                      Value);
+}
+
+unsigned long
+CEmitReduction (
+    PCEMIT_PROGRAM Program,
+    long Offset,
+    OPCODES Opcode
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine finds the slot the runtime keeps for the reduction variable
+    at a global offset, adding it the first time the variable is updated. 
+    Both passes find the variables in the same order.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Offset - Offset of the variable in the global data.
+    
+    Opcode - The update opcode, RSUB counting as RADD.
+    
+ Return value:
+ 
+    The slot of the variable in the copies of a thread.
+
+*/
+    
+{
+    PCEMIT_REDUCTION Reductions;
+    unsigned long i;
+    
+    for(i=0; i<Program->ReductionCount; ++i) {
+        if(Program->Reductions[i].Offset == Offset) {
+            return i;
+        }
+    }
+    
+    Reductions = realloc(Program->Reductions, (i + 1) * sizeof(CEMIT_REDUCTION));
+    if(Reductions == NULL) {
+        Program->Failed = 1;
+        return 0;
+    }
+    
+    Reductions[i].Offset = Offset;
+    Reductions[i].Opcode = (Opcode == OPC_RSUB) ? OPC_RADD : Opcode;
+    Program->Reductions = Reductions;
+    Program->ReductionCount = i + 1;
+    return i;
+}
+
+const char *
+CEmitReductionOperator (
+    OPCODES Opcode
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine names the operator the runtime folds a reduction with.
+    
+ Arguments:
+ 
+    Opcode - The update opcode of the variable, RSUB counting as RADD.
+    
+ Return value:
+ 
+    The name of the operator.
+
+*/
+    
+{
+    switch(Opcode) {
+        case OPC_ROR:
+            return "BUTT_REDUCE_OR";
+            
+        case OPC_RAND:
+            return "BUTT_REDUCE_AND";
+            
+        case OPC_RXOR:
+            return "BUTT_REDUCE_XOR";
+            
+        case OPC_RMIN:
+            return "BUTT_REDUCE_MIN";
+            
+        case OPC_RMAX:
+            return "BUTT_REDUCE_MAX";
+            
+        default:
+            return "BUTT_REDUCE_ADD";
+    }
+}
+
+void
+CEmitReductionUpdate (
+    PCEMIT_PROGRAM Program,
+    PINSTRUCTION Instruction
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine emits an update of the reduction variable Lt names, which
+    goes to the copy of the calling thread and leaves the operand in Dt as
+    the VM does.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Instruction - The reduction instruction.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    char Right[CEMIT_EXPRESSION_SIZE];
+    char Value[2*CEMIT_EXPRESSION_SIZE];
+    char Update[5*CEMIT_EXPRESSION_SIZE];
+    unsigned long Reduction;
+    
+    if(Instruction->Arith.LtRegister != REG_RGD) {
+        Program->Failed = 1;
+        return;
+    }
+    
+    Reduction = CEmitReduction(Program, 
+                               (long)Instruction->Arith.LtRegisterOffset, 
+                               Instruction->Opcode);
+    
+    CEmitLoadOperand(Program, 
+                     Instruction->Arith.RtRegister, 
+                     Instruction->Arith.RtRegisterOffset, 
+                     Instruction->Arith.AtomicLoad,
+                     Right);
+                     
+    if(Instruction->Opcode == OPC_RSUB) {
+        snprintf(Value, sizeof(Value), "(int32_t)(0u - (uint32_t)%s)", Right);
+    } else {
+        snprintf(Value, sizeof(Value), "%s", Right);
+    }
+    
+    snprintf(Update, 
+             sizeof(Update), 
+             "(ButtReduce(Thread, %lu, %s), %s)", 
+             Reduction, 
+             Value, 
+             Right);
+    
+    CEmitStoreOperand(Program,
+                      Instruction->Arith.DtRegister,
+                      Instruction->Arith.DtRegisterOffset,
+                      0,
+                      Update);
+}
+
+unsigned long
+CEmitBarrier (
+    PCEMIT_PROGRAM Program,
+    long Offset
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine finds the state the runtime keeps for the barrier at a 
+    global offset, adding it the first time the barrier is waited on. Both
+    passes find the barriers in the same order.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Offset - Offset of the barrier in the global data.
+    
+ Return value:
+ 
+    The index of the barrier in ButtBarriers.
+
+*/
+    
+{
+    long *Barriers;
+    unsigned long i;
+    
+    for(i=0; i<Program->BarrierCount; ++i) {
+        if(Program->Barriers[i] == Offset) {
+            return i;
+        }
+    }
+    
+    Barriers = realloc(Program->Barriers, (i + 1) * sizeof(long));
+    if(Barriers == NULL) {
+        Program->Failed = 1;
+        return 0;
+    }
+    
+    Barriers[i] = Offset;
+    Program->Barriers = Barriers;
+    Program->BarrierCount = i + 1;
+    return i;
+}
+
+unsigned long
+CEmitChannel (
+    PCEMIT_PROGRAM Program,
+    PINSTRUCTION Instruction
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine finds the ring the runtime keeps for the channel a send or
+    receive names, adding it the first time the channel is used. Both passes
+    find the channels in the same order.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Instruction - The send or receive.
+    
+ Return value:
+ 
+    The index of the channel in ButtChannels.
+
+*/
+    
+{
+    PCEMIT_CHANNEL Channels;
+    long Offset;
+    unsigned long i;
+    
+    Offset = (long)Instruction->Channel.ChannelOffset;
+    for(i=0; i<Program->ChannelCount; ++i) {
+        if(Program->Channels[i].Offset == Offset) {
+            return i;
+        }
+    }
+    
+    Channels = realloc(Program->Channels, (i + 1) * sizeof(CEMIT_CHANNEL));
+    if(Channels == NULL) {
+        Program->Failed = 1;
+        return 0;
+    }
+    
+    Channels[i].Offset = Offset;
+    Channels[i].Capacity = (unsigned long)Instruction->Channel.Capacity + 1;
+    Channels[i].Single = Instruction->Channel.Single;
+    Program->Channels = Channels;
+    Program->ChannelCount = i + 1;
+    return i;
+}
+
+void
+CEmitCall (
+    PCEMIT_PROGRAM Program,
+    unsigned long Index,
+    PINSTRUCTION Instruction
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine emits a call. A normal call pushes its return address like 
+    the VM does, since the callee return pops it along with the parameters. 
+    Parallel calls and loops go through the runtime.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Index - Index of the call instruction.
+    
+    Instruction - The call instruction.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    char Name[32];
+    unsigned long Target;
+    long Region;
+    
+    if(CEmitJumpTarget(Program, Index, &Target) != 0) {
+        Program->Failed = 1;
+        return;
+    }
+    
+    Region = CEmitFindRegion(Program, Target);
+    if(Region <= 0) {
+        Program->Failed = 1;
+        return;
+    }
+    
+    CEmitRegionName(Region, Name);
+    CEmitUseRegister(Program, REG_RRV);
+    if(Instruction->Opcode == OPC_CALLNORM) {
+        CEmitPrint(Program, "    RSB = RSB - %u;\n", PROGRAM_STACK_ALIGNMENT);
+        CEmitPrint(Program, 
+                   "    ButtStore(BUTT_STACK(RSB, %ld), %lu);\n",
+                   -(long)PROGRAM_STACK_TOP,
+                   Index + 1);
+                   
+        CEmitSaveStack(Program);
+        CEmitPrint(Program, "    RRV = (uint32_t)%s(Thread);\n", Name);
+        CEmitPrint(Program, "    RST = Thread->Rst;\n");
+        CEmitPrint(Program, "    RSB = Thread->Rsb;\n");
+        
+    } else if(Instruction->Opcode == OPC_PFOR) {
+        CEmitSaveStack(Program);
+        CEmitPrint(Program, 
+                   "    ButtParallelFor(Thread, %s, %u, %lu);\n",
+                   Name,
+                   (unsigned)Instruction->Jump.Schedule,
+                   Program->Regions[Region].ParameterCount - LOOP_BODY_PARAMETER_COUNT);
+                   
+        CEmitPrint(Program, "    RSB = Thread->Rsb;\n");
+        
+    } else {
+        CEmitSaveStack(Program);
+        CEmitPrint(Program, 
+                   "    RRV = (uint32_t)ButtParallelCall(Thread, %s, %lu, %s);\n",
+                   Name,
+                   Program->Regions[Region].ParameterCount,
+                   Instruction->Opcode == OPC_CALLPLLS ? "BUTT_CALL_SYNC" :
+                   Instruction->Jump.Future != 0 ? "BUTT_CALL_FUTURE" :
+                   "BUTT_CALL_ASYNC");
+                   
+        CEmitPrint(Program, "    RSB = Thread->Rsb;\n");
+    }
+}
+
+void
+CEmitJump (
+    PCEMIT_PROGRAM Program,
+    unsigned long Index,
+    PINSTRUCTION Instruction
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine emits a jump. Jumps within the region become gotos. The 
+    start block jumps into main, which becomes a tail call.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Index - Index of the jump instruction.
+    
+    Instruction - The jump instruction.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PCEMIT_REGION Region;
+    char Name[32];
+    unsigned long Target;
+    long TargetRegion;
+    
+    if(CEmitJumpTarget(Program, Index, &Target) != 0) {
+        Program->Failed = 1;
+        return;
+    }
+    
+    Region = &Program->Regions[Program->CurrentRegion];
+    if(Target < Region->Start || Target >= Region->End) {
+        TargetRegion = CEmitFindRegion(Program, Target);
+        if(TargetRegion < 0 || Instruction->Jump.JumpType != JUMP_TYPE_UNCONDITIONAL) {
+            Program->Failed = 1;
+            return;
+        }
+        
+        CEmitRegionName(TargetRegion, Name);
+        CEmitSaveStack(Program);
+        CEmitPrint(Program, "    return %s(Thread);\n", Name);
+        return;
+    }
+    
+    Program->Labels[Target] = 1;
+    if(Instruction->Jump.JumpType == JUMP_TYPE_UNCONDITIONAL) {
+        CEmitPrint(Program, "    goto I%lu;\n", Target);
+        return;
+    }
+    
+    //
+    // Loops without a condition test RIP, which is never zero.
+    //
+    
+    if(Instruction->Jump.ZeroRegister == REG_RIP) {
+        return;
+    }
+    
+    if(Instruction->Jump.ZeroRegister >= REG_MAX ||
+       IS_REGISTER_INDEX(Instruction->Jump.ZeroRegister)) {
+        
+        Program->Failed = 1;
+        return;
+    }
+    
+    CEmitUseRegister(Program, Instruction->Jump.ZeroRegister);
+    CEmitPrint(Program, 
+               "    if(%s == 0) goto I%lu;\n", 
+               _REGISTER_NAMES[Instruction->Jump.ZeroRegister],
+               Target);
+}
+
+void
+CEmitInstruction (
+    PCEMIT_PROGRAM Program,
+    unsigned long Index
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine emits the C statements for a single instruction.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    Index - Index of the instruction.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PINSTRUCTION Instruction;
+    char Left[CEMIT_EXPRESSION_SIZE];
+    char Value[2*CEMIT_EXPRESSION_SIZE];
+    unsigned long Shift;
+    
+    Instruction = Program->Instructions[Index];
+    switch(Instruction->Opcode) {
+        case OPC_ADDI:
+        case OPC_ADDF:
+        case OPC_SUBI:
+        case OPC_SUBF:
+        case OPC_MULI:
+        case OPC_MULF:
+        case OPC_DIVI:
+        case OPC_DIVF:
+        case OPC_XOR:
+        case OPC_OR:
+        case OPC_AND:
+        case OPC_LOR:
+        case OPC_LAND:
+        case OPC_EQ:
+        case OPC_NEQ:
+        case OPC_LT:
+        case OPC_GT:
+        case OPC_LTE:
+        case OPC_GTE:
+            CEmitArithmetic(Program, Instruction);
+            break;
+            
+        case OPC_AADD:
+        case OPC_ASUB:
+        case OPC_AOR:
+        case OPC_AAND:
+        case OPC_AXOR:
+        case OPC_ACAS:
+            CEmitAtomic(Program, Instruction);
+            break;
+            
+        case OPC_RADD:
+        case OPC_RSUB:
+        case OPC_ROR:
+        case OPC_RAND:
+        case OPC_RXOR:
+        case OPC_RMIN:
+        case OPC_RMAX:
+            CEmitReductionUpdate(Program, Instruction);
+            break;
+            
+        case OPC_WAIT:
+            if(Instruction->Stack.Register != REG_RGD) {
+                Program->Failed = 1;
+                break;
+            }
+            
+            CEmitPrint(Program,
+                       "    ButtBarrierWait(ButtGlobalData + %ld, &ButtBarriers[%lu]);\n",
+                       (long)Instruction->Stack.RegisterOffset,
+                       CEmitBarrier(Program, (long)Instruction->Stack.RegisterOffset));
+                       
+            break;
+            
+        case OPC_SEND:
+            CEmitLoadOperand(Program, Instruction->Channel.Register, 0, 0, Left);
+            CEmitPrint(Program,
+                       "    ButtChannel(&ButtChannels[%lu], (int32_t)%s, 0);\n",
+                       CEmitChannel(Program, Instruction),
+                       Left);
+                       
+            break;
+            
+        case OPC_RECV:
+            sprintf(Value, 
+                    "(uint32_t)ButtChannel(&ButtChannels[%lu], 0, 1)",
+                    CEmitChannel(Program, Instruction));
+                    
+            CEmitStoreOperand(Program, Instruction->Channel.Register, 0, 0, Value);
+            break;
+            
+        case OPC_JOIN:
+            CEmitLoadOperand(Program,
+                             Instruction->Arith.LtRegister,
+                             Instruction->Arith.LtRegisterOffset,
+                             Instruction->Arith.AtomicLoad,
+                             Left);
+                             
+            sprintf(Value, "(uint32_t)ButtJoin((int32_t)%s)", Left);
+            CEmitStoreOperand(Program,
+                              Instruction->Arith.DtRegister,
+                              Instruction->Arith.DtRegisterOffset,
+                              0,
+                              Value);
+                              
+            break;
+            
+        case OPC_NOT:
+            CEmitPrint(Program, "    ButtFatal(\"%s\");\n", ERR_STR_INVALIDINSTR);
+            break;
+            
+        case OPC_RCOPYD:
+            if(Instruction->Indirect.LtRegister >= REG_MAX ||
+               Instruction->Indirect.DtRegister >= REG_MAX) {
+                
+                Program->Failed = 1;
+                break;
+            }
+            
+            //
+            // Every region starts RGD at the data start, which is all the
+            // start block and the thread stubs copy into it, so the copy 
+            // is dropped and RGD only declared where it is read.
+            //
+            
+            if(Instruction->Indirect.DtRegister == REG_RGD) {
+                break;
+            }
+            
+            CEmitUseRegister(Program, Instruction->Indirect.LtRegister);
+            if(Instruction->Indirect.LtOffsetType == INDIRECT_OFFSET_TYPE_CONSTANT) {
+                sprintf(Value,
+                        "%s + (uint32_t)%ld",
+                        _REGISTER_NAMES[Instruction->Indirect.LtRegister],
+                        (long)Instruction->Indirect.LtOffset);
+                        
+            } else if(Instruction->Indirect.LtOffset >= 0 &&
+                      Instruction->Indirect.LtOffset < REG_MAX) {
+                      
+                CEmitUseRegister(Program, Instruction->Indirect.LtOffset);
+                sprintf(Value,
+                        "%s + %s",
+                        _REGISTER_NAMES[Instruction->Indirect.LtRegister],
+                        _REGISTER_NAMES[Instruction->Indirect.LtOffset]);
+                        
+            } else {
+                Program->Failed = 1;
+                break;
+            }
+            
+            CEmitUseRegister(Program, Instruction->Indirect.DtRegister);
+            CEmitPrint(Program, 
+                       "    %s = %s;\n", 
+                       _REGISTER_NAMES[Instruction->Indirect.DtRegister],
+                       Value);
+                       
+            break;
+            
+        case OPC_STRI8:
+        case OPC_STRU8:
+        case OPC_STRI16:
+        case OPC_STRU16:
+        case OPC_STRI32:
+        case OPC_STRU32:
+        case OPC_STRF:
+        case OPC_STRTH:
+            CEmitLoadOperand(Program,
+                             Instruction->Store.RtRegister,
+                             Instruction->Store.RtRegisterOffset,
+                             Instruction->Store.AtomicLoad,
+                             Left);
+                             
+            Shift = 0;
+            if(Instruction->Opcode == OPC_STRI8 || Instruction->Opcode == OPC_STRU8) {
+                Shift = 24;
+            } else if(Instruction->Opcode == OPC_STRI16 || Instruction->Opcode == OPC_STRU16) {
+                Shift = 16;
+            }
+            
+            //
+            // Shifting up and back down truncates to the store width and 
+            // sign extends, as the VM does.
+            //
+            
+            if(Shift != 0) {
+                sprintf(Value, "(int32_t)((uint32_t)%s << %lu) >> %lu", Left, Shift, Shift);
+            } else {
+                sprintf(Value, "%s", Left);
+            }
+            
+            CEmitStoreOperand(Program,
+                              Instruction->Store.DtRegister,
+                              Instruction->Store.DtRegisterOffset,
+                              Instruction->Store.AtomicStore,
+                              Value);
+                              
+            break;
+            
+        case OPC_JMP:
+        case OPC_JMPZ:
+            CEmitJump(Program, Index, Instruction);
+            break;
+            
+        case OPC_CALLNORM:
+        case OPC_CALLPLLS:
+        case OPC_CALLPLLA:
+        case OPC_PFOR:
+            CEmitCall(Program, Index, Instruction);
+            break;
+            
+        case OPC_RETURN:
+            CEmitUseRegister(Program, REG_RRV);
+            CEmitUseRegister(Program, REG_RST);
+            CEmitUseRegister(Program, REG_RSB);
+            CEmitPrint(Program, "    Thread->Rst = RST;\n");
+            CEmitPrint(Program, 
+                       "    Thread->Rsb = RSB + %lu;\n",
+                       (unsigned long)Instruction->Return.StackCleanup + 
+                       PROGRAM_STACK_ALIGNMENT);
+                       
+            CEmitPrint(Program, "    return (int32_t)RRV;\n");
+            break;
+            
+        case OPC_PUSH:
+            CEmitLoadOperand(Program,
+                             Instruction->Stack.Register,
+                             Instruction->Stack.RegisterOffset,
+                             Instruction->Stack.AtomicLoad,
+                             Left);
+                             
+            CEmitUseRegister(Program, REG_RSB);
+            CEmitPrint(Program, "    D = %s;\n", Left);
+            CEmitPrint(Program, "    RSB = RSB - %u;\n", PROGRAM_STACK_ALIGNMENT);
+            CEmitPrint(Program, 
+                       "    ButtStore(BUTT_STACK(RSB, %ld), D);\n",
+                       -(long)PROGRAM_STACK_TOP);
+                       
+            break;
+            
+        case OPC_POP:
+            CEmitUseRegister(Program, REG_RSB);
+            CEmitPrint(Program, 
+                       "    D = ButtLoad(BUTT_STACK(RSB, %ld));\n",
+                       -(long)PROGRAM_STACK_TOP);
+                       
+            CEmitPrint(Program, "    RSB = RSB + %u;\n", PROGRAM_STACK_ALIGNMENT);
+            CEmitStoreOperand(Program,
+                              Instruction->Stack.Register,
+                              Instruction->Stack.RegisterOffset,
+                              0,
+                              "D");
+                              
+            break;
+            
+        case OPC_PRINT:
+            CEmitUseRegister(Program, REG_RSB);
+            CEmitPrint(Program, 
+                       "    RSB = ButtPrint(Stack, RSB, %lu);\n",
+                       (unsigned long)Instruction->Io.PopCount);
+                       
+            break;
+            
+        case OPC_READ:
+            CEmitUseRegister(Program, REG_RSB);
+            CEmitPrint(Program, 
+                       "    RSB = ButtRead(Stack, RSB, %lu);\n",
+                       (unsigned long)Instruction->Io.PopCount);
+                       
+            break;
+            
+        default:
+            Program->Failed = 1;
+            break;
+    }
+}
+
+void
+CEmitRegion (
+    PCEMIT_PROGRAM Program,
+    unsigned long RegionIndex
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine emits a region as a C function. VM registers become locals,
+    only the ones the region touches are declared. Labels are only placed on
+    jump targets.
+    
+ Arguments:
+ 
+    Program - The program being emitted.
+    
+    RegionIndex - The region to emit.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PCEMIT_REGION Region;
+    PINSTRUCTION Last;
+    char Name[32];
+    unsigned long i;
+    
+    Program->CurrentRegion = RegionIndex;
+    Region = &Program->Regions[RegionIndex];
+    CEmitRegionName(RegionIndex, Name);
+    CEmitPrint(Program, "static int32_t\n%s (\n    PBUTT_THREAD Thread\n    )\n{\n", Name);
+    CEmitPrint(Program, "    char *Stack = Thread->Stack;\n");
+    CEmitPrint(Program, "    int32_t D;\n");
+    for(i=0; i<REG_MAX; ++i) {
+        if((Region->RegisterMask & (1UL << i)) == 0) {
+            continue;
+        }
+        
+        if(i == REG_RST) {
+            CEmitPrint(Program, "    uint32_t RST = Thread->Rst;\n");
+        } else if(i == REG_RSB) {
+            CEmitPrint(Program, "    uint32_t RSB = Thread->Rsb;\n");
+        } else if(i == REG_RGD) {
+        
+            //
+            // As the start block leaves it, see OPC_RCOPYD.
+            //
+            
+            CEmitPrint(Program, "    uint32_t RGD = BUTT_DATA_START;\n");
+        } else {
+            CEmitPrint(Program, "    uint32_t %s = 0;\n", _REGISTER_NAMES[i]);
+        }
+    }
+    
+    CEmitPrint(Program, "\n    (void)Stack;\n    (void)D;\n");
+    for(i=Region->Start; i<Region->End; ++i) {
+        if(Program->Labels[i] != 0) {
+            CEmitPrint(Program, "I%lu:\n", i);
+        }
+        
+        CEmitInstruction(Program, i);
+    }
+    
+    //
+    // Running off the end of a function runs into the next one.
+    //
+    
+    Last = Program->Instructions[Region->End - 1];
+    if(Last->Opcode == OPC_RETURN ||
+       ((Last->Opcode == OPC_JMP || Last->Opcode == OPC_JMPZ) &&
+        Last->Jump.JumpType == JUMP_TYPE_UNCONDITIONAL)) {
+        
+        CEmitPrint(Program, "}\n\n");
+        return;
+    }
+    
+    if(RegionIndex + 1 < Program->RegionCount) {
+        CEmitRegionName(RegionIndex + 1, Name);
+        CEmitSaveStack(Program);
+        CEmitPrint(Program, "    return %s(Thread);\n}\n\n", Name);
+    } else {
+        CEmitPrint(Program, "    ButtFatal(\"%s\");\n}\n\n", ERR_STR_INVALIDINSTR);
+    }
+}
+
+int
+CEmitCompareRegion (
+    const void *Left,
+    const void *Right
+    )
+{
+    const CEMIT_REGION *L = Left;
+    const CEMIT_REGION *R = Right;
+    
+    return (L->Start > R->Start) - (L->Start < R->Start);
+}
+
+int
+CEmitProgram (
+    FILE *OutFile,
+    PSQUEUE InstructionQueue,
+    PSQUEUE FunctionSymbolQueue,
+    PSCOPE_CONTEXT GlobalContext
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine emits the program as a standalone C file, one C function 
+    per BUTT function, with the runtime in front. The output builds with 
+    any C compiler, gcc -O2 out.c -o out.exe being the intended use.
+    
+ Arguments:
+ 
+    OutFile - Pointer to the write-opened file to emit to. Closed on return.
+    
+    InstructionQueue - Pointer to the global instruction queue for the program.
+    
+    FunctionSymbolQueue - Pointer to the function symbol queue.
+    
+    GlobalContext - Pointer to the programs global context.
+    
+ Return value:
+ 
+    0 on success, -1 if the program can't be expressed in C.
+
+*/
+    
+{
+    assert(GlobalContext->GlobalContext == GlobalContext);
+    
+    CEMIT_PROGRAM Program;
+    PFUNCTION_SYMBOL FunctionSymbol;
+    void *CurrentNode;
+    char Name[32];
+    unsigned long ParameterMaximum;
+    unsigned long i;
+    int RetVal;
+    
+    RetVal = -1;
+    ParameterMaximum = 0;
+    memset(&Program, 0, sizeof(CEMIT_PROGRAM));
+    Program.InstructionCount = SQueueSize(InstructionQueue);
+    Program.RegionCount = SQueueSize(FunctionSymbolQueue) + 1;
+    Program.Instructions = malloc(Program.InstructionCount * sizeof(PINSTRUCTION));
+    Program.Regions = malloc(Program.RegionCount * sizeof(CEMIT_REGION));
+    Program.Labels = malloc(Program.InstructionCount);
+    if(Program.Instructions == NULL || 
+       Program.Regions == NULL || 
+       Program.Labels == NULL ||
+       Program.InstructionCount == 0) {
+        
+        goto CEmitProgramEnd;
+    }
+    
+    memset(Program.Regions, 0, Program.RegionCount * sizeof(CEMIT_REGION));
+    memset(Program.Labels, 0, Program.InstructionCount);
+    i = 0;
+    CurrentNode = SQueueTopNode(InstructionQueue);
+    while(CurrentNode != NULL) {
+        Program.Instructions[i] = SQueueDataFromNode(CurrentNode);
+        i += 1;
+        CurrentNode = SQueueNextFromNode(CurrentNode);
+    }
+    
+    //
+    // Split the code into regions at the function symbols.
+    //
+    
+    i = 1;
+    CurrentNode = SQueueTopNode(FunctionSymbolQueue);
+    while(CurrentNode != NULL) {
+        FunctionSymbol = SQueueDataFromNode(CurrentNode);
+        Program.Regions[i].Start = (FunctionSymbol->FunctionAddress - PROGRAM_CODE_START) /
+                                   PROGRAM_CODE_ALIGNMENT;
+                                   
+        Program.Regions[i].ParameterCount = FunctionSymbol->ParameterCount;
+        if(FunctionSymbol->ParameterCount > ParameterMaximum) {
+            ParameterMaximum = FunctionSymbol->ParameterCount;
+        }
+        
+        if(Program.Regions[i].Start == 0 || 
+           Program.Regions[i].Start >= Program.InstructionCount) {
+            
+            goto CEmitProgramEnd;
+        }
+        
+        i += 1;
+        CurrentNode = SQueueNextFromNode(CurrentNode);
+    }
+    
+    qsort(Program.Regions + 1, 
+          Program.RegionCount - 1, 
+          sizeof(CEMIT_REGION), 
+          CEmitCompareRegion);
+          
+    for(i=0; i<Program.RegionCount; ++i) {
+        if(i + 1 < Program.RegionCount) {
+            Program.Regions[i].End = Program.Regions[i + 1].Start;
+        } else {
+            Program.Regions[i].End = Program.InstructionCount;
+        }
+        
+        if(Program.Regions[i].End <= Program.Regions[i].Start) {
+            goto CEmitProgramEnd;
+        }
+    }
+    
+    //
+    // The first pass finds the jump targets and the registers each region 
+    // uses, the second one writes the file.
+    //
+    
+    for(i=0; i<Program.RegionCount; ++i) {
+        CEmitRegion(&Program, i);
+    }
+    
+    if(Program.Failed != 0) {
+        goto CEmitProgramEnd;
+    }
+    
+    Program.OutFile = OutFile;
+    CEmitPrint(&Program, "//\n// Generated by BUTT. Build with gcc -O2.\n//\n\n");
+    CEmitPrint(&Program, "#define BUTT_STACK_TOP          0x%X\n", PROGRAM_STACK_TOP);
+    CEmitPrint(&Program, "#define BUTT_STACK_SIZE         0x%X\n", PROGRAM_STACK_TOP);
+    CEmitPrint(&Program, "#define BUTT_DATA_START         0x%X\n", PROGRAM_DATA_START);
+    CEmitPrint(&Program, 
+               "#define BUTT_DATA_SIZE          0x%llX\n",
+               (GlobalContext->DataPointer - PROGRAM_DATA_START) * PROGRAM_STACK_ALIGNMENT);
+               
+    CEmitPrint(&Program, "#define BUTT_BARRIER_COUNT      %lu\n", Program.BarrierCount);
+    CEmitPrint(&Program, "#define BUTT_CHANNEL_COUNT      %lu\n", Program.ChannelCount);
+    CEmitPrint(&Program, "#define BUTT_REDUCTION_COUNT    %lu\n", Program.ReductionCount);
+    CEmitPrint(&Program, "#define BUTT_PARAMETER_MAX      %lu\n", ParameterMaximum);
+    CEmitPrint(&Program, "#define BUTT_CHANNEL_CAPACITIES ");
+    for(i=0; i<Program.ChannelCount; ++i) {
+        CEmitPrint(&Program, "%lu, ", Program.Channels[i].Capacity);
+    }
+    
+    CEmitPrint(&Program, "0\n");
+    CEmitPrint(&Program, "#define BUTT_CHANNEL_SINGLES    ");
+    for(i=0; i<Program.ChannelCount; ++i) {
+        CEmitPrint(&Program, "%u, ", Program.Channels[i].Single);
+    }
+    
+    CEmitPrint(&Program, "0\n");
+    CEmitPrint(&Program, "#define BUTT_REDUCTION_OFFSETS  ");
+    for(i=0; i<Program.ReductionCount; ++i) {
+        CEmitPrint(&Program, "%ld, ", Program.Reductions[i].Offset);
+    }
+    
+    CEmitPrint(&Program, "0\n");
+    CEmitPrint(&Program, "#define BUTT_REDUCTION_OPERATORS ");
+    for(i=0; i<Program.ReductionCount; ++i) {
+        CEmitPrint(&Program, "%s, ", CEmitReductionOperator(Program.Reductions[i].Opcode));
+    }
+    
+    CEmitPrint(&Program, "0\n\n");
+    
+    fputs(CEmitRuntime, OutFile);
+    CEmitPrint(&Program, "\n");
+    for(i=0; i<Program.RegionCount; ++i) {
+        CEmitRegionName(i, Name);
+        CEmitPrint(&Program, "static int32_t %s(PBUTT_THREAD Thread);\n", Name);
+    }
+    
+    CEmitPrint(&Program, "\n");
+    for(i=0; i<Program.RegionCount; ++i) {
+        CEmitRegion(&Program, i);
+    }
+    
+    CEmitPrint(&Program, "int\nmain (\n    void\n    )\n{\n    return ButtRun(ButtStart);\n}\n");
+    RetVal = 0;
+    
+CEmitProgramEnd:
+    fclose(OutFile);
+    free(Program.Instructions);
+    free(Program.Regions);
+    free(Program.Labels);
+    free(Program.Barriers);
+    free(Program.Channels);
+    free(Program.Reductions);
+    
+    return RetVal;
+}
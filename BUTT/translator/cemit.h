@@ -0,0 +1,54 @@
+/**
+
+ Copyright 2015 Omar Carey.
+ 
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ Translation Unit:
+    
+    cemit.h
+    
+ Abstract:
+    
+    This module defines the C backend, which emits a program as a standalone 
+    C file instead of a VM binary.
+    
+ Author:
+    
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+ 
+    10/17/26        Initial Creation
+
+**/
+
+#ifndef __CEMIT_H__
+#define __CEMIT_H__
+
+#include "objtypes.h"
+#include "../../utils/inc/squeue.h"
+#include <stdio.h>
+
+int
+CEmitProgram (
+    FILE *OutFile,
+    PSQUEUE InstructionQueue,
+    PSQUEUE FunctionSymbolQueue,
+    PSCOPE_CONTEXT GlobalContext
+    );
+
+#endif // __CEMIT_H__
@@ -32,6 +32,13 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        Atomic read-modify-write
+    10/17/26        Thread joins
+    10/17/26        Parallel loops
+    10/17/26        Reductions
+    10/17/26        Barriers
+    10/17/26        Channels
+    10/17/26        Single channels
 
 **/
 
@@ -112,6 +119,48 @@ DebugPrettyPrintInstructionArithmetic (
     case OPC_GTE:
         sprintf(OpcodeString, "%-8s", "GTE");
         break;
+    case OPC_AADD:
+        sprintf(OpcodeString, "%-8s", "AADD");
+        break;
+    case OPC_ASUB:
+        sprintf(OpcodeString, "%-8s", "ASUB");
+        break;
+    case OPC_AOR:
+        sprintf(OpcodeString, "%-8s", "AOR");
+        break;
+    case OPC_AAND:
+        sprintf(OpcodeString, "%-8s", "AAND");
+        break;
+    case OPC_AXOR:
+        sprintf(OpcodeString, "%-8s", "AXOR");
+        break;
+    case OPC_ACAS:
+        sprintf(OpcodeString, "%-8s", "ACAS");
+        break;
+    case OPC_JOIN:
+        sprintf(OpcodeString, "%-8s", "JOIN");
+        break;
+    case OPC_RADD:
+        sprintf(OpcodeString, "%-8s", "RADD");
+        break;
+    case OPC_RSUB:
+        sprintf(OpcodeString, "%-8s", "RSUB");
+        break;
+    case OPC_ROR:
+        sprintf(OpcodeString, "%-8s", "ROR");
+        break;
+    case OPC_RAND:
+        sprintf(OpcodeString, "%-8s", "RAND");
+        break;
+    case OPC_RXOR:
+        sprintf(OpcodeString, "%-8s", "RXOR");
+        break;
+    case OPC_RMIN:
+        sprintf(OpcodeString, "%-8s", "RMIN");
+        break;
+    case OPC_RMAX:
+        sprintf(OpcodeString, "%-8s", "RMAX");
+        break;
     }
     
     printf("%s %s%s%+d%s %s%s%+d%s %s%s%+d%s\n",
@@ -252,6 +301,9 @@ DebugPrettyPrintInstructionJump (
     case OPC_CALLPLLA:
         sprintf(OpcodeString, "%-8s", "CALLPLLA");
         break;
+    case OPC_PFOR:
+        sprintf(OpcodeString, "%-8s", "PFOR");
+        break;
     }
     
     JumpAddr = _ABS((signed)Instruction->Jump.RegisterOffset);
@@ -301,6 +353,9 @@ DebugPrettyPrintInstructionStack (
     case OPC_POP:
         sprintf(OpcodeString, "%-8s", "POP");
         break;
+    case OPC_WAIT:
+        sprintf(OpcodeString, "%-8s", "WAIT");
+        break;
     }
     
     printf("%s %s%s%+d%s\n",
@@ -332,6 +387,31 @@ DebugPrettyPrintInstructionIo (
            Instruction->Io.PopCount);
 }
 
+void
+DebugPrettyPrintInstructionChannel (
+    PINSTRUCTION Instruction
+    )
+{
+    char OpcodeString[16];
+    
+    switch(Instruction->Opcode) {
+    case OPC_SEND:
+        sprintf(OpcodeString, "%-8s", "SEND");
+        break;
+    case OPC_RECV:
+        sprintf(OpcodeString, "%-8s", "RECV");
+        break;
+    }
+    
+    printf("%s %s, %s%+d (%u%s)\n",
+           OpcodeString,                                                    // %s
+           _REGISTER_NAMES[Instruction->Channel.Register],                  // %s
+           _REGISTER_NAMES[REG_RGD],                                        // %s
+           (signed)Instruction->Channel.ChannelOffset,                      // %d
+           (unsigned)Instruction->Channel.Capacity + 1,                     // %u
+           Instruction->Channel.Single ? ", single" : "");                  // %s
+}
+
 void
 DebugPrettyPrintInstruction (
     PINSTRUCTION Instruction
@@ -358,6 +438,20 @@ DebugPrettyPrintInstruction (
         case OPC_GT:
         case OPC_LTE:
         case OPC_GTE:
+        case OPC_AADD:
+        case OPC_ASUB:
+        case OPC_AOR:
+        case OPC_AAND:
+        case OPC_AXOR:
+        case OPC_ACAS:
+        case OPC_JOIN:
+        case OPC_RADD:
+        case OPC_RSUB:
+        case OPC_ROR:
+        case OPC_RAND:
+        case OPC_RXOR:
+        case OPC_RMIN:
+        case OPC_RMAX:
             DebugPrettyPrintInstructionArithmetic(Instruction);
             break;
             
@@ -382,6 +476,7 @@ DebugPrettyPrintInstruction (
         case OPC_CALLNORM:
         case OPC_CALLPLLS:
         case OPC_CALLPLLA:
+        case OPC_PFOR:
             DebugPrettyPrintInstructionJump(Instruction);
             break;
             
@@ -391,6 +486,7 @@ DebugPrettyPrintInstruction (
             
         case OPC_PUSH:
         case OPC_POP:
+        case OPC_WAIT:
             DebugPrettyPrintInstructionStack(Instruction);
             break;
             
@@ -399,6 +495,11 @@ DebugPrettyPrintInstruction (
             DebugPrettyPrintInstructionIo(Instruction);
             break;
             
+        case OPC_SEND:
+        case OPC_RECV:
+            DebugPrettyPrintInstructionChannel(Instruction);
+            break;
+            
         case OPC_ERR:
         default:
             assert(!"The fuck are you printing m8?");
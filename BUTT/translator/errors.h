@@ -33,6 +33,13 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        C backend error
+    10/17/26        Atomic read-modify-write errors
+    10/17/26        Parallel loop errors
+    10/17/26        Reduction errors
+    10/17/26        Barrier errors
+    10/17/26        Channel errors
+    10/17/26        Single channels
 
 **/
 
@@ -59,5 +66,22 @@
 #define ERR_STR_PARAMMISMATCH   "Parameter mismatch."
 #define ERR_STR_PARAMTYPEERR    "Parameter type mismatch."
 #define ERR_STR_EXCESSPARAM     "Parameter count for function has been exceeded."
+#define ERR_STR_CEMITFAIL       "Unable to emit C for the program."
+#define ERR_STR_NOTATOMIC       "Read-modify-write needs an atomic integer variable."
+#define ERR_STR_PFORFORM        "Parallel loops must be of the form pfor(i = a; i < b; i = i + c), c greater than 0."
+#define ERR_STR_PFORCHUNK       "Parallel loop chunk size must be greater than 0."
+#define ERR_STR_PFORSCHEDULE    "Parallel loop schedule must be static, dynamic or guided."
+#define ERR_STR_PFORRETURN      "Return inside a parallel loop."
+#define ERR_STR_REDUCEGLOBAL    "Reduction variables must be integer globals."
+#define ERR_STR_REDUCEOP        "A reduction variable is only updated with the operator it reduces with."
+#define ERR_STR_REDUCENAME      "Reductions reduce with +, |, &, ^, min or max."
+#define ERR_STR_REDUCEMINMAX    "Min and max reduction variables must be int32 globals."
+#define ERR_STR_BARRIERGLOBAL   "Barriers must be globals."
+#define ERR_STR_NOTBARRIER      "Only a barrier can be waited on."
+#define ERR_STR_CHANNELGLOBAL   "Channels must be int32 or uint32 globals."
+#define ERR_STR_CHANNELSIZE     "Channels must be declared with a size from 1 to 1048576."
+#define ERR_STR_CHANNELUSE      "A channel is only used through send and recv."
+#define ERR_STR_CHANNELKIND     "A channel is declared as channel or channel(single)."
+#define ERR_STR_NOTCHANNEL      "Only a channel can be sent to or received from."
 
 #endif // __ERRORS_H__
\ No newline at end of file
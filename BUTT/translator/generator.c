@@ -35,6 +35,14 @@
  
     11/17/15        Initial Creation
     11/25/15        Documented functions
+    10/17/26        Return address takes a full stack slot
+    10/17/26        Atomic read-modify-write and compare and swap
+    10/17/26        Thread joins and futures, thread locals let go on return
+    10/17/26        Parallel loops, their bodies capture locals
+    10/17/26        Array elements take the type of the array
+    10/17/26        Reduction variables
+    10/17/26        Barrier waits
+    10/17/26        Channel sends and receives
 
 **/
 
@@ -269,14 +277,54 @@ GenerateExpressionInstruction (
     // to dereference them.
     //
     
-    if(IS_REGISTER_WORKING(OperandR->Register) || 
-       IS_REGISTER_INDEX_IX(OperandR->Register)) {
+    //
+    // They go back in the reverse order they were taken, which is right to
+    // left unless the left operand was joined after the right one.
+    //
+    
+    if(IS_REGISTER_WORKING(OperandL->Register) &&
+       IS_REGISTER_WORKING(OperandR->Register) &&
+       OperandL->Register > OperandR->Register) {
+       
+        DereferenceRegister(OperandL);
         DereferenceRegister(OperandR);
+    } else {
+        if(IS_REGISTER_WORKING(OperandR->Register) || 
+           IS_REGISTER_INDEX_IX(OperandR->Register)) {
+            DereferenceRegister(OperandR);
+        }
+        
+        if(IS_REGISTER_WORKING(OperandL->Register) || 
+           IS_REGISTER_INDEX_IX(OperandL->Register)) {
+            DereferenceRegister(OperandL);
+        }
     }
     
-    if(IS_REGISTER_WORKING(OperandL->Register) || 
-       IS_REGISTER_INDEX_IX(OperandL->Register)) {
-        DereferenceRegister(OperandL);
+    //
+    // Read-modify-write assignments are a single atomic on the variable, so
+    // the lvalue has to be an atomic one.
+    //
+    
+    if(IsOperatorReadModifyWrite(Operator->Type) && 
+       (!OperandL->IsAtomic || OperandL->DataType >= IDN_TYPE_FLOATT)) {
+        
+        yyerror(ERR_STR_NOTATOMIC);
+        return NULL;
+    }
+    
+    //
+    // A reduction variable only takes updates of its own operator, and a
+    // sum takes subtractions too.
+    //
+    
+    if(IsOperatorReadModifyWrite(Operator->Type) &&
+       OperandL->Reduction != OPR_TYPE_STR &&
+       Operator->Type != OperandL->Reduction &&
+       (Operator->Type != OPR_TYPE_SUBSTR || 
+        OperandL->Reduction != OPR_TYPE_ADDSTR)) {
+        
+        yyerror(ERR_STR_REDUCEOP);
+        return NULL;
     }
     
     //
@@ -292,6 +340,28 @@ GenerateExpressionInstruction (
         return NULL;
     }
     
+    //
+    // Updates of a reduction variable go to the copy of the thread, the
+    // reduction opcodes are in the same order as the atomic ones. A store
+    // into a min or max reduction is an update of it.
+    //
+    
+    if(IsOperatorReadModifyWrite(Operator->Type) &&
+       OperandL->Reduction != OPR_TYPE_STR) {
+        
+        Opcode = (OPCODES)(Opcode - OPC_AADD + OPC_RADD);
+    } else if(Operator->Type == OPR_TYPE_STR &&
+              (OperandL->Reduction == OPR_TYPE_MINSTR ||
+               OperandL->Reduction == OPR_TYPE_MAXSTR)) {
+        
+        if(OperandR->DataType >= IDN_TYPE_FLOATT) {
+            yyerror(ERR_STR_INVALIDINSTR);
+            return NULL;
+        }
+        
+        Opcode = (OperandL->Reduction == OPR_TYPE_MINSTR) ? OPC_RMIN : OPC_RMAX;
+    }
+    
     //
     // Determine the new register data type.
     //
@@ -305,7 +375,22 @@ GenerateExpressionInstruction (
         return NULL;
     }
     
-    if(Operator->Type == OPR_TYPE_STR) {
+    //
+    // A thread parameter borrows the handle of the caller, so a thread 
+    // stored into one is a plain copy that takes no reference to it.
+    //
+    
+    if(Opcode == OPC_STRTH && 
+       OperandL->Register == REG_RST && 
+       OperandL->RelOffset > 0) {
+       
+        Opcode = OPC_STRI32;
+    }
+    
+    if(Operator->Type == OPR_TYPE_STR && 
+       Opcode != OPC_RMIN && 
+       Opcode != OPC_RMAX) {
+       
         Instruction = InstrMakeStore(Opcode, OperandR, OperandL);
         *OperandOut = OperandL;
     } else {
@@ -336,6 +421,463 @@ GenerateExpressionInstruction (
     return Instruction;
 }
 
+void
+GenerateBarrierWait (
+    PIDENTIFIER_OBJECT Barrier,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine generates a wait on a barrier. The thread goes on once as
+    many threads as the barrier holds have waited on it, the last of them
+    starting the next phase.
+    
+ Arguments:
+ 
+    Barrier - A pointer to the barrier variable.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PINSTRUCTION InstructionWait;
+    
+    InstructionWait = InstrMakeBarrierWait(OPC_WAIT, Barrier);
+    Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+    SQueuePush(InstructionQueue, InstructionWait);
+    
+#ifdef COMPILE_VERBOSE
+    DebugPrettyPrintInstruction(InstructionWait);
+#endif
+}
+
+void
+GenerateChannelSend (
+    PIDENTIFIER_OBJECT Channel,
+    PSSTACK OperandStack,
+    PSSTACK OperatorStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine finishes the value of a send and generates the send. The 
+    send takes the value in a register, so unless the expression already left 
+    it in a working register it is copied into one. The thread waits for room
+    while the channel is full.
+    
+ Arguments:
+ 
+    Channel - A pointer to the channel variable.
+    
+    OperandStack - A pointer to the operand stack.
+    
+    OperatorStack - A pointer to the operator stack.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PIDENTIFIER_OBJECT Value;
+    PIDENTIFIER_OBJECT ValueRegister;
+    IDENTIFIER_OBJECT ConstantZero;
+    PINSTRUCTION InstructionCopy;
+    PINSTRUCTION InstructionSend;
+    
+    GenerateExpressionInstructionsUntilMatch(OperandStack,
+                                             OperatorStack,
+                                             InstructionQueue,
+                                             OPR_TYPE_LPAREN,
+                                             Context);
+    
+    Value = GenerateThreadJoin(SStackPop(OperandStack), 
+                               InstructionQueue, 
+                               Context);
+    
+    if(Value->DataType >= IDN_TYPE_FLOATT) {
+        yyerror(ERR_STR_INVALIDINSTR);
+        return;
+    }
+    
+    ValueRegister = Value;
+    if(!IS_REGISTER_WORKING(Value->Register)) {
+        if(IS_REGISTER_INDEX_IX(Value->Register)) {
+            DereferenceRegister(Value);
+        }
+        
+        ValueRegister = NextAvailableRegister( );
+        if(ValueRegister == NULL) {
+            yyerror(ERR_STR_NOREGISTERS);
+            return;
+        }
+        
+        ValueRegister->DataType = IDN_TYPE_INT32T;
+        
+        memset(&ConstantZero, 0, sizeof(IDENTIFIER_OBJECT));
+        ConstantZero.Register = REG_RCT;
+        ConstantZero.RelOffset = 0;
+        
+        InstructionCopy = InstrMakeArithmetic(OPC_ADDI, 
+                                              Value, 
+                                              &ConstantZero, 
+                                              ValueRegister);
+        
+        Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+        SQueuePush(InstructionQueue, InstructionCopy);
+        
+#ifdef COMPILE_VERBOSE
+        DebugPrettyPrintInstruction(InstructionCopy);
+#endif
+    }
+    
+    InstructionSend = InstrMakeChannel(OPC_SEND, Channel, ValueRegister);
+    Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+    SQueuePush(InstructionQueue, InstructionSend);
+    DereferenceRegister(ValueRegister);
+    
+#ifdef COMPILE_VERBOSE
+    DebugPrettyPrintInstruction(InstructionSend);
+#endif
+}
+
+void
+GenerateChannelReceive (
+    PIDENTIFIER_OBJECT Channel,
+    PSSTACK OperandStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine generates a receive, taking the oldest value out of a 
+    channel. The thread waits for one while the channel is empty. The working
+    register the value is left in is pushed onto the operand stack.
+    
+ Arguments:
+ 
+    Channel - A pointer to the channel variable.
+    
+    OperandStack - A pointer to the operand stack.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PIDENTIFIER_OBJECT ValueRegister;
+    PINSTRUCTION InstructionReceive;
+    
+    ValueRegister = NextAvailableRegister( );
+    if(ValueRegister == NULL) {
+        yyerror(ERR_STR_NOREGISTERS);
+        return;
+    }
+    
+    ValueRegister->DataType = Channel->DataType;
+    InstructionReceive = InstrMakeChannel(OPC_RECV, Channel, ValueRegister);
+    Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+    SQueuePush(InstructionQueue, InstructionReceive);
+    SStackPush(OperandStack, ValueRegister);
+    
+#ifdef COMPILE_VERBOSE
+    DebugPrettyPrintInstruction(InstructionReceive);
+#endif
+}
+
+PIDENTIFIER_OBJECT
+GenerateThreadJoin (
+    PIDENTIFIER_OBJECT Operand,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine reads a thread for its value. A thread variable, or an async 
+    call, holds a handle to the thread, and its value is the return value of 
+    the thread. Getting it joins the thread, so it waits for the thread to
+    finish first.
+    
+ Arguments:
+ 
+    Operand - A pointer to the operand to read.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    The working register the value of the thread is left in, or the operand
+    itself if it isn't a thread.
+
+*/
+    
+{
+    PIDENTIFIER_OBJECT ValueRegister;
+    IDENTIFIER_OBJECT ConstantZero;
+    PINSTRUCTION InstructionJoin;
+    
+    if(Operand->DataType != IDN_TYPE_THREADT) {
+        return Operand;
+    }
+    
+    if(IS_REGISTER_WORKING(Operand->Register) || 
+       IS_REGISTER_INDEX_IX(Operand->Register)) {
+        DereferenceRegister(Operand);
+    }
+    
+    ValueRegister = NextAvailableRegister( );
+    if(ValueRegister == NULL) {
+        yyerror(ERR_STR_NOREGISTERS);
+        return Operand;
+    }
+    
+    memset(&ConstantZero, 0, sizeof(IDENTIFIER_OBJECT));
+    ConstantZero.Register = REG_RCT;
+    ConstantZero.RelOffset = 0;
+    
+    InstructionJoin = InstrMakeArithmetic(OPC_JOIN, 
+                                          Operand, 
+                                          &ConstantZero, 
+                                          ValueRegister);
+    
+    ValueRegister->DataType = IDN_TYPE_INT32T;
+    Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+    SQueuePush(InstructionQueue, InstructionJoin);
+    
+#ifdef COMPILE_VERBOSE
+    DebugPrettyPrintInstruction(InstructionJoin);
+#endif
+
+    return ValueRegister;
+}
+
+void
+GenerateThreadDeclaration (
+    PIDENTIFIER_OBJECT Identifier,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine clears a thread local as it is declared. Storing a thread
+    into a thread variable lets go of the one it held before, which for a 
+    local is whatever the stack had there unless cleared first. Locals 
+    declared before the first statement of a function are cleared on every
+    call, so they let go of their threads on return as well.
+    
+ Arguments:
+ 
+    Identifier - A pointer to the variable declared.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PINSTRUCTION InstructionClear;
+    IDENTIFIER_OBJECT ConstantZero;
+    IDENTIFIER_OBJECT Element;
+    unsigned long ElementCount;
+    unsigned long i;
+    unsigned IsEntry;
+    
+    if(Context == Context->GlobalContext || 
+       Identifier->DataType != IDN_TYPE_THREADT) {
+       
+        return;
+    }
+    
+    IsEntry = (Context->CodePointer == Context->EntryPointer);
+    ElementCount = 1;
+    if(Identifier->ArraySize > 0) {
+        ElementCount = Identifier->ArraySize / PROGRAM_STACK_ALIGNMENT;
+    }
+    
+    memset(&ConstantZero, 0, sizeof(IDENTIFIER_OBJECT));
+    ConstantZero.Register = REG_RCT;
+    memset(&Element, 0, sizeof(IDENTIFIER_OBJECT));
+    Element.Register = REG_RST;
+    
+    //
+    // A plain store, there is nothing to let go of yet.
+    //
+    
+    for(i=0; i<ElementCount; ++i) {
+        Element.RelOffset = Identifier->RelOffset - 
+                            (signed long)(i*PROGRAM_STACK_ALIGNMENT);
+                            
+        InstructionClear = InstrMakeStore(OPC_STRI32, &ConstantZero, &Element);
+        SQueuePush(InstructionQueue, InstructionClear);
+        Context->CodePointer = Context->CodePointer + PROGRAM_CODE_ALIGNMENT;
+        
+#ifdef COMPILE_VERBOSE
+        DebugPrettyPrintInstruction(InstructionClear);
+#endif
+    }
+    
+    if(IsEntry) {
+        Context->EntryPointer = Context->CodePointer;
+        Identifier->OwnsThread = 1;
+    }
+}
+
+int
+GenerateThreadRelease (
+    void* Item,
+    void* Data
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine is called for every identifier of a function on its way 
+    out. A thread local owning its thread lets go of it, by having no thread
+    stored into it.
+    
+ Arguments:
+ 
+    Item - A pointer to the instruction queue.
+    
+    Data - A pointer to the identifier.
+    
+ Return value:
+ 
+    SHASHMAP_OK, so every identifier gets looked at.
+
+*/
+    
+{
+    PIDENTIFIER_OBJECT Identifier;
+    PINSTRUCTION InstructionRelease;
+    IDENTIFIER_OBJECT ConstantZero;
+    IDENTIFIER_OBJECT Element;
+    unsigned long ElementCount;
+    unsigned long i;
+    
+    Identifier = Data;
+    if(!Identifier->OwnsThread) {
+        return SHASHMAP_OK;
+    }
+    
+    ElementCount = 1;
+    if(Identifier->ArraySize > 0) {
+        ElementCount = Identifier->ArraySize / PROGRAM_STACK_ALIGNMENT;
+    }
+    
+    memset(&ConstantZero, 0, sizeof(IDENTIFIER_OBJECT));
+    ConstantZero.Register = REG_RCT;
+    memset(&Element, 0, sizeof(IDENTIFIER_OBJECT));
+    Element.Register = REG_RST;
+    for(i=0; i<ElementCount; ++i) {
+        Element.RelOffset = Identifier->RelOffset - 
+                            (signed long)(i*PROGRAM_STACK_ALIGNMENT);
+                            
+        InstructionRelease = InstrMakeStore(OPC_STRTH, &ConstantZero, &Element);
+        SQueuePush((PSQUEUE)Item, InstructionRelease);
+        
+#ifdef COMPILE_VERBOSE
+        DebugPrettyPrintInstruction(InstructionRelease);
+#endif
+    }
+    
+    return SHASHMAP_OK;
+}
+
+void
+GenerateExpressionJoinOperands (
+    POPERATOR_OBJECT Operator,
+    PIDENTIFIER_OBJECT *OperandL,
+    PIDENTIFIER_OBJECT *OperandR,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine joins the threads an operation reads the value of. Storing
+    a thread into a thread variable copies the handle instead, and the 
+    lvalue of an assignment isn't read. The right operand is joined first,
+    its register being the last one taken.
+    
+ Arguments:
+ 
+    Operator - A pointer to the operator.
+    
+    OperandL - A pointer to the left operand, updated if joined.
+    
+    OperandR - A pointer to the right operand, updated if joined.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    if(Operator->Type == OPR_TYPE_STR && 
+       (*OperandL)->DataType == IDN_TYPE_THREADT) {
+       
+        return;
+    }
+    
+    *OperandR = GenerateThreadJoin(*OperandR, InstructionQueue, Context);
+    if(Operator->Type != OPR_TYPE_STR && 
+       !IsOperatorReadModifyWrite(Operator->Type)) {
+       
+        *OperandL = GenerateThreadJoin(*OperandL, InstructionQueue, Context);
+    }
+}
+
 void
 GenerateExpressionInstructions (
     PSSTACK OperandStack,
@@ -397,6 +939,12 @@ GenerateExpressionInstructions (
         
         OperandR = SStackPop(OperandStack);
         OperandL = SStackPop(OperandStack);
+        GenerateExpressionJoinOperands(Operator,
+                                       &OperandL,
+                                       &OperandR,
+                                       InstructionQueue,
+                                       Context);
+                                       
         Instruction = GenerateExpressionInstruction(OperandL, 
                                                     OperandR, 
                                                     Operator, 
@@ -466,6 +1014,12 @@ GenerateExpressionInstructionsEmptyStacks (
         Operator = SStackPop(OperatorStack);
         OperandR = SStackPop(OperandStack);
         OperandL = SStackPop(OperandStack);
+        GenerateExpressionJoinOperands(Operator,
+                                       &OperandL,
+                                       &OperandR,
+                                       InstructionQueue,
+                                       Context);
+                                       
         Instruction = GenerateExpressionInstruction(OperandL, 
                                                     OperandR, 
                                                     Operator, 
@@ -536,6 +1090,12 @@ GenerateExpressionInstructionsUntilMatch (
     while(Operator->Type != OperatorMatch) {
         OperandR = SStackPop(OperandStack);
         OperandL = SStackPop(OperandStack);
+        GenerateExpressionJoinOperands(Operator,
+                                       &OperandL,
+                                       &OperandR,
+                                       InstructionQueue,
+                                       Context);
+                                       
         Instruction = GenerateExpressionInstruction(OperandL, 
                                                     OperandR, 
                                                     Operator, 
@@ -555,6 +1115,179 @@ GenerateExpressionInstructionsUntilMatch (
     }
 }
 
+void
+GenerateAtomicCompareSwapExpected (
+    PSSTACK OperandStack,
+    PSSTACK OperatorStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine finishes the expected value of a compare and swap. The swap
+    takes it in the register it leaves the old value of the variable in, so
+    unless the expression already left it in a working register it is copied
+    into one. The register is left at the top of the operand stack.
+    
+ Arguments:
+ 
+    OperandStack - A pointer to the operand stack.
+    
+    OperatorStack - A pointer to the operator stack.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PIDENTIFIER_OBJECT Expected;
+    PIDENTIFIER_OBJECT ExpectedRegister;
+    IDENTIFIER_OBJECT ConstantZero;
+    PINSTRUCTION InstructionCopy;
+    
+    GenerateExpressionInstructionsUntilMatch(OperandStack,
+                                             OperatorStack,
+                                             InstructionQueue,
+                                             OPR_TYPE_LPAREN,
+                                             Context);
+    
+    Expected = SStackPop(OperandStack);
+    if(IS_REGISTER_WORKING(Expected->Register)) {
+        SStackPush(OperandStack, Expected);
+        return;
+    }
+    
+    if(IS_REGISTER_INDEX_IX(Expected->Register)) {
+        DereferenceRegister(Expected);
+    }
+    
+    ExpectedRegister = NextAvailableRegister( );
+    if(ExpectedRegister == NULL) {
+        yyerror(ERR_STR_NOREGISTERS);
+        return;
+    }
+    
+    ExpectedRegister->DataType = IDN_TYPE_INT32T;
+    
+    memset(&ConstantZero, 0, sizeof(IDENTIFIER_OBJECT));
+    ConstantZero.Register = REG_RCT;
+    ConstantZero.RelOffset = 0;
+    
+    InstructionCopy = InstrMakeArithmetic(OPC_ADDI, 
+                                          Expected, 
+                                          &ConstantZero, 
+                                          ExpectedRegister);
+    
+    Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+    SQueuePush(InstructionQueue, InstructionCopy);
+    SStackPush(OperandStack, ExpectedRegister);
+    
+#ifdef COMPILE_VERBOSE
+    DebugPrettyPrintInstruction(InstructionCopy);
+#endif
+}
+
+void
+GenerateAtomicCompareSwap (
+    PIDENTIFIER_OBJECT Variable,
+    PSSTACK OperandStack,
+    PSSTACK OperatorStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine finishes the desired value of a compare and swap and 
+    generates the swap. The variable takes the desired value if it holds the
+    expected one. Either way the register the expected value was in is left
+    at the top of the operand stack, holding the old value of the variable.
+    
+ Arguments:
+ 
+    Variable - A pointer to the atomic variable.
+    
+    OperandStack - A pointer to the operand stack.
+    
+    OperatorStack - A pointer to the operator stack.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PIDENTIFIER_OBJECT Desired;
+    PIDENTIFIER_OBJECT ExpectedRegister;
+    PINSTRUCTION InstructionSwap;
+    
+    GenerateExpressionInstructionsUntilMatch(OperandStack,
+                                             OperatorStack,
+                                             InstructionQueue,
+                                             OPR_TYPE_LPAREN,
+                                             Context);
+    
+    Desired = SStackPop(OperandStack);
+    ExpectedRegister = SStackPop(OperandStack);
+    
+    assert(IS_REGISTER_WORKING(ExpectedRegister->Register));
+    
+    if(!Variable->IsAtomic || Variable->DataType >= IDN_TYPE_FLOATT) {
+        yyerror(ERR_STR_NOTATOMIC);
+        return;
+    }
+    
+    if(Variable->Reduction != OPR_TYPE_STR) {
+        yyerror(ERR_STR_REDUCEOP);
+        return;
+    }
+    
+    if(Desired->DataType >= IDN_TYPE_FLOATT) {
+        yyerror(ERR_STR_INVALIDINSTR);
+        return;
+    }
+    
+    //
+    // The desired value was worked out after the expected one, so its
+    // register goes first.
+    //
+    
+    if(IS_REGISTER_WORKING(Desired->Register) || 
+       IS_REGISTER_INDEX_IX(Desired->Register)) {
+        DereferenceRegister(Desired);
+    }
+    
+    InstructionSwap = InstrMakeArithmetic(OPC_ACAS, 
+                                          Variable, 
+                                          Desired, 
+                                          ExpectedRegister);
+    
+    ExpectedRegister->DataType = Variable->DataType;
+    Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+    SQueuePush(InstructionQueue, InstructionSwap);
+    SStackPush(OperandStack, ExpectedRegister);
+    
+#ifdef COMPILE_VERBOSE
+    DebugPrettyPrintInstruction(InstructionSwap);
+#endif
+}
+
 void
 GenerateArrayInstructions (
     PSSTACK OperandStack,
@@ -653,7 +1386,13 @@ GenerateArrayInstructions (
         }
     }
     
+    //
+    // Elements are stored and loaded through the index register, so it
+    // takes the type of the array.
+    //
+    
     AccessIndexRegister = NextAvailableRegisterIndex( );
+    AccessIndexRegister->DataType = ArrayBase->DataType;
     
     MultiplyArrayOffset = InstrMakeArithmetic(OPC_MULI,
                                               AccessOffset,
@@ -799,6 +1538,10 @@ GenerateIoAddPrintIdentifier (
                                               Context);
     
     PrintIdentifier = SStackPop(OperandStack);
+    PrintIdentifier = GenerateThreadJoin(PrintIdentifier, 
+                                         InstructionQueue, 
+                                         Context);
+                                         
     InstructionPush = InstrMakeStackPush(OPC_PUSH, PrintIdentifier);
     Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
     SQueuePush(InstructionQueue, InstructionPush);
@@ -979,7 +1722,13 @@ GenerateFunctionHeaderStage0 (
     
     FunctionIdentifier = Context->Identifier;
     ParameterCount = SQueueSize(FunctionIdentifier->Parameters);
-    CurrentParameterOffset = 4 + PROGRAM_STACK_ALIGNMENT*ParameterCount;
+    //
+    // The parameters sit above the return address, which takes a stack slot
+    // of its own.
+    //
+    
+    CurrentParameterOffset = PROGRAM_STACK_ALIGNMENT + 
+                             PROGRAM_STACK_ALIGNMENT*ParameterCount;
     CurrentParameterNode = SQueueTopNode(FunctionIdentifier->Parameters);
     while(CurrentParameterNode != NULL) {
         
@@ -1012,6 +1761,7 @@ GenerateFunctionHeaderStage0 (
 #endif
     
     Context->CodePointer = Context->CodePointer + 4*PROGRAM_CODE_ALIGNMENT;
+    Context->EntryPointer = Context->CodePointer;
     SStackPush(PendingInstructionStack, InstructionStep3);
     SQueuePush(InstructionQueue, InstructionStep0);
     SQueuePush(InstructionQueue, InstructionStep1);
@@ -1100,6 +1850,10 @@ GenerateFunctionTrailer (
     Additionally, this function patches all the return instructions found in the
     function to make them jump to this exit sequence.
     
+    The exit sequence is preceded by a thread store of 0 into every thread
+    local owning its thread, unless the function returns a thread, which 
+    may well be one of them.
+    
  Arguments:
  
     PendingInstructionStack - A pointer to the pending instruction stack.
@@ -1132,6 +1886,7 @@ GenerateFunctionTrailer (
     PIDENTIFIER_OBJECT RelativeOffset;
     unsigned long ReturnCount;
     unsigned long CurrentReturnCount;
+    unsigned long ReleaseCount;
     signed Delta;
     unsigned StackCleanupBytes;
     
@@ -1155,6 +1910,14 @@ GenerateFunctionTrailer (
         CurrentReturnCount = CurrentReturnCount + 1;
     }
     
+    if(Context->Identifier->ReturnType != IDN_TYPE_THREADT) {
+        ReleaseCount = SQueueSize(InstructionQueue);
+        SHashMapIterate(Context->SymTable, GenerateThreadRelease, InstructionQueue);
+        ReleaseCount = SQueueSize(InstructionQueue) - ReleaseCount;
+        Context->CodePointer = Context->CodePointer + 
+                               ReleaseCount*PROGRAM_CODE_ALIGNMENT;
+    }
+    
     RegisterRt0 = NextAvailableRegister( );
     
     assert(RegisterRt0->Register == REG_RT0);
@@ -1296,6 +2059,9 @@ GenerateFunctionCallPushParameter (
     
     PINSTRUCTION InstructionPush;
     PIDENTIFIER_OBJECT ParameterIdentifier;
+    PIDENTIFIER_OBJECT Parameter;
+    void *Node;
+    unsigned long i;
     
     //
     // By now we already pushed an LPAREN into the operand stack before
@@ -1320,6 +2086,26 @@ GenerateFunctionCallPushParameter (
     // TODO: verify type matching
     //
     
+    Parameter = NULL;
+    Node = SQueueTopNode(FunctionCall->FunctionIdentifier->Parameters);
+    for(i=1; Node != NULL && i < FunctionCall->CurrentParameterCount; ++i) {
+        Node = SQueueNextFromNode(Node);
+    }
+    
+    if(Node != NULL) {
+        Parameter = SQueueDataFromNode(Node);
+    }
+    
+    //
+    // Threads are passed by value unless the parameter is a thread itself.
+    //
+    
+    if(Parameter == NULL || Parameter->DataType != IDN_TYPE_THREADT) {
+        ParameterIdentifier = GenerateThreadJoin(ParameterIdentifier, 
+                                                 InstructionQueue, 
+                                                 Context);
+    }
+    
     assert(IS_REGISTER_WORKING(ParameterIdentifier->Register)  ||
            IS_REGISTER_INDEX_IX(ParameterIdentifier->Register) ||
            ParameterIdentifier->Register == REG_RST            ||
@@ -1397,6 +2183,7 @@ GenerateFunctionCallMakeCall (
         SStackPush(OperandStack, RegisterInv);
     } else {
         RegisterRtn = NextAvailableRegister( );
+        RegisterRtn->DataType = FunctionCall->FunctionIdentifier->ReturnType;
         RegisterRrv = RegisterSpecialRegister(REG_RRV);
         RegisterRrv->RelOffset = 4;
         InstructionReturnCopy = InstrMakeIndirectDirect(OPC_RCOPYD,
@@ -1474,6 +2261,12 @@ GenerateFunctionReturn (
                                               Context);
                                               
     ReturnIdentifier = SStackPop(OperandStack);
+    if(Context->Identifier->ReturnType != IDN_TYPE_THREADT) {
+        ReturnIdentifier = GenerateThreadJoin(ReturnIdentifier, 
+                                              InstructionQueue, 
+                                              Context);
+    }
+    
     RegisterRct = RegisterIdentifierAsIntegerConstant(0, Context);
     RegisterRrv = RegisterSpecialRegister(REG_RRV);
     InstructionCopyToRrv = InstrMakeArithmetic(OPC_ADDI, 
@@ -1526,7 +2319,8 @@ GenerateFunctionCallPatchParallelSync (
     
 void
 GenerateFunctionCallPatchParallelAsync (
-    PINSTRUCTION InstructionCall
+    PINSTRUCTION InstructionCall,
+    PSSTACK OperandStack
     )
     
 /*
@@ -1540,6 +2334,9 @@ GenerateFunctionCallPatchParallelAsync (
  
     InstructionCall - The instruction to be patched.
     
+    OperandStack - A pointer to the operand stack, holding the result of the
+                   call at the top.
+    
  Return value:
  
     void.
@@ -1547,5 +2344,419 @@ GenerateFunctionCallPatchParallelAsync (
 */
     
 {
+    PIDENTIFIER_OBJECT ReturnIdentifier;
+    
     InstrPatchNormalCallToParallelAsync(OPC_CALLPLLA, InstructionCall);
+    
+    //
+    // The call now evaluates to a handle to the thread, joined wherever its
+    // value gets read.
+    //
+    
+    ReturnIdentifier = SStackTop(OperandStack);
+    if(IS_REGISTER_WORKING(ReturnIdentifier->Register)) {
+        ReturnIdentifier->DataType = IDN_TYPE_THREADT;
+        InstructionCall->Jump.Future = 1;
+    }
+}
+
+void
+GenerateFunctionCallDropFuture (
+    PIDENTIFIER_OBJECT Result,
+    PINSTRUCTION LastCallInstruction
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine is called with the result of an expression statement. A 
+    handle to a thread left there is never joined, and only an async call can
+    have left one, the last call made. That call needs no handle after all.
+    
+ Arguments:
+ 
+    Result - The result of the expression statement.
+    
+    LastCallInstruction - The last call instruction generated.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    if(Result->DataType != IDN_TYPE_THREADT ||
+       !IS_REGISTER_WORKING(Result->Register) ||
+       LastCallInstruction == NULL ||
+       LastCallInstruction->Opcode != OPC_CALLPLLA) {
+       
+        return;
+    }
+    
+    LastCallInstruction->Jump.Future = 0;
+}
+
+void
+GenerateParallelLoopPushValue (
+    PSSTACK OperandStack,
+    PSSTACK OperatorStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine evaluates the start or the bound of a parallel loop and pushes
+    it, the way a parameter gets pushed for a call.
+    
+ Arguments:
+ 
+    OperandStack - A pointer to the operand stack.
+    
+    OperatorStack - A pointer to the operator stack.
+                    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PINSTRUCTION InstructionPush;
+    PIDENTIFIER_OBJECT Value;
+    
+    GenerateExpressionInstructionsEmptyStacks(OperandStack,
+                                              OperatorStack,
+                                              InstructionQueue,
+                                              Context);
+                                              
+    Value = SStackPop(OperandStack);
+    Value = GenerateThreadJoin(Value, InstructionQueue, Context);
+    if(Value->DataType >= IDN_TYPE_FLOATT) {
+        yyerror(ERR_STR_PFORFORM);
+        return;
+    }
+    
+    InstructionPush = InstrMakeStackPush(OPC_PUSH, Value);
+    SQueuePush(InstructionQueue, InstructionPush);
+    Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+    DereferenceRegister(Value);
+    
+#ifdef COMPILE_VERBOSE
+    DebugPrettyPrintInstruction(InstructionPush);
+#endif
+}
+
+void
+GenerateParallelLoopStart (
+    PPARALLELLOOP_OBJECT Loop,
+    PSSTACK PendingInstructionStack,
+    PSSTACK InstructionCountStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine is called once the start and the bound of a parallel loop have
+    been pushed. The rest of what the PFOR instruction takes is only known
+    once the body has been parsed, so the loop keeps the instruction queue
+    and the context it is in for GenerateParallelLoopEnd. The body gets a 
+    function of its own, which starts as follows:
+    
+    [0] Function header, stage 0
+    [1] RCOPYD Data RGD
+    [2] LT     I B RTn
+    [3] JMPZ   RTn Exit
+    
+    I is the index and B the bound of the iterations the thread runs, both 
+    parameters to the function.
+    
+ Arguments:
+ 
+    Loop - A pointer to the parallel loop object.
+    
+    PendingInstructionStack - A pointer to the pending instruction stack.
+    
+    InstructionCountStack - A pointer to the current instruction count stack.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    Context - A pointer to the current scope context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    assert(Context != Context->GlobalContext);
+    
+    PINSTRUCTION InstructionData;
+    PINSTRUCTION InstructionCompare;
+    PINSTRUCTION InstructionExit;
+    PIDENTIFIER_OBJECT RegisterRct;
+    PIDENTIFIER_OBJECT RegisterRgd;
+    PIDENTIFIER_OBJECT CompareRegister;
+    OPERATOR_OBJECT Operator;
+    
+    Loop->ParentInstructionQueue = InstructionQueue;
+    Loop->ParentContext = Context;
+    if(RegisterParallelLoopFunction(Loop, Context) == NULL) {
+        yyerror(ERR_STR_NOMEM);
+        return;
+    }
+    
+    FreeAllRegisters( );
+    GenerateFunctionHeaderStage0(PendingInstructionStack,
+                                 Loop->InstructionQueue,
+                                 Loop->Context);
+    
+    //
+    // Only main finds RGD loaded, by the start block. The body is all but
+    // certain to index global arrays, so it loads RGD itself.
+    //
+    
+    RegisterRgd = RegisterSpecialRegister(REG_RGD);
+    RegisterRct = RegisterIdentifierAsIntegerConstant(0, Loop->Context);
+    RegisterRct->RelOffset = PROGRAM_DATA_START;
+    InstructionData = InstrMakeIndirectDirect(OPC_RCOPYD, RegisterRct, NULL, RegisterRgd);
+    SQueuePush(Loop->InstructionQueue, InstructionData);
+    Loop->Context->CodePointer = Loop->Context->CodePointer + PROGRAM_CODE_ALIGNMENT;
+    DestroyIdentifier(RegisterRgd);
+    DestroyIdentifier(RegisterRct);
+    
+    SStackPush(InstructionCountStack, (void*)SQueueSize(Loop->InstructionQueue));
+    
+    Operator.Type = OPR_TYPE_LT;
+    InstructionCompare = GenerateExpressionInstruction(Loop->Index,
+                                                       Loop->Bound,
+                                                       &Operator,
+                                                       &CompareRegister);
+                                                       
+    InstructionExit = InstrMakeJumpConditional(OPC_JMPZ, NULL, CompareRegister);
+    SQueuePush(Loop->InstructionQueue, InstructionCompare);
+    SQueuePush(Loop->InstructionQueue, InstructionExit);
+    Loop->Context->CodePointer = Loop->Context->CodePointer + 2*PROGRAM_CODE_ALIGNMENT;
+    SStackPush(PendingInstructionStack, InstructionExit);
+    SStackPush(InstructionCountStack, (void*)SQueueSize(Loop->InstructionQueue));
+}
+
+void
+GenerateParallelLoopEnd (
+    PPARALLELLOOP_OBJECT Loop,
+    PSSTACK PendingInstructionStack,
+    PSSTACK InstructionCountStack,
+    PSSTACK PendingReturnJumpsStack,
+    PSSTACK PendingReturnInstructionCountStack
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine finishes the function of a parallel loop body once the body
+    has been parsed, with the step of the index and the jump back to the 
+    loop condition, followed by the function exit sequence:
+    
+    [0] ADD    I S RTn
+    [1] STR    RTn I
+    [2] JMP    Condition
+    [3] Function trailer
+    
+    S refers to the stride of the loop. The function the loop is in then 
+    pushes the values of the locals the body captured, the stride and the
+    chunk size after the start and the bound, and runs the loop with the 
+    PFOR instruction, which splits the iterations among threads running the
+    body.
+    
+ Arguments:
+ 
+    Loop - A pointer to the parallel loop object.
+    
+    PendingInstructionStack - A pointer to the pending instruction stack.
+    
+    InstructionCountStack - A pointer to the current instruction count stack.
+    
+    PendingReturnJumpsStack - A pointer to the pending return jump stack.
+    
+    PendingReturnInstructionCountStack - A pointer to the pending return
+                                         instruction count stack.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PINSTRUCTION InstructionAdd;
+    PINSTRUCTION InstructionStore;
+    PINSTRUCTION InstructionLoop;
+    PINSTRUCTION InstructionPush;
+    PINSTRUCTION ExitInstruction;
+    PSCOPE_CONTEXT Context;
+    PIDENTIFIER_OBJECT Capture;
+    PIDENTIFIER_OBJECT RegisterRct;
+    PIDENTIFIER_OBJECT SumRegister;
+    PIDENTIFIER_OBJECT StoreOperand;
+    PIDENTIFIER_OBJECT RelativeOffset;
+    OPERATOR_OBJECT Operator;
+    void* CaptureNode;
+    signed LoopDelta;
+    signed ExitDelta;
+    
+    FreeAllRegisters( );
+    RegisterRct = RegisterIdentifierAsIntegerConstant(Loop->Stride, Loop->Context);
+    Operator.Type = OPR_TYPE_PLUS;
+    InstructionAdd = GenerateExpressionInstruction(Loop->Index,
+                                                   RegisterRct,
+                                                   &Operator,
+                                                   &SumRegister);
+    
+    Operator.Type = OPR_TYPE_STR;
+    InstructionStore = GenerateExpressionInstruction(Loop->Index,
+                                                     SumRegister,
+                                                     &Operator,
+                                                     &StoreOperand);
+                                                     
+    SQueuePush(Loop->InstructionQueue, InstructionAdd);
+    SQueuePush(Loop->InstructionQueue, InstructionStore);
+    Loop->Context->CodePointer = Loop->Context->CodePointer + 2*PROGRAM_CODE_ALIGNMENT;
+    DestroyIdentifier(RegisterRct);
+    
+    //
+    // Same as a for loop from here.
+    //
+    
+    ExitInstruction = SStackPop(PendingInstructionStack);
+    ExitDelta = SQueueSize(Loop->InstructionQueue) - 
+                (size_t)SStackPop(InstructionCountStack) + 2;
+                 
+    LoopDelta = SQueueSize(Loop->InstructionQueue) - 
+                (size_t)SStackPop(InstructionCountStack);
+                 
+    ExitDelta = ExitDelta * PROGRAM_CODE_ALIGNMENT;
+    LoopDelta = LoopDelta * PROGRAM_CODE_ALIGNMENT;
+      
+    RelativeOffset = RegisterSpecialRegister(REG_RIP);
+    RelativeOffset->RelOffset = ExitDelta;
+            
+    InstrPatchJumpConditionalAddTargetRelative(ExitInstruction, RelativeOffset);
+    RelativeOffset->RelOffset = LoopDelta*-1;
+    InstructionLoop = InstrMakeJump(OPC_JMP, RelativeOffset);
+    SQueuePush(Loop->InstructionQueue, InstructionLoop);
+    Loop->Context->CodePointer = Loop->Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+    DestroyIdentifier(RelativeOffset);
+    
+    GenerateFunctionHeaderStage1(PendingInstructionStack,
+                                 Loop->InstructionQueue,
+                                 Loop->Context);
+                                 
+    GenerateFunctionTrailer(PendingReturnJumpsStack,
+                            PendingReturnInstructionCountStack,
+                            Loop->InstructionQueue,
+                            Loop->Context);
+                            
+    FreeAllRegisters( );
+    
+    //
+    // Back in the function the loop is in.
+    //
+    
+    Context = Loop->ParentContext;
+    CaptureNode = SQueueTopNode(Loop->Context->Captures);
+    while(CaptureNode != NULL) {
+        Capture = SQueueDataFromNode(CaptureNode);
+        InstructionPush = InstrMakeStackPush(OPC_PUSH, Capture);
+        SQueuePush(Loop->ParentInstructionQueue, InstructionPush);
+        Context->CodePointer = Context->CodePointer + 1*PROGRAM_CODE_ALIGNMENT;
+        CaptureNode = SQueueNextFromNode(CaptureNode);
+    }
+    
+    RegisterRct = RegisterIdentifierAsIntegerConstant(Loop->Stride, Context);
+    InstructionPush = InstrMakeStackPush(OPC_PUSH, RegisterRct);
+    SQueuePush(Loop->ParentInstructionQueue, InstructionPush);
+    
+    RegisterRct->RelOffset = Loop->Chunk;
+    InstructionPush = InstrMakeStackPush(OPC_PUSH, RegisterRct);
+    SQueuePush(Loop->ParentInstructionQueue, InstructionPush);
+    
+    Loop->LoopInstruction = InstrMakeParallelLoop(OPC_PFOR, Loop->Schedule);
+    SQueuePush(Loop->ParentInstructionQueue, Loop->LoopInstruction);
+    Context->CodePointer = Context->CodePointer + 3*PROGRAM_CODE_ALIGNMENT;
+    DestroyIdentifier(RegisterRct);
+    
+#ifdef COMPILE_VERBOSE
+    DebugPrettyPrintInstruction(Loop->LoopInstruction);
+#endif
+}
+
+void
+GenerateParallelLoopBodies (
+    PSQUEUE LoopQueue,
+    PSQUEUE InstructionQueue,
+    PSQUEUE FunctionSymbolQueue,
+    PSCOPE_CONTEXT GlobalContext
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine puts the functions of the parallel loop bodies finished so
+    far after the last function, in the order they were finished, and points
+    their PFOR instructions at them.
+    
+ Arguments:
+ 
+    LoopQueue - A pointer to the queue of finished parallel loops.
+    
+    InstructionQueue - A pointer to the global instruction queue.
+    
+    FunctionSymbolQueue - A pointer to the function symbol queue.
+    
+    GlobalContext - A pointer to the global context.
+    
+ Return value:
+ 
+    void.
+
+*/
+    
+{
+    PPARALLELLOOP_OBJECT Loop;
+    PFUNCTION_SYMBOL FunctionSymbol;
+    
+    while(SQueueSize(LoopQueue) > 0) {
+        Loop = SQueuePop(LoopQueue);
+        Loop->Function->AbsOffset = GlobalContext->CodePointer;
+        InstrPatchParallelLoopBody(Loop->LoopInstruction, Loop->Function);
+        FunctionSymbol = RegisterFunctionSymbol(Loop->Context);
+        if(FunctionSymbol == NULL) {
+            yyerror(ERR_STR_NOMEM);
+            return;
+        }
+        
+        SQueuePush(FunctionSymbolQueue, FunctionSymbol);
+        while(SQueueSize(Loop->InstructionQueue) > 0) {
+            SQueuePush(InstructionQueue, SQueuePop(Loop->InstructionQueue));
+        }
+        
+        GlobalContext->CodePointer = GlobalContext->CodePointer + 
+                                     Loop->Context->CodePointer;
+                                     
+        DestroyScopeContext(Loop->Context);
+    }
 }
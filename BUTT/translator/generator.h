@@ -33,6 +33,11 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        Atomic compare and swap
+    10/17/26        Thread joins and thread local declarations
+    10/17/26        Parallel loops
+    10/17/26        Barrier waits
+    10/17/26        Channel sends and receives
 
 **/
 
@@ -87,6 +92,70 @@ GenerateExpressionInstructionsUntilMatch (
     PSCOPE_CONTEXT Context
     );
     
+void
+GenerateBarrierWait (
+    PIDENTIFIER_OBJECT Barrier,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
+void
+GenerateChannelSend (
+    PIDENTIFIER_OBJECT Channel,
+    PSSTACK OperandStack,
+    PSSTACK OperatorStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
+void
+GenerateChannelReceive (
+    PIDENTIFIER_OBJECT Channel,
+    PSSTACK OperandStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
+PIDENTIFIER_OBJECT
+GenerateThreadJoin (
+    PIDENTIFIER_OBJECT Operand,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
+void
+GenerateThreadDeclaration (
+    PIDENTIFIER_OBJECT Identifier,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
+void
+GenerateExpressionJoinOperands (
+    POPERATOR_OBJECT Operator,
+    PIDENTIFIER_OBJECT *OperandL,
+    PIDENTIFIER_OBJECT *OperandR,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
+void
+GenerateAtomicCompareSwapExpected (
+    PSSTACK OperandStack,
+    PSSTACK OperatorStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
+void
+GenerateAtomicCompareSwap (
+    PIDENTIFIER_OBJECT Variable,
+    PSSTACK OperandStack,
+    PSSTACK OperatorStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
 void
 GenerateArrayInstructions (
     PSSTACK OperandStack,
@@ -189,7 +258,48 @@ GenerateFunctionCallPatchParallelSync (
     
 void
 GenerateFunctionCallPatchParallelAsync (
-    PINSTRUCTION InstructionCall
+    PINSTRUCTION InstructionCall,
+    PSSTACK OperandStack
+    );
+    
+void
+GenerateFunctionCallDropFuture (
+    PIDENTIFIER_OBJECT Result,
+    PINSTRUCTION LastCallInstruction
+    );
+
+void
+GenerateParallelLoopPushValue (
+    PSSTACK OperandStack,
+    PSSTACK OperatorStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
+void
+GenerateParallelLoopStart (
+    PPARALLELLOOP_OBJECT Loop,
+    PSSTACK PendingInstructionStack,
+    PSSTACK InstructionCountStack,
+    PSQUEUE InstructionQueue,
+    PSCOPE_CONTEXT Context
+    );
+    
+void
+GenerateParallelLoopEnd (
+    PPARALLELLOOP_OBJECT Loop,
+    PSSTACK PendingInstructionStack,
+    PSSTACK InstructionCountStack,
+    PSSTACK PendingReturnJumpsStack,
+    PSSTACK PendingReturnInstructionCountStack
+    );
+    
+void
+GenerateParallelLoopBodies (
+    PSQUEUE LoopQueue,
+    PSQUEUE InstructionQueue,
+    PSQUEUE FunctionSymbolQueue,
+    PSCOPE_CONTEXT GlobalContext
     );
 
 #endif // __GENERATOR_H__
@@ -32,6 +32,11 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        Mark loads of atomic variables
+    10/17/26        Parallel loops
+    10/17/26        Barrier waits
+    10/17/26        Channel instructions
+    10/17/26        Single channels
 
 **/
 
@@ -66,6 +71,7 @@ InstrMakeArithmetic (
     NewInstruction->Arith.LtRegisterOffset = OperandL->RelOffset;
     NewInstruction->Arith.RtRegisterOffset = OperandR->RelOffset;
     NewInstruction->Arith.DtRegisterOffset = Destination->RelOffset;
+    NewInstruction->Arith.AtomicLoad = !!(OperandL->IsAtomic || OperandR->IsAtomic);
 
     return NewInstruction;   
 }
@@ -146,6 +152,7 @@ InstrMakeStore (
     NewInstruction->Store.RtRegister = Operand->Register;
     NewInstruction->Store.DtRegister = Destination->Register;
     NewInstruction->Store.AtomicStore = !!(Destination->IsAtomic);
+    NewInstruction->Store.AtomicLoad = !!(Operand->IsAtomic);
     NewInstruction->Store.RtRegisterOffset = Operand->RelOffset;
     NewInstruction->Store.DtRegisterOffset = Destination->RelOffset;
     
@@ -369,6 +376,39 @@ InstrMakeCallParallelAsync(
     return NewInstruction;
 }
 
+PINSTRUCTION
+InstrMakeParallelLoop (
+    OPCODES Opcode,
+    unsigned Schedule
+    )
+{
+    (void)Opcode;
+    assert(Opcode == OPC_PFOR);
+    
+    PINSTRUCTION NewInstruction;
+    
+    NewInstruction = malloc(sizeof(INSTRUCTION));
+    memset(NewInstruction, 0, sizeof(INSTRUCTION));    
+    NewInstruction->Opcode = OPC_PFOR;
+    NewInstruction->Jump.JumpType = JUMP_TYPE_UNCONDITIONAL;
+    NewInstruction->Jump.Register = REG_RCT;
+    NewInstruction->Jump.Schedule = Schedule;
+    
+    return NewInstruction;
+}
+
+PINSTRUCTION
+InstrPatchParallelLoopBody (
+    PINSTRUCTION Instruction,
+    PIDENTIFIER_OBJECT Function
+    )
+{
+    assert(Instruction->Opcode == OPC_PFOR);
+    
+    Instruction->Jump.RegisterOffset = Function->AbsOffset;
+    return Instruction;
+}
+
 PINSTRUCTION
 InstrMakeReturn (
     OPCODES Opcode,
@@ -403,6 +443,7 @@ InstrMakeStackPush(
     NewInstruction->Opcode = OPC_PUSH;
     NewInstruction->Stack.Register = Value->Register;
     NewInstruction->Stack.RegisterOffset = Value->RelOffset;
+    NewInstruction->Stack.AtomicLoad = !!(Value->IsAtomic);
     
     return NewInstruction;
 }
@@ -425,6 +466,53 @@ InstrMakeStackPop(
     return NewInstruction;
 }
 
+PINSTRUCTION
+InstrMakeBarrierWait (
+    OPCODES Opcode,
+    PIDENTIFIER_OBJECT Barrier
+    )
+{
+    (void)Opcode;
+    assert(Opcode == OPC_WAIT);
+    assert(Barrier->Register == REG_RGD);
+    
+    PINSTRUCTION NewInstruction;
+    
+    NewInstruction = malloc(sizeof(INSTRUCTION));
+    memset(NewInstruction, 0, sizeof(INSTRUCTION));
+    NewInstruction->Opcode = OPC_WAIT;
+    NewInstruction->Stack.Register = Barrier->Register;
+    NewInstruction->Stack.RegisterOffset = Barrier->RelOffset;
+    NewInstruction->Stack.AtomicLoad = 1;
+    
+    return NewInstruction;
+}
+
+PINSTRUCTION
+InstrMakeChannel (
+    OPCODES Opcode,
+    PIDENTIFIER_OBJECT Channel,
+    PIDENTIFIER_OBJECT Value
+    )
+{
+    assert(Opcode == OPC_SEND || Opcode == OPC_RECV);
+    assert(Channel->Register == REG_RGD);
+    assert(Channel->ChannelSize > 0 && Channel->ChannelSize <= CHANNEL_MAX_SIZE);
+    assert(IS_REGISTER_WORKING(Value->Register));
+    
+    PINSTRUCTION NewInstruction;
+    
+    NewInstruction = malloc(sizeof(INSTRUCTION));
+    memset(NewInstruction, 0, sizeof(INSTRUCTION));
+    NewInstruction->Opcode = Opcode;
+    NewInstruction->Channel.Register = Value->Register;
+    NewInstruction->Channel.ChannelOffset = Channel->RelOffset;
+    NewInstruction->Channel.Capacity = Channel->ChannelSize - 1;
+    NewInstruction->Channel.Single = Channel->ChannelSingle;
+    
+    return NewInstruction;
+}
+
 PINSTRUCTION
 InstrMakeIoRead (
     OPCODES Opcode,
@@ -33,6 +33,9 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        Parallel loops
+    10/17/26        Barrier waits
+    10/17/26        Channel instructions
 
 **/
 
@@ -134,6 +137,18 @@ InstrMakeCallParallelAsync (
     PIDENTIFIER_OBJECT Function
     );
     
+PINSTRUCTION
+InstrMakeParallelLoop (
+    OPCODES Opcode,
+    unsigned Schedule
+    );
+    
+PINSTRUCTION
+InstrPatchParallelLoopBody (
+    PINSTRUCTION Instruction,
+    PIDENTIFIER_OBJECT Function
+    );
+
 PINSTRUCTION
 InstrMakeReturn (
     OPCODES Opcode,
@@ -152,6 +167,19 @@ InstrMakeStackPop (
     PIDENTIFIER_OBJECT Location
     );
     
+PINSTRUCTION
+InstrMakeBarrierWait (
+    OPCODES Opcode,
+    PIDENTIFIER_OBJECT Barrier
+    );
+    
+PINSTRUCTION
+InstrMakeChannel (
+    OPCODES Opcode,
+    PIDENTIFIER_OBJECT Channel,
+    PIDENTIFIER_OBJECT Value
+    );
+    
 PINSTRUCTION
 InstrMakeIoRead (
     OPCODES Opcode,
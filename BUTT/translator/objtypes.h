@@ -32,6 +32,13 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        Atomic read-modify-write assignments
+    10/17/26        Thread locals let go of their threads on return
+    10/17/26        Parallel loops, their bodies capture locals
+    10/17/26        Reduction variables
+    10/17/26        Barriers
+    10/17/26        Channels
+    10/17/26        Single channels
 
 **/
 
@@ -40,6 +47,7 @@
 
 #include <inttypes.h>
 #include "../Common/registerdef.h"
+#include "../Common/instrdef.h"
 #include "../../utils/inc/squeue.h"
 #include "../../utils/inc/sstack.h"
 #include "../../utils/inc/shashmap.h"
@@ -100,8 +108,26 @@ typedef enum OPR_TYPE {
     
     OPR_TYPE_LBRACK         = 19,
     OPR_TYPE_RBRACK         = 20,
+    
+    //
+    // Read-modify-write assignments, only on atomic variables.
+    //
+    
+    OPR_TYPE_ADDSTR         = 21,
+    OPR_TYPE_SUBSTR         = 22,
+    OPR_TYPE_ORSTR          = 23,
+    OPR_TYPE_ANDSTR         = 24,
+    OPR_TYPE_XORSTR         = 25,
+    
+    //
+    // Only the operators of min and max reductions, whose stores keep the 
+    // least or the greatest value stored.
+    //
+    
+    OPR_TYPE_MINSTR         = 26,
+    OPR_TYPE_MAXSTR         = 27,
 
-    OPR_TYPE_ERR            = 21
+    OPR_TYPE_ERR            = 28
 } OPR_TYPE, *POPR_TYPE;
 
 typedef struct _IDENTIFIER_OBJECT {
@@ -119,6 +145,12 @@ typedef struct _IDENTIFIER_OBJECT {
     };
     
     unsigned IsAtomic;                      // Arrays may not be atomic.
+    OPR_TYPE Reduction;                     // Update operator, STR if none.
+    unsigned IsBarrier;                     // Holds the count of a barrier.
+    unsigned IsChannel;                     // Holds no value of its own.
+    unsigned long ChannelSize;              // Values the channel holds.
+    unsigned ChannelSingle;                 // One sender and one receiver.
+    unsigned OwnsThread;                    // Let go of on return.
     unsigned long ReturnCount;
     union {
         unsigned long ArraySize;
@@ -147,6 +179,31 @@ typedef struct _SCOPE_CONTEXT {
     unsigned long long ParameterPointer;
     unsigned long long DataPointer; 
     unsigned long long StackPointer; // Only for the global context.
+    unsigned long long EntryPointer; // End of the code every call runs.
+    struct _SCOPE_CONTEXT* ParentContext; // Only for parallel loop bodies.
+    PSQUEUE Captures;                // Locals of the parent a body reads.
 } SCOPE_CONTEXT, *PSCOPE_CONTEXT;
 
+//
+// The body of a parallel loop is translated as a function of its own, taking
+// the index and the bound of the iterations it runs, then a copy of each 
+// local of the function around it the body refers to. It is put after the
+// function the loop is in once that one is done.
+//
+
+typedef struct _PARALLELLOOP_OBJECT {
+    char* IndexName;
+    PIDENTIFIER_OBJECT Function;
+    PIDENTIFIER_OBJECT Index;
+    PIDENTIFIER_OBJECT Bound;
+    signed long Stride;
+    signed long Chunk;
+    unsigned Schedule;
+    PINSTRUCTION LoopInstruction;
+    PSCOPE_CONTEXT Context;
+    PSCOPE_CONTEXT ParentContext;
+    PSQUEUE InstructionQueue;
+    PSQUEUE ParentInstructionQueue;
+} PARALLELLOOP_OBJECT, *PPARALLELLOOP_OBJECT;
+
 #endif // __OBJTYPES_H__
@@ -33,6 +33,8 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        Atomic read-modify-write
+    10/17/26        Thread copies
 
 **/
 
@@ -127,6 +129,18 @@ OpcodeFromOperator (
     }
 }
 
+int
+IsOperatorReadModifyWrite (
+    OPR_TYPE O
+    )
+{
+    return (O == OPR_TYPE_ADDSTR || 
+            O == OPR_TYPE_SUBSTR || 
+            O == OPR_TYPE_ORSTR  || 
+            O == OPR_TYPE_ANDSTR || 
+            O == OPR_TYPE_XORSTR);
+}
+
 int
 IsOperandSigned (
     IDN_TYPE T
@@ -197,6 +211,34 @@ GenerateOpcode (
         //
         
         return OpcodeFromOperator(O, L, R);
+    
+    case OPR_TYPE_ADDSTR:
+    case OPR_TYPE_SUBSTR:
+    case OPR_TYPE_ORSTR:
+    case OPR_TYPE_ANDSTR:
+    case OPR_TYPE_XORSTR:
+        
+        //
+        // These are single hardware atomics on the 32 bit value of the
+        // variable, there is no such thing for floats or threads.
+        //
+        
+        if(L >= IDN_TYPE_FLOATT || R >= IDN_TYPE_FLOATT) {
+            return OPC_ERR;
+        }
+        
+        switch(O) {
+        case OPR_TYPE_ADDSTR:
+            return OPC_AADD;
+        case OPR_TYPE_SUBSTR:
+            return OPC_ASUB;
+        case OPR_TYPE_ORSTR:
+            return OPC_AOR;
+        case OPR_TYPE_ANDSTR:
+            return OPC_AAND;
+        default:
+            return OPC_AXOR;
+        }
         
     default:
         return OPC_ERR;
@@ -212,6 +254,15 @@ GenerateResultingDataType (
     OPR_TYPE O
     )
 {
+    //
+    // Storing a thread into a thread copies the handle, so the result is
+    // still a thread. Thread values read anywhere else were joined already.
+    //
+    
+    if(O == OPR_TYPE_STR && L == IDN_TYPE_THREADT && R == IDN_TYPE_THREADT) {
+        return IDN_TYPE_THREADT;
+    }
+    
     if(L >= IDN_TYPE_THREADT || R >= IDN_TYPE_THREADT) {
         return IDN_TYPE_ERR;
     }
@@ -220,7 +271,7 @@ GenerateResultingDataType (
         return IDN_TYPE_FLOATT;
     }
     
-    if(O == OPR_TYPE_STR) {
+    if(O == OPR_TYPE_STR || IsOperatorReadModifyWrite(O)) {
         
         //
         // If this is a store then we will end up pushing a new register or
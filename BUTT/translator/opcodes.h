@@ -33,6 +33,7 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        Atomic read-modify-write
 
 **/
 
@@ -49,6 +50,11 @@ GenerateOpcode (
     OPR_TYPE O
     );
 
+int
+IsOperatorReadModifyWrite (
+    OPR_TYPE O
+    );
+
 IDN_TYPE
 GenerateResultingDataType (
     IDN_TYPE L, 
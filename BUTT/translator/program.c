@@ -33,6 +33,9 @@
  
     11/17/15        Initial Creation
     11/25/15        Documented functions
+    10/17/26        Function symbol write buffer holds symbols
+    10/17/26        Record the stack depth of each function
+    10/17/26        Parallel loops and the values their bodies capture
 
 **/
 
@@ -138,6 +141,7 @@ ProgramSerializeQueue (
     assert((WriteBufferSize % DataSize) == 0);
     
     WriteBufferLength = 0;
+    WriteBufferCount = 0;
     CurrentNode = SQueueTopNode(Queue);
     while(CurrentNode != NULL) {
         NodeData = SQueueDataFromNode(CurrentNode);
@@ -179,6 +183,435 @@ ProgramSerializeQueue (
     }
 }
 
+//
+// What the stack depth analysis needs at hand. The instructions and symbols
+// are copied out of their queues so calls can be followed by address.
+//
+
+typedef struct _PROGRAM_STACK_CONTEXT {
+    PINSTRUCTION *Instructions;
+    unsigned long InstructionCount;
+    PFUNCTION_SYMBOL *Functions;
+    unsigned long FunctionCount;
+    unsigned char *State;
+} PROGRAM_STACK_CONTEXT, *PPROGRAM_STACK_CONTEXT;
+
+#define PROGRAM_STACK_NEW       0
+#define PROGRAM_STACK_ACTIVE    1
+#define PROGRAM_STACK_DONE      2
+
+void
+ProgramFunctionRange (
+    PPROGRAM_STACK_CONTEXT Context,
+    unsigned long Index,
+    unsigned long *Start,
+    unsigned long *End
+    )
+
+/*
+    
+ Routine description:
+    
+    This routine finds the instructions of a function, from its address to
+    the next function. Functions are emitted one after the other.
+    
+ Arguments:
+    
+    Context - The stack depth analysis context.
+    
+    Index - Index of the function.
+    
+    Start - Receives the index of its first instruction.
+    
+    End - Receives the index past its last instruction.
+    
+ Return value:
+    
+    void.
+
+*/
+    
+{
+    *Start = (Context->Functions[Index]->FunctionAddress - PROGRAM_CODE_START) /
+             PROGRAM_CODE_ALIGNMENT;
+    
+    *End = Context->InstructionCount;
+    if(Index + 1 < Context->FunctionCount) {
+        *End = (Context->Functions[Index + 1]->FunctionAddress - PROGRAM_CODE_START) /
+               PROGRAM_CODE_ALIGNMENT;
+    }
+}
+
+long
+ProgramFindFunction (
+    PPROGRAM_STACK_CONTEXT Context,
+    unsigned long Address
+    )
+
+/*
+    
+ Routine description:
+    
+    This routine finds the function starting at an address.
+    
+ Arguments:
+    
+    Context - The stack depth analysis context.
+    
+    Address - The address.
+    
+ Return value:
+    
+    Index of the function, -1 if no function starts there.
+
+*/
+    
+{
+    unsigned long i;
+    
+    for(i=0; i<Context->FunctionCount; ++i) {
+        if(Context->Functions[i]->FunctionAddress == Address) {
+            return (long)i;
+        }
+    }
+    
+    return -1;
+}
+
+int
+ProgramFunctionCleanup (
+    PPROGRAM_STACK_CONTEXT Context,
+    unsigned long Index,
+    long long *Cleanup
+    )
+
+/*
+    
+ Routine description:
+    
+    This routine finds how far the returns of a function move the stack
+    pointer of its caller back up, past the return address.
+    
+ Arguments:
+    
+    Context - The stack depth analysis context.
+    
+    Index - Index of the function.
+    
+    Cleanup - Receives the cleanup in bytes.
+    
+ Return value:
+    
+    1 if every return of the function cleans up the same, 0 otherwise.
+
+*/
+    
+{
+    PINSTRUCTION Instruction;
+    unsigned long Start;
+    unsigned long End;
+    int Found;
+    
+    Found = 0;
+    ProgramFunctionRange(Context, Index, &Start, &End);
+    for(; Start < End; ++Start) {
+        Instruction = Context->Instructions[Start];
+        if(Instruction->Opcode != OPC_RETURN) {
+            continue;
+        }
+    
+        if(Found != 0 && *Cleanup != (long long)Instruction->Return.StackCleanup) {
+            return 0;
+        }
+    
+        *Cleanup = (long long)Instruction->Return.StackCleanup;
+        Found = 1;
+    }
+    
+    return Found;
+}
+
+unsigned long
+ProgramFunctionStackDepth (
+    PPROGRAM_STACK_CONTEXT Context,
+    unsigned long Index
+    )
+
+/*
+    
+ Routine description:
+    
+    This routine works out the stack depth of a function, see symdef.h. The
+    code of the function is walked in address order, keeping count of how
+    far below the return address the stack pointer is. Statements start and
+    end with nothing pushed, so every jump lands where that count holds. A
+    call adds the depth of the callee, worked out first. A function reached
+    again while its own depth is being worked out recurses, and it and every
+    function calling it are left unbounded.
+    
+ Arguments:
+    
+    Context - The stack depth analysis context.
+    
+    Index - Index of the function.
+    
+ Return value:
+    
+    The stack depth of the function, SYMBOL_STACK_UNBOUNDED if it has none.
+
+*/
+    
+{
+    PFUNCTION_SYMBOL Function;
+    PINSTRUCTION Instruction;
+    unsigned long Start;
+    unsigned long End;
+    unsigned long Address;
+    unsigned long CalleeDepth;
+    unsigned long Depth;
+    long long Cleanup;
+    long long Current;
+    long long Maximum;
+    long long Frame;
+    long Callee;
+    int FrameKnown;
+    
+    Function = Context->Functions[Index];
+    if(Context->State[Index] == PROGRAM_STACK_DONE) {
+        return Function->StackDepth;
+    }
+    
+    if(Context->State[Index] == PROGRAM_STACK_ACTIVE) {
+        return SYMBOL_STACK_UNBOUNDED;
+    }
+    
+    Context->State[Index] = PROGRAM_STACK_ACTIVE;
+    Depth = SYMBOL_STACK_UNBOUNDED;
+    Current = 0;
+    Maximum = 0;
+    Frame = 0;
+    FrameKnown = 0;
+    
+    ProgramFunctionRange(Context, Index, &Start, &End);
+    for(; Start < End; ++Start) {
+        Instruction = Context->Instructions[Start];
+        Address = PROGRAM_CODE_START + Start * PROGRAM_CODE_ALIGNMENT;
+        switch(Instruction->Opcode) {
+            case OPC_RCOPYD:
+    
+                //
+                // RST is set from RSB in the prologue and the frame is
+                // addressed off it from then on.
+                //
+    
+                if(Instruction->Indirect.DtRegister == REG_RST) {
+                    Frame = Current;
+                    FrameKnown = (Instruction->Indirect.LtRegister == REG_RSB &&
+                                  Instruction->Indirect.LtOffsetType == INDIRECT_OFFSET_TYPE_CONSTANT &&
+                                  Instruction->Indirect.LtOffset == 0);
+                }
+    
+                if(Instruction->Indirect.DtRegister != REG_RSB) {
+                    break;
+                }
+    
+                if(Instruction->Indirect.LtOffsetType != INDIRECT_OFFSET_TYPE_CONSTANT) {
+                    goto ProgramFunctionStackDepthEnd;
+                }
+    
+                if(Instruction->Indirect.LtRegister == REG_RSB) {
+                    Current = Current - Instruction->Indirect.LtOffset;
+                } else if(Instruction->Indirect.LtRegister == REG_RST && FrameKnown != 0) {
+                    Current = Frame - Instruction->Indirect.LtOffset;
+                } else {
+                    goto ProgramFunctionStackDepthEnd;
+                }
+    
+                break;
+    
+            case OPC_PUSH:
+                Current = Current + PROGRAM_STACK_ALIGNMENT;
+                break;
+    
+            case OPC_POP:
+                Current = Current - PROGRAM_STACK_ALIGNMENT;
+                break;
+    
+            case OPC_PRINT:
+            case OPC_READ:
+                Current = Current -
+                          (long long)Instruction->Io.PopCount * PROGRAM_STACK_ALIGNMENT;
+                break;
+    
+            //
+            // The body of a parallel loop runs on other threads, this one
+            // only takes the loop parameters and the captured values off.
+            //
+    
+            case OPC_PFOR:
+                Callee = ProgramFindFunction(Context,
+                                             (unsigned long)Instruction->Jump.RegisterOffset);
+                                             
+                if(Callee < 0) {
+                    goto ProgramFunctionStackDepthEnd;
+                }
+                
+                Current = Current - 
+                          (long long)(LOOP_PARAMETER_COUNT - LOOP_BODY_PARAMETER_COUNT + 
+                                      Context->Functions[Callee]->ParameterCount) *
+                          PROGRAM_STACK_ALIGNMENT;
+                break;
+    
+            case OPC_CALLNORM:
+            case OPC_CALLPLLS:
+            case OPC_CALLPLLA:
+                if(Instruction->Jump.JumpType != JUMP_TYPE_UNCONDITIONAL) {
+                    break;
+                }
+    
+                if(Instruction->Jump.Register == REG_RCT) {
+                    Callee = ProgramFindFunction(Context,
+                                                 (unsigned long)Instruction->Jump.RegisterOffset);
+                } else if(Instruction->Jump.Register == REG_RIP) {
+                    Callee = ProgramFindFunction(Context,
+                                                 Address + Instruction->Jump.RegisterOffset);
+                } else {
+                    Callee = -1;
+                }
+    
+                if(Callee < 0) {
+                    goto ProgramFunctionStackDepthEnd;
+                }
+    
+                //
+                // A parallel call runs the callee on a stack of its own and
+                // only takes the parameters off this one.
+                //
+    
+                if(Instruction->Opcode != OPC_CALLNORM) {
+                    Current = Current -
+                              (long long)Context->Functions[Callee]->ParameterCount *
+                              PROGRAM_STACK_ALIGNMENT;
+                    break;
+                }
+    
+                CalleeDepth = ProgramFunctionStackDepth(Context, (unsigned long)Callee);
+                if(CalleeDepth == SYMBOL_STACK_UNBOUNDED ||
+                   ProgramFunctionCleanup(Context, (unsigned long)Callee, &Cleanup) == 0) {
+    
+                    goto ProgramFunctionStackDepthEnd;
+                }
+    
+                if(Current + PROGRAM_STACK_ALIGNMENT + (long long)CalleeDepth > Maximum) {
+                    Maximum = Current + PROGRAM_STACK_ALIGNMENT + (long long)CalleeDepth;
+                }
+    
+                Current = Current - Cleanup;
+                break;
+    
+            default:
+                break;
+        }
+    
+        if(Current < 0) {
+            goto ProgramFunctionStackDepthEnd;
+        }
+    
+        if(Current > Maximum) {
+            Maximum = Current;
+        }
+    }
+    
+    if(Maximum < (long long)SYMBOL_STACK_UNBOUNDED) {
+        Depth = (unsigned long)Maximum;
+    }
+
+ProgramFunctionStackDepthEnd:
+    Function->StackDepth = Depth;
+    Context->State[Index] = PROGRAM_STACK_DONE;
+    return Depth;
+}
+
+void
+ProgramRecordStackDepth (
+    PSQUEUE InstructionQueue,
+    PSQUEUE FunctionSymbolQueue
+    )
+
+/*
+    
+ Routine description:
+    
+    This routine fills in the stack depth of every function symbol.
+    
+ Arguments:
+    
+    InstructionQueue - Pointer to the global instruction queue for the program.
+    
+    FunctionSymbolQueue - Pointer to the function symbol queue.
+    
+ Return value:
+    
+    void.
+
+*/
+    
+{
+    PROGRAM_STACK_CONTEXT Context;
+    void *Node;
+    unsigned long i;
+    
+    memset(&Context, 0, sizeof(PROGRAM_STACK_CONTEXT));
+    Context.InstructionCount = SQueueSize(InstructionQueue);
+    Context.FunctionCount = SQueueSize(FunctionSymbolQueue);
+    if(Context.FunctionCount == 0) {
+        return;
+    }
+    
+    Context.Instructions = malloc(Context.InstructionCount * sizeof(PINSTRUCTION));
+    Context.Functions = malloc(Context.FunctionCount * sizeof(PFUNCTION_SYMBOL));
+    Context.State = calloc(Context.FunctionCount, sizeof(unsigned char));
+    if(Context.Instructions == NULL ||
+       Context.Functions == NULL ||
+       Context.State == NULL) {
+    
+        //
+        // Not knowing the depths only costs the VM memory.
+        //
+    
+        for(Node = SQueueTopNode(FunctionSymbolQueue);
+            Node != NULL;
+            Node = SQueueNextFromNode(Node)) {
+    
+            ((PFUNCTION_SYMBOL)SQueueDataFromNode(Node))->StackDepth =
+                SYMBOL_STACK_UNBOUNDED;
+        }
+    
+        goto ProgramRecordStackDepthEnd;
+    }
+    
+    i = 0;
+    for(Node = SQueueTopNode(InstructionQueue); Node != NULL; Node = SQueueNextFromNode(Node)) {
+        Context.Instructions[i] = SQueueDataFromNode(Node);
+        i += 1;
+    }
+    
+    i = 0;
+    for(Node = SQueueTopNode(FunctionSymbolQueue); Node != NULL; Node = SQueueNextFromNode(Node)) {
+        Context.Functions[i] = SQueueDataFromNode(Node);
+        i += 1;
+    }
+    
+    for(i=0; i<Context.FunctionCount; ++i) {
+        ProgramFunctionStackDepth(&Context, i);
+    }
+
+ProgramRecordStackDepthEnd:
+    free(Context.Instructions);
+    free(Context.Functions);
+    free(Context.State);
+}
+
 void
 ProgramSerializeCode (
     FILE  *OutFile,
@@ -215,7 +648,7 @@ ProgramSerializeCode (
     assert(GlobalContext->GlobalContext == GlobalContext);
     
     unsigned char WriteBuffer[4096];
-    PFUNCTION_SYMBOL FunctionSymbolWriteBuffer[4096/sizeof(FUNCTION_SYMBOL)];
+    FUNCTION_SYMBOL FunctionSymbolWriteBuffer[4096/sizeof(FUNCTION_SYMBOL)];
     PINSTRUCTION InstructionWriteBuffer[4096/sizeof(INSTRUCTION)];
     size_t WriteBufferLength;
     size_t BytesWritten; 
@@ -241,7 +674,7 @@ ProgramSerializeCode (
     ProgramHeader.SymbolSize = SQueueSize(FunctionSymbolQueue) * sizeof(FUNCTION_SYMBOL);
     ProgramHeader.SymbolBinaryLocation = HEADER_SIZE_BYTES;
     ProgramHeader.CodeBinaryLocation = ProgramHeader.SymbolBinaryLocation + 
-                                       ProgramHeader.SymbolSize + sizeof(FUNCTION_SYMBOL);
+                                       ProgramHeader.SymbolSize;
     
     memset(WriteBuffer, 0, sizeof(WriteBuffer));
     memcpy(WriteBuffer, &ProgramHeader, sizeof(PROGRAM_HEADER));
@@ -254,6 +687,7 @@ ProgramSerializeCode (
     // Function symbols
     //
     
+    ProgramRecordStackDepth(InstructionQueue, FunctionSymbolQueue);
     ProgramSerializeQueue(FunctionSymbolWriteBuffer, 
                           sizeof(FunctionSymbolWriteBuffer),
                           OutFile,
@@ -34,6 +34,7 @@
  
     11/17/15        Initial Creation
     11/25/15        Documented functions
+    10/17/26        Parallel loops, their bodies capture locals
 
 **/
 
@@ -212,7 +213,9 @@ GetDeclaredIdentifier (
  Routine description:
  
     This routine retrieves an identifier from the symbol table pertaining to the
-    provided context, or NULL if it does not exist.
+    provided context, or NULL if it does not exist. The body of a parallel 
+    loop also sees the locals and parameters of the function around it, 
+    which get captured the first time the body refers to them.
     
  Arguments:
  
@@ -233,6 +236,15 @@ GetDeclaredIdentifier (
         return Identifier;
     }
     
+    if(Context->ParentContext != NULL) {
+        Identifier = GetDeclaredIdentifier(Name, Context->ParentContext);
+        if(Identifier == NULL || Identifier->Register != REG_RST) {
+            return Identifier;
+        }
+        
+        return RegisterIdentifierAsCapture(Identifier, Context);
+    }
+    
     if(SHashMapGet(Context->GlobalContext->SymTable, Name, (void**)&Identifier) == SHASHMAP_OK) {
         return Identifier;
     }
@@ -485,6 +497,54 @@ RegisterIdentifierAsParameter (
     return NewParameter;    
 }
 
+PIDENTIFIER_OBJECT
+RegisterIdentifierAsCapture (
+    PIDENTIFIER_OBJECT Identifier, 
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine captures a local or parameter of the function around a 
+    parallel loop into the body of the loop, as a parameter of the body 
+    taking a copy of its value. The index and the bound had their offsets
+    turned around by the function header already, so the parameter pointer
+    is past both, right where the first value pushed before them lands.
+    
+ Arguments:
+ 
+    Identifier - Pointer to the identifier in the function around the loop.
+    
+    Context - Context for the loop body.
+    
+ Return value:
+ 
+    Pointer to the newly registered parameter, NULL if the identifier is an
+    array, which has no single value to copy.
+
+*/
+    
+{
+    PIDENTIFIER_OBJECT Capture;
+    
+    if(CheckIdentifierIsArray(Identifier)) {
+        return NULL;
+    }
+    
+    Capture = RegisterIdentifierAsParameter(Identifier->Name, 
+                                            Identifier->DataType, 
+                                            Context);
+                                            
+    if(RegisterParameterToIdentifier(Context->Identifier, Capture) == NULL) {
+        return NULL;
+    }
+    
+    SQueuePush(Context->Captures, (void*)Identifier);
+    return Capture;
+}
+
 PIDENTIFIER_OBJECT
 RegisterArrayToIdentifier (
     PIDENTIFIER_OBJECT Identifier, 
@@ -828,6 +888,125 @@ CleanIoObject (
     return IoObject;
 }
 
+//
+// Parallel loops
+//
+
+PPARALLELLOOP_OBJECT
+RegisterParallelLoop (
+    void
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine registers a parallel loop object.
+    
+ Arguments:
+ 
+    void
+    
+ Return value:
+ 
+    A pointer to the newly registered parallel loop object.
+
+*/
+    
+{
+    PPARALLELLOOP_OBJECT Loop;
+    
+    Loop = malloc(sizeof(PARALLELLOOP_OBJECT));
+    if(Loop == NULL) {
+        return NULL;
+    }
+    
+    memset(Loop, 0, sizeof(PARALLELLOOP_OBJECT));
+    Loop->Stride = 1;
+    Loop->Schedule = LOOP_SCHEDULE_STATIC;
+    
+    return Loop;
+}
+
+PPARALLELLOOP_OBJECT
+RegisterParallelLoopFunction (
+    PPARALLELLOOP_OBJECT Loop,
+    PSCOPE_CONTEXT Context
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine registers the function the body of a parallel loop is
+    translated to, along with its scope context and instruction queue. The
+    function is named so no identifier can clash with it, and takes the loop
+    index followed by the bound of the iterations it runs, then the locals
+    the body captures. Its address is not known until the function the loop
+    is in is done, so its code pointer starts at zero and only keeps its 
+    size.
+    
+ Arguments:
+ 
+    Loop - Pointer to the parallel loop object.
+    
+    Context - A pointer to the context of the function the loop is in.
+    
+ Return value:
+ 
+    A pointer to the parallel loop object, NULL if out of memory.
+
+*/
+    
+{
+    static unsigned long LoopCount = 0;
+    PIDENTIFIER_OBJECT Function;
+    char* Name;
+    
+    Name = malloc(32);
+    if(Name == NULL) {
+        return NULL;
+    }
+    
+    sprintf(Name, "pfor@%lu", LoopCount);
+    LoopCount = LoopCount + 1;
+    
+    Function = RegisterIdentifier(Name, IDN_TYPE_VOID, Context->GlobalContext);
+    RegisterIdentifierAsFunction(Function, Context->GlobalContext);
+    Loop->Function = Function;
+    Loop->Context = CreateScopeContext(Function, Context->GlobalContext);
+    if(Loop->Context == NULL) {
+        return NULL;
+    }
+    
+    SQueueInitialize(&Loop->Context->Captures);
+    if(Loop->Context->Captures == NULL) {
+        return NULL;
+    }
+    
+    Loop->Context->CodePointer = 0;
+    Loop->Context->ParentContext = Context;
+    Loop->Index = RegisterIdentifierAsParameter(Loop->IndexName, 
+                                                IDN_TYPE_INT32T, 
+                                                Loop->Context);
+                                                
+    Loop->Bound = RegisterIdentifierAsParameter("pfor.bound", 
+                                                IDN_TYPE_INT32T, 
+                                                Loop->Context);
+                                                
+    if(RegisterParameterToIdentifier(Function, Loop->Index) == NULL ||
+       RegisterParameterToIdentifier(Function, Loop->Bound) == NULL) {
+        return NULL;
+    }
+    
+    SQueueInitialize(&Loop->InstructionQueue);
+    if(Loop->InstructionQueue == NULL) {
+        return NULL;
+    }
+    
+    return Loop;
+}
+
 int
 InitializeRegisters (
     void
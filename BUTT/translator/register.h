@@ -33,6 +33,7 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        Parallel loops, their bodies capture locals
 
 **/
 
@@ -131,6 +132,12 @@ RegisterIdentifierAsParameter (
     PSCOPE_CONTEXT Context
     );
 
+PIDENTIFIER_OBJECT
+RegisterIdentifierAsCapture (
+    PIDENTIFIER_OBJECT Identifier, 
+    PSCOPE_CONTEXT Context
+    );
+
 POPERATOR_OBJECT
 RegisterOperator (
     OPR_TYPE Opr
@@ -174,6 +181,21 @@ CleanIoObject (
     PIO_OBJECT IoObject
     );
 
+//
+// Parallel loops
+//
+
+PPARALLELLOOP_OBJECT
+RegisterParallelLoop (
+    void
+    );
+    
+PPARALLELLOOP_OBJECT
+RegisterParallelLoopFunction (
+    PPARALLELLOOP_OBJECT Loop,
+    PSCOPE_CONTEXT Context
+    );
+
 //
 // Registers
 //
@@ -34,6 +34,14 @@
  Revision:
  
     11/17/15        Initial Creation
+    10/17/26        C backend
+    10/17/26        Atomic read-modify-write and compare and swap
+    10/17/26        Parallel calls in expressions, thread joins, cleared thread locals
+    10/17/26        Parallel loops
+    10/17/26        Reduction variables
+    10/17/26        Barriers
+    10/17/26        Channels
+    10/17/26        Single channels
 
 **/
 
@@ -52,6 +60,7 @@
 #include "register.h"
 #include "generator.h"
 #include "program.h"
+#include "cemit.h"
 #include "debug.h"
 #include "errors.h"
 
@@ -75,7 +84,12 @@ FILE* _NUL;
 extern int yyerror(char *err);
 
 OPR_TYPE GOperatorStore[] = { 
-    OPR_TYPE_STR 
+    OPR_TYPE_STR,
+    OPR_TYPE_ADDSTR,
+    OPR_TYPE_SUBSTR,
+    OPR_TYPE_ORSTR,
+    OPR_TYPE_ANDSTR,
+    OPR_TYPE_XORSTR
     };
     
 OPR_TYPE GOperatorLog1[] = { 
@@ -144,6 +158,14 @@ PINSTRUCTION GLastCallInstruction = NULL;
 
 PIO_OBJECT GCurrentIoObject = NULL;
 
+//
+// Parallel loops being parsed, innermost on top, and the ones whose bodies
+// are done but not yet put after the function they are in.
+//
+
+PSSTACK GParallelLoopStack = NULL;
+PSQUEUE GPendingLoopQueue = NULL;
+
 //
 // Symbol to export
 //
@@ -171,6 +193,8 @@ unsigned long GMainAddress = 0;
 %token<String> TIDENTIFIER;
 
 %type<ConstantObjType> DataType;
+%type<Int> ReduceOperator;
+%type<Int> ChannelKind;
 
 // KEYWORDS
 
@@ -188,6 +212,14 @@ unsigned long GMainAddress = 0;
 %token<String> TKSYNC
 %token<String> TKASYNC
 %token<String> TKATOMIC
+%token<String> TKCAS
+%token<String> TKPFOR
+%token<String> TKREDUCE
+%token<String> TKBARRIER
+%token<String> TKWAIT
+%token<String> TKCHANNEL
+%token<String> TKSEND
+%token<String> TKRECV
 
 /* Data types */
 %token<String> TKVOID
@@ -215,6 +247,13 @@ unsigned long GMainAddress = 0;
 %token<String> TKLEQ
 %token<String> TKGEQ
 
+/* Read-modify-write two char tokens */
+%token<String> TKADDASS
+%token<String> TKSUBASS
+%token<String> TKORASS
+%token<String> TKANDASS
+%token<String> TKXORASS
+
 %start Prg
 
 %%
@@ -342,6 +381,15 @@ FuncDecl:
             (GCurrentContext->CodePointer - GGlobalContext->CodePointer);// + PROGRAM_CODE_ALIGNMENT;
         DestroyScopeContext(GCurrentContext);
         GCurrentContext = GGlobalContext;
+        
+        //
+        // The bodies of the parallel loops in the function go right after it.
+        //
+        
+        GenerateParallelLoopBodies(GPendingLoopQueue,
+                                   GInstructionQueue,
+                                   GFunctionSymbolQueue,
+                                   GGlobalContext);
     }
     ;
     
@@ -519,7 +567,8 @@ FuncCallPllSub2: /* empty */
     | 
     TKASYNC
     {
-        GenerateFunctionCallPatchParallelAsync(GLastCallInstruction);
+        GenerateFunctionCallPatchParallelAsync(GLastCallInstruction,
+                                               GCurrentExpressionOperandStack);
     }
     ;
     
@@ -545,9 +594,148 @@ VarDeclHdrAtomic:
         SStackPush(GCurrentIdentifierStack, Identifier);
     }
     
+/*
+ A reduction variable is an atomic global every thread of the VM but the first
+ keeps a copy of. Updates go to the copy, which is folded into the variable
+ with the operator when the thread finishes or a parallel loop it runs is done.
+ Min and max aren't keywords, and their updates are plain stores.
+*/
+
+ReduceOperator: '+'     { $$ = OPR_TYPE_ADDSTR; }
+    | '|'               { $$ = OPR_TYPE_ORSTR; }
+    | '&'               { $$ = OPR_TYPE_ANDSTR; }
+    | '^'               { $$ = OPR_TYPE_XORSTR; }
+    | TIDENTIFIER
+    {
+        if(strcmp($1, "min") == 0) {
+            $$ = OPR_TYPE_MINSTR;
+        } else if(strcmp($1, "max") == 0) {
+            $$ = OPR_TYPE_MAXSTR;
+        } else {
+            yyerror(ERR_STR_REDUCENAME);
+        }
+    }
+    ;
+    
+VarDeclHdrReduce:
+    TKREDUCE
+    '('
+    ReduceOperator
+    ')'
+    DataType
+    TIDENTIFIER
+    {
+        PIDENTIFIER_OBJECT Identifier;
+        
+        if(GCurrentContext != GGlobalContext || $5 >= IDN_TYPE_FLOATT) {
+            yyerror(ERR_STR_REDUCEGLOBAL);
+        }
+        
+        if(($3 == OPR_TYPE_MINSTR || $3 == OPR_TYPE_MAXSTR) && 
+           $5 != IDN_TYPE_INT32T) {
+           
+            yyerror(ERR_STR_REDUCEMINMAX);
+        }
+        
+        if(CheckIdentifierExists($6, GCurrentContext) != 0) {
+            yyerror(ERR_STR_REDECLARED);
+        }
+        
+        Identifier = RegisterIdentifier($6, $5, GCurrentContext);
+        if(Identifier == NULL) {
+            yyerror(ERR_STR_NOMEM);
+        }
+        
+        Identifier = RegisterIdentifierAsVariable(Identifier, 1, GCurrentContext);
+        Identifier->Reduction = (OPR_TYPE)$3;
+        SStackPush(GCurrentIdentifierStack, Identifier);
+    }
+    
+/*
+ A barrier is an atomic global holding the count of threads that meet at it.
+ The VM keeps the threads that have arrived apart from the variable.
+*/
+
+VarDeclHdrBarrier:
+    TKBARRIER
+    TIDENTIFIER
+    {
+        PIDENTIFIER_OBJECT Identifier;
+        
+        if(GCurrentContext != GGlobalContext) {
+            yyerror(ERR_STR_BARRIERGLOBAL);
+        }
+        
+        if(CheckIdentifierExists($2, GCurrentContext) != 0) {
+            yyerror(ERR_STR_REDECLARED);
+        }
+        
+        Identifier = RegisterIdentifier($2, IDN_TYPE_INT32T, GCurrentContext);
+        if(Identifier == NULL) {
+            yyerror(ERR_STR_NOMEM);
+        }
+        
+        Identifier = RegisterIdentifierAsVariable(Identifier, 1, GCurrentContext);
+        Identifier->IsBarrier = 1;
+        SStackPush(GCurrentIdentifierStack, Identifier);
+    }
+    
+/*
+ A channel is an atomic global standing for a bounded queue the VM keeps, the
+ size of the queue being declared like the size of an array. A channel
+ declared single promises that one thread at a time sends to it and one 
+ receives from it, which lets the VM skip the compare and swap on its ends.
+ Single isn't a keyword.
+*/
+
+ChannelKind: /* empty */    { $$ = 0; }
+    | '(' TIDENTIFIER ')'
+    {
+        if(strcmp($2, "single") != 0) {
+            yyerror(ERR_STR_CHANNELKIND);
+        }
+        
+        $$ = 1;
+    }
+    ;
+    
+VarDeclHdrChannel:
+    TKCHANNEL
+    ChannelKind
+    DataType
+    TIDENTIFIER
+    {
+        PIDENTIFIER_OBJECT Identifier;
+        
+        if(GCurrentContext != GGlobalContext || 
+           ($3 != IDN_TYPE_INT32T && $3 != IDN_TYPE_UINT32T)) {
+            yyerror(ERR_STR_CHANNELGLOBAL);
+        }
+        
+        if(CheckIdentifierExists($4, GCurrentContext) != 0) {
+            yyerror(ERR_STR_REDECLARED);
+        }
+        
+        Identifier = RegisterIdentifier($4, $3, GCurrentContext);
+        if(Identifier == NULL) {
+            yyerror(ERR_STR_NOMEM);
+        }
+        
+        Identifier = RegisterIdentifierAsVariable(Identifier, 1, GCurrentContext);
+        Identifier->IsChannel = 1;
+        Identifier->ChannelSingle = $2;
+        SStackPush(GCurrentIdentifierStack, Identifier);
+    }
+    
 VarDeclHdr:
     VarDeclHdrAtomic
     |
+    VarDeclHdrReduce
+    |
+    VarDeclHdrBarrier
+    |
+    VarDeclHdrChannel
+    |
     FuncVarDeclHdr
     {
         PIDENTIFIER_OBJECT Identifier;
@@ -573,7 +761,18 @@ VarDeclSub1:
     ;
 
 VarDeclSub2: /* empty */ 
-    { }
+    { 
+        PIDENTIFIER_OBJECT CurrentIdentifier;
+        
+        CurrentIdentifier = SStackTop(GCurrentIdentifierStack);
+        if(CurrentIdentifier->IsChannel) {
+            yyerror(ERR_STR_CHANNELSIZE);
+        }
+        
+        GenerateThreadDeclaration(CurrentIdentifier, 
+                                  GInstructionQueue, 
+                                  GCurrentContext);
+    }
     | 
     '[' TINT ']' 
     {
@@ -584,11 +783,27 @@ VarDeclSub2: /* empty */
         }
         
         CurrentIdentifier = SStackTop(GCurrentIdentifierStack);
-        if(CurrentIdentifier->IsAtomic) {
-            yyerror(ERR_STR_NOATOMICARR);
-        }
+        if(CurrentIdentifier->IsChannel) {
         
-        RegisterArrayToIdentifier(CurrentIdentifier, $2, GCurrentContext);
+            //
+            // The values of a channel live in the VM, not in the variable.
+            //
+            
+            if($2 > CHANNEL_MAX_SIZE) {
+                yyerror(ERR_STR_CHANNELSIZE);
+            }
+            
+            CurrentIdentifier->ChannelSize = $2;
+        } else {
+            if(CurrentIdentifier->IsAtomic) {
+                yyerror(ERR_STR_NOATOMICARR);
+            }
+            
+            RegisterArrayToIdentifier(CurrentIdentifier, $2, GCurrentContext);
+            GenerateThreadDeclaration(CurrentIdentifier, 
+                                      GInstructionQueue, 
+                                      GCurrentContext);
+        }
     }
     ;
     
@@ -613,6 +828,10 @@ VarDeclSub3: /* empty */
                                                      CurrentIdentifier->IsAtomic,
                                                      GCurrentContext);
         
+        NewIdentifier->Reduction = CurrentIdentifier->Reduction;
+        NewIdentifier->IsBarrier = CurrentIdentifier->IsBarrier;
+        NewIdentifier->IsChannel = CurrentIdentifier->IsChannel;
+        NewIdentifier->ChannelSingle = CurrentIdentifier->ChannelSingle;
         SStackPush(GCurrentIdentifierStack, NewIdentifier);
     }
     VarDeclSub1
@@ -634,17 +853,6 @@ BlockSub2: /* empty */
     ;
     
 BlockBody: VarDecl
-    | 
-    FuncCallPll ';' 
-    {
-        PIDENTIFIER_OBJECT ReturnIdentifier;
-        
-        assert(SStackSize(GCurrentExpressionOperandStack) == 1);
-        assert(SStackSize(GCurrentExpressionOperatorStack) == 0);
-        
-        ReturnIdentifier = SStackPop(GCurrentExpressionOperandStack);
-        DereferenceRegister(ReturnIdentifier);
-    }
     |
     Exp 
     ';'
@@ -654,7 +862,12 @@ BlockBody: VarDecl
                                                   GInstructionQueue,
                                                   GCurrentContext);
         
-        SStackPop(GCurrentExpressionOperandStack);
+        //
+        // A parallel call made as a statement of its own is never joined.
+        //
+        
+        GenerateFunctionCallDropFuture(SStackPop(GCurrentExpressionOperandStack),
+                                       GLastCallInstruction);
         
         //
         // I think at this point we should be able to clear all working
@@ -665,9 +878,12 @@ BlockBody: VarDecl
     }
     | Cond
     | FLoop
+    | PLoop
     | WLoop
     | Return
     | IO ';'
+    | Wait ';'
+    | Send ';'
     
 /* I/O */
 
@@ -720,6 +936,10 @@ IoRead:
             yyerror(ERR_STR_UNDECLARED);
         }
         
+        if(Identifier->IsChannel) {
+            yyerror(ERR_STR_CHANNELUSE);
+        }
+        
         GenerateIoAddReadIdentifier(GCurrentIoObject, 
                                     Identifier, 
                                     GInstructionQueue,
@@ -745,6 +965,10 @@ IoReadSub1: /* empty */
             yyerror(ERR_STR_UNDECLARED);
         }
         
+        if(Identifier->IsChannel) {
+            yyerror(ERR_STR_CHANNELUSE);
+        }
+        
         GenerateIoAddReadIdentifier(GCurrentIoObject, 
                                     Identifier, 
                                     GInstructionQueue,
@@ -752,6 +976,66 @@ IoReadSub1: /* empty */
     }
     IoReadSub1
     
+/* Barrier wait */
+
+Wait:
+    TKWAIT
+    '('
+    TIDENTIFIER
+    ')'
+    {
+        PIDENTIFIER_OBJECT Identifier;
+        
+        Identifier = GetDeclaredIdentifier($3, GCurrentContext);
+        if(Identifier == NULL) {
+            yyerror(ERR_STR_UNDECLARED);
+        }
+        
+        if(Identifier->IsBarrier == 0) {
+            yyerror(ERR_STR_NOTBARRIER);
+        }
+        
+        GenerateBarrierWait(Identifier, GInstructionQueue, GCurrentContext);
+    }
+    
+/* Channel send */
+
+Send:
+    TKSEND
+    '('
+    TIDENTIFIER
+    ','
+    {
+        //
+        // The value gets an LPAREN as a stopper, like call parameters do.
+        //
+        
+        SStackPush(GCurrentExpressionOperatorStack, 
+                   RegisterOperator(OPR_TYPE_LPAREN));
+    }
+    Exp
+    ')'
+    {
+        PIDENTIFIER_OBJECT Identifier;
+        
+        Identifier = GetDeclaredIdentifier($3, GCurrentContext);
+        if(Identifier == NULL) {
+            yyerror(ERR_STR_UNDECLARED);
+        }
+        
+        if(Identifier->IsChannel == 0) {
+            yyerror(ERR_STR_NOTCHANNEL);
+        }
+        
+        GenerateChannelSend(Identifier,
+                            GCurrentExpressionOperandStack,
+                            GCurrentExpressionOperatorStack,
+                            GInstructionQueue,
+                            GCurrentContext);
+        
+        FreeAllRegisters( );
+    }
+    
 /* Function return */
     
 Return: 
@@ -759,6 +1043,10 @@ Return:
     Exp 
     ';'
     {
+        if(SStackSize(GParallelLoopStack) > 0) {
+            yyerror(ERR_STR_PFORRETURN);
+        }
+        
         GenerateFunctionReturn(GCurrentExpressionOperandStack,
                                GCurrentExpressionOperatorStack,
                                GPendingReturnJumpsStack,
@@ -879,6 +1167,157 @@ FLoopSub1: /* empty */
     | Exp
     ;
     
+PLoop:
+    TKPFOR
+    '('
+    TIDENTIFIER
+    '='
+    {
+        PPARALLELLOOP_OBJECT Loop;
+        
+        Loop = RegisterParallelLoop( );
+        if(Loop == NULL) {
+            yyerror(ERR_STR_NOMEM);
+        }
+        
+        Loop->IndexName = $3;
+        SStackPush(GParallelLoopStack, Loop);
+    }
+    Exp
+    ';'
+    {
+        //
+        // Start
+        //
+        
+        GenerateParallelLoopPushValue(GCurrentExpressionOperandStack,
+                                      GCurrentExpressionOperatorStack,
+                                      GInstructionQueue,
+                                      GCurrentContext);
+    }
+    TIDENTIFIER
+    '<'
+    Exp
+    ';'
+    {
+        //
+        // Bound
+        //
+        
+        PPARALLELLOOP_OBJECT Loop = SStackTop(GParallelLoopStack);
+        if(strcmp($9, Loop->IndexName) != 0) {
+            yyerror(ERR_STR_PFORFORM);
+        }
+        
+        GenerateParallelLoopPushValue(GCurrentExpressionOperandStack,
+                                      GCurrentExpressionOperatorStack,
+                                      GInstructionQueue,
+                                      GCurrentContext);
+    }
+    TIDENTIFIER
+    PLoopStep
+    ')'
+    PLoopSchedule
+    {
+        PPARALLELLOOP_OBJECT Loop = SStackTop(GParallelLoopStack);
+        if(strcmp($14, Loop->IndexName) != 0) {
+            yyerror(ERR_STR_PFORFORM);
+        }
+        
+        GenerateParallelLoopStart(Loop,
+                                  GPendingInstructionStack,
+                                  GCurrentInstructionCountStack,
+                                  GInstructionQueue,
+                                  GCurrentContext);
+        
+        //
+        // The body is parsed into a function of its own.
+        //
+        
+        GInstructionQueue = Loop->InstructionQueue;
+        GCurrentContext = Loop->Context;
+    }
+    Block
+    {
+        PPARALLELLOOP_OBJECT Loop = SStackPop(GParallelLoopStack);
+        
+        GenerateParallelLoopEnd(Loop,
+                                GPendingInstructionStack,
+                                GCurrentInstructionCountStack,
+                                GPendingReturnJumpsStack,
+                                GPendingReturnInstructionCountStack);
+        
+        GInstructionQueue = Loop->ParentInstructionQueue;
+        GCurrentContext = Loop->ParentContext;
+        SQueuePush(GPendingLoopQueue, Loop);
+    }
+    ;
+    
+PLoopStep:
+    '='
+    TIDENTIFIER
+    '+'
+    TINT
+    {
+        PPARALLELLOOP_OBJECT Loop = SStackTop(GParallelLoopStack);
+        if(strcmp($2, Loop->IndexName) != 0 || $4 <= 0) {
+            yyerror(ERR_STR_PFORFORM);
+        }
+        
+        Loop->Stride = $4;
+    }
+    |
+    TKADDASS
+    TINT
+    {
+        PPARALLELLOOP_OBJECT Loop = SStackTop(GParallelLoopStack);
+        if($2 <= 0) {
+            yyerror(ERR_STR_PFORFORM);
+        }
+        
+        Loop->Stride = $2;
+    }
+    ;
+    
+PLoopSchedule: /* empty */
+    |
+    TKAS
+    TIDENTIFIER
+    PLoopChunk
+    {
+        PPARALLELLOOP_OBJECT Loop = SStackTop(GParallelLoopStack);
+        
+        //
+        // The schedules aren't keywords, so they remain free to name 
+        // variables with.
+        //
+        
+        if(strcmp($2, "static") == 0) {
+            Loop->Schedule = LOOP_SCHEDULE_STATIC;
+        } else if(strcmp($2, "dynamic") == 0) {
+            Loop->Schedule = LOOP_SCHEDULE_DYNAMIC;
+        } else if(strcmp($2, "guided") == 0) {
+            Loop->Schedule = LOOP_SCHEDULE_GUIDED;
+        } else {
+            yyerror(ERR_STR_PFORSCHEDULE);
+        }
+    }
+    ;
+    
+PLoopChunk: /* empty */
+    |
+    '('
+    TINT
+    ')'
+    {
+        if($2 <= 0) {
+            yyerror(ERR_STR_PFORCHUNK);
+        }
+        
+        ((PPARALLELLOOP_OBJECT)SStackTop(GParallelLoopStack))->Chunk = $2;
+    }
+    ;
+    
 WLoop: 
     TKWHILE 
     {
@@ -1054,6 +1493,36 @@ ExpOpAss:
         SStackPush(GCurrentExpressionOperatorStack, 
                    RegisterOperator(OPR_TYPE_STR));
     }
+    | 
+    TKADDASS
+    {
+        SStackPush(GCurrentExpressionOperatorStack, 
+                   RegisterOperator(OPR_TYPE_ADDSTR));
+    }
+    | 
+    TKSUBASS
+    {
+        SStackPush(GCurrentExpressionOperatorStack, 
+                   RegisterOperator(OPR_TYPE_SUBSTR));
+    }
+    | 
+    TKORASS
+    {
+        SStackPush(GCurrentExpressionOperatorStack, 
+                   RegisterOperator(OPR_TYPE_ORSTR));
+    }
+    | 
+    TKANDASS
+    {
+        SStackPush(GCurrentExpressionOperatorStack, 
+                   RegisterOperator(OPR_TYPE_ANDSTR));
+    }
+    | 
+    TKXORASS
+    {
+        SStackPush(GCurrentExpressionOperatorStack, 
+                   RegisterOperator(OPR_TYPE_XORSTR));
+    }
     ;
     
 ExpOpLog1: 
@@ -1303,6 +1772,68 @@ ExpPrio7:
     | 
     FuncCall
     | 
+    FuncCallPll
+    | 
+    TKCAS
+    '('
+    TIDENTIFIER
+    ','
+    {
+        //
+        // cas(Variable, Expected, Desired) evaluates to the old value of the
+        // variable. Each value gets an LPAREN as a stopper, like call
+        // parameters do.
+        //
+        
+        SStackPush(GCurrentExpressionOperatorStack, 
+                   RegisterOperator(OPR_TYPE_LPAREN));
+    }
+    Exp
+    ','
+    {
+        GenerateAtomicCompareSwapExpected(GCurrentExpressionOperandStack,
+                                          GCurrentExpressionOperatorStack,
+                                          GInstructionQueue,
+                                          GCurrentContext);
+        
+        SStackPush(GCurrentExpressionOperatorStack, 
+                   RegisterOperator(OPR_TYPE_LPAREN));
+    }
+    Exp
+    ')'
+    {
+        PIDENTIFIER_OBJECT Variable = GetDeclaredIdentifier($3, GCurrentContext);
+        if(Variable == NULL) {
+            yyerror(ERR_STR_UNDECLARED);
+        }
+        
+        GenerateAtomicCompareSwap(Variable,
+                                  GCurrentExpressionOperandStack,
+                                  GCurrentExpressionOperatorStack,
+                                  GInstructionQueue,
+                                  GCurrentContext);
+    }
+    | 
+    TKRECV
+    '('
+    TIDENTIFIER
+    ')'
+    {
+        PIDENTIFIER_OBJECT Channel = GetDeclaredIdentifier($3, GCurrentContext);
+        if(Channel == NULL) {
+            yyerror(ERR_STR_UNDECLARED);
+        }
+        
+        if(Channel->IsChannel == 0) {
+            yyerror(ERR_STR_NOTCHANNEL);
+        }
+        
+        GenerateChannelReceive(Channel,
+                               GCurrentExpressionOperandStack,
+                               GInstructionQueue,
+                               GCurrentContext);
+    }
+    | 
     TIDENTIFIER
     {
         PIDENTIFIER_OBJECT Identifier = GetDeclaredIdentifier($1, GCurrentContext);
@@ -1310,6 +1841,10 @@ ExpPrio7:
             yyerror(ERR_STR_UNDECLARED);
         }
         
+        if(Identifier->IsChannel) {
+            yyerror(ERR_STR_CHANNELUSE);
+        }
+        
         SStackPush(GCurrentExpressionOperandStack, Identifier);
     }
     ExpPrio7Sub1
@@ -1361,6 +1896,7 @@ int main(int argc, char** argv) {
     
     FILE *SourceFile;
     FILE *CompileFile;
+    int EmitC;
     
 #ifndef COMPILE_VERBOSE
     _NUL = fopen("nul", "w");
@@ -1373,10 +1909,16 @@ int main(int argc, char** argv) {
     // Open the source and compile files. No real point doing the work if we
     // can't open either of them right?
     //
-    // Also, it would be nice if we had a command line parser.
+    // Also, it would be nice if we had a command line parser. Until then -c 
+    // is the only option, it emits the program as C into out.c.
     //
     
-    ProgramOpenInputOutputFiles("src.ut", "out.cut", &SourceFile, &CompileFile);
+    EmitC = (argc > 1 && strcmp(argv[1], "-c") == 0);
+    ProgramOpenInputOutputFiles("src.ut", 
+                                EmitC ? "out.c" : "out.cut", 
+                                &SourceFile, 
+                                &CompileFile);
+
     if(SourceFile == NULL) {
         yyerror(ERR_STR_FILEINOPEN); 
     }
@@ -1402,6 +1944,8 @@ int main(int argc, char** argv) {
     SStackInitialize(&GCurrentFunctionCallStack);
     SQueueInitialize(&GInstructionQueue);
     SQueueInitialize(&GFunctionSymbolQueue);
+    SStackInitialize(&GParallelLoopStack);
+    SQueueInitialize(&GPendingLoopQueue);
     GCurrentIoObject = RegisterIoObject( );
     if(GGlobalContext == NULL                   || 
        GCurrentIdentifierStack == NULL          ||
@@ -1414,6 +1958,8 @@ int main(int argc, char** argv) {
        GCurrentFunctionCallStack == NULL        ||
        GInstructionQueue == NULL                ||
        GFunctionSymbolQueue == NULL             ||
+       GParallelLoopStack == NULL               ||
+       GPendingLoopQueue == NULL                ||
        GCurrentIoObject == NULL) {
            
         yyerror(ERR_STR_NOMEM);
@@ -1450,10 +1996,21 @@ int main(int argc, char** argv) {
                                     GMainAddress,
                                     GGlobalContext);
     
-    ProgramSerializeCode(CompileFile, 
-                         GInstructionQueue,
-                         GFunctionSymbolQueue,
-                         GGlobalContext);
+    if(EmitC != 0) {
+        if(CEmitProgram(CompileFile, 
+                        GInstructionQueue,
+                        GFunctionSymbolQueue,
+                        GGlobalContext) != 0) {
+                        
+            yyerror(ERR_STR_CEMITFAIL);
+        }
+        
+    } else {
+        ProgramSerializeCode(CompileFile, 
+                             GInstructionQueue,
+                             GFunctionSymbolQueue,
+                             GGlobalContext);
+    }
                          
 #ifndef COMPILE_VERBOSE
     fclose(_NUL);
@@ -0,0 +1,1046 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    decode.c
+
+ Abstract:
+
+    This module implements the load time decoding of the 64 bit instruction
+    encoding into the native width instruction stream the interpreter runs
+    from.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Stack operands are window offsets
+    10/17/26        Atomic loads
+    10/17/26        Atomic read-modify-write
+    10/17/26        Thread joins and futures, thread stores keep their handler
+    10/17/26        Parallel loops
+    10/17/26        Reductions
+    10/17/26        Barriers
+    10/17/26        Channels
+    10/17/26        Single channels
+
+**/
+
+#include "decode.h"
+#include "program.h"
+#include "error.h"
+#include <windows.h>
+#include <malloc.h>
+#include <string.h>
+
+VOID
+DecodeOperand (
+    PPROGRAM Program,
+    ULONG Register,
+    LONG RegisterOffset,
+    BOOL Writable,
+    PDECODED_OPERAND Operand
+    )
+
+/*
+
+ Routine description:
+
+    This routine classifies a register/offset operand pair into an operand
+    kind, folding in whatever can be computed ahead of time.
+
+ Arguments:
+
+    Program - The program being decoded.
+
+    Register - The operand register.
+
+    RegisterOffset - The operand register offset.
+
+    Writable - TRUE if the operand is the destination of the instruction.
+
+    Operand - Pointer receiving the decoded operand.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    if(Register >= REG_MAX) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+
+    Operand->Register = Register;
+    Operand->Reserved = 0;
+
+    if(Register == REG_RGD) {
+        Operand->Kind = OPERAND_KIND_GLOBAL;
+        Operand->Offset = RegisterOffset;
+
+    } else if(IS_REGISTER_INDEX(Register)) {
+
+        //
+        // Index registers hold VM addresses, which are offsets into the
+        // window of the executing thread.
+        //
+
+        Operand->Kind = OPERAND_KIND_STACK;
+        Operand->Offset = RegisterOffset;
+
+    } else if(Register == REG_RCT) {
+        if(Writable != FALSE) {
+            VmFatal(ERR_STR_INVALIDINSTR);
+        }
+
+        Operand->Kind = OPERAND_KIND_CONSTANT;
+        Operand->Offset = RegisterOffset;
+
+    } else {
+        Operand->Kind = OPERAND_KIND_REGISTER;
+        Operand->Offset = 0;
+    }
+}
+
+VOID
+DecodeRegister (
+    ULONG Register,
+    PDECODED_OPERAND Operand
+    )
+
+/*
+
+ Routine description:
+
+    This routine decodes a plain register operand, one whose value is used
+    as is rather than as an index into memory.
+
+ Arguments:
+
+    Register - The operand register.
+
+    Operand - Pointer receiving the decoded operand.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    if(Register >= REG_MAX) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+
+    Operand->Kind = OPERAND_KIND_REGISTER;
+    Operand->Register = Register;
+    Operand->Reserved = 0;
+    Operand->Offset = 0;
+}
+
+ULONG
+DecodeJumpTarget (
+    PPROGRAM Program,
+    ULONG InstructionIndex,
+    PINSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine resolves the target of a jump or call to an index into the
+    decoded instruction stream.
+
+ Arguments:
+
+    Program - The program being decoded.
+
+    InstructionIndex - Index of the jump or call instruction.
+
+    Instruction - The jump or call instruction.
+
+ Return value:
+
+    The index of the target instruction.
+
+*/
+
+{
+    LONG Rjo;
+    LONG Target;
+
+    Rjo = Instruction->Jump.RegisterOffset;
+    if(Instruction->Jump.Register == REG_RIP) {
+        Target = (LONG)(InstructionIndex * sizeof(INSTRUCTION)) + Rjo;
+    } else if(Instruction->Jump.Register == REG_RCT) {
+        Target = Rjo - (LONG)Program->Header.CodeStart;
+    } else {
+        VmFatal(ERR_STR_INVALIDINSTR);
+        return 0; // Keep the compiler happy.
+    }
+
+    if((Target % (LONG)sizeof(INSTRUCTION)) != 0) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+
+    return (ULONG)(Target / (LONG)sizeof(INSTRUCTION));
+}
+
+ULONG
+DecodeReduction (
+    PPROGRAM Program,
+    PDECODED_OPERAND Variable,
+    ULONG Opcode
+    )
+
+/*
+
+ Routine description:
+
+    This routine looks a reduction variable up in the table of the program,
+    adding it if it isn't there yet. A variable takes updates of only one
+    operator, a sum being updated with RADD and RSUB alike.
+
+ Arguments:
+
+    Program - The program being decoded.
+
+    Variable - The decoded variable operand, which must be a global.
+
+    Opcode - The update opcode.
+
+ Return value:
+
+    The slot of the variable.
+
+*/
+
+{
+    PPROGRAM_REDUCTION Reductions;
+    ULONG i;
+
+    if(Variable->Kind != OPERAND_KIND_GLOBAL) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+
+    if(Opcode == OPC_RSUB) {
+        Opcode = OPC_RADD;
+    }
+
+    for(i=0; i<Program->ReductionCount; ++i) {
+        if(Program->Reductions[i].Offset == Variable->Offset) {
+            break;
+        }
+    }
+
+    if(i == Program->ReductionCount) {
+        Reductions = realloc(Program->Reductions,
+                             (i + 1) * sizeof(PROGRAM_REDUCTION));
+
+        if(Reductions == NULL) {
+            VmFatal(ERR_STR_NOMEM);
+        }
+
+        Reductions[i].Offset = Variable->Offset;
+        Reductions[i].Opcode = Opcode;
+        Program->Reductions = Reductions;
+        Program->ReductionCount = i + 1;
+    }
+
+    if(Program->Reductions[i].Opcode != Opcode) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+
+    return i;
+}
+
+ULONG
+DecodeBarrier (
+    PPROGRAM Program,
+    PDECODED_OPERAND Variable
+    )
+
+/*
+
+ Routine description:
+
+    This routine looks a barrier up in the table of the program, adding it if
+    it isn't there yet.
+
+ Arguments:
+
+    Program - The program being decoded.
+
+    Variable - The decoded barrier operand, which must be a global.
+
+ Return value:
+
+    The slot of the barrier.
+
+*/
+
+{
+    PLONG Barriers;
+    ULONG i;
+
+    if(Variable->Kind != OPERAND_KIND_GLOBAL) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+
+    for(i=0; i<Program->BarrierCount; ++i) {
+        if(Program->Barriers[i] == Variable->Offset) {
+            return i;
+        }
+    }
+
+    Barriers = realloc(Program->Barriers, (i + 1) * sizeof(LONG));
+    if(Barriers == NULL) {
+        VmFatal(ERR_STR_NOMEM);
+    }
+
+    Barriers[i] = Variable->Offset;
+    Program->Barriers = Barriers;
+    Program->BarrierCount = i + 1;
+    return i;
+}
+
+ULONG
+DecodeChannel (
+    PPROGRAM Program,
+    PDECODED_OPERAND Variable,
+    ULONG Capacity,
+    BOOL Single
+    )
+
+/*
+
+ Routine description:
+
+    This routine looks a channel up in the table of the program, adding it if
+    it isn't there yet. Every send and receive on a channel must agree on its
+    capacity and on whether it has a single sender and receiver.
+
+ Arguments:
+
+    Program - The program being decoded.
+
+    Variable - The decoded channel operand, which must be a global.
+
+    Capacity - The number of values the instruction says the channel holds.
+
+    Single - TRUE if the instruction says the channel has a single sender and
+        receiver.
+
+ Return value:
+
+    The slot of the channel.
+
+*/
+
+{
+    PPROGRAM_CHANNEL Channels;
+    ULONG i;
+
+    if(Variable->Kind != OPERAND_KIND_GLOBAL ||
+       Capacity == 0 ||
+       Capacity > CHANNEL_MAX_SIZE) {
+
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+
+    for(i=0; i<Program->ChannelCount; ++i) {
+        if(Program->Channels[i].Offset == Variable->Offset) {
+            if(Program->Channels[i].Capacity != Capacity ||
+               Program->Channels[i].Single != Single) {
+
+                VmFatal(ERR_STR_INVALIDINSTR);
+            }
+
+            return i;
+        }
+    }
+
+    Channels = realloc(Program->Channels, (i + 1) * sizeof(PROGRAM_CHANNEL));
+    if(Channels == NULL) {
+        VmFatal(ERR_STR_NOMEM);
+    }
+
+    Channels[i].Offset = Variable->Offset;
+    Channels[i].Capacity = Capacity;
+    Channels[i].Single = Single;
+    Program->Channels = Channels;
+    Program->ChannelCount = i + 1;
+    return i;
+}
+
+VOID
+DecodeInstruction (
+    PPROGRAM Program,
+    ULONG InstructionIndex,
+    PINSTRUCTION Instruction,
+    PDECODED_INSTRUCTION Decoded
+    )
+
+/*
+
+ Routine description:
+
+    This routine decodes a single 64 bit instruction.
+
+ Arguments:
+
+    Program - The program being decoded.
+
+    InstructionIndex - Index of the instruction in the code section.
+
+    Instruction - The instruction to decode.
+
+    Decoded - Pointer receiving the decoded instruction.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    memset(Decoded, 0, sizeof(DECODED_INSTRUCTION));
+    Decoded->Opcode = Instruction->Opcode;
+    Decoded->BaseOpcode = Instruction->Opcode;
+
+    switch(Instruction->Opcode) {
+        case OPC_ADDI:
+        case OPC_ADDF:
+        case OPC_SUBI:
+        case OPC_SUBF:
+        case OPC_MULI:
+        case OPC_MULF:
+        case OPC_DIVI:
+        case OPC_DIVF:
+        case OPC_XOR:
+        case OPC_OR:
+        case OPC_AND:
+        case OPC_NOT:
+        case OPC_LOR:
+        case OPC_LAND:
+        case OPC_EQ:
+        case OPC_NEQ:
+        case OPC_LT:
+        case OPC_GT:
+        case OPC_LTE:
+        case OPC_GTE:
+            DecodeOperand(Program,
+                          Instruction->Arith.LtRegister,
+                          Instruction->Arith.LtRegisterOffset,
+                          FALSE,
+                          &Decoded->Left);
+
+            DecodeOperand(Program,
+                          Instruction->Arith.RtRegister,
+                          Instruction->Arith.RtRegisterOffset,
+                          FALSE,
+                          &Decoded->Right);
+
+            DecodeOperand(Program,
+                          Instruction->Arith.DtRegister,
+                          Instruction->Arith.DtRegisterOffset,
+                          TRUE,
+                          &Decoded->Destination);
+
+            if(Instruction->Arith.AtomicLoad != 0) {
+                Decoded->Flags |= DECODED_FLAG_ATOMIC_LOAD;
+            }
+
+            break;
+
+        case OPC_AADD:
+        case OPC_ASUB:
+        case OPC_AOR:
+        case OPC_AAND:
+        case OPC_AXOR:
+        case OPC_ACAS:
+            DecodeOperand(Program,
+                          Instruction->Arith.LtRegister,
+                          Instruction->Arith.LtRegisterOffset,
+                          TRUE,
+                          &Decoded->Left);
+
+            DecodeOperand(Program,
+                          Instruction->Arith.RtRegister,
+                          Instruction->Arith.RtRegisterOffset,
+                          FALSE,
+                          &Decoded->Right);
+
+            DecodeOperand(Program,
+                          Instruction->Arith.DtRegister,
+                          Instruction->Arith.DtRegisterOffset,
+                          TRUE,
+                          &Decoded->Destination);
+
+            //
+            // The variable is in memory and the result goes to a register.
+            // Compare and swap reads the expected value from that register
+            // as well.
+            //
+
+            if((Decoded->Left.Kind != OPERAND_KIND_GLOBAL &&
+                Decoded->Left.Kind != OPERAND_KIND_STACK) ||
+               Decoded->Destination.Kind != OPERAND_KIND_REGISTER) {
+
+                VmFatal(ERR_STR_INVALIDINSTR);
+            }
+
+            Decoded->Flags |= DECODED_FLAG_ATOMIC_STORE;
+            if(Instruction->Arith.AtomicLoad != 0) {
+                Decoded->Flags |= DECODED_FLAG_ATOMIC_LOAD;
+            }
+
+            break;
+
+        case OPC_RADD:
+        case OPC_RSUB:
+        case OPC_ROR:
+        case OPC_RAND:
+        case OPC_RXOR:
+        case OPC_RMIN:
+        case OPC_RMAX:
+            DecodeOperand(Program,
+                          Instruction->Arith.LtRegister,
+                          Instruction->Arith.LtRegisterOffset,
+                          TRUE,
+                          &Decoded->Left);
+
+            DecodeOperand(Program,
+                          Instruction->Arith.RtRegister,
+                          Instruction->Arith.RtRegisterOffset,
+                          FALSE,
+                          &Decoded->Right);
+
+            DecodeOperand(Program,
+                          Instruction->Arith.DtRegister,
+                          Instruction->Arith.DtRegisterOffset,
+                          TRUE,
+                          &Decoded->Destination);
+
+            if(Decoded->Destination.Kind != OPERAND_KIND_REGISTER) {
+                VmFatal(ERR_STR_INVALIDINSTR);
+            }
+
+            Decoded->Slot = DecodeReduction(Program,
+                                            &Decoded->Left,
+                                            Instruction->Opcode);
+
+            Decoded->Flags |= DECODED_FLAG_ATOMIC_STORE;
+            if(Instruction->Arith.AtomicLoad != 0) {
+                Decoded->Flags |= DECODED_FLAG_ATOMIC_LOAD;
+            }
+
+            break;
+
+        case OPC_JOIN:
+            DecodeOperand(Program,
+                          Instruction->Arith.LtRegister,
+                          Instruction->Arith.LtRegisterOffset,
+                          FALSE,
+                          &Decoded->Left);
+
+            DecodeOperand(Program,
+                          Instruction->Arith.RtRegister,
+                          Instruction->Arith.RtRegisterOffset,
+                          FALSE,
+                          &Decoded->Right);
+
+            DecodeOperand(Program,
+                          Instruction->Arith.DtRegister,
+                          Instruction->Arith.DtRegisterOffset,
+                          TRUE,
+                          &Decoded->Destination);
+
+            //
+            // The translator always joins into a working register.
+            //
+
+            if(Decoded->Destination.Kind != OPERAND_KIND_REGISTER) {
+                VmFatal(ERR_STR_INVALIDINSTR);
+            }
+
+            if(Instruction->Arith.AtomicLoad != 0) {
+                Decoded->Flags |= DECODED_FLAG_ATOMIC_LOAD;
+            }
+
+            break;
+
+        case OPC_MOVE:
+            VmFatal(ERR_STR_ONLYRCOPYD);
+            break;
+
+        case OPC_RCOPYD:
+            DecodeRegister(Instruction->Indirect.LtRegister, &Decoded->Left);
+            if(Instruction->Indirect.LtOffsetType == INDIRECT_OFFSET_TYPE_CONSTANT) {
+                Decoded->Right.Kind = OPERAND_KIND_CONSTANT;
+                Decoded->Right.Register = REG_RCT;
+                Decoded->Right.Offset = Instruction->Indirect.LtOffset;
+            } else {
+                DecodeRegister(Instruction->Indirect.LtOffset, &Decoded->Right);
+            }
+
+            DecodeRegister(Instruction->Indirect.DtRegister,
+                           &Decoded->Destination);
+
+            break;
+
+        case OPC_STRI8:
+        case OPC_STRU8:
+        case OPC_STRI16:
+        case OPC_STRU16:
+        case OPC_STRI32:
+        case OPC_STRU32:
+        case OPC_STRF:
+        case OPC_STRTH:
+            switch(Instruction->Opcode) {
+                case OPC_STRI8:
+                case OPC_STRU8:
+                    Decoded->StoreShift = 24;
+                    break;
+
+                case OPC_STRI16:
+                case OPC_STRU16:
+                    Decoded->StoreShift = 16;
+                    break;
+
+                default:
+                    Decoded->StoreShift = 0;
+                    break;
+            }
+
+            if(Instruction->Store.AtomicStore != 0) {
+                Decoded->Flags |= DECODED_FLAG_ATOMIC_STORE;
+            }
+
+            if(Instruction->Store.AtomicLoad != 0) {
+                Decoded->Flags |= DECODED_FLAG_ATOMIC_LOAD;
+            }
+
+            DecodeOperand(Program,
+                          Instruction->Store.RtRegister,
+                          Instruction->Store.RtRegisterOffset,
+                          FALSE,
+                          &Decoded->Right);
+
+            DecodeOperand(Program,
+                          Instruction->Store.DtRegister,
+                          Instruction->Store.DtRegisterOffset,
+                          TRUE,
+                          &Decoded->Destination);
+
+            break;
+
+        case OPC_JMP:
+        case OPC_JMPZ:
+        case OPC_CALLNORM:
+        case OPC_CALLPLLS:
+        case OPC_CALLPLLA:
+        case OPC_PFOR:
+            Decoded->Target = DecodeJumpTarget(Program,
+                                               InstructionIndex,
+                                               Instruction);
+
+            //
+            // The jump type decides whether the jump is conditional, not the
+            // opcode, so normalize on the opcode here.
+            //
+
+            if(Instruction->Jump.JumpType == JUMP_TYPE_CONDITIONAL) {
+                if(IS_REGISTER_INDEX(Instruction->Jump.ZeroRegister) ||
+                   Instruction->Opcode == OPC_PFOR) {
+                    VmFatal(ERR_STR_INVALIDINSTR);
+                }
+
+                Decoded->Opcode = OPC_JMPZ;
+                Decoded->BaseOpcode = OPC_JMPZ;
+                DecodeRegister(Instruction->Jump.ZeroRegister, &Decoded->Left);
+
+                //
+                // Loops without a condition test RIP, which is never zero.
+                // The interpreter keeps RIP out of the register set, so turn
+                // these into a jump to the next instruction.
+                //
+
+                if(Instruction->Jump.ZeroRegister == REG_RIP) {
+                    Decoded->Opcode = OPC_JMP;
+                    Decoded->BaseOpcode = OPC_JMP;
+                    Decoded->Target = InstructionIndex + 1;
+                }
+            } else if(Instruction->Opcode == OPC_JMPZ) {
+                Decoded->Opcode = OPC_JMP;
+                Decoded->BaseOpcode = OPC_JMP;
+            }
+
+            if(Instruction->Opcode == OPC_CALLPLLA && Instruction->Jump.Future != 0) {
+                Decoded->Flags |= DECODED_FLAG_FUTURE;
+            }
+
+            //
+            // Parallel loops carry their schedule in Right.
+            //
+
+            if(Instruction->Opcode == OPC_PFOR) {
+                Decoded->Right.Kind = OPERAND_KIND_CONSTANT;
+                Decoded->Right.Register = REG_RCT;
+                Decoded->Right.Offset = (LONG)Instruction->Jump.Schedule;
+            }
+
+            break;
+
+        case OPC_RETURN:
+            Decoded->StackCleanup = Instruction->Return.StackCleanup +
+                                    Program->Header.StackAlignment;
+
+            if((Decoded->StackCleanup % Program->Header.StackAlignment) != 0) {
+                VmFatal(ERR_STR_INVALIDINSTR);
+            }
+
+            break;
+
+        case OPC_PUSH:
+            DecodeOperand(Program,
+                          Instruction->Stack.Register,
+                          Instruction->Stack.RegisterOffset,
+                          FALSE,
+                          &Decoded->Left);
+
+            if(Instruction->Stack.AtomicLoad != 0) {
+                Decoded->Flags |= DECODED_FLAG_ATOMIC_LOAD;
+            }
+
+            break;
+
+        case OPC_POP:
+            DecodeOperand(Program,
+                          Instruction->Stack.Register,
+                          Instruction->Stack.RegisterOffset,
+                          TRUE,
+                          &Decoded->Destination);
+
+            break;
+
+        case OPC_WAIT:
+            DecodeOperand(Program,
+                          Instruction->Stack.Register,
+                          Instruction->Stack.RegisterOffset,
+                          FALSE,
+                          &Decoded->Left);
+
+            Decoded->Slot = DecodeBarrier(Program, &Decoded->Left);
+            Decoded->Flags |= DECODED_FLAG_ATOMIC_LOAD;
+            break;
+
+        //
+        // The channel goes in Right, the value in Left for a send and in the
+        // destination for a receive. Values only travel in registers.
+        //
+
+        case OPC_SEND:
+        case OPC_RECV:
+            DecodeOperand(Program,
+                          REG_RGD,
+                          (LONG)Instruction->Channel.ChannelOffset,
+                          FALSE,
+                          &Decoded->Right);
+
+            Decoded->Slot = DecodeChannel(Program,
+                                          &Decoded->Right,
+                                          (ULONG)Instruction->Channel.Capacity + 1,
+                                          (BOOL)Instruction->Channel.Single);
+
+            if(Instruction->Channel.Register == REG_RCT ||
+               IS_REGISTER_INDEX(Instruction->Channel.Register)) {
+
+                VmFatal(ERR_STR_INVALIDINSTR);
+            }
+
+            if(Instruction->Opcode == OPC_SEND) {
+                DecodeRegister(Instruction->Channel.Register, &Decoded->Left);
+            } else {
+                DecodeRegister(Instruction->Channel.Register, &Decoded->Destination);
+            }
+
+            break;
+
+        case OPC_PRINT:
+        case OPC_READ:
+            Decoded->PopCount = Instruction->Io.PopCount;
+            break;
+
+        case OPC_ERR:
+        default:
+            VmFatal(ERR_STR_INVALIDINSTR);
+    }
+}
+
+LONG
+DecodeProgram (
+    PPROGRAM Program,
+    PINSTRUCTION Code,
+    ULONG CodeCount
+    )
+
+/*
+
+ Routine description:
+
+    This routine makes a single pass over the code section and builds the
+    decoded instruction stream. The stream is cache line aligned, carries
+    jump targets as instruction indices and pre-classified operand kinds.
+
+ Arguments:
+
+    Program - The program being decoded. Receives the decoded stream.
+
+    Code - The code section as read from the program file.
+
+    CodeCount - Number of instructions in the code section.
+
+ Return value:
+
+    0 on success, -1 otherwise.
+
+*/
+
+{
+    PDECODED_INSTRUCTION Instructions;
+    ULONG i;
+
+    Instructions = _aligned_malloc(CodeCount * sizeof(DECODED_INSTRUCTION),
+                                   DECODED_INSTRUCTION_ALIGNMENT);
+
+    if(Instructions == NULL) {
+        return -1;
+    }
+
+    for(i=0; i<CodeCount; ++i) {
+        DecodeInstruction(Program, i, &Code[i], &Instructions[i]);
+    }
+
+    Program->Instructions = Instructions;
+    Program->InstructionCount = CodeCount;
+    DecodeQuickenProgram(Program);
+
+    return 0;
+}
+
+LONG
+DecodeQuickOperator (
+    ULONG Opcode
+    )
+
+/*
+
+ Routine description:
+
+    This routine maps an arithmetic opcode to its quickened operator.
+
+ Arguments:
+
+    Opcode - The base opcode.
+
+ Return value:
+
+    The quickened operator, or -1 if the opcode has no quickened variants.
+
+*/
+
+{
+    switch(Opcode) {
+        case OPC_ADDI:
+        case OPC_ADDF:
+            return QUICK_OPERATOR_ADD;
+
+        case OPC_SUBI:
+        case OPC_SUBF:
+            return QUICK_OPERATOR_SUB;
+
+        case OPC_MULI:
+        case OPC_MULF:
+            return QUICK_OPERATOR_MUL;
+
+        case OPC_DIVI:
+        case OPC_DIVF:
+            return QUICK_OPERATOR_DIV;
+
+        case OPC_XOR:
+            return QUICK_OPERATOR_XOR;
+
+        case OPC_OR:
+            return QUICK_OPERATOR_OR;
+
+        case OPC_AND:
+            return QUICK_OPERATOR_AND;
+
+        case OPC_LOR:
+            return QUICK_OPERATOR_LOR;
+
+        case OPC_LAND:
+            return QUICK_OPERATOR_LAND;
+
+        case OPC_EQ:
+            return QUICK_OPERATOR_EQ;
+
+        case OPC_NEQ:
+            return QUICK_OPERATOR_NEQ;
+
+        case OPC_LT:
+            return QUICK_OPERATOR_LT;
+
+        case OPC_GT:
+            return QUICK_OPERATOR_GT;
+
+        case OPC_LTE:
+            return QUICK_OPERATOR_LTE;
+
+        case OPC_GTE:
+            return QUICK_OPERATOR_GTE;
+
+        default:
+            return -1;
+    }
+}
+
+VOID
+DecodeQuickenProgram (
+    PPROGRAM Program
+    )
+
+/*
+
+ Routine description:
+
+    This routine rewrites each decoded instruction into the handler variant
+    specialized for the concrete kinds of its operands, so the interpreter
+    doesn't have to look at the operand kinds at all on the hot path.
+
+    Instructions without a matching variant, or touching atomic variables,
+    keep their base opcode and run through the generic handlers.
+
+ Arguments:
+
+    Program - The program whose instruction stream is to be quickened.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PDECODED_INSTRUCTION Instruction;
+    LONG Operator;
+    ULONG i;
+
+    for(i=0; i<Program->InstructionCount; ++i) {
+        Instruction = &Program->Instructions[i];
+        if(Instruction->Flags != 0) {
+            continue;
+        }
+
+        switch(Instruction->Opcode) {
+            case OPC_RCOPYD:
+                if(Instruction->Right.Kind == OPERAND_KIND_CONSTANT) {
+                    Instruction->Opcode = QUICK_OPCODE_RCOPYD_CONSTANT;
+                } else {
+                    Instruction->Opcode = QUICK_OPCODE_RCOPYD_REGISTER;
+                }
+
+                break;
+
+            case OPC_STRI8:
+            case OPC_STRU8:
+            case OPC_STRI16:
+            case OPC_STRU16:
+            case OPC_STRI32:
+            case OPC_STRU32:
+            case OPC_STRF:
+                Instruction->Opcode =
+                    QUICK_OPCODE_STORE(Instruction->Right.Kind,
+                                       Instruction->Destination.Kind);
+
+                break;
+
+            case OPC_PUSH:
+                Instruction->Opcode = QUICK_OPCODE_PUSH(Instruction->Left.Kind);
+                break;
+
+            case OPC_POP:
+                Instruction->Opcode =
+                    QUICK_OPCODE_POP(Instruction->Destination.Kind);
+
+                break;
+
+            default:
+
+                //
+                // The translator only ever computes into registers, so only 
+                // those arithmetic forms get variants.
+                //
+
+                Operator = DecodeQuickOperator(Instruction->Opcode);
+                if(Operator >= 0 &&
+                   Instruction->Destination.Kind == OPERAND_KIND_REGISTER) {
+
+                    Instruction->Opcode =
+                        QUICK_OPCODE_ARITHMETIC(Operator,
+                                                Instruction->Left.Kind,
+                                                Instruction->Right.Kind);
+                }
+
+                break;
+        }
+    }
+}
+
+VOID
+DecodeFree (
+    PDECODED_INSTRUCTION Instructions
+    )
+
+/*
+
+ Routine description:
+
+    This routine frees a decoded instruction stream.
+
+ Arguments:
+
+    Instructions - The decoded instruction stream.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    _aligned_free(Instructions);
+}
@@ -0,0 +1,221 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    decode.h
+
+ Abstract:
+
+    This module defines the decoded instruction stream the interpreter runs
+    from, and the routines that build it at load time.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Calls carry the stack depth of the callee
+    10/17/26        Atomic load flag
+    10/17/26        Atomic read-modify-write
+    10/17/26        Future flag
+    10/17/26        Reduction slots
+    10/17/26        Barrier slots
+    10/17/26        Channel slots
+
+**/
+
+#ifndef __DECODE_H__
+#define __DECODE_H__
+
+#include <windows.h>
+#include "../Common/def.h"
+
+#define DECODED_INSTRUCTION_ALIGNMENT   64
+
+//
+// Every register/offset pair in the 64 bit encoding is resolved once at load
+// time to one of these operand kinds, so the interpreter never has to walk the
+// register class macros again.
+//
+
+typedef enum _OPERAND_KIND {
+    OPERAND_KIND_REGISTER   = 0,    // Register[Register]
+    OPERAND_KIND_CONSTANT   = 1,    // Offset
+    OPERAND_KIND_GLOBAL     = 2,    // GlobalData[Offset]
+    OPERAND_KIND_STACK      = 3,    // ThreadStack[Register[Register] + Offset]
+} OPERAND_KIND;
+
+typedef struct _DECODED_OPERAND {
+    UCHAR Kind;
+    UCHAR Register;
+    USHORT Reserved;
+
+    //
+    // For stack operands the stack pointer bias is already folded in here.
+    //
+
+    LONG Offset;
+} DECODED_OPERAND, *PDECODED_OPERAND;
+
+//
+// Instructions touching atomic variables are never quickened or fused, the
+// generic handlers make their loads acquire and their stores release. The
+// atomic read-modify-writes count as stores.
+//
+
+#define DECODED_FLAG_ATOMIC_STORE   0x01
+#define DECODED_FLAG_ATOMIC_LOAD    0x02
+
+//
+// Async calls that get joined later leave a handle to a future in RRV.
+//
+
+#define DECODED_FLAG_FUTURE         0x04
+
+//
+// Quickened opcodes live above the 6 bit opcode space. Each one is a variant
+// of a base opcode specialized for the concrete kinds of its operands.
+//
+
+#define QUICK_OPERATOR_LIST(X)                                              \
+    X(ADD, +) X(SUB, -) X(MUL, *) X(DIV, /) X(XOR, ^) X(OR, |) X(AND, &)    \
+    X(LOR, ||) X(LAND, &&) X(EQ, ==) X(NEQ, !=) X(LT, <) X(GT, >)           \
+    X(LTE, <=) X(GTE, >=)
+
+#define QUICK_OPERATOR_ENUM(Name, Operator)     QUICK_OPERATOR_##Name,
+
+typedef enum _QUICK_OPERATOR {
+    QUICK_OPERATOR_LIST(QUICK_OPERATOR_ENUM)
+    QUICK_OPERATOR_COUNT
+} QUICK_OPERATOR;
+
+#define QUICK_KIND_COUNT                    4
+
+#define QUICK_OPCODE_BASE                   64
+#define QUICK_OPCODE_RCOPYD_CONSTANT        (QUICK_OPCODE_BASE + 0)
+#define QUICK_OPCODE_RCOPYD_REGISTER        (QUICK_OPCODE_BASE + 1)
+#define QUICK_OPCODE_PUSH(K)                (QUICK_OPCODE_BASE + 4 + (K))
+#define QUICK_OPCODE_POP(K)                 (QUICK_OPCODE_BASE + 8 + (K))
+#define QUICK_OPCODE_STORE(R, D)            (QUICK_OPCODE_BASE + 16 +      \
+                                             (R) * QUICK_KIND_COUNT + (D))
+
+#define QUICK_OPCODE_ARITHMETIC(O, L, R)    (QUICK_OPCODE_BASE + 32 +      \
+                                             (O) * QUICK_KIND_COUNT *       \
+                                             QUICK_KIND_COUNT +             \
+                                             (L) * QUICK_KIND_COUNT + (R))
+
+//
+// Fused opcodes sit above the quickened ones. A fused instruction replaces a
+// recurring translator idiom with a single dispatch. The instructions it
+// covers stay in the following slots, so jump targets don't move and the
+// fused handler picks their operands up from there.
+//
+
+#define FUSE_COMPARE_LIST(X)                                                \
+    X(EQ, ==) X(NEQ, !=) X(LT, <) X(GT, >) X(LTE, <=) X(GTE, >=)
+
+#define FUSE_ARITHMETIC_LIST(X)                                             \
+    X(ADD, +) X(SUB, -) X(MUL, *)
+
+#define FUSE_COMPARE_ENUM(Name, Operator)       FUSE_COMPARE_##Name,
+#define FUSE_ARITHMETIC_ENUM(Name, Operator)    FUSE_ARITHMETIC_##Name,
+
+typedef enum _FUSE_COMPARE {
+    FUSE_COMPARE_LIST(FUSE_COMPARE_ENUM)
+    FUSE_COMPARE_COUNT
+} FUSE_COMPARE;
+
+typedef enum _FUSE_ARITHMETIC {
+    FUSE_ARITHMETIC_LIST(FUSE_ARITHMETIC_ENUM)
+    FUSE_ARITHMETIC_COUNT
+} FUSE_ARITHMETIC;
+
+#define FUSED_OPCODE_BASE                   QUICK_OPCODE_ARITHMETIC(QUICK_OPERATOR_COUNT, 0, 0)
+#define FUSED_OPCODE_ELEMENT_ADDRESS(K)     (FUSED_OPCODE_BASE + (K))
+#define FUSED_OPCODE_COMPARE_BRANCH(O, L, R)                                \
+    (FUSED_OPCODE_BASE + QUICK_KIND_COUNT +                                 \
+     (O) * QUICK_KIND_COUNT * QUICK_KIND_COUNT +                            \
+     (L) * QUICK_KIND_COUNT + (R))
+
+//
+// Fused stores only ever target memory, global or stack.
+//
+
+#define FUSED_OPCODE_ARITHMETIC_STORE(O, L, R, D)                           \
+    (FUSED_OPCODE_COMPARE_BRANCH(FUSE_COMPARE_COUNT, 0, 0) +                \
+     (O) * QUICK_KIND_COUNT * QUICK_KIND_COUNT * 2 +                        \
+     (L) * QUICK_KIND_COUNT * 2 + (R) * 2 + ((D) - OPERAND_KIND_GLOBAL))
+
+#define DECODED_OPCODE_COUNT                FUSED_OPCODE_ARITHMETIC_STORE(FUSE_ARITHMETIC_COUNT, 0, 0, OPERAND_KIND_GLOBAL)
+
+typedef struct _DECODED_INSTRUCTION {
+
+    //
+    // The opcode the interpreter dispatches on, which may be a quickened
+    // variant, and the opcode it was decoded from.
+    //
+
+    USHORT Opcode;
+    UCHAR Flags;
+    UCHAR BaseOpcode;
+
+    union {
+        ULONG Target;                   // Jumps & calls, instruction index
+        ULONG Slot;                     // Reductions, barriers & channels, their state
+        ULONG StackCleanup;             // Return, bytes including return address
+        ULONG PopCount;                 // I/O
+        ULONG StoreShift;               // Stores, 32 - store width in bits
+    };
+
+    //
+    // Calls of a verified program carry the number of bytes of stack the
+    // callee can use below its return address in Left.Offset.
+    //
+
+    DECODED_OPERAND Left;
+    DECODED_OPERAND Right;
+    DECODED_OPERAND Destination;
+} DECODED_INSTRUCTION, *PDECODED_INSTRUCTION;
+
+static_assert(sizeof(DECODED_INSTRUCTION) == 32,
+              "sizeof(DECODED_INSTRUCTION) isn't 32.");
+
+struct _PROGRAM;
+
+LONG
+DecodeProgram (
+    struct _PROGRAM *Program,
+    PINSTRUCTION Code,
+    ULONG CodeCount
+    );
+
+VOID
+DecodeQuickenProgram (
+    struct _PROGRAM *Program
+    );
+
+VOID
+DecodeFree (
+    PDECODED_INSTRUCTION Instructions
+    );
+
+#endif // __DECODE_H__
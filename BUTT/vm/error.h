@@ -32,6 +32,8 @@
  Revision:
  
     11/24/15        Initial Creation
+    10/17/26        Access violation and stack overflow
+    10/17/26        Invalid thread
 
 **/
 
@@ -44,6 +46,10 @@
 #define ERR_STR_TLSALLOCFAIL        "Allocating TLS index."
 #define ERR_STR_INVALIDINSTR        "Invalid instruction."
 #define ERR_STR_ONLYRCOPYD          "Only RCOPYD is defined for Indirect type instruction."
+#define ERR_STR_PROGRAMREADFAIL     "Reading program file."
+#define ERR_STR_ACCESSVIOLATION     "Memory access outside of the address space."
+#define ERR_STR_STACKOVERFLOW       "Stack overflow."
+#define ERR_STR_INVALIDTHREAD       "Join of an invalid thread."
 
 void 
 VmFatal (
@@ -32,6 +32,28 @@
  Revision:
  
     11/24/15        Initial Creation
+    10/17/26        Execute from the decoded instruction stream
+    10/17/26        Per-opcode handlers with optional threaded dispatch
+    10/17/26        Quickened operand kind specialized handlers
+    10/17/26        Fused superinstruction handlers
+    10/17/26        Trace into the per thread ring instead of formatting
+    10/17/26        Hand threads to the JIT when the program was translated
+    10/17/26        Count loop back edges and run hot loop traces
+    10/17/26        Run each thread in a window of the flat address space
+    10/17/26        One interpreter core per stack alignment
+    10/17/26        Bounds checked cores for unverified programs
+    10/17/26        Push register sets onto a contiguous frame stack
+    10/17/26        Parallel calls spawn tasks on the worker pool
+    10/17/26        Preempt and park threads instead of blocking workers
+    10/17/26        Windows come from and go back to the worker's cache
+    10/17/26        Size thread stacks by the stack depth of their function
+    10/17/26        Acquire and release accesses of atomic variables
+    10/17/26        Atomic read-modify-write handlers
+    10/17/26        Futures for async calls and thread joins, counted references
+    10/17/26        Parallel loops run their chunks on runner threads
+    10/17/26        Reductions into per thread copies, folded on finish
+    10/17/26        Barrier waits
+    10/17/26        Channel sends and receives
 
 **/
 
@@ -39,478 +61,683 @@
 #include "error.h"
 #include "memory_inl.h"
 #include "program.h"
-#include <windows.h>
-
-#ifdef COMPILE_VERBOSE
-#define PRINT_OUT       stdout
-#else
-extern FILE* _NUL;
-#define PRINT_OUT       _NUL
+#include "space.h"
+#include "pool.h"
+#if defined(EXEC_JIT) || defined(EXEC_LOOP_JIT)
+#include "jit.h"
 #endif
+#include <windows.h>
 
 extern PPROGRAM GProgram;
 extern void VmFatal(char* Error);
 
-ULONG GCodePointerBias;
-ULONG GDataPointerBias;
-ULONG GStackPointerBias;
+#if TRACE_LEVEL > TRACE_LEVEL_NONE
+
+//
+// Threads are numbered in the order they start, for their trace files. The
+// worker a thread runs on says nothing about it.
+//
+
+volatile LONG ExecThreadCount = 0;
+#endif
 
 extern
 inline
-VOID
-MemRegisterValue (
-    PCHAR Stack,
-    PREGISTER_SET RegisterSet, 
-    ULONG Register,
-    LONG RegisterOffset,
-    PLONG Value
+BOOL
+MemAddressValid (
+    PPROGRAM Program,
+    ULONG Address,
+    ULONG Width
     );
-
+    
+extern
+inline
 BOOL
-ExecArithmeticInstruction (
+MemGlobalValid (
+    PPROGRAM Program,
+    LONG Offset,
+    ULONG Width
+    );
+    
+extern
+inline
+PCHAR
+MemStackAddress (
+    PCHAR Window,
+    ULONG Address,
+    ULONG Width,
+    BOOL Checked
+    );
+    
+extern
+inline
+PCHAR
+MemGlobalAddress (
+    PCHAR GlobalData,
+    LONG Offset,
+    ULONG Width,
+    BOOL Checked
+    );
+    
+extern
+inline
+LONG
+MemLoad (
+    PCHAR Address,
+    ULONG Width
+    );
+    
+extern
+inline
+VOID
+MemStore (
+    PCHAR Address,
+    LONG Value,
+    ULONG Width
+    );
+    
+extern
+inline
+LONG
+MemLoadAcquire (
+    PCHAR Address,
+    ULONG Width
+    );
+    
+extern
+inline
+VOID
+MemStoreRelease (
+    PCHAR Address,
+    LONG Value,
+    ULONG Width
+    );
+    
+extern
+inline
+LONG
+MemAtomicUpdate (
+    PCHAR Address,
+    ULONG Opcode,
+    LONG Value,
+    ULONG Width
+    );
+    
+extern
+inline
+LONG
+MemAtomicCompareSwap (
+    PCHAR Address,
+    LONG Expected,
+    LONG Desired,
+    ULONG Width
+    );
+    
+extern
+inline
+LONG
+MemAtomicExchange (
+    PCHAR Address,
+    LONG Value,
+    ULONG Width
+    );
+    
+extern
+inline
+LONG
+MemOperandValue (
     PTHREAD_EXECUTION_DATA ExecData,
-    PINSTRUCTION Instruction
-    )
+    PDECODED_OPERAND Operand,
+    ULONG Width,
+    BOOL Checked
+    );
+    
+extern
+inline
+VOID
+MemOperandStore (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_OPERAND Operand,
+    LONG Value,
+    ULONG Width,
+    BOOL Checked
+    );
+    
+extern
+inline
+LONG
+MemOperandValueAcquire (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_OPERAND Operand,
+    ULONG Width,
+    BOOL Checked
+    );
+    
+extern
+inline
+VOID
+MemOperandStoreRelease (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_OPERAND Operand,
+    LONG Value,
+    ULONG Width,
+    BOOL Checked
+    );
+    
+extern
+inline
+VOID
+MemStackPush (
+    PTHREAD_EXECUTION_DATA ExecData,
+    LONG Value,
+    ULONG Width,
+    BOOL Checked
+    );
+    
+extern
+inline
+LONG
+MemStackPop (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Width,
+    BOOL Checked
+    );
 
+VOID
+ExecGrowFrames (
+    PTHREAD_EXECUTION_DATA ExecData
+    )
+    
 /*
 
  Routine description:
  
-    This routine executes an arithmetic instruction.
+    This routine doubles the room on the frame stack of a thread. The array
+    may move, so the active register set is pointed at its new home.
     
  Arguments:
  
-    ExecData - The thread execution data for the calling thread.
-    
-    Instruction - The instruction to execute.
+    ExecData - The thread execution data for the thread. The frame stack must
+               be full.
     
  Return value:
  
-    TRUE if we should continue executing instructions. FALSE otherwise.
+    VOID.
 
 */
     
 {
-    LONG L;
-    LONG R;
-    LONG D;
-    ULONG Rl;
-    ULONG Rr;
-    ULONG Rd;
-    LONG Rlo;
-    LONG Rro;
-    LONG Rdo;
-    LONG StackOffset;
-    
-    Rl = Instruction->Arith.LtRegister;
-    Rr = Instruction->Arith.RtRegister;
-    Rd = Instruction->Arith.DtRegister;
-    Rlo = Instruction->Arith.LtRegisterOffset;
-    Rro = Instruction->Arith.RtRegisterOffset;
-    Rdo = Instruction->Arith.DtRegisterOffset;
-    
-    MemRegisterValue(ExecData->ThreadStack,
-                     ExecData->ActiveRegisterSet,
-                     Rl,
-                     Rlo,
-                     &L);
-                     
-    MemRegisterValue(ExecData->ThreadStack,
-                     ExecData->ActiveRegisterSet,
-                     Rr,
-                     Rro,
-                     &R);
+    PREGISTER_SET Frames;
+    ULONG Capacity;
     
-    switch(Instruction->Opcode) {
-        case OPC_ADDI:
-        case OPC_ADDF:
-            D = L + R;
-            break;
-            
-        case OPC_SUBI:
-        case OPC_SUBF:
-            D = L - R;
-            break;
-            
-        case OPC_MULI:
-        case OPC_MULF:
-            D = L * R;
-            break;
-            
-        case OPC_DIVI:
-        case OPC_DIVF:
-            D = L / R;
-            break;
-            
-        case OPC_XOR:
-            D = L ^ R;
-            break;
-            
-        case OPC_OR:
-            D = L | R;
-            break;
-            
-        case OPC_AND:
-            D = L & R;
-            break;
-            
-        case OPC_NOT:
-            assert(!"Yeah... didn't think this NOT thing through.");
-            
-        case OPC_LOR:
-            D = L || R;
-            break;
-            
-        case OPC_LAND:
-            D = L && R;
-            break;
-            
-        case OPC_EQ:
-            D = L == R;
-            break;
-            
-        case OPC_NEQ:
-            D = L != R;
-            break;
-            
-        case OPC_LT:
-            D = L < R;
-            break;
-            
-        case OPC_GT:
-            D = L > R;
-            break;
-            
-        case OPC_LTE:
-            D = L <= R;
-            break;
-            
-        case OPC_GTE:
-            D = L >= R;
-            break;
-            
-        default:
-            VmFatal(ERR_STR_INVALIDINSTR);
+    Capacity = ExecData->FrameCapacity * 2;
+    if(Capacity <= ExecData->FrameCapacity) {
+        VmFatal(ERR_STR_NOMEM);
     }
     
-    fprintf(PRINT_OUT, "Arithmetic: Storing %ld OP %ld = %ld into %s + %ld\n",
-           L, R, D, _REGISTER_NAMES[Rd], Rdo);
-    
-    if(Rd == REG_RGD) {
-        memcpy(GProgram->GlobalData+Rro, &D, GProgram->Header.StackAlignment);
-    } if(IS_REGISTER_INDEX(Rd)) {
-        StackOffset = ExecData->ActiveRegisterSet->Register[Rd];
-        StackOffset = StackOffset - GStackPointerBias;
-        StackOffset = StackOffset + Rdo;
-        memcpy(ExecData->ThreadStack+StackOffset,
-               &D,
-               GProgram->Header.StackAlignment);
-    } else {
-        ExecData->ActiveRegisterSet->Register[Rd] = D;
+    Frames = realloc(ExecData->Frames, Capacity * sizeof(REGISTER_SET));
+    if(Frames == NULL) {
+        VmFatal(ERR_STR_NOMEM);
     }
     
-    ExecData->ActiveRegisterSet->Register[REG_RIP] =
-        ExecData->ActiveRegisterSet->Register[REG_RIP] + sizeof(INSTRUCTION);
-    
-    return TRUE;
+    ExecData->Frames = Frames;
+    ExecData->FrameCapacity = Capacity;
+    ExecData->ActiveRegisterSet = &Frames[ExecData->FrameCount - 1];
 }
 
-BOOL
-ExecDirectIndirectInstruction (
+PTHREAD_CREATION_DATA
+ExecThreadCreationData (
     PTHREAD_EXECUTION_DATA ExecData,
-    PINSTRUCTION Instruction
+    ULONG JumpIndex,
+    ULONG ParameterCount,
+    BOOL Checked
     )
     
 /*
 
  Routine description:
  
-    This routine executes an indirect/direct instruction.
+    This routine builds the creation data for a thread spawned by a parallel
+    call. The mini stack holds a return address slot followed by the 
+    parameters, as a called function expects to find them.
     
  Arguments:
  
-    ExecData - The thread execution data for the calling thread.
+    ExecData - The thread execution data for the calling thread. RSB must
+               point at the parameters.
     
-    Instruction - The instruction to execute.
+    JumpIndex - Index of the entry instruction of the function to run.
+    
+    ParameterCount - Number of parameters the function takes.
+    
+    Checked - TRUE to bounds check the parameter reads.
     
  Return value:
  
-    TRUE if we should continue executing instructions. FALSE otherwise.
+    The creation data.
 
 */
     
 {
-    LONG L;
-    LONG Offset;
-    LONG D;
-    ULONG Rl;
+    PTHREAD_CREATION_DATA CreationData;
+    ULONG Alignment;
+    ULONG Rsb;
+    ULONG i;
     
-    if(Instruction->Opcode != OPC_RCOPYD) {
-        VmFatal(ERR_STR_ONLYRCOPYD);
+    Alignment = GProgram->Header.StackAlignment;
+    CreationData = malloc(sizeof(THREAD_CREATION_DATA));
+    if(CreationData == NULL) {
+        VmFatal(ERR_STR_NOMEM);
     }
     
-    Rl = Instruction->Indirect.LtRegister;
-    L = ExecData->ActiveRegisterSet->Register[Rl];
-    if(Instruction->Indirect.LtOffsetType == INDIRECT_OFFSET_TYPE_CONSTANT) {
-        Offset = Instruction->Indirect.LtOffset;
-    } else {
-        Offset = ExecData->ActiveRegisterSet->Register[Instruction->Indirect.LtOffset];
+    CreationData->RegisterSet = malloc(sizeof(REGISTER_SET));
+    CreationData->MiniStackSize = (ParameterCount + 1) * Alignment;
+    CreationData->MiniStack = malloc(CreationData->MiniStackSize);
+    if(CreationData->RegisterSet == NULL || CreationData->MiniStack == NULL) {
+        VmFatal(ERR_STR_NOMEM);
     }
     
-    D = L + Offset;
-    ExecData->ActiveRegisterSet->Register[Instruction->Indirect.DtRegister] = D;
-    
-    fprintf(PRINT_OUT, 
-            "Copying value 0x%X into %s\n", 
-            (int)D, 
-            _REGISTER_NAMES[Instruction->Indirect.DtRegister]);
-    
-    ExecData->ActiveRegisterSet->Register[REG_RIP] =
-        ExecData->ActiveRegisterSet->Register[REG_RIP] + sizeof(INSTRUCTION);
+    memset(CreationData->RegisterSet, 0, sizeof(REGISTER_SET));
+    memset(CreationData->MiniStack, 0, Alignment);
+    CreationData->JumpIndex = JumpIndex;
+    CreationData->StackDepth = 0;
+    
+    Rsb = ExecData->ActiveRegisterSet->Register[REG_RSB];
+    for(i=0; i<ParameterCount; ++i) {
+        memcpy(CreationData->MiniStack + (i + 1) * Alignment,
+               MemStackAddress(ExecData->ThreadStack, 
+                               Rsb + i * Alignment, 
+                               Alignment, 
+                               Checked),
+               Alignment);
+    }
     
-    return TRUE;
+    return CreationData;
 }
 
-BOOL
-ExecStoreInstruction (
-    PTHREAD_EXECUTION_DATA ExecData,
-    PINSTRUCTION Instruction
+ULONG
+ExecThreadStackDepth (
+    PFUNCTION_SYMBOL Symbol,
+    PDECODED_INSTRUCTION Instruction,
+    ULONG MiniStackSize
     )
     
 /*
 
  Routine description:
  
-    This routine executes a store instruction.
+    This routine works out how much stack a thread spawned to run a function
+    needs. It only needs as much as the function goes deep, if the 
+    translator could bound that. The verifier left the frame of the function
+    with the instruction spawning it, for when it goes deeper. Calls further
+    down check against the limit like any other. Reads of fixed stack 
+    addresses could land below it, so a program that makes any gets whole
+    stacks.
     
  Arguments:
  
-    ExecData - The thread execution data for the calling thread.
+    Symbol - The function symbol of the function to run.
     
-    Instruction - The instruction to execute.
+    Instruction - The instruction spawning the thread.
+    
+    MiniStackSize - Size in bytes of what the thread finds on its stack 
+                    when it starts.
     
  Return value:
  
-    TRUE if we should continue executing instructions. FALSE otherwise.
-    
- Remarks:
-    
-    This routine masks and sign extends the data to be stored according to the
-    store type.
+    The stack depth below StackTop, 0 for all of it.
 
 */
     
 {
-    LONG R;
-    LONG D;
-    ULONG Rr;
-    ULONG Rd;
-    LONG Rro;
-    LONG Rdo;
-    LONG StackOffset;
-    unsigned StoreMask;
-    unsigned SignBit;
-    unsigned SignExtend;
-    
-    Rr = Instruction->Store.RtRegister;
-    Rd = Instruction->Store.DtRegister;
-    Rro = Instruction->Store.RtRegisterOffset;
-    Rdo = Instruction->Store.DtRegisterOffset;
-    
-    switch(Instruction->Opcode) {
-        case OPC_STRI8:
-        case OPC_STRU8:
-            StoreMask = 0xFF;
-            SignExtend = 0xFFFFFF00;
-            SignBit = 0x80;
-            break;
-            
-        case OPC_STRI16:
-        case OPC_STRU16:
-            StoreMask = 0xFFFF;
-            SignExtend = 0xFFFF0000;
-            SignBit = 0x8000;
-            break;
-            
-        case OPC_STRI32:
-        case OPC_STRU32:
-        case OPC_STRF:
-        case OPC_STRTH:
-            StoreMask = 0xFFFFFFFF;
-            SignExtend = 0x00000000;
-            SignBit = 0x80000000;
-            break;
-    }
-    
-    MemRegisterValue(ExecData->ThreadStack,
-                     ExecData->ActiveRegisterSet,
-                     Rr,
-                     Rro,
-                     &R);
+    ULONG StackDepth;
     
-    D = R & StoreMask;
-    if(D & SignBit) {
-        D = D | SignExtend;
+    if(GProgram->Verified == FALSE ||
+       GProgram->FixedStackReads != FALSE ||
+       Symbol->StackDepth == SYMBOL_STACK_UNBOUNDED) {
+       
+        return 0;
     }
     
-    if(Rd == REG_RGD) {
-        memcpy(GProgram->GlobalData+Rro, &D, GProgram->Header.StackAlignment);
-    } if(IS_REGISTER_INDEX(Rd)) {
-        StackOffset = ExecData->ActiveRegisterSet->Register[Rd];
-        StackOffset = StackOffset - GStackPointerBias;
-        StackOffset = StackOffset + Rdo;
-        memcpy(ExecData->ThreadStack+StackOffset,
-               &D,
-               GProgram->Header.StackAlignment);
-    } else {
-        ExecData->ActiveRegisterSet->Register[Rd] = D;
+    StackDepth = (ULONG)Symbol->StackDepth;
+    if(StackDepth < (ULONG)Instruction->Left.Offset) {
+        StackDepth = (ULONG)Instruction->Left.Offset;
     }
     
-    fprintf(PRINT_OUT, 
-            "Store: Storing %ld into %s + %ld\n", 
-            D, 
-            _REGISTER_NAMES[Rd], 
-            Rdo);
-    
-    ExecData->ActiveRegisterSet->Register[REG_RIP] =
-        ExecData->ActiveRegisterSet->Register[REG_RIP] + sizeof(INSTRUCTION);
-    
-    return TRUE;
+    return StackDepth + MiniStackSize;
 }
 
 BOOL
-ExecJumpInstruction (
+ExecCallInstruction (
     PTHREAD_EXECUTION_DATA ExecData,
-    PINSTRUCTION Instruction
+    PDECODED_INSTRUCTION Instruction,
+    BOOL Checked
     )
     
 /*
 
  Routine description:
  
-    This routine executes a jump or call instruction.
+    This routine executes a call instruction.
     
  Arguments:
  
-    ExecData - The thread execution data for the calling thread.
+    ExecData - The thread execution data for the calling thread. RIP must 
+               index the call instruction.
     
     Instruction - The instruction to execute.
     
+    Checked - TRUE to bounds check the stack accesses of the call.
+    
  Return value:
  
-    TRUE if we should continue executing instructions. FALSE otherwise.
+    TRUE if we should continue executing instructions. FALSE if the thread
+    parked, RIP then indexes the instruction it resumes at.
 
 */
     
 {
-    ULONG Rj;
-    ULONG Rz;
-    signed Rjo;
-    ULONG Target;
     ULONG ReturnAddress;
-    signed StackOffset;
+    ULONG Rsb;
     PREGISTER_SET NewRegisterSet;
+    PFUNCTION_SYMBOL Symbol;
+    PTHREAD_CREATION_DATA CreationData;
+    PTHREAD_EXECUTION_DATA Thread;
     
-    Rj = Instruction->Jump.Register;
-    Rz = Instruction->Jump.ZeroRegister;
-    Rjo = Instruction->Jump.RegisterOffset;
-    
-    if(Rj == REG_RIP) {
-        Target = ExecData->ActiveRegisterSet->Register[Rj] + Rjo;
-        fprintf(PRINT_OUT, 
-                "Conditional Target %s 0x%X\n", 
-                _REGISTER_NAMES[Rj], 
-                (unsigned int)Target);
-                
-    } else if(Rj == REG_RCT) {
-        Target = Rjo;
-        fprintf(PRINT_OUT, 
-                "Target %s 0x%X\n", 
-                _REGISTER_NAMES[Rj], 
-                (unsigned int)Target);
-        
-    } else {
-        assert(!"Stop! Jump is using invalid (currently) register");
-    }
-    
-    if(Instruction->Jump.JumpType == JUMP_TYPE_CONDITIONAL) {
-        
-        assert(!IS_REGISTER_INDEX(Rz));
+    switch(Instruction->Opcode) {
+        case OPC_CALLNORM:
         
-        if(ExecData->ActiveRegisterSet->Register[Rz] == 0) {
-            ExecData->ActiveRegisterSet->Register[REG_RIP] = Target;
-            return TRUE;
-        } 
-    } else {
-        switch(Instruction->Opcode) {
-            case OPC_JMP:
-                ExecData->ActiveRegisterSet->Register[REG_RIP] = Target;
-                return TRUE;
-                
-            case OPC_CALLNORM:
+            //
+            // The verifier left the stack depth of the callee with the call,
+            // and made sure that frame stays inside it. Whether there is room
+            // for it below the caller is all that's left to check.
+            //
             
-                //
-                // Save the return address. 
-                //
-                
-                ReturnAddress = ExecData->ActiveRegisterSet->Register[REG_RIP] +
-                                sizeof(INSTRUCTION);
-                 
-                ExecData->ActiveRegisterSet->Register[REG_RSB] = 
-                    ExecData->ActiveRegisterSet->Register[REG_RSB] - 
-                    GProgram->Header.StackAlignment;
+            Rsb = ExecData->ActiveRegisterSet->Register[REG_RSB];
+            if(Rsb < ExecData->StackLimit + 
+                     GProgram->Header.StackAlignment + 
+                     (ULONG)Instruction->Left.Offset) {
+                     
+                VmFatal(ERR_STR_STACKOVERFLOW);
+            }
+            
+            //
+            // Save the return address. RIP holds an index into the decoded
+            // instruction stream, and so does the saved return address.
+            //
+            
+            ReturnAddress = ExecData->ActiveRegisterSet->Register[REG_RIP] + 1;
+            MemStackPush(ExecData, 
+                         ReturnAddress, 
+                         GProgram->Header.StackAlignment,
+                         Checked);
+            TRACE_CONTROL(ExecData->Trace,
+                          TRACE_TYPE_CALL,
+                          ReturnAddress - 1,
+                          0,
+                          Instruction->Target,
+                          ReturnAddress,
+                          ExecData->ActiveRegisterSet->Register[REG_RSB],
+                          0);
                 
-                StackOffset = ExecData->ActiveRegisterSet->Register[REG_RSB];
-                StackOffset = StackOffset - GStackPointerBias;
-                memcpy(ExecData->ThreadStack+StackOffset, 
-                       &ReturnAddress, 
-                       GProgram->Header.StackAlignment);
-                 
-                fprintf(PRINT_OUT, 
-                        "Call: Pushing RIP+0x8: 0x%X at 0x%p RSB: 0x%X\n",
-                       (int)ReturnAddress,
-                       ExecData->ThreadStack+StackOffset,
-                       (int)ExecData->ActiveRegisterSet->Register[REG_RSB]);
-                    
-                //
-                // We save the registers. All of them. Even if we don't need to.
-                // Because that's just how we roll. 
-                //
+            //
+            // We save the registers. All of them. Even if we don't need to.
+            // Because that's just how we roll. They stay where they are at
+            // the top of the frame stack, and the callee gets the next one.
+            //
+            
+            if(ExecData->FrameCount == ExecData->FrameCapacity) {
+                ExecGrowFrames(ExecData);
+            }
+            
+            NewRegisterSet = &ExecData->Frames[ExecData->FrameCount];
+            ExecData->FrameCount = ExecData->FrameCount + 1;
+            
+            memset(NewRegisterSet, 0, sizeof(REGISTER_SET));
+            NewRegisterSet->Register[REG_RIP] = Instruction->Target;
+            NewRegisterSet->Register[REG_RST] = 
+                ExecData->ActiveRegisterSet->Register[REG_RST];
+            NewRegisterSet->Register[REG_RSB] = 
+                ExecData->ActiveRegisterSet->Register[REG_RSB];
                 
-                SStackPush(ExecData->RegisterSetStack,
-                           ExecData->ActiveRegisterSet);
+            ExecData->ActiveRegisterSet = NewRegisterSet;
+            return TRUE;
+            
+        case OPC_CALLPLLA:
+        case OPC_CALLPLLS:
+        
+            //
+            // The new thread gets the parameters and room for the return 
+            // address it never returns to, and its own zeroed register set.
+            // The parameters are off the caller's stack once they are copied.
+            //
+            
+            Symbol = ProgramLookupFunction(GProgram, Instruction->Target);
+            if(Symbol == NULL) {
+                VmFatal(ERR_STR_INVALIDINSTR);
+            }
+            
+            Rsb = ExecData->ActiveRegisterSet->Register[REG_RSB];
+            CreationData = ExecThreadCreationData(ExecData, 
+                                                  Instruction->Target,
+                                                  Symbol->ParameterCount,
+                                                  Checked);
+                                                  
+            CreationData->StackDepth = ExecThreadStackDepth(Symbol,
+                                                            Instruction,
+                                                            CreationData->MiniStackSize);
+                                                            
+            ExecData->ActiveRegisterSet->Register[REG_RSB] = 
+                Rsb + Symbol->ParameterCount * GProgram->Header.StackAlignment;
                 
-                NewRegisterSet = malloc(sizeof(REGISTER_SET));
-                if(ExecData->ActiveRegisterSet == NULL) {
-                    VmFatal(ERR_STR_NOMEM);
+            ExecData->ActiveRegisterSet->Register[REG_RIP] = 
+                ExecData->ActiveRegisterSet->Register[REG_RIP] + 1;
+            
+            TRACE_CONTROL(ExecData->Trace,
+                          TRACE_TYPE_CALL,
+                          ExecData->ActiveRegisterSet->Register[REG_RIP] - 1,
+                          0,
+                          Instruction->Target,
+                          0,
+                          ExecData->ActiveRegisterSet->Register[REG_RSB],
+                          0);
+                          
+            //
+            // A sync call parks the caller until the thread is done, and the
+            // thread hands it its return value then. The worker moves on to
+            // other threads meanwhile, likely the new one. An async call that
+            // gets joined later gets a handle to a future for the thread
+            // instead.
+            //
+            
+            if(Instruction->BaseOpcode == OPC_CALLPLLA) {
+                Thread = ExecThreadCreate(CreationData, NULL);
+                ExecData->ActiveRegisterSet->Register[REG_RRV] = 0;
+                if((Instruction->Flags & DECODED_FLAG_FUTURE) != 0) {
+                    ExecData->ActiveRegisterSet->Register[REG_RRV] = 
+                        PoolFutureCreate(ExecData->Worker->Pool, &Thread->Future);
                 }
                 
-                memset(NewRegisterSet, 0, sizeof(REGISTER_SET));
-                NewRegisterSet->Register[REG_RIP] = Target;
-                NewRegisterSet->Register[REG_RST] = 
-                    ExecData->ActiveRegisterSet->Register[REG_RST];
-                NewRegisterSet->Register[REG_RSB] = 
-                    ExecData->ActiveRegisterSet->Register[REG_RSB];
-                    
-                ExecData->ActiveRegisterSet = NewRegisterSet;
+                PoolSpawn(ExecData->Worker, Thread);
                 return TRUE;
-                
-            case OPC_CALLPLLA:
-            case OPC_CALLPLLS:
-                assert(!"Stop! Calls not yet supported.");
+            }
+            
+            ExecData->JoinCount = 2;
+            ExecData->Status = EXEC_STATUS_PARKED;
+            PoolSpawn(ExecData->Worker, ExecThreadCreate(CreationData, ExecData));
+            return FALSE;
+            
+        default:
+            assert(!"Stop! Not a call.");
+            return FALSE;
+    }
+}
+
+BOOL
+ExecParallelLoopInstruction (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_INSTRUCTION Instruction,
+    BOOL Checked
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine executes a parallel loop instruction. The first index, the
+    bound, the values of the locals the body captured, the stride and the 
+    chunk size were pushed in that order. They are popped, and the loop body
+    runs on a runner thread per worker at most, each running chunk after 
+    chunk until the loop is done. The caller parks until the last one 
+    finishes.
+    
+ Arguments:
+ 
+    ExecData - The thread execution data for the calling thread. RIP must 
+               index the parallel loop instruction.
+    
+    Instruction - The instruction to execute.
+    
+    Checked - TRUE to bounds check the stack accesses of the loop.
+    
+ Return value:
+ 
+    TRUE if we should continue executing instructions, because the loop had
+    no iterations. FALSE if the thread parked, RIP then indexes the 
+    instruction it resumes at.
+
+*/
+    
+{
+    PFUNCTION_SYMBOL Symbol;
+    PTHREAD_CREATION_DATA CreationData;
+    PTHREAD_EXECUTION_DATA Thread;
+    PPOOL_LOOP Loop;
+    LONG Parameters[LOOP_PARAMETER_COUNT];
+    ULONG CaptureCount;
+    ULONG Alignment;
+    ULONG Offset;
+    ULONG Rsb;
+    LONG64 Runners;
+    LONG64 i;
+    
+    Symbol = ProgramLookupFunction(GProgram, Instruction->Target);
+    if(Symbol == NULL || Symbol->ParameterCount < LOOP_BODY_PARAMETER_COUNT) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+    
+    //
+    // The captured values sit between the stride and the bound.
+    //
+    
+    CaptureCount = Symbol->ParameterCount - LOOP_BODY_PARAMETER_COUNT;
+    Alignment = GProgram->Header.StackAlignment;
+    Rsb = ExecData->ActiveRegisterSet->Register[REG_RSB];
+    for(i=0; i<LOOP_PARAMETER_COUNT; ++i) {
+        Offset = (ULONG)i;
+        if(i >= LOOP_PARAMETER_COUNT - LOOP_BODY_PARAMETER_COUNT) {
+            Offset = Offset + CaptureCount;
         }
+        
+        Parameters[i] = MemLoad(MemStackAddress(ExecData->ThreadStack,
+                                                Rsb + Offset * Alignment,
+                                                Alignment,
+                                                Checked),
+                                Alignment);
     }
     
-    ExecData->ActiveRegisterSet->Register[REG_RIP] =
-        ExecData->ActiveRegisterSet->Register[REG_RIP] + sizeof(INSTRUCTION);
+    ExecData->ActiveRegisterSet->Register[REG_RSB] = 
+        Rsb + (LOOP_PARAMETER_COUNT + CaptureCount) * Alignment;
+        
+    //
+    // The updates the caller made to reduction variables so far are folded
+    // in, as the runners fold theirs before it runs again.
+    //
+    
+    PoolReductionFold(ExecData);
+        
+    ExecData->ActiveRegisterSet->Register[REG_RIP] = 
+        ExecData->ActiveRegisterSet->Register[REG_RIP] + 1;
+        
+    TRACE_CONTROL(ExecData->Trace,
+                  TRACE_TYPE_CALL,
+                  ExecData->ActiveRegisterSet->Register[REG_RIP] - 1,
+                  0,
+                  Instruction->Target,
+                  0,
+                  ExecData->ActiveRegisterSet->Register[REG_RSB],
+                  0);
+                  
+    Loop = PoolLoopCreate(ExecData->Worker->Pool,
+                          Instruction->Target,
+                          (ULONG)Instruction->Right.Offset,
+                          Parameters[3],
+                          Parameters[2],
+                          Parameters[1],
+                          Parameters[0],
+                          CaptureCount);
+                          
+    if(Loop == NULL) {
+        return TRUE;
+    }
     
-    return TRUE;
+    //
+    // The first capture was pushed first, so it sits highest.
+    //
+    
+    Offset = LOOP_PARAMETER_COUNT - LOOP_BODY_PARAMETER_COUNT + CaptureCount;
+    for(i=0; i<(LONG64)CaptureCount; ++i) {
+        Offset = Offset - 1;
+        Loop->Captures[i] = MemLoad(MemStackAddress(ExecData->ThreadStack,
+                                                    Rsb + Offset * Alignment,
+                                                    Alignment,
+                                                    Checked),
+                                    Alignment);
+    }
+    
+    //
+    // The runners are parked on like a sync call, each finishing takes one
+    // off. The loop is gone once the last one does, so the count of them is
+    // kept apart.
+    //
+    
+    Runners = Loop->Runners;
+    ExecData->JoinCount = (LONG)Runners + 1;
+    ExecData->Status = EXEC_STATUS_PARKED;
+    for(i=0; i<Runners; ++i) {
+        CreationData = malloc(sizeof(THREAD_CREATION_DATA));
+        if(CreationData == NULL) {
+            VmFatal(ERR_STR_NOMEM);
+        }
+        
+        CreationData->RegisterSet = malloc(sizeof(REGISTER_SET));
+        if(CreationData->RegisterSet == NULL) {
+            VmFatal(ERR_STR_NOMEM);
+        }
+        
+        memset(CreationData->RegisterSet, 0, sizeof(REGISTER_SET));
+        CreationData->MiniStack = NULL;
+        CreationData->MiniStackSize = 0;
+        CreationData->JumpIndex = Instruction->Target;
+        CreationData->StackDepth = 
+            ExecThreadStackDepth(Symbol, 
+                                 Instruction, 
+                                 (Symbol->ParameterCount + 1) * Alignment);
+                                 
+        Thread = ExecThreadCreate(CreationData, ExecData);
+        Thread->Loop = Loop;
+        Thread->LoopRunner = i;
+        PoolSpawn(ExecData->Worker, Thread);
+    }
+    
+    return FALSE;
 }
 
 BOOL
 ExecReturnInstruction (
     PTHREAD_EXECUTION_DATA ExecData,
-    PINSTRUCTION Instruction
+    PDECODED_INSTRUCTION Instruction,
+    BOOL Checked
     )
     
 /*
@@ -525,9 +752,12 @@ ExecReturnInstruction (
     
     Instruction - The instruction to execute.
     
+    Checked - TRUE to bounds check the return address.
+    
  Return value:
  
-    TRUE if we should continue executing instructions. FALSE otherwise.
+    TRUE if we should continue executing instructions. FALSE if the thread 
+    returned from its entry function.
 
 */
     
@@ -536,59 +766,61 @@ ExecReturnInstruction (
     PREGISTER_SET TopRegisterSet;
     ULONG StackCleanup;
     ULONG ReturnAddress;
-    ULONG Rsb = 0;
-    signed StackOffset;
     
-    if(SStackSize(ExecData->RegisterSetStack) == 0) {
+    if(ExecData->FrameCount == 1) {
         return FALSE;
     }
     
-    StackCleanup = Instruction->Return.StackCleanup + 
-                   GProgram->Header.StackAlignment;
-    
-    TopRegisterSet = SStackPop(ExecData->RegisterSetStack);
-    StackOffset = ExecData->ActiveRegisterSet->Register[REG_RSB];
-    StackOffset = StackOffset - GStackPointerBias;
-    memcpy(&ReturnAddress, 
-           ExecData->ThreadStack+StackOffset, 
-           GProgram->Header.StackAlignment);
-           
-    assert((StackCleanup % GProgram->Header.StackAlignment) == 0);
+    StackCleanup = Instruction->StackCleanup;
+    
+    TopRegisterSet = ExecData->ActiveRegisterSet - 1;
+    ReturnAddress = MemLoad(MemStackAddress(ExecData->ThreadStack,
+                                            ExecData->ActiveRegisterSet->Register[REG_RSB], 
+                                            GProgram->Header.StackAlignment,
+                                            Checked),
+                            GProgram->Header.StackAlignment);
+                            
+    if(Checked != FALSE && ReturnAddress >= GProgram->InstructionCount) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
            
     ExecData->ActiveRegisterSet->Register[REG_RSB] = 
         ExecData->ActiveRegisterSet->Register[REG_RSB] + 
         StackCleanup;
            
-    fprintf(PRINT_OUT, "RETURN: RSB: 0x%X: Returning to 0x%X: Cleaning up 0x%X bytes\n", 
-           (int)ExecData->ActiveRegisterSet->Register[REG_RSB],
-           (int)ReturnAddress,
-           (int)StackCleanup);
-           
-    fprintf(PRINT_OUT, "Stack RSB: 0x%X, Active RSB: 0x%X\n",
-           (int)Rsb,
-           (int)ExecData->ActiveRegisterSet->Register[REG_RSB]);
+    TRACE_CONTROL(ExecData->Trace,
+                  TRACE_TYPE_RETURN,
+                  (ULONG)(Instruction - GProgram->Instructions),
+                  0,
+                  ReturnAddress,
+                  ExecData->ActiveRegisterSet->Register[REG_RSB],
+                  StackCleanup,
+                  0);
     
     TopRegisterSet->Register[REG_RIP] = ReturnAddress;
     TopRegisterSet->Register[REG_RRV] = ExecData->ActiveRegisterSet->Register[REG_RRV];
     TopRegisterSet->Register[REG_RST] = ExecData->ActiveRegisterSet->Register[REG_RST];
     TopRegisterSet->Register[REG_RSB] = ExecData->ActiveRegisterSet->Register[REG_RSB];
-    free(ExecData->ActiveRegisterSet);
+    ExecData->FrameCount = ExecData->FrameCount - 1;
     ExecData->ActiveRegisterSet = TopRegisterSet;
     
     return TRUE;
 }
 
-BOOL
-ExecStackInstruction (
+VOID
+ExecReductionInstruction (
     PTHREAD_EXECUTION_DATA ExecData,
-    PINSTRUCTION Instruction
+    PDECODED_INSTRUCTION Instruction
     )
     
 /*
 
  Routine description:
  
-    This routine executes a stack push/pop instruction.
+    This routine executes a reduction update. It goes to the copy the 
+    thread keeps of the variable, which no other thread writes, so it never
+    has to wait for the cache line. It leaves the operand in the destination
+    register.
     
  Arguments:
  
@@ -598,107 +830,48 @@ ExecStackInstruction (
     
  Return value:
  
-    TRUE if we should continue executing instructions. FALSE otherwise.
+    VOID.
 
-*/
-    
-{
-    ULONG R;
-    ULONG D;
-    PCHAR Da;
-    signed Ro;
-    signed StackOffset;
-    
-    R = Instruction->Stack.Register;
-    Ro = Instruction->Stack.RegisterOffset;
-    
-    if(R == REG_RGD) {
-        memcpy(&D, GProgram->GlobalData+Ro, GProgram->Header.StackAlignment);
-        Da = GProgram->GlobalData+Ro;
-    } if(IS_REGISTER_INDEX(R)) {
-        StackOffset = ExecData->ActiveRegisterSet->Register[R];
-        StackOffset = StackOffset - GStackPointerBias;
-        StackOffset = StackOffset + Ro;
-        //StackOffset = StackOffset - GProgram->Header.StackAlignment;
-        memcpy(&D, 
-               ExecData->ThreadStack+StackOffset, 
-               GProgram->Header.StackAlignment);
-               
-        fprintf(PRINT_OUT, 
-                "Pushing register index %s offset %d address 0x%p value %d\n",
-               _REGISTER_NAMES[R],
-               Ro,
-               ExecData->ThreadStack+StackOffset,
-               (int)D);
-               
-        Da = ExecData->ThreadStack+StackOffset;
-    } else if(R == REG_RCT) {
-        
-        assert(Instruction->Opcode == OPC_PUSH);
-        
-        D = Ro;
-    } else {        
-        D = ExecData->ActiveRegisterSet->Register[R];
-        Da = (PCHAR)&ExecData->ActiveRegisterSet->Register[R];
-    }
-    
-    switch(Instruction->Opcode) {
-    case OPC_PUSH: 
-        ExecData->ActiveRegisterSet->Register[REG_RSB] = 
-            ExecData->ActiveRegisterSet->Register[REG_RSB] - 
-            GProgram->Header.StackAlignment;
-        
-        StackOffset = ExecData->ActiveRegisterSet->Register[REG_RSB];
-        StackOffset = StackOffset - GStackPointerBias;
-        memcpy(ExecData->ThreadStack+StackOffset, 
-               &D, 
-               GProgram->Header.StackAlignment);
-            
-        fprintf(PRINT_OUT, 
-                "Push: Pushing 0x%X at 0x%p RSB: 0x%X\n",
-               (int)D,
-               ExecData->ThreadStack+StackOffset,
-               (int)ExecData->ActiveRegisterSet->Register[REG_RSB]);
-        
-        break;
-        
-    case OPC_POP:   
-        StackOffset = ExecData->ActiveRegisterSet->Register[REG_RSB];
-        StackOffset = StackOffset - GStackPointerBias;
-        memcpy(Da,
-               ExecData->ThreadStack+StackOffset,
-               GProgram->Header.StackAlignment);
-               
-        fprintf(PRINT_OUT, 
-                "Pop: Poping 0x%X at 0x%p RSB: 0x%X\n",
-               (int)*(int*)Da,
-               ExecData->ThreadStack+StackOffset,
-               (int)ExecData->ActiveRegisterSet->Register[REG_RSB]);  
-        
-        ExecData->ActiveRegisterSet->Register[REG_RSB] = 
-            ExecData->ActiveRegisterSet->Register[REG_RSB] +
-            GProgram->Header.StackAlignment;
-        
-        break;
-    }
+*/
     
-    ExecData->ActiveRegisterSet->Register[REG_RIP] =
-        ExecData->ActiveRegisterSet->Register[REG_RIP] + sizeof(INSTRUCTION);
+{
+    PREGISTER_SET Registers;
+    LONG Value;
+    
+    Registers = ExecData->ActiveRegisterSet;
+    Value = MemOperandValue(ExecData, 
+                            &Instruction->Right, 
+                            GProgram->Header.StackAlignment, 
+                            TRUE);
+                            
+    //
+    // A sum folds subtractions in as additions.
+    //
     
-    return TRUE;
+    PoolReductionUpdate(ExecData,
+                        Instruction->Slot,
+                        MemGlobalAddress(GProgram->GlobalData,
+                                         Instruction->Left.Offset,
+                                         GProgram->Header.StackAlignment,
+                                         TRUE),
+                        (Instruction->BaseOpcode == OPC_RSUB) ? 
+                            (LONG)(0 - (ULONG)Value) : Value);
+                    
+    Registers->Register[Instruction->Destination.Register] = Value;
 }
 
-BOOL
+VOID
 ExecIoInstruction (
     PTHREAD_EXECUTION_DATA ExecData,
-    PINSTRUCTION Instruction
+    PDECODED_INSTRUCTION Instruction
     )
     
 /*
 
  Routine description:
  
-    This routine executes an IO read/print instruction.
+    This routine executes an IO read/print instruction. I/O is slow enough
+    next to a bounds check that it's always checked.
     
  Arguments:
  
@@ -708,19 +881,18 @@ ExecIoInstruction (
     
  Return value:
  
-    TRUE if we should continue executing instructions. FALSE otherwise.
+    VOID.
 
 */
     
 {
     ULONG i;
     ULONG PopCount;
-    signed StackOffset;
     signed PrintVal;
-    signed ReadAddress;
-    signed RsbOffset;
+    ULONG ReadAddress;
+    ULONG RsbOffset;
     
-    PopCount = Instruction->Io.PopCount;
+    PopCount = Instruction->PopCount;
     RsbOffset = ExecData->ActiveRegisterSet->Register[REG_RSB] + 
                 PopCount * GProgram->Header.StackAlignment - 
                 GProgram->Header.StackAlignment;
@@ -732,16 +904,15 @@ ExecIoInstruction (
                 ExecData->ActiveRegisterSet->Register[REG_RSB] +
                 GProgram->Header.StackAlignment;
                 
-                StackOffset = RsbOffset;
-                StackOffset = StackOffset - GStackPointerBias;
-                memcpy(&PrintVal,
-                       ExecData->ThreadStack+StackOffset,
-                       GProgram->Header.StackAlignment);
+                PrintVal = MemLoad(MemStackAddress(ExecData->ThreadStack,
+                                                   RsbOffset,
+                                                   GProgram->Header.StackAlignment,
+                                                   TRUE),
+                                   GProgram->Header.StackAlignment);
                 
 #ifdef COMPILE_VERBOSE
-                fprintf(PRINT_OUT, 
-                        "PRINT: 0x%p: RSB: 0x%X: RsbOffset: 0x%X: %d\n", 
-                       ExecData->ThreadStack+StackOffset,
+                printf("PRINT: 0x%p: RSB: 0x%X: RsbOffset: 0x%X: %d\n",
+                       ExecData->ThreadStack+RsbOffset,
                        (int)ExecData->ActiveRegisterSet->Register[REG_RSB],
                        (int)RsbOffset,
                        PrintVal);
@@ -759,202 +930,634 @@ ExecIoInstruction (
                 ExecData->ActiveRegisterSet->Register[REG_RSB] +
                 GProgram->Header.StackAlignment;
                 
-                StackOffset = RsbOffset;
-                StackOffset = StackOffset - GStackPointerBias;
-                memcpy(&ReadAddress,
-                       ExecData->ThreadStack+StackOffset,
-                       GProgram->Header.StackAlignment);
+                ReadAddress = MemLoad(MemStackAddress(ExecData->ThreadStack,
+                                                      RsbOffset,
+                                                      GProgram->Header.StackAlignment,
+                                                      TRUE),
+                                      GProgram->Header.StackAlignment);
                 
-                ReadAddress = ReadAddress - GStackPointerBias;
 #ifdef COMPILE_VERBOSE
-                fprintf(PRINT_OUT, 
-                        "READ: RSB: 0x%X: RsbOffset: 0x%X: ReadAddr: 0x%X: ", 
+                printf("READ: RSB: 0x%X: RsbOffset: 0x%X: ReadAddr: 0x%X: ",
                        (int)ExecData->ActiveRegisterSet->Register[REG_RSB], 
                        (int)RsbOffset,
-                       (int)(ReadAddress + GStackPointerBias));
+                       (int)ReadAddress);
 #else
                 printf("READ: ");
 #endif            
-                scanf("%d", (int*)(ExecData->ThreadStack+ReadAddress));
+                scanf("%d", (int*)MemStackAddress(ExecData->ThreadStack,
+                                                  ReadAddress,
+                                                  sizeof(int),
+                                                  TRUE));
                 
                 RsbOffset = RsbOffset - GProgram->Header.StackAlignment;
             }
             
             break;
     }
+}
+
+//
+// The interpreter core is written once, as one handler per opcode. With 
+// EXEC_THREADED_DISPATCH defined the handlers are GCC labels and each one 
+// jumps straight to the next through a dispatch table indexed by opcode. 
+// Without it they are the cases of a portable switch loop.
+//
+
+#ifdef EXEC_THREADED_DISPATCH
+#define EXEC_HANDLER(Opcode)        Handler_##Opcode:
+#define EXEC_QUICK_HANDLER(Name, Opcode)    Handler_##Name:
+#ifdef EXEC_LOOP_JIT
+#define EXEC_DISPATCH()                                                     \
+    EXEC_TRACE_FETCH();                                                     \
+    goto *Dispatch[Instruction->Opcode]
+#else
+#define EXEC_DISPATCH()                                                     \
+    EXEC_TRACE_FETCH();                                                     \
+    goto *DispatchTable[Instruction->Opcode]
+#endif
+#else
+#define EXEC_HANDLER(Opcode)        case Opcode:
+#define EXEC_QUICK_HANDLER(Name, Opcode)    case Opcode:
+#define EXEC_DISPATCH()             continue
+#endif
+
+#define EXEC_INDEX()                (ULONG)(Instruction - Instructions)
+
+//
+// With EXEC_LOOP_JIT every jump back to an earlier instruction counts as a
+// trip round a loop. A loop that has a trace runs it, and when the trace
+// leaves the loop the interpreter picks up where it left off. A loop that
+// just got hot is recorded for the loop JIT. While recording, threaded
+// dispatch goes through a table sending every opcode to the recorder first.
+//
+
+#ifdef EXEC_LOOP_JIT
+
+#ifdef EXEC_THREADED_DISPATCH
+#define EXEC_SET_DISPATCH(Table)    Dispatch = (Table)
+#else
+#define EXEC_SET_DISPATCH(Table)    ((VOID)0)
+#endif
+
+#define EXEC_LOOP_BACKEDGE()                                                \
+    if(Instruction->Target <= EXEC_INDEX() &&                               \
+       Loops != NULL &&                                                     \
+       Recorder == NULL) {                                                  \
+                                                                            \
+        D = Instruction->Target;                                            \
+        if(Loops->Traces[D] != NULL) {                                      \
+            Instruction = &Instructions[JitLoopExecute(ExecData, D)];       \
+            EXEC_DISPATCH();                                                \
+        }                                                                   \
+                                                                            \
+        if(Loops->Counters[D] < JIT_LOOP_THRESHOLD &&                       \
+           ++Loops->Counters[D] == JIT_LOOP_THRESHOLD) {                    \
+                                                                            \
+            Recorder = JitLoopRecorderCreate(D);                            \
+            if(Recorder != NULL) {                                          \
+                EXEC_SET_DISPATCH(RecordTable);                             \
+            }                                                               \
+        }                                                                   \
+    }
+
+#else
+#define EXEC_LOOP_BACKEDGE()        ((VOID)0)
+#endif
+
+//
+// Backward jumps and calls take from the time slice of the thread, and the
+// one that finds it used up stops the core, to run again from that same
+// instruction. A loop being recorded finishes its trip first.
+//
+
+#ifdef EXEC_LOOP_JIT
+#define EXEC_PREEMPTIBLE()          (Recorder == NULL)
+#else
+#define EXEC_PREEMPTIBLE()          TRUE
+#endif
+
+#define EXEC_PREEMPT()                                                      \
+    if(ExecData->Budget != 0) {                                             \
+        ExecData->Budget = ExecData->Budget - 1;                            \
+    } else if(EXEC_PREEMPTIBLE()) {                                         \
+        ExecData->Status = EXEC_STATUS_YIELDED;                             \
+        goto ExecCoreEnd;                                                   \
+    }
+
+//
+// Trace points. These cost nothing unless TRACE_LEVEL asks for them.
+//
+
+#define EXEC_TRACE_FETCH()                                                  \
+    TRACE_INSTRUCTION(ExecData->Trace, TRACE_TYPE_FETCH, EXEC_INDEX(), 0,   \
+                      Instruction->Opcode, 0, 0, 0)
+
+#define EXEC_NEXT()                                                         \
+    Instruction = Instruction + 1;                                          \
+    EXEC_DISPATCH()
+
+//
+// RIP only lives in the register set across calls, returns and thread 
+// boundaries. Everywhere else the instruction pointer is a local.
+//
+
+#define EXEC_SAVE_RIP()                                                     \
+    ExecData->ActiveRegisterSet->Register[REG_RIP] =                        \
+        (ULONG)(Instruction - Instructions)
+        
+#define EXEC_LOAD_RIP()                                                     \
+    Registers = ExecData->ActiveRegisterSet;                                \
+    Instruction = &Instructions[Registers->Register[REG_RIP]]
+
+#define EXEC_TRACE_ARITHMETIC()                                             \
+    TRACE_INSTRUCTION(ExecData->Trace, TRACE_TYPE_ARITHMETIC, EXEC_INDEX(), \
+                      Instruction->Destination.Register, L, R, D,           \
+                      Instruction->Destination.Offset)
+
+#define EXEC_TRACE_STORE()                                                  \
+    TRACE_MEMORY(ExecData->Trace, TRACE_TYPE_STORE, EXEC_INDEX(),           \
+                 Instruction->Destination.Register, D,                      \
+                 Instruction->Destination.Offset, 0, 0)
+
+#define EXEC_TRACE_RCOPYD()                                                 \
+    TRACE_INSTRUCTION(ExecData->Trace, TRACE_TYPE_RCOPYD, EXEC_INDEX(),     \
+                      Instruction->Destination.Register, D, 0, 0, 0)
+
+#define EXEC_TRACE_PUSH()                                                   \
+    TRACE_MEMORY(ExecData->Trace, TRACE_TYPE_PUSH, EXEC_INDEX(), 0, D,      \
+                 Registers->Register[REG_RSB], 0, 0)
+
+#define EXEC_TRACE_POP()                                                    \
+    TRACE_MEMORY(ExecData->Trace, TRACE_TYPE_POP, EXEC_INDEX(), 0, D,       \
+                 Registers->Register[REG_RSB], 0, 0)
+
+#define EXEC_TRACE_JUMP()                                                   \
+    TRACE_CONTROL(ExecData->Trace, TRACE_TYPE_JUMP, EXEC_INDEX(), 0,        \
+                  Instruction->Target, 0, 0, 0)
+
+#define EXEC_TRACE_BRANCH(Target, Condition)                                \
+    TRACE_CONTROL(ExecData->Trace, TRACE_TYPE_BRANCH, EXEC_INDEX(), 0,      \
+                  (Target), (Condition), 0, 0)
+
+//
+// Only instructions reading atomic variables, or computing into memory, are
+// left to the generic handlers, so they can afford to look at the flags.
+//
+
+#define EXEC_LOAD_OPERAND(Operand)                                          \
+    (((Instruction->Flags & DECODED_FLAG_ATOMIC_LOAD) != 0) ?               \
+     MemOperandValueAcquire(ExecData, &(Operand), EXEC_CORE_ALIGNMENT,      \
+                            EXEC_CORE_CHECKED) :                            \
+     MemOperandValue(ExecData, &(Operand), EXEC_CORE_ALIGNMENT,             \
+                     EXEC_CORE_CHECKED))
+
+#define EXEC_ARITHMETIC(Operator)                                           \
+    L = EXEC_LOAD_OPERAND(Instruction->Left);                               \
+    R = EXEC_LOAD_OPERAND(Instruction->Right);                              \
+    D = L Operator R;                                                       \
+    EXEC_TRACE_ARITHMETIC();                                                \
+    MemOperandStore(ExecData, &Instruction->Destination, D,                 \
+                    EXEC_CORE_ALIGNMENT, EXEC_CORE_CHECKED);                \
+    EXEC_NEXT()
+    
+//
+// Operand accessors for a known operand kind. These are what the quickened
+// handlers are built from.
+//
+
+#define EXEC_LOAD_REGISTER(Operand)                                         \
+    ((LONG)Registers->Register[(Operand).Register])
     
-    ExecData->ActiveRegisterSet->Register[REG_RIP] =
-        ExecData->ActiveRegisterSet->Register[REG_RIP] + sizeof(INSTRUCTION);
+#define EXEC_LOAD_CONSTANT(Operand)                                         \
+    ((Operand).Offset)
     
-    return TRUE;
-}
+#define EXEC_GLOBAL_ADDRESS(Operand)                                        \
+    MemGlobalAddress(GlobalData, (Operand).Offset, EXEC_CORE_ALIGNMENT,     \
+                     EXEC_CORE_CHECKED)
+    
+#define EXEC_STACK_ADDRESS(Operand)                                         \
+    MemStackAddress(Stack,                                                  \
+                    Registers->Register[(Operand).Register]+(Operand).Offset,\
+                    EXEC_CORE_ALIGNMENT,                                    \
+                    EXEC_CORE_CHECKED)
+    
+#define EXEC_MEMORY_ADDRESS(Operand)                                        \
+    (((Operand).Kind == OPERAND_KIND_GLOBAL) ?                              \
+     EXEC_GLOBAL_ADDRESS(Operand) : EXEC_STACK_ADDRESS(Operand))
+    
+#define EXEC_LOAD_GLOBAL(Operand)                                           \
+    MemLoad(EXEC_GLOBAL_ADDRESS(Operand), EXEC_CORE_ALIGNMENT)
+    
+#define EXEC_LOAD_STACK(Operand)                                            \
+    MemLoad(EXEC_STACK_ADDRESS(Operand), EXEC_CORE_ALIGNMENT)
+    
+#define EXEC_STORE_REGISTER(Operand, Value)                                 \
+    Registers->Register[(Operand).Register] = (Value)
+    
+#define EXEC_STORE_GLOBAL(Operand, Value)                                   \
+    MemStore(EXEC_GLOBAL_ADDRESS(Operand), (Value), EXEC_CORE_ALIGNMENT)
+    
+#define EXEC_STORE_STACK(Operand, Value)                                    \
+    MemStore(EXEC_STACK_ADDRESS(Operand), (Value), EXEC_CORE_ALIGNMENT)
 
-BOOL
-ExecProcessInstruction (
-    PTHREAD_EXECUTION_DATA ExecData,
-    PINSTRUCTION Instruction
+//
+// The quickened handler templates. Every variant the decoder can produce is
+// stamped out from these through the variant lists below, once as a handler
+// and once as its dispatch table entry.
+//
+
+#define EXEC_QUICK_ARITHMETIC_OPCODE(Name, LeftKind, RightKind)             \
+    QUICK_OPCODE_ARITHMETIC(QUICK_OPERATOR_##Name,                          \
+                            OPERAND_KIND_##LeftKind,                        \
+                            OPERAND_KIND_##RightKind)
+
+#define EXEC_QUICK_ARITHMETIC_HANDLER(Name, Operator, LeftKind, RightKind)  \
+    EXEC_QUICK_HANDLER(Quick_##Name##_##LeftKind##_##RightKind,             \
+                       EXEC_QUICK_ARITHMETIC_OPCODE(Name, LeftKind, RightKind))\
+        L = EXEC_LOAD_##LeftKind(Instruction->Left);                        \
+        R = EXEC_LOAD_##RightKind(Instruction->Right);                      \
+        D = L Operator R;                                                   \
+        EXEC_TRACE_ARITHMETIC();                                            \
+        EXEC_STORE_REGISTER(Instruction->Destination, D);                   \
+        EXEC_NEXT();
+        
+#define EXEC_QUICK_ARITHMETIC_ENTRY(Name, Operator, LeftKind, RightKind)    \
+    [EXEC_QUICK_ARITHMETIC_OPCODE(Name, LeftKind, RightKind)] =             \
+        &&Handler_Quick_##Name##_##LeftKind##_##RightKind,
+
+#define EXEC_KIND_PAIR_VARIANTS(X, Name, Operator)                          \
+    X(Name, Operator, REGISTER, REGISTER)                                   \
+    X(Name, Operator, REGISTER, CONSTANT)                                   \
+    X(Name, Operator, REGISTER, GLOBAL)                                     \
+    X(Name, Operator, REGISTER, STACK)                                      \
+    X(Name, Operator, CONSTANT, REGISTER)                                   \
+    X(Name, Operator, CONSTANT, CONSTANT)                                   \
+    X(Name, Operator, CONSTANT, GLOBAL)                                     \
+    X(Name, Operator, CONSTANT, STACK)                                      \
+    X(Name, Operator, GLOBAL, REGISTER)                                     \
+    X(Name, Operator, GLOBAL, CONSTANT)                                     \
+    X(Name, Operator, GLOBAL, GLOBAL)                                       \
+    X(Name, Operator, GLOBAL, STACK)                                        \
+    X(Name, Operator, STACK, REGISTER)                                      \
+    X(Name, Operator, STACK, CONSTANT)                                      \
+    X(Name, Operator, STACK, GLOBAL)                                        \
+    X(Name, Operator, STACK, STACK)
+    
+#define EXEC_QUICK_ARITHMETIC_HANDLERS(Name, Operator)                      \
+    EXEC_KIND_PAIR_VARIANTS(EXEC_QUICK_ARITHMETIC_HANDLER, Name, Operator)
+    
+#define EXEC_QUICK_ARITHMETIC_ENTRIES(Name, Operator)                       \
+    EXEC_KIND_PAIR_VARIANTS(EXEC_QUICK_ARITHMETIC_ENTRY, Name, Operator)
+
+//
+// The fused handler templates. A fused instruction runs the whole idiom it
+// replaced, picking up the operands of the instructions it covers from the
+// slots after it, and then skips over them.
+//
+
+#define EXEC_FUSED_ELEMENT_ADDRESS_HANDLER(Kind)                            \
+    EXEC_QUICK_HANDLER(Fused_ELEMENT_ADDRESS_##Kind,                        \
+                       FUSED_OPCODE_ELEMENT_ADDRESS(OPERAND_KIND_##Kind))   \
+        L = EXEC_LOAD_##Kind(Instruction->Left);                            \
+        R = L * Instruction->Right.Offset + Instruction[1].Right.Offset;    \
+        EXEC_STORE_REGISTER(Instruction->Destination, R);                   \
+        D = EXEC_LOAD_REGISTER(Instruction[2].Left) + R;                    \
+        EXEC_STORE_REGISTER(Instruction[2].Destination, D);                 \
+        Instruction = Instruction + 2;                                      \
+        EXEC_TRACE_RCOPYD();                                                \
+        EXEC_NEXT();
+
+#define EXEC_FUSED_ELEMENT_ADDRESS_ENTRY(Kind)                              \
+    [FUSED_OPCODE_ELEMENT_ADDRESS(OPERAND_KIND_##Kind)] =                   \
+        &&Handler_Fused_ELEMENT_ADDRESS_##Kind,
+
+#define EXEC_FUSED_ELEMENT_ADDRESS_VARIANTS(X)                              \
+    X(REGISTER) X(CONSTANT) X(GLOBAL) X(STACK)
+
+#define EXEC_FUSED_COMPARE_BRANCH_OPCODE(Name, LeftKind, RightKind)         \
+    FUSED_OPCODE_COMPARE_BRANCH(FUSE_COMPARE_##Name,                        \
+                                OPERAND_KIND_##LeftKind,                    \
+                                OPERAND_KIND_##RightKind)
+
+#define EXEC_FUSED_COMPARE_BRANCH_HANDLER(Name, Operator, LeftKind, RightKind)\
+    EXEC_QUICK_HANDLER(Fused_##Name##_JMPZ_##LeftKind##_##RightKind,        \
+                       EXEC_FUSED_COMPARE_BRANCH_OPCODE(Name,               \
+                                                        LeftKind,           \
+                                                        RightKind))         \
+        L = EXEC_LOAD_##LeftKind(Instruction->Left);                        \
+        R = EXEC_LOAD_##RightKind(Instruction->Right);                      \
+        D = L Operator R;                                                   \
+        EXEC_TRACE_ARITHMETIC();                                            \
+        EXEC_STORE_REGISTER(Instruction->Destination, D);                   \
+        Instruction = Instruction + 1;                                      \
+        EXEC_TRACE_BRANCH(Instruction->Target, D);                          \
+        if(D == 0) {                                                        \
+            Instruction = &Instructions[Instruction->Target];               \
+            EXEC_DISPATCH();                                                \
+        }                                                                   \
+                                                                            \
+        EXEC_NEXT();
+
+#define EXEC_FUSED_COMPARE_BRANCH_ENTRY(Name, Operator, LeftKind, RightKind)\
+    [EXEC_FUSED_COMPARE_BRANCH_OPCODE(Name, LeftKind, RightKind)] =         \
+        &&Handler_Fused_##Name##_JMPZ_##LeftKind##_##RightKind,
+
+#define EXEC_FUSED_COMPARE_BRANCH_HANDLERS(Name, Operator)                  \
+    EXEC_KIND_PAIR_VARIANTS(EXEC_FUSED_COMPARE_BRANCH_HANDLER, Name, Operator)
+
+#define EXEC_FUSED_COMPARE_BRANCH_ENTRIES(Name, Operator)                   \
+    EXEC_KIND_PAIR_VARIANTS(EXEC_FUSED_COMPARE_BRANCH_ENTRY, Name, Operator)
+
+#define EXEC_FUSED_ARITHMETIC_STORE_OPCODE(Name, LeftKind, RightKind,       \
+                                           DestinationKind)                 \
+    FUSED_OPCODE_ARITHMETIC_STORE(FUSE_ARITHMETIC_##Name,                   \
+                                  OPERAND_KIND_##LeftKind,                  \
+                                  OPERAND_KIND_##RightKind,                 \
+                                  OPERAND_KIND_##DestinationKind)
+
+#define EXEC_FUSED_ARITHMETIC_STORE_HANDLER(Name, Operator, LeftKind,       \
+                                            RightKind, DestinationKind)     \
+    EXEC_QUICK_HANDLER(Fused_##Name##_STR_##LeftKind##_##RightKind##_##DestinationKind,\
+                       EXEC_FUSED_ARITHMETIC_STORE_OPCODE(Name,             \
+                                                          LeftKind,         \
+                                                          RightKind,        \
+                                                          DestinationKind)) \
+        L = EXEC_LOAD_##LeftKind(Instruction->Left);                        \
+        R = EXEC_LOAD_##RightKind(Instruction->Right);                      \
+        D = L Operator R;                                                   \
+        EXEC_TRACE_ARITHMETIC();                                            \
+        EXEC_STORE_REGISTER(Instruction->Destination, D);                   \
+        Instruction = Instruction + 1;                                      \
+        D = (LONG)((ULONG)D << Instruction->StoreShift) >>                  \
+            Instruction->StoreShift;                                        \
+        EXEC_STORE_##DestinationKind(Instruction->Destination, D);          \
+        EXEC_TRACE_STORE();                                                 \
+        EXEC_NEXT();
+
+#define EXEC_FUSED_ARITHMETIC_STORE_ENTRY(Name, Operator, LeftKind,         \
+                                          RightKind, DestinationKind)       \
+    [EXEC_FUSED_ARITHMETIC_STORE_OPCODE(Name,                               \
+                                        LeftKind,                           \
+                                        RightKind,                          \
+                                        DestinationKind)] =                 \
+        &&Handler_Fused_##Name##_STR_##LeftKind##_##RightKind##_##DestinationKind,
+
+#define EXEC_FUSED_ARITHMETIC_STORE_GLOBAL_HANDLER(Name, Operator, LeftKind, RightKind) \
+    EXEC_FUSED_ARITHMETIC_STORE_HANDLER(Name, Operator, LeftKind, RightKind, GLOBAL)
+
+#define EXEC_FUSED_ARITHMETIC_STORE_STACK_HANDLER(Name, Operator, LeftKind, RightKind) \
+    EXEC_FUSED_ARITHMETIC_STORE_HANDLER(Name, Operator, LeftKind, RightKind, STACK)
+
+#define EXEC_FUSED_ARITHMETIC_STORE_GLOBAL_ENTRY(Name, Operator, LeftKind, RightKind) \
+    EXEC_FUSED_ARITHMETIC_STORE_ENTRY(Name, Operator, LeftKind, RightKind, GLOBAL)
+
+#define EXEC_FUSED_ARITHMETIC_STORE_STACK_ENTRY(Name, Operator, LeftKind, RightKind) \
+    EXEC_FUSED_ARITHMETIC_STORE_ENTRY(Name, Operator, LeftKind, RightKind, STACK)
+
+#define EXEC_FUSED_ARITHMETIC_STORE_HANDLERS(Name, Operator)                \
+    EXEC_KIND_PAIR_VARIANTS(EXEC_FUSED_ARITHMETIC_STORE_GLOBAL_HANDLER,     \
+                            Name,                                           \
+                            Operator)                                       \
+    EXEC_KIND_PAIR_VARIANTS(EXEC_FUSED_ARITHMETIC_STORE_STACK_HANDLER,      \
+                            Name,                                           \
+                            Operator)
+
+#define EXEC_FUSED_ARITHMETIC_STORE_ENTRIES(Name, Operator)                 \
+    EXEC_KIND_PAIR_VARIANTS(EXEC_FUSED_ARITHMETIC_STORE_GLOBAL_ENTRY,       \
+                            Name,                                           \
+                            Operator)                                       \
+    EXEC_KIND_PAIR_VARIANTS(EXEC_FUSED_ARITHMETIC_STORE_STACK_ENTRY,        \
+                            Name,                                           \
+                            Operator)
+
+#define EXEC_QUICK_STORE_HANDLER(RightKind, DestinationKind)                \
+    EXEC_QUICK_HANDLER(Quick_STR_##RightKind##_##DestinationKind,           \
+                       QUICK_OPCODE_STORE(OPERAND_KIND_##RightKind,         \
+                                          OPERAND_KIND_##DestinationKind))  \
+        R = EXEC_LOAD_##RightKind(Instruction->Right);                      \
+        D = (LONG)((ULONG)R << Instruction->StoreShift) >>                  \
+            Instruction->StoreShift;                                        \
+        EXEC_STORE_##DestinationKind(Instruction->Destination, D);          \
+        EXEC_TRACE_STORE();                                                 \
+        EXEC_NEXT();
+        
+#define EXEC_QUICK_STORE_ENTRY(RightKind, DestinationKind)                  \
+    [QUICK_OPCODE_STORE(OPERAND_KIND_##RightKind,                           \
+                        OPERAND_KIND_##DestinationKind)] =                  \
+        &&Handler_Quick_STR_##RightKind##_##DestinationKind,
+
+#define EXEC_QUICK_STORE_VARIANTS(X)                                        \
+    X(REGISTER, REGISTER) X(REGISTER, GLOBAL) X(REGISTER, STACK)            \
+    X(CONSTANT, REGISTER) X(CONSTANT, GLOBAL) X(CONSTANT, STACK)            \
+    X(GLOBAL, REGISTER) X(GLOBAL, GLOBAL) X(GLOBAL, STACK)                  \
+    X(STACK, REGISTER) X(STACK, GLOBAL) X(STACK, STACK)
+
+#define EXEC_QUICK_PUSH_HANDLER(Kind)                                       \
+    EXEC_QUICK_HANDLER(Quick_PUSH_##Kind,                                   \
+                       QUICK_OPCODE_PUSH(OPERAND_KIND_##Kind))              \
+        D = EXEC_LOAD_##Kind(Instruction->Left);                            \
+        MemStackPush(ExecData, D, EXEC_CORE_ALIGNMENT, EXEC_CORE_CHECKED);  \
+        EXEC_TRACE_PUSH();                                                  \
+        EXEC_NEXT();
+        
+#define EXEC_QUICK_PUSH_ENTRY(Kind)                                         \
+    [QUICK_OPCODE_PUSH(OPERAND_KIND_##Kind)] = &&Handler_Quick_PUSH_##Kind,
+    
+#define EXEC_QUICK_PUSH_VARIANTS(X)                                         \
+    X(REGISTER) X(CONSTANT) X(GLOBAL) X(STACK)
+    
+#define EXEC_QUICK_POP_HANDLER(Kind)                                        \
+    EXEC_QUICK_HANDLER(Quick_POP_##Kind,                                    \
+                       QUICK_OPCODE_POP(OPERAND_KIND_##Kind))               \
+        D = MemStackPop(ExecData, EXEC_CORE_ALIGNMENT, EXEC_CORE_CHECKED);  \
+        EXEC_STORE_##Kind(Instruction->Destination, D);                     \
+        EXEC_TRACE_POP();                                                   \
+        EXEC_NEXT();
+        
+#define EXEC_QUICK_POP_ENTRY(Kind)                                          \
+    [QUICK_OPCODE_POP(OPERAND_KIND_##Kind)] = &&Handler_Quick_POP_##Kind,
+    
+#define EXEC_QUICK_POP_VARIANTS(X)                                          \
+    X(REGISTER) X(GLOBAL) X(STACK)
+    
+#define EXEC_OPCODE_LIST(X)                                                 \
+    X(OPC_ADDI) X(OPC_ADDF) X(OPC_SUBI) X(OPC_SUBF) X(OPC_MULI)             \
+    X(OPC_MULF) X(OPC_DIVI) X(OPC_DIVF) X(OPC_RCOPYD) X(OPC_XOR)            \
+    X(OPC_OR) X(OPC_AND) X(OPC_NOT) X(OPC_LOR) X(OPC_LAND) X(OPC_EQ)        \
+    X(OPC_NEQ) X(OPC_LT) X(OPC_GT) X(OPC_LTE) X(OPC_GTE) X(OPC_STRI8)       \
+    X(OPC_STRU8) X(OPC_STRI16) X(OPC_STRU16) X(OPC_STRI32) X(OPC_STRU32)    \
+    X(OPC_STRF) X(OPC_STRTH) X(OPC_JMP) X(OPC_JMPZ) X(OPC_CALLNORM)         \
+    X(OPC_CALLPLLS) X(OPC_CALLPLLA) X(OPC_RETURN) X(OPC_PUSH) X(OPC_POP)    \
+    X(OPC_PRINT) X(OPC_READ) X(OPC_AADD) X(OPC_ASUB) X(OPC_AOR)             \
+    X(OPC_AAND) X(OPC_AXOR) X(OPC_ACAS) X(OPC_JOIN) X(OPC_PFOR)             \
+    X(OPC_RADD) X(OPC_RSUB) X(OPC_ROR) X(OPC_RAND) X(OPC_RXOR)              \
+    X(OPC_RMIN) X(OPC_RMAX) X(OPC_WAIT) X(OPC_SEND) X(OPC_RECV)
+
+#define EXEC_DISPATCH_ENTRY(Opcode)     [Opcode] = &&Handler_##Opcode,
+
+//
+// The interpreter core, once per supported stack alignment for programs the
+// verifier proved safe, and once more each with every access to VM memory
+// bounds checked for the rest.
+//
+
+#define EXEC_CORE_ROUTINE           ExecThreadExecute4
+#define EXEC_CORE_ALIGNMENT         4
+#define EXEC_CORE_CHECKED           FALSE
+#include "exec_core.h"
+#undef EXEC_CORE_ROUTINE
+#undef EXEC_CORE_ALIGNMENT
+#undef EXEC_CORE_CHECKED
+
+#define EXEC_CORE_ROUTINE           ExecThreadExecute8
+#define EXEC_CORE_ALIGNMENT         8
+#define EXEC_CORE_CHECKED           FALSE
+#include "exec_core.h"
+#undef EXEC_CORE_ROUTINE
+#undef EXEC_CORE_ALIGNMENT
+#undef EXEC_CORE_CHECKED
+
+#define EXEC_CORE_ROUTINE           ExecThreadExecuteChecked4
+#define EXEC_CORE_ALIGNMENT         4
+#define EXEC_CORE_CHECKED           TRUE
+#include "exec_core.h"
+#undef EXEC_CORE_ROUTINE
+#undef EXEC_CORE_ALIGNMENT
+#undef EXEC_CORE_CHECKED
+
+#define EXEC_CORE_ROUTINE           ExecThreadExecuteChecked8
+#define EXEC_CORE_ALIGNMENT         8
+#define EXEC_CORE_CHECKED           TRUE
+#include "exec_core.h"
+#undef EXEC_CORE_ROUTINE
+#undef EXEC_CORE_ALIGNMENT
+#undef EXEC_CORE_CHECKED
+
+VOID
+ExecThreadExecute (
+    PTHREAD_EXECUTION_DATA ExecData
     )
     
 /*
 
  Routine description:
  
-    This routine executes an instruction.
+    This routine runs an execution thread, natively when the program was
+    translated and otherwise in the interpreter core matching the stack
+    alignment of the program, checked unless the program was verified. The
+    core leaves the reason it stopped in the status of the thread. The JIT
+    doesn't translate programs with parallel calls or loops, so their 
+    threads never need to stop early and run to their end.
     
  Arguments:
  
     ExecData - The thread execution data for the calling thread.
     
-    Instruction - The instruction to execute.
-    
  Return value:
  
-    TRUE if we should continue executing instructions. FALSE otherwise.
+    VOID.
 
 */
     
 {
-    switch(Instruction->Opcode) {
-        case OPC_ADDI:
-        case OPC_ADDF:
-        case OPC_SUBI:
-        case OPC_SUBF:
-        case OPC_MULI:
-        case OPC_MULF:
-        case OPC_DIVI:
-        case OPC_DIVF:
-        case OPC_XOR:
-        case OPC_OR:
-        case OPC_AND:
-        case OPC_NOT:
-        case OPC_LOR:
-        case OPC_LAND:
-        case OPC_EQ:
-        case OPC_NEQ:
-        case OPC_LT:
-        case OPC_GT:
-        case OPC_LTE:
-        case OPC_GTE:
-            return ExecArithmeticInstruction(ExecData, Instruction);
-            
-        case OPC_MOVE:
-        case OPC_RCOPYD:
-            return ExecDirectIndirectInstruction(ExecData, Instruction);
-            
-        case OPC_STRI8:
-        case OPC_STRU8:
-        case OPC_STRI16:
-        case OPC_STRU16:
-        case OPC_STRI32:
-        case OPC_STRU32:
-        case OPC_STRF:
-        case OPC_STRTH:
-            return ExecStoreInstruction(ExecData, Instruction);
-            
-        case OPC_JMP:
-        case OPC_JMPZ:
-        case OPC_CALLNORM:
-        case OPC_CALLPLLS:
-        case OPC_CALLPLLA:
-            return ExecJumpInstruction(ExecData, Instruction);
-            
-        case OPC_RETURN:
-            return ExecReturnInstruction(ExecData, Instruction);
-            
-        case OPC_PUSH:
-        case OPC_POP:
-            return ExecStackInstruction(ExecData, Instruction);
-            
-        case OPC_PRINT:
-        case OPC_READ:
-            return ExecIoInstruction(ExecData, Instruction);
-            
-        case OPC_ERR:
-        default:
-            VmFatal(ERR_STR_INVALIDINSTR);
-            return FALSE; // Keep the compiler happy.
+#ifdef EXEC_JIT
+    if(GProgram->Jit != NULL) {
+        JitExecute(ExecData);
+        return;
+    }
+#endif
+
+    if(GProgram->Verified == FALSE) {
+        if(GProgram->Header.StackAlignment == 8) {
+            ExecThreadExecuteChecked8(ExecData);
+        } else {
+            ExecThreadExecuteChecked4(ExecData);
+        }
+        
+        return;
+    }
+
+    if(GProgram->Header.StackAlignment == 8) {
+        ExecThreadExecute8(ExecData);
+    } else {
+        ExecThreadExecute4(ExecData);
     }
 }
 
-VOID
-ExecThreadExecute (
-    PTHREAD_EXECUTION_DATA ExecData
+PTHREAD_EXECUTION_DATA
+ExecThreadCreate (
+    PTHREAD_CREATION_DATA CreationData,
+    PTHREAD_EXECUTION_DATA Joiner
     )
     
 /*
 
  Routine description:
  
-    This routine is the main execution loop for an execution thread.
+    This routine creates a thread. Its frames and window wait until it first
+    runs, so a thread that hasn't yet costs next to nothing.
     
  Arguments:
  
-    ExecData - The thread execution data for the calling thread.
+    CreationData - The thread creation data for the thread, which takes it
+                   over.
+    
+    Joiner - The thread parked on this one, NULL if none is.
     
  Return value:
  
-    VOID.
+    The thread execution data for the thread.
 
 */
     
 {
-    INSTRUCTION Instruction;
-    ULONG InstructionIndex;
-    BOOL ContinueProcessing;
-    
-    ContinueProcessing = TRUE;
-    while(ContinueProcessing != FALSE) {
-        InstructionIndex = ExecData->ActiveRegisterSet->Register[REG_RIP];
-        InstructionIndex = InstructionIndex - GCodePointerBias;
-        fprintf(PRINT_OUT, "Accessing instruction: 0x%X\n", (int)InstructionIndex);
-        memcpy(&Instruction, &GProgram->Code[InstructionIndex], sizeof(INSTRUCTION));
-        ContinueProcessing = ExecProcessInstruction(ExecData, &Instruction);
+    PTHREAD_EXECUTION_DATA ThreadExecData;
+    
+    ThreadExecData = malloc(sizeof(THREAD_EXECUTION_DATA));
+    if(ThreadExecData == NULL) {
+        VmFatal(ERR_STR_NOMEM);
     }
     
-    return;
+    memset(ThreadExecData, 0, sizeof(THREAD_EXECUTION_DATA));
+    ThreadExecData->CreationData = CreationData;
+    ThreadExecData->Joiner = Joiner;
+    return ThreadExecData;
 }
 
-DWORD
-WINAPI
-ThreadExecFunc (
-    LPVOID Param
+VOID
+ExecThreadStart (
+    PTHREAD_EXECUTION_DATA ThreadExecData
     )
     
 /*
 
  Routine description:
  
-    This routine initializes the thread execution data and starts executing 
-    the instructions.
+    This routine sets a thread up from its creation data the first time it
+    runs, in a window from the cache of the worker running it.
     
  Arguments:
  
-    Param - The thread creation data for this thread
+    ThreadExecData - The thread execution data for the thread.
     
  Return value:
  
-    0.
+    VOID.
 
 */
     
 {
     PTHREAD_CREATION_DATA ThreadCreationData;
-    PTHREAD_EXECUTION_DATA ThreadExecData;
-    
-    ThreadExecData = malloc(sizeof(THREAD_EXECUTION_DATA));
-    if(ThreadExecData == NULL) {
-        VmFatal(ERR_STR_NOMEM);
-    }
     
-    SStackInitialize(&ThreadExecData->RegisterSetStack);
-    if(ThreadExecData->RegisterSetStack == NULL) {
+    ThreadCreationData = ThreadExecData->CreationData;
+    ThreadExecData->Frames = malloc(EXEC_INITIAL_FRAMES * sizeof(REGISTER_SET));
+    if(ThreadExecData->Frames == NULL) {
         VmFatal(ERR_STR_NOMEM);
     }
     
-    ThreadExecData->ActiveRegisterSet = malloc(sizeof(REGISTER_SET));
-    if(ThreadExecData->ActiveRegisterSet == NULL) {
-        VmFatal(ERR_STR_NOMEM);
-    }
+    ThreadExecData->FrameCount = 1;
+    ThreadExecData->FrameCapacity = EXEC_INITIAL_FRAMES;
+    ThreadExecData->ActiveRegisterSet = &ThreadExecData->Frames[0];
     
     //
     // The spawning thread looks up the target address and copies the stack 
@@ -964,28 +1567,24 @@ ThreadExecFunc (
     // thread creation. Nice.
     //
     
-    ThreadCreationData = Param;    
     memcpy(ThreadExecData->ActiveRegisterSet, 
            ThreadCreationData->RegisterSet,
            sizeof(REGISTER_SET));
     
-    ThreadExecData->ActiveRegisterSet->Register[REG_RIP] = ThreadCreationData->JumpAddress;
+    ThreadExecData->ActiveRegisterSet->Register[REG_RIP] = ThreadCreationData->JumpIndex;
     ThreadExecData->ActiveRegisterSet->Register[REG_RST] = GProgram->Header.StackTop;
     ThreadExecData->ActiveRegisterSet->Register[REG_RSB] = GProgram->Header.StackTop;
     
-    ThreadExecData->ThreadStack = malloc(GProgram->Header.StackSize);
+    ThreadExecData->ThreadStack = 
+        SpaceWindowCreate(GProgram, 
+                          &ThreadExecData->Worker->Windows,
+                          ThreadCreationData->StackDepth,
+                          &ThreadExecData->StackLimit);
+        
     if(ThreadExecData->ThreadStack == NULL) {
         VmFatal(ERR_STR_NOMEM);
     }
     
-    //
-    // Stack grows down, so the stack pointer needs to point to the top of the
-    // stack. No funny business here.
-    //
-    
-    ThreadExecData->ThreadStack = 
-        ThreadExecData->ThreadStack + GProgram->Header.StackSize - 1;
-    
     if(ThreadCreationData->MiniStack != NULL) {
     
         //
@@ -996,22 +1595,241 @@ ThreadExecFunc (
         assert((ThreadCreationData->MiniStackSize % 
                 GProgram->Header.StackAlignment) == 0);
         
-        memcpy(ThreadExecData->ThreadStack,
-               ThreadCreationData->MiniStack,
-               ThreadCreationData->MiniStackSize);
-               
         ThreadExecData->ActiveRegisterSet->Register[REG_RSB] = 
             ThreadExecData->ActiveRegisterSet->Register[REG_RSB] - 
-            (ThreadCreationData->MiniStackSize / GProgram->Header.StackAlignment);
+            ThreadCreationData->MiniStackSize;
+            
+        memcpy(ThreadExecData->ThreadStack+
+               ThreadExecData->ActiveRegisterSet->Register[REG_RSB],
+               ThreadCreationData->MiniStack,
+               ThreadCreationData->MiniStackSize);
         
         free(ThreadCreationData->MiniStack);
     }
     
+#if TRACE_LEVEL > TRACE_LEVEL_NONE
+    ThreadExecData->Trace = TraceRingCreate((ULONG)InterlockedIncrement(&ExecThreadCount));
+    if(ThreadExecData->Trace == NULL) {
+        VmFatal(ERR_STR_NOMEM);
+    }
+#else
+    ThreadExecData->Trace = NULL;
+#endif
+
+    TRACE_CONTROL(ThreadExecData->Trace,
+                  TRACE_TYPE_THREAD_START,
+                  ThreadCreationData->JumpIndex,
+                  0,
+                  ThreadCreationData->JumpIndex,
+                  0,
+                  0,
+                  0);
+                  
     free(ThreadCreationData->RegisterSet);
     free(ThreadCreationData);
-    ExecThreadExecute(ThreadExecData);
+    ThreadExecData->CreationData = NULL;
+}
+
+BOOL
+ExecParallelLoopChunk (
+    PTHREAD_EXECUTION_DATA ThreadExecData
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine sets a runner of a parallel loop up to run its next chunk.
+    The body is called afresh at the top of the stack with the first index
+    and the bound of the chunk, then the captured values, over a return 
+    address it never returns to.
+    
+ Arguments:
+ 
+    ThreadExecData - The thread execution data for the runner.
+    
+ Return value:
+ 
+    TRUE if the runner has a chunk to run, FALSE if it is done.
+
+*/
+    
+{
+    PPOOL_LOOP Loop;
+    PREGISTER_SET RegisterSet;
+    ULONG Alignment;
+    ULONG Rsb;
+    ULONG i;
+    LONG First;
+    LONG Bound;
+    
+    Loop = ThreadExecData->Loop;
+    if(PoolLoopNext(Loop, &ThreadExecData->LoopRunner, &First, &Bound) == FALSE) {
+        return FALSE;
+    }
+    
+    Alignment = GProgram->Header.StackAlignment;
+    Rsb = GProgram->Header.StackTop - 
+          (LOOP_BODY_PARAMETER_COUNT + Loop->CaptureCount + 1) * Alignment;
+          
+    ThreadExecData->FrameCount = 1;
+    ThreadExecData->ActiveRegisterSet = &ThreadExecData->Frames[0];
+    RegisterSet = ThreadExecData->ActiveRegisterSet;
+    memset(RegisterSet, 0, sizeof(REGISTER_SET));
+    RegisterSet->Register[REG_RIP] = Loop->JumpIndex;
+    RegisterSet->Register[REG_RST] = GProgram->Header.StackTop;
+    RegisterSet->Register[REG_RSB] = Rsb;
+    
+    MemStore(MemStackAddress(ThreadExecData->ThreadStack, Rsb, Alignment, FALSE), 
+             0, 
+             Alignment);
+             
+    MemStore(MemStackAddress(ThreadExecData->ThreadStack, Rsb + Alignment, Alignment, FALSE), 
+             Bound, 
+             Alignment);
+             
+    MemStore(MemStackAddress(ThreadExecData->ThreadStack, Rsb + 2 * Alignment, Alignment, FALSE), 
+             First, 
+             Alignment);
+             
+    for(i=0; i<Loop->CaptureCount; ++i) {
+        MemStore(MemStackAddress(ThreadExecData->ThreadStack, Rsb + (3 + i) * Alignment, Alignment, FALSE), 
+                 Loop->Captures[i], 
+                 Alignment);
+    }
+    
+    return TRUE;
+}
+
+ULONG
+ExecRunThread (
+    PPOOL_WORKER Worker,
+    PTHREAD_EXECUTION_DATA ThreadExecData
+    )
     
-    return 0;
+/*
+
+ Routine description:
+ 
+    This routine runs a thread on the calling worker for up to a time 
+    slice, or a runner of a parallel loop until it runs out of chunks or
+    time. A thread that finishes hands its return value to the thread
+    parked on it, or to its future, if there is one.
+    
+ Arguments:
+ 
+    Worker - The worker running the thread.
+    
+    ThreadExecData - The thread execution data for the thread.
+    
+ Return value:
+ 
+    Why the thread stopped running, one of EXEC_STATUS.
+
+*/
+    
+{
+    ThreadExecData->Worker = Worker;
+    if(ThreadExecData->CreationData != NULL) {
+        ExecThreadStart(ThreadExecData);
+        if(ThreadExecData->Loop != NULL &&
+           ExecParallelLoopChunk(ThreadExecData) == FALSE) {
+           
+            goto ExecRunThreadFinished;
+        }
+    }
+    
+    ThreadExecData->Budget = EXEC_TIME_SLICE;
+    for(;;) {
+        ThreadExecData->Status = EXEC_STATUS_FINISHED;
+        ExecThreadExecute(ThreadExecData);
+        if(ThreadExecData->Status != EXEC_STATUS_FINISHED) {
+            return ThreadExecData->Status;
+        }
+        
+        //
+        // A runner of a parallel loop goes on to its next chunk within the
+        // same time slice, and yields in between once that is used up.
+        //
+        
+        if(ThreadExecData->Loop == NULL || 
+           ExecParallelLoopChunk(ThreadExecData) == FALSE) {
+           
+            break;
+        }
+        
+        if(ThreadExecData->Budget == 0) {
+            ThreadExecData->Status = EXEC_STATUS_YIELDED;
+            return EXEC_STATUS_YIELDED;
+        }
+    }
+    
+ExecRunThreadFinished:
+    TRACE_CONTROL(ThreadExecData->Trace,
+                  TRACE_TYPE_THREAD_END,
+                  ThreadExecData->ActiveRegisterSet->Register[REG_RIP],
+                  0,
+                  0,
+                  0,
+                  0,
+                  0);
+                  
+    //
+    // A runner hands nothing back, and the last one to finish frees its
+    // loop.
+    //
+    
+    if(ThreadExecData->Loop != NULL) {
+        if(InterlockedDecrement(&ThreadExecData->Loop->Active) == 0) {
+            free(ThreadExecData->Loop);
+        }
+    } else if(ThreadExecData->Joiner != NULL) {
+        ThreadExecData->Joiner->ActiveRegisterSet->Register[REG_RRV] = 
+            ThreadExecData->ActiveRegisterSet->Register[REG_RRV];
+    }
+    
+    if(ThreadExecData->Future != NULL) {
+        ThreadExecData->Future->Value = 
+            (LONG)ThreadExecData->ActiveRegisterSet->Register[REG_RRV];
+    }
+    
+    return EXEC_STATUS_FINISHED;
+}
+
+VOID
+ExecThreadFree (
+    PTHREAD_EXECUTION_DATA ThreadExecData
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine frees a finished thread. Its window goes to the cache of
+    the worker that ran it last.
+    
+ Arguments:
+ 
+    ThreadExecData - The thread execution data for the thread.
+    
+ Return value:
+ 
+    VOID.
+
+*/
+    
+{
+#if TRACE_LEVEL > TRACE_LEVEL_NONE
+    TraceRingFlush(ThreadExecData->Trace);
+    TraceRingFree(ThreadExecData->Trace);
+#endif
+
+    SpaceWindowFree(GProgram, 
+                    &ThreadExecData->Worker->Windows, 
+                    ThreadExecData->ThreadStack);
+                    
+    free(ThreadExecData->Frames);
+    free(ThreadExecData);
 }
 
 VOID
@@ -1037,19 +1855,16 @@ ExecPrimeProgram (
     
 {
     PTHREAD_CREATION_DATA FirstThread;
-    HANDLE FirstThreadHandle;
     
     //
     // The code is compiled with different offsets in mind, as its meant to 
-    // simulate running in an environment with a single address space. We
-    // counter this here with bias variables which we subtract with ever access
-    // to certain registers
+    // simulate running in an environment with a single address space. Each
+    // thread runs in a window of the VM address space mirroring it, so VM 
+    // addresses need no translating beyond adding the window base. Code 
+    // addresses were already resolved to indices into the decoded 
+    // instruction stream when the program was loaded.
     //
     
-    GCodePointerBias = GProgram->Header.CodeStart;
-    GDataPointerBias = GProgram->Header.DataStart;
-    GStackPointerBias = GProgram->Header.StackTop;
-    
     FirstThread = malloc(sizeof(THREAD_CREATION_DATA));
     if(FirstThread == NULL) {
         VmFatal(ERR_STR_NOMEM);
@@ -1064,14 +1879,8 @@ ExecPrimeProgram (
     memset(FirstThread->RegisterSet, 0, sizeof(REGISTER_SET));
     FirstThread->MiniStack = NULL;
     FirstThread->MiniStackSize = 0;
-    FirstThread->JumpAddress = GProgram->Header.CodeStart;
-    
-    FirstThreadHandle = CreateThread(NULL,
-                                     0,
-                                     ThreadExecFunc,
-                                     (LPVOID)FirstThread,
-                                     0,
-                                     NULL);
-                                     
-    WaitForSingleObject(FirstThreadHandle, INFINITE);
+    FirstThread->JumpIndex = 0;
+    FirstThread->StackDepth = 0;
+    
+    PoolRun(FirstThread);
 }
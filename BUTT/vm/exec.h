@@ -32,6 +32,16 @@
  Revision:
  
     11/24/15        Initial Creation
+    10/17/26        Thread entry points are decoded instruction indices
+    10/17/26        Per thread trace ring
+    10/17/26        Expose the I/O routine to the JIT
+    10/17/26        Contiguous per thread frame stack
+    10/17/26        Threads run on the worker pool
+    10/17/26        Threads are green threads scheduled by the pool
+    10/17/26        Threads carry the stack depth they need
+    10/17/26        Futures of async calls
+    10/17/26        Runners of parallel loops
+    10/17/26        Reduction instructions and per thread copies
 
 **/
 
@@ -41,26 +51,145 @@
 #include <windows.h>
 #include "../Common/def.h"
 #include "../../utils/inc/shashmap.h"
-#include "../../utils/inc/sstack.h"
 #include "../../utils/inc/squeue.h"
+#include "decode.h"
+#include "trace.h"
 
 typedef struct _REGISTER_SET {
-    ULONG Register[REG_MAX-1];
+    ULONG Register[REG_MAX];
 } REGISTER_SET, *PREGISTER_SET;
 
-typedef struct _THREAD_EXECUTION_DATA {
-    PSSTACK RegisterSetStack;
-    PREGISTER_SET ActiveRegisterSet;
-    PCHAR ThreadStack;
-} THREAD_EXECUTION_DATA, *PTHREAD_EXECUTION_DATA;
+//
+// The register sets of the frames a thread has called through live one after
+// the other in a single array, the active one at the top. Calls and returns
+// only move the top. The array doubles when a call runs out of room, so the
+// active register set pointer has to be reloaded after every call.
+//
+
+#define EXEC_INITIAL_FRAMES     64
+
+//
+// A thread runs on a worker until it finishes, waits on a thread it called
+// in sync or joins, or has taken this many backward jumps and calls,
+// whichever comes first. It then gives the worker up to the next one.
+//
+
+#define EXEC_TIME_SLICE         10000
+
+typedef enum _EXEC_STATUS {
+    EXEC_STATUS_FINISHED    = 0,    // Returned from its entry function
+    EXEC_STATUS_YIELDED     = 1,    // Out of time, runnable
+    EXEC_STATUS_PARKED      = 2,    // Waiting on a sync call or a join
+} EXEC_STATUS;
 
 typedef struct _THREAD_CREATION_DATA {
     PREGISTER_SET RegisterSet;
     PCHAR MiniStack;
     ULONG MiniStackSize;
-    ULONG JumpAddress;
+    ULONG JumpIndex;
+    ULONG StackDepth;               // Below StackTop, 0 for all of it
 } THREAD_CREATION_DATA, *PTHREAD_CREATION_DATA;
 
+//
+// A BUTT thread is only its execution data. The workers of the pool switch
+// between threads by switching the execution data they run, so a thread
+// costs no OS thread of its own, and nothing past this until it first runs.
+//
+
+typedef struct _THREAD_EXECUTION_DATA {
+    PREGISTER_SET Frames;
+    ULONG FrameCount;
+    ULONG FrameCapacity;
+    PREGISTER_SET ActiveRegisterSet;
+    PCHAR ThreadStack;
+    ULONG StackLimit;
+    PTRACE_RING Trace;
+    struct _POOL_WORKER *Worker;
+    
+    //
+    // What the thread starts from, NULL once it has started.
+    //
+    
+    PTHREAD_CREATION_DATA CreationData;
+    
+    //
+    // Why the thread last stopped running, and how many more backward jumps
+    // and calls it may take before it has to.
+    //
+    
+    ULONG Status;
+    ULONG Budget;
+    
+    //
+    // The thread that called this one in sync, NULL for async. The caller
+    // parks on JoinCount, which the callee finishing and the caller parking
+    // each take one off. Whichever gets it to zero makes the caller
+    // runnable again.
+    //
+    
+    struct _THREAD_EXECUTION_DATA *Joiner;
+    volatile LONG JoinCount;
+    
+    //
+    // The future of an async call that gets joined, NULL otherwise. Threads
+    // joining it park on it the same way, through JoinCount.
+    //
+    
+    struct _POOL_FUTURE *Future;
+    
+    //
+    // The parallel loop the thread runs chunks of, NULL if it is no runner,
+    // and where the runner is at in the loop.
+    //
+    
+    struct _POOL_LOOP *Loop;
+    LONG64 LoopRunner;
+    
+    //
+    // The copies the thread keeps of the reduction variables, NULL until it
+    // first updates one. The first thread of the program keeps none.
+    //
+    
+    PLONG Reductions;
+    BOOL First;
+    
+    //
+    // Link on the run queue of the pool, or on the list of threads parked on
+    // a future.
+    //
+    
+    struct _THREAD_EXECUTION_DATA *Next;
+} THREAD_EXECUTION_DATA, *PTHREAD_EXECUTION_DATA;
+
+PTHREAD_EXECUTION_DATA
+ExecThreadCreate (
+    PTHREAD_CREATION_DATA CreationData,
+    PTHREAD_EXECUTION_DATA Joiner
+    );
+
+ULONG
+ExecRunThread (
+    struct _POOL_WORKER *Worker,
+    PTHREAD_EXECUTION_DATA ExecData
+    );
+
+VOID
+ExecThreadFree (
+    PTHREAD_EXECUTION_DATA ExecData
+    );
+
+VOID
+ExecReductionInstruction (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_INSTRUCTION Instruction
+    );
+
+VOID
+ExecIoInstruction (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_INSTRUCTION Instruction
+    );
+
 VOID
 ExecPrimeProgram (
     VOID
@@ -0,0 +1,490 @@
+/**
+
+ Copyright 2015 Omar Carey.
+ 
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ Translation Unit:
+    
+    exec_core.h
+    
+ Abstract:
+   
+    This module is the interpreter core. exec.c includes it once per 
+    supported stack alignment, with EXEC_CORE_ROUTINE naming the routine
+    and EXEC_CORE_ALIGNMENT the alignment, so every VM memory access in it
+    has a width known at compile time. It has no include guard on purpose.
+    
+ Author:
+    
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+ 
+    10/17/26        Initial Creation
+    10/17/26        Optionally bounds checked
+    10/17/26        Preemption at backward jumps and calls
+    10/17/26        Atomic loads and stores
+    10/17/26        Atomic read-modify-write
+    10/17/26        Thread joins, thread stores count references to futures
+    10/17/26        Parallel loops
+    10/17/26        Reductions
+    10/17/26        Barrier waits
+    10/17/26        Channel sends and receives
+
+**/
+
+#if !defined(EXEC_CORE_ROUTINE) || !defined(EXEC_CORE_ALIGNMENT) ||         \
+    !defined(EXEC_CORE_CHECKED)
+#error "exec_core.h is included by exec.c only."
+#endif
+
+VOID
+EXEC_CORE_ROUTINE (
+    PTHREAD_EXECUTION_DATA ExecData
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine is the main execution loop for an execution thread, for
+    programs with a stack alignment of EXEC_CORE_ALIGNMENT. Accesses to VM
+    memory are bounds checked if EXEC_CORE_CHECKED is TRUE. It runs until
+    the thread finishes, parks or runs out of time, and saves RIP so the
+    thread can pick up from there.
+    
+ Arguments:
+ 
+    ExecData - The thread execution data for the calling thread.
+    
+ Return value:
+ 
+    VOID.
+
+*/
+    
+{
+    PDECODED_INSTRUCTION Instructions;
+    PDECODED_INSTRUCTION Instruction;
+    PREGISTER_SET Registers;
+    PCHAR Stack;
+    PCHAR GlobalData;
+    LONG L;
+    LONG R;
+    LONG D;
+#ifdef EXEC_LOOP_JIT
+    PJIT_LOOP_CACHE Loops;
+    PJIT_LOOP_RECORDER Recorder;
+#endif
+    
+#ifdef EXEC_THREADED_DISPATCH
+
+    //
+    // The decoder only ever produces opcodes from the lists, so there is no 
+    // need to fill the holes in the table.
+    //
+
+    static const PVOID DispatchTable[DECODED_OPCODE_COUNT] = {
+        EXEC_OPCODE_LIST(EXEC_DISPATCH_ENTRY)
+        QUICK_OPERATOR_LIST(EXEC_QUICK_ARITHMETIC_ENTRIES)
+        EXEC_QUICK_STORE_VARIANTS(EXEC_QUICK_STORE_ENTRY)
+        EXEC_QUICK_PUSH_VARIANTS(EXEC_QUICK_PUSH_ENTRY)
+        EXEC_QUICK_POP_VARIANTS(EXEC_QUICK_POP_ENTRY)
+        [QUICK_OPCODE_RCOPYD_CONSTANT] = &&Handler_Quick_RCOPYD_CONSTANT,
+        [QUICK_OPCODE_RCOPYD_REGISTER] = &&Handler_Quick_RCOPYD_REGISTER,
+        EXEC_FUSED_ELEMENT_ADDRESS_VARIANTS(EXEC_FUSED_ELEMENT_ADDRESS_ENTRY)
+        FUSE_COMPARE_LIST(EXEC_FUSED_COMPARE_BRANCH_ENTRIES)
+        FUSE_ARITHMETIC_LIST(EXEC_FUSED_ARITHMETIC_STORE_ENTRIES)
+    };
+    
+#ifdef EXEC_LOOP_JIT
+    static const PVOID RecordTable[DECODED_OPCODE_COUNT] = {
+        [0 ... DECODED_OPCODE_COUNT - 1] = &&Handler_Record
+    };
+
+    const PVOID *Dispatch;
+
+    Dispatch = DispatchTable;
+#endif
+#endif
+
+    Instructions = GProgram->Instructions;
+    GlobalData = GProgram->GlobalData;
+    Stack = ExecData->ThreadStack;
+#ifdef EXEC_LOOP_JIT
+    Loops = GProgram->Loops;
+    Recorder = NULL;
+#endif
+    EXEC_LOAD_RIP();
+    
+#ifdef EXEC_THREADED_DISPATCH
+    EXEC_DISPATCH();
+
+#ifdef EXEC_LOOP_JIT
+Handler_Record:
+    if(JitLoopRecord(Recorder, EXEC_INDEX()) != FALSE) {
+        Recorder = NULL;
+        Dispatch = DispatchTable;
+    }
+
+    goto *DispatchTable[Instruction->Opcode];
+#endif
+#else
+    for(;;) {
+        EXEC_TRACE_FETCH();
+#ifdef EXEC_LOOP_JIT
+        if(Recorder != NULL && JitLoopRecord(Recorder, EXEC_INDEX()) != FALSE) {
+            Recorder = NULL;
+        }
+#endif
+        switch(Instruction->Opcode) {
+#endif
+    
+    EXEC_HANDLER(OPC_ADDI)
+    EXEC_HANDLER(OPC_ADDF)
+        EXEC_ARITHMETIC(+);
+        
+    EXEC_HANDLER(OPC_SUBI)
+    EXEC_HANDLER(OPC_SUBF)
+        EXEC_ARITHMETIC(-);
+        
+    EXEC_HANDLER(OPC_MULI)
+    EXEC_HANDLER(OPC_MULF)
+        EXEC_ARITHMETIC(*);
+        
+    EXEC_HANDLER(OPC_DIVI)
+    EXEC_HANDLER(OPC_DIVF)
+        EXEC_ARITHMETIC(/);
+        
+    EXEC_HANDLER(OPC_XOR)
+        EXEC_ARITHMETIC(^);
+        
+    EXEC_HANDLER(OPC_OR)
+        EXEC_ARITHMETIC(|);
+        
+    EXEC_HANDLER(OPC_AND)
+        EXEC_ARITHMETIC(&);
+        
+    EXEC_HANDLER(OPC_NOT)
+        assert(!"Yeah... didn't think this NOT thing through.");
+        VmFatal(ERR_STR_INVALIDINSTR);
+        
+    EXEC_HANDLER(OPC_LOR)
+        EXEC_ARITHMETIC(||);
+        
+    EXEC_HANDLER(OPC_LAND)
+        EXEC_ARITHMETIC(&&);
+        
+    EXEC_HANDLER(OPC_EQ)
+        EXEC_ARITHMETIC(==);
+        
+    EXEC_HANDLER(OPC_NEQ)
+        EXEC_ARITHMETIC(!=);
+        
+    EXEC_HANDLER(OPC_LT)
+        EXEC_ARITHMETIC(<);
+        
+    EXEC_HANDLER(OPC_GT)
+        EXEC_ARITHMETIC(>);
+        
+    EXEC_HANDLER(OPC_LTE)
+        EXEC_ARITHMETIC(<=);
+        
+    EXEC_HANDLER(OPC_GTE)
+        EXEC_ARITHMETIC(>=);
+        
+    QUICK_OPERATOR_LIST(EXEC_QUICK_ARITHMETIC_HANDLERS)
+        
+    EXEC_HANDLER(OPC_RCOPYD)
+    
+        //
+        // The left operand is always a plain register here, the offset is 
+        // either a constant or a plain register. The decoder made sure of 
+        // both.
+        //
+        
+        D = MemOperandValue(ExecData, 
+                            &Instruction->Left, 
+                            EXEC_CORE_ALIGNMENT, 
+                            EXEC_CORE_CHECKED) + 
+            MemOperandValue(ExecData, 
+                            &Instruction->Right, 
+                            EXEC_CORE_ALIGNMENT, 
+                            EXEC_CORE_CHECKED);
+            
+        EXEC_STORE_REGISTER(Instruction->Destination, D);
+        EXEC_TRACE_RCOPYD();
+        EXEC_NEXT();
+        
+    EXEC_QUICK_HANDLER(Quick_RCOPYD_CONSTANT, QUICK_OPCODE_RCOPYD_CONSTANT)
+        D = EXEC_LOAD_REGISTER(Instruction->Left) + 
+            EXEC_LOAD_CONSTANT(Instruction->Right);
+            
+        EXEC_STORE_REGISTER(Instruction->Destination, D);
+        EXEC_TRACE_RCOPYD();
+        EXEC_NEXT();
+        
+    EXEC_QUICK_HANDLER(Quick_RCOPYD_REGISTER, QUICK_OPCODE_RCOPYD_REGISTER)
+        D = EXEC_LOAD_REGISTER(Instruction->Left) + 
+            EXEC_LOAD_REGISTER(Instruction->Right);
+            
+        EXEC_STORE_REGISTER(Instruction->Destination, D);
+        EXEC_TRACE_RCOPYD();
+        EXEC_NEXT();
+        
+    EXEC_HANDLER(OPC_STRI8)
+    EXEC_HANDLER(OPC_STRU8)
+    EXEC_HANDLER(OPC_STRI16)
+    EXEC_HANDLER(OPC_STRU16)
+    EXEC_HANDLER(OPC_STRI32)
+    EXEC_HANDLER(OPC_STRU32)
+    EXEC_HANDLER(OPC_STRF)
+        R = EXEC_LOAD_OPERAND(Instruction->Right);
+        
+        //
+        // Shifting up and back down masks off everything above the store 
+        // width and sign extends what's left in one go.
+        //
+        
+        D = (LONG)((ULONG)R << Instruction->StoreShift) >> Instruction->StoreShift;
+        if((Instruction->Flags & DECODED_FLAG_ATOMIC_STORE) != 0) {
+            MemOperandStoreRelease(ExecData, 
+                                   &Instruction->Destination, 
+                                   D, 
+                                   EXEC_CORE_ALIGNMENT, 
+                                   EXEC_CORE_CHECKED);
+        } else {
+            MemOperandStore(ExecData, 
+                            &Instruction->Destination, 
+                            D, 
+                            EXEC_CORE_ALIGNMENT, 
+                            EXEC_CORE_CHECKED);
+        }
+                        
+        EXEC_TRACE_STORE();
+        EXEC_NEXT();
+        
+    EXEC_HANDLER(OPC_STRTH)
+    
+        //
+        // A thread variable holds a reference to the future of the thread,
+        // so the handle stored takes one and the one it replaces lets go of
+        // its own. Swapping it in keeps two stores racing from letting go of
+        // the same one.
+        //
+        
+        D = EXEC_LOAD_OPERAND(Instruction->Right);
+        PoolFutureRetain(ExecData->Worker->Pool, (ULONG)D);
+        L = MemAtomicExchange(EXEC_MEMORY_ADDRESS(Instruction->Destination),
+                              D,
+                              EXEC_CORE_ALIGNMENT);
+                              
+        PoolFutureRelease(ExecData->Worker->Pool, (ULONG)L);
+        EXEC_TRACE_STORE();
+        EXEC_NEXT();
+        
+    EXEC_QUICK_STORE_VARIANTS(EXEC_QUICK_STORE_HANDLER)
+        
+    EXEC_HANDLER(OPC_JMP)
+        EXEC_TRACE_JUMP();
+        if(Instruction->Target <= EXEC_INDEX()) {
+            EXEC_PREEMPT();
+        }
+        
+        EXEC_LOOP_BACKEDGE();
+        Instruction = &Instructions[Instruction->Target];
+        EXEC_DISPATCH();
+        
+    EXEC_HANDLER(OPC_JMPZ)
+        D = EXEC_LOAD_REGISTER(Instruction->Left);
+        EXEC_TRACE_BRANCH(Instruction->Target, D);
+        if(D == 0) {
+            Instruction = &Instructions[Instruction->Target];
+            EXEC_DISPATCH();
+        }
+        
+        EXEC_NEXT();
+        
+    EXEC_HANDLER(OPC_CALLNORM)
+    EXEC_HANDLER(OPC_CALLPLLS)
+    EXEC_HANDLER(OPC_CALLPLLA)
+        EXEC_PREEMPT();
+        EXEC_SAVE_RIP();
+        if(ExecCallInstruction(ExecData, Instruction, EXEC_CORE_CHECKED) == FALSE) {
+            EXEC_LOAD_RIP();
+            goto ExecCoreEnd;
+        }
+        
+        EXEC_LOAD_RIP();
+        EXEC_DISPATCH();
+        
+    EXEC_HANDLER(OPC_PFOR)
+        EXEC_PREEMPT();
+        EXEC_SAVE_RIP();
+        if(ExecParallelLoopInstruction(ExecData, Instruction, EXEC_CORE_CHECKED) == FALSE) {
+            EXEC_LOAD_RIP();
+            goto ExecCoreEnd;
+        }
+        
+        EXEC_LOAD_RIP();
+        EXEC_DISPATCH();
+        
+    EXEC_HANDLER(OPC_RETURN)
+        if(ExecReturnInstruction(ExecData, Instruction, EXEC_CORE_CHECKED) == FALSE) {
+            goto ExecCoreEnd;
+        }
+        
+        EXEC_LOAD_RIP();
+        EXEC_DISPATCH();
+        
+    EXEC_HANDLER(OPC_PUSH)
+        D = EXEC_LOAD_OPERAND(Instruction->Left);
+        MemStackPush(ExecData, D, EXEC_CORE_ALIGNMENT, EXEC_CORE_CHECKED);
+        EXEC_TRACE_PUSH();
+        EXEC_NEXT();
+        
+    EXEC_QUICK_PUSH_VARIANTS(EXEC_QUICK_PUSH_HANDLER)
+        
+    EXEC_HANDLER(OPC_POP)
+        D = MemStackPop(ExecData, EXEC_CORE_ALIGNMENT, EXEC_CORE_CHECKED);
+        MemOperandStore(ExecData, 
+                        &Instruction->Destination, 
+                        D, 
+                        EXEC_CORE_ALIGNMENT, 
+                        EXEC_CORE_CHECKED);
+                        
+        EXEC_TRACE_POP();
+        EXEC_NEXT();
+        
+    EXEC_QUICK_POP_VARIANTS(EXEC_QUICK_POP_HANDLER)
+        
+    EXEC_FUSED_ELEMENT_ADDRESS_VARIANTS(EXEC_FUSED_ELEMENT_ADDRESS_HANDLER)
+    FUSE_COMPARE_LIST(EXEC_FUSED_COMPARE_BRANCH_HANDLERS)
+    FUSE_ARITHMETIC_LIST(EXEC_FUSED_ARITHMETIC_STORE_HANDLERS)
+        
+    EXEC_HANDLER(OPC_AADD)
+    EXEC_HANDLER(OPC_ASUB)
+    EXEC_HANDLER(OPC_AOR)
+    EXEC_HANDLER(OPC_AAND)
+    EXEC_HANDLER(OPC_AXOR)
+        L = 0;
+        R = EXEC_LOAD_OPERAND(Instruction->Right);
+        D = MemAtomicUpdate(EXEC_MEMORY_ADDRESS(Instruction->Left),
+                            Instruction->Opcode,
+                            R,
+                            EXEC_CORE_ALIGNMENT);
+                            
+        EXEC_STORE_REGISTER(Instruction->Destination, D);
+        EXEC_TRACE_ARITHMETIC();
+        EXEC_NEXT();
+        
+    EXEC_HANDLER(OPC_ACAS)
+        L = EXEC_LOAD_REGISTER(Instruction->Destination);
+        R = EXEC_LOAD_OPERAND(Instruction->Right);
+        D = MemAtomicCompareSwap(EXEC_MEMORY_ADDRESS(Instruction->Left),
+                                 L,
+                                 R,
+                                 EXEC_CORE_ALIGNMENT);
+                                 
+        EXEC_STORE_REGISTER(Instruction->Destination, D);
+        EXEC_TRACE_ARITHMETIC();
+        EXEC_NEXT();
+        
+    EXEC_HANDLER(OPC_JOIN)
+        L = EXEC_LOAD_OPERAND(Instruction->Left);
+        if(PoolFutureJoin(ExecData, 
+                          (ULONG)L, 
+                          Instruction->Left.Kind == OPERAND_KIND_REGISTER,
+                          &D) == FALSE) {
+                          
+            goto ExecCoreEnd;
+        }
+        
+        R = 0;
+        EXEC_STORE_REGISTER(Instruction->Destination, D);
+        EXEC_TRACE_ARITHMETIC();
+        EXEC_NEXT();
+        
+    EXEC_HANDLER(OPC_RADD)
+    EXEC_HANDLER(OPC_RSUB)
+    EXEC_HANDLER(OPC_ROR)
+    EXEC_HANDLER(OPC_RAND)
+    EXEC_HANDLER(OPC_RXOR)
+    EXEC_HANDLER(OPC_RMIN)
+    EXEC_HANDLER(OPC_RMAX)
+        ExecReductionInstruction(ExecData, Instruction);
+        EXEC_NEXT();
+        
+    EXEC_HANDLER(OPC_WAIT)
+    
+        //
+        // A thread parked on the barrier is done waiting once it runs again,
+        // so it picks up after the wait.
+        //
+        
+        if(PoolBarrierWait(ExecData, 
+                           Instruction->Slot, 
+                           EXEC_MEMORY_ADDRESS(Instruction->Left)) == FALSE) {
+                           
+            Instruction = Instruction + 1;
+            goto ExecCoreEnd;
+        }
+        
+        EXEC_NEXT();
+        
+    //
+    // A thread parked on a channel runs the send or receive again once it 
+    // runs again, since another thread may have got there first.
+    //
+    
+    EXEC_HANDLER(OPC_SEND)
+        L = EXEC_LOAD_OPERAND(Instruction->Left);
+        if(PoolChannelSend(ExecData, Instruction->Slot, L) == FALSE) {
+            goto ExecCoreEnd;
+        }
+        
+        EXEC_NEXT();
+        
+    EXEC_HANDLER(OPC_RECV)
+        if(PoolChannelReceive(ExecData, Instruction->Slot, &D) == FALSE) {
+            goto ExecCoreEnd;
+        }
+        
+        EXEC_STORE_REGISTER(Instruction->Destination, D);
+        EXEC_NEXT();
+        
+    EXEC_HANDLER(OPC_PRINT)
+    EXEC_HANDLER(OPC_READ)
+        ExecIoInstruction(ExecData, Instruction);
+        EXEC_NEXT();
+        
+#ifndef EXEC_THREADED_DISPATCH
+        default:
+            VmFatal(ERR_STR_INVALIDINSTR);
+        }
+    }
+#endif
+
+ExecCoreEnd:
+#ifdef EXEC_LOOP_JIT
+    if(Recorder != NULL) {
+        JitLoopRecorderFree(Recorder);
+    }
+#endif
+    EXEC_SAVE_RIP();
+    return;
+}
@@ -0,0 +1,484 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    fuse.c
+
+ Abstract:
+
+    This module implements the load time superinstruction fusion pass. It
+    recognizes the instruction sequences the translator emits over and over
+    and replaces each with a single fused instruction.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Instruction span of fused opcodes
+    10/17/26        Leave atomic loads alone
+    10/17/26        Leave thread stores alone
+    10/17/26        Parallel loops
+
+**/
+
+#include "fuse.h"
+#include "decode.h"
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+VOID
+DebugPrettyPrintFuseReport (
+    PPROGRAM Program,
+    PFUSE_REPORT Report
+    )
+{
+    printf("###################### FUSION REPORT START ######################\n");
+    printf("Instructions        : 0x%X\n", (unsigned int)Program->InstructionCount);
+    printf("Element address     : 0x%X\n", (unsigned int)Report->ElementAddress);
+    printf("Compare and branch  : 0x%X\n", (unsigned int)Report->CompareBranch);
+    printf("Arithmetic and store: 0x%X\n", (unsigned int)Report->ArithmeticStore);
+    printf("Dispatches saved    : 0x%X\n", (unsigned int)Report->DispatchesSaved);
+    printf("####################### FUSION REPORT END #######################\n");
+}
+
+PUCHAR
+FuseMarkJumpTargets (
+    PPROGRAM Program
+    )
+
+/*
+
+ Routine description:
+
+    This routine marks every instruction control can arrive at other than
+    by falling through from the instruction before it. Fusion must never
+    swallow one of those.
+
+ Arguments:
+
+    Program - The program being fused.
+
+ Return value:
+
+    An array with one entry per instruction, non zero for jump targets. NULL
+    if out of memory.
+
+*/
+
+{
+    PDECODED_INSTRUCTION Instruction;
+    PUCHAR JumpTargets;
+    ULONG i;
+
+    JumpTargets = malloc(Program->InstructionCount + 1);
+    if(JumpTargets == NULL) {
+        return NULL;
+    }
+
+    memset(JumpTargets, 0, Program->InstructionCount + 1);
+    JumpTargets[0] = 1;
+    for(i=0; i<Program->InstructionCount; ++i) {
+        Instruction = &Program->Instructions[i];
+        switch(Instruction->BaseOpcode) {
+            case OPC_CALLNORM:
+            case OPC_CALLPLLS:
+            case OPC_CALLPLLA:
+            case OPC_PFOR:
+
+                //
+                // Returns land on the instruction after the call, and a
+                // parallel loop goes on there once its body is done.
+                //
+
+                JumpTargets[i + 1] = 1;
+
+                //
+                // Fall through.
+                //
+
+            case OPC_JMP:
+            case OPC_JMPZ:
+                if(Instruction->Target < Program->InstructionCount) {
+                    JumpTargets[Instruction->Target] = 1;
+                }
+
+                break;
+        }
+    }
+
+    return JumpTargets;
+}
+
+LONG
+FuseCompareOperator (
+    ULONG Opcode
+    )
+{
+    switch(Opcode) {
+        case OPC_EQ:
+            return FUSE_COMPARE_EQ;
+
+        case OPC_NEQ:
+            return FUSE_COMPARE_NEQ;
+
+        case OPC_LT:
+            return FUSE_COMPARE_LT;
+
+        case OPC_GT:
+            return FUSE_COMPARE_GT;
+
+        case OPC_LTE:
+            return FUSE_COMPARE_LTE;
+
+        case OPC_GTE:
+            return FUSE_COMPARE_GTE;
+
+        default:
+            return -1;
+    }
+}
+
+LONG
+FuseArithmeticOperator (
+    ULONG Opcode
+    )
+{
+    switch(Opcode) {
+        case OPC_ADDI:
+        case OPC_ADDF:
+            return FUSE_ARITHMETIC_ADD;
+
+        case OPC_SUBI:
+        case OPC_SUBF:
+            return FUSE_ARITHMETIC_SUB;
+
+        case OPC_MULI:
+        case OPC_MULF:
+            return FUSE_ARITHMETIC_MUL;
+
+        default:
+            return -1;
+    }
+}
+
+BOOL
+FuseIsRegister (
+    PDECODED_OPERAND Operand,
+    ULONG Register
+    )
+{
+    return (Operand->Kind == OPERAND_KIND_REGISTER &&
+            Operand->Register == Register);
+}
+
+ULONG
+FuseElementAddress (
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine fuses the array element address computation emitted by
+    GenerateArrayInstructions:
+
+        MULI   Index RCT+Alignment RTn
+        ADDI   RTn RCT+Base RTn
+        RCOPYD Rb+RTn IXn
+
+ Arguments:
+
+    Instruction - First instruction of the candidate sequence.
+
+ Return value:
+
+    The number of instructions fused, 0 if the sequence doesn't match.
+
+*/
+
+{
+    ULONG Rt;
+
+    if(Instruction[0].BaseOpcode != OPC_MULI ||
+       Instruction[0].Right.Kind != OPERAND_KIND_CONSTANT ||
+       Instruction[0].Destination.Kind != OPERAND_KIND_REGISTER) {
+
+        return 0;
+    }
+
+    Rt = Instruction[0].Destination.Register;
+    if(Instruction[1].BaseOpcode != OPC_ADDI ||
+       FuseIsRegister(&Instruction[1].Left, Rt) == FALSE ||
+       Instruction[1].Right.Kind != OPERAND_KIND_CONSTANT ||
+       FuseIsRegister(&Instruction[1].Destination, Rt) == FALSE) {
+
+        return 0;
+    }
+
+    if(Instruction[2].BaseOpcode != OPC_RCOPYD ||
+       FuseIsRegister(&Instruction[2].Right, Rt) == FALSE) {
+
+        return 0;
+    }
+
+    Instruction[0].Opcode = FUSED_OPCODE_ELEMENT_ADDRESS(Instruction[0].Left.Kind);
+    return 3;
+}
+
+ULONG
+FuseCompareBranch (
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine fuses a comparison into a register with the conditional
+    jump testing that register, the shape of every loop and if condition.
+
+ Arguments:
+
+    Instruction - First instruction of the candidate sequence.
+
+ Return value:
+
+    The number of instructions fused, 0 if the sequence doesn't match.
+
+*/
+
+{
+    LONG Operator;
+
+    Operator = FuseCompareOperator(Instruction[0].BaseOpcode);
+    if(Operator < 0 ||
+       Instruction[0].Destination.Kind != OPERAND_KIND_REGISTER) {
+
+        return 0;
+    }
+
+    if(Instruction[1].BaseOpcode != OPC_JMPZ ||
+       FuseIsRegister(&Instruction[1].Left,
+                      Instruction[0].Destination.Register) == FALSE) {
+
+        return 0;
+    }
+
+    Instruction[0].Opcode = FUSED_OPCODE_COMPARE_BRANCH(Operator,
+                                                        Instruction[0].Left.Kind,
+                                                        Instruction[0].Right.Kind);
+    return 2;
+}
+
+ULONG
+FuseArithmeticStore (
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine fuses an arithmetic instruction into a register with the
+    store of that register to memory, the tail of most expression
+    statements.
+
+ Arguments:
+
+    Instruction - First instruction of the candidate sequence.
+
+ Return value:
+
+    The number of instructions fused, 0 if the sequence doesn't match.
+
+*/
+
+{
+    LONG Operator;
+
+    Operator = FuseArithmeticOperator(Instruction[0].BaseOpcode);
+    if(Operator < 0 ||
+       Instruction[0].Destination.Kind != OPERAND_KIND_REGISTER) {
+
+        return 0;
+    }
+
+    switch(Instruction[1].BaseOpcode) {
+        case OPC_STRI8:
+        case OPC_STRU8:
+        case OPC_STRI16:
+        case OPC_STRU16:
+        case OPC_STRI32:
+        case OPC_STRU32:
+        case OPC_STRF:
+            break;
+
+        default:
+            return 0;
+    }
+
+    if(Instruction[1].Flags != 0 ||
+       FuseIsRegister(&Instruction[1].Right,
+                      Instruction[0].Destination.Register) == FALSE) {
+
+        return 0;
+    }
+
+    if(Instruction[1].Destination.Kind != OPERAND_KIND_GLOBAL &&
+       Instruction[1].Destination.Kind != OPERAND_KIND_STACK) {
+
+        return 0;
+    }
+
+    Instruction[0].Opcode =
+        FUSED_OPCODE_ARITHMETIC_STORE(Operator,
+                                      Instruction[0].Left.Kind,
+                                      Instruction[0].Right.Kind,
+                                      Instruction[1].Destination.Kind);
+    return 2;
+}
+
+LONG
+FuseProgram (
+    PPROGRAM Program
+    )
+
+/*
+
+ Routine description:
+
+    This routine walks the decoded instruction stream and replaces the
+    recurring translator idioms with fused superinstructions, then prints
+    a report of which fusions fired.
+
+ Arguments:
+
+    Program - The program to fuse.
+
+ Return value:
+
+    0 on success, -1 otherwise.
+
+*/
+
+{
+    FUSE_REPORT Report;
+    PUCHAR JumpTargets;
+    PDECODED_INSTRUCTION Instruction;
+    ULONG Remaining;
+    ULONG Fused;
+    ULONG i;
+
+    JumpTargets = FuseMarkJumpTargets(Program);
+    if(JumpTargets == NULL) {
+        return -1;
+    }
+
+    memset(&Report, 0, sizeof(FUSE_REPORT));
+    i = 0;
+    while(i < Program->InstructionCount) {
+        Instruction = &Program->Instructions[i];
+        Remaining = Program->InstructionCount - i;
+        Fused = 0;
+
+        //
+        // The fused handlers load their operands plain.
+        //
+
+        if(Instruction->Flags != 0) {
+            i = i + 1;
+            continue;
+        }
+
+        if(Remaining >= 3 &&
+           JumpTargets[i + 1] == 0 &&
+           JumpTargets[i + 2] == 0) {
+
+            Fused = FuseElementAddress(Instruction);
+            if(Fused != 0) {
+                Report.ElementAddress += 1;
+            }
+        }
+
+        if(Fused == 0 && Remaining >= 2 && JumpTargets[i + 1] == 0) {
+            Fused = FuseCompareBranch(Instruction);
+            if(Fused != 0) {
+                Report.CompareBranch += 1;
+            } else {
+                Fused = FuseArithmeticStore(Instruction);
+                if(Fused != 0) {
+                    Report.ArithmeticStore += 1;
+                }
+            }
+        }
+
+        if(Fused != 0) {
+            Report.DispatchesSaved += Fused - 1;
+            i = i + Fused;
+        } else {
+            i = i + 1;
+        }
+    }
+
+    free(JumpTargets);
+    DebugPrettyPrintFuseReport(Program, &Report);
+
+    return 0;
+}
+
+ULONG
+FuseInstructionSpan (
+    ULONG Opcode
+    )
+
+/*
+
+ Routine description:
+
+    This routine returns how many decoded instructions an instruction with
+    the given dispatch opcode executes.
+
+ Arguments:
+
+    Opcode - The dispatch opcode, possibly fused.
+
+ Return value:
+
+    The number of instructions covered, 1 for anything that isn't fused.
+
+*/
+
+{
+    if(Opcode < FUSED_OPCODE_BASE) {
+        return 1;
+    }
+
+    if(Opcode < FUSED_OPCODE_COMPARE_BRANCH(0, 0, 0)) {
+        return FUSED_MAX_SPAN;
+    }
+
+    return 2;
+}
@@ -0,0 +1,68 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    fuse.h
+
+ Abstract:
+
+    This module defines the load time superinstruction fusion pass.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Instruction span of fused opcodes
+
+**/
+
+#ifndef __FUSE_H__
+#define __FUSE_H__
+
+#include <windows.h>
+#include "program.h"
+
+//
+// The most decoded instructions a single fused instruction covers.
+//
+
+#define FUSED_MAX_SPAN          3
+
+typedef struct _FUSE_REPORT {
+    ULONG ElementAddress;
+    ULONG CompareBranch;
+    ULONG ArithmeticStore;
+    ULONG DispatchesSaved;
+} FUSE_REPORT, *PFUSE_REPORT;
+
+LONG
+FuseProgram (
+    PPROGRAM Program
+    );
+
+ULONG
+FuseInstructionSpan (
+    ULONG Opcode
+    );
+
+#endif // __FUSE_H__
@@ -0,0 +1,1913 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    jit.c
+
+ Abstract:
+
+    This module implements the template JIT. Every decoded instruction is
+    translated on its own, through one machine code template per opcode
+    class, into a single executable region. Jumps and calls become native
+    jumps and calls between the translated instructions.
+
+    While generated code runs, the host registers hold:
+
+        RBX - The active register set, the pinned frame of VM registers
+        R12 - Global data
+        R13 - The thread stack
+        R14 - The JIT_CONTEXT of the thread
+        RSP - 16 byte aligned, with 32 bytes of shadow space below any frame
+
+    Every VM call gets a fresh register set on the native stack, so a VM
+    return is a native return.
+
+    Programs the template JIT leaves to the interpreter can still have their
+    hot loops translated. The interpreter records the instructions one
+    iteration of a hot loop executes and the same templates turn them into a
+    straight line trace that jumps back to its own start. Every conditional
+    branch on the trace becomes a guard that leaves the trace, and hands the
+    thread back to the interpreter, when the branch goes the other way.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Hot loop traces
+    10/17/26        Unbiased window offsets for stack operands
+    10/17/26        Stack depth check on calls
+    10/17/26        Loop traces leave when the time slice runs out
+    10/17/26        Atomic read-modify-write templates
+    10/17/26        Joins and thread stores stay with the interpreter
+    10/17/26        So do parallel loops
+    10/17/26        Reductions through a helper
+    10/17/26        Barrier waits stay with the interpreter
+    10/17/26        So do channel sends and receives
+    10/17/26        Document the helpers generated code calls
+
+**/
+
+#include "jit.h"
+#include "error.h"
+#include "fuse.h"
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if (defined(EXEC_JIT) || defined(EXEC_LOOP_JIT)) && !defined(__x86_64__)
+#error "The JIT only targets x86-64. Build without EXEC_JIT and EXEC_LOOP_JIT."
+#endif
+
+extern PPROGRAM GProgram;
+
+//
+// Worst case machine code size of any single instruction template, the call
+// template being the largest.
+//
+
+#define JIT_MAX_INSTRUCTION_SIZE    256
+
+//
+// Host registers, as encoded in ModRM.
+//
+
+#define JIT_EAX                 0
+#define JIT_ECX                 1
+#define JIT_EDX                 2
+#define JIT_EBX                 3
+
+#define JIT_MODRM(Mod, Reg, Rm) (UCHAR)(((Mod) << 6) | ((Reg) << 3) | (Rm))
+
+//
+// [R13 + RDX] as a SIB byte.
+//
+
+#define JIT_SIB_R13_RDX         0x15
+
+#define JIT_REGISTER_DISP(R)    (UCHAR)((R) * sizeof(ULONG))
+
+//
+// Native stack reserved by a VM call: shadow space for helper calls and the
+// callee register set. Together with the saved RBX and the return address
+// this keeps RSP 16 byte aligned.
+//
+
+#define JIT_SHADOW_SIZE         32
+#define JIT_CALL_FRAME_SIZE     (JIT_SHADOW_SIZE + ((sizeof(REGISTER_SET) + 15) & ~15))
+
+static_assert((JIT_CALL_FRAME_SIZE % 16) == 0,
+              "JIT_CALL_FRAME_SIZE isn't 16 byte aligned.");
+
+static_assert(JIT_CALL_FRAME_SIZE < 0x80,
+              "JIT_CALL_FRAME_SIZE doesn't fit in an 8 bit displacement.");
+
+static_assert((sizeof(REGISTER_SET) % 8) == 0,
+              "sizeof(REGISTER_SET) isn't a multiple of 8.");
+
+typedef struct _JIT_FIXUP {
+    ULONG Offset;
+    ULONG Target;
+} JIT_FIXUP, *PJIT_FIXUP;
+
+typedef struct _JIT_COMPILER {
+    PPROGRAM Program;
+    PUCHAR Code;
+    ULONG Size;
+    ULONG Capacity;
+    PULONG NativeOffsets;
+    PJIT_FIXUP Fixups;
+    ULONG FixupCount;
+    ULONG ExitOffset;
+} JIT_COMPILER, *PJIT_COMPILER;
+
+VOID
+JIT_ABI
+JitHelperIo (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PREGISTER_SET RegisterSet,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine runs a print or read for generated code, which calls it
+    instead of translating the instruction.
+
+ Arguments:
+
+    ExecData - The executing thread.
+
+    RegisterSet - The registers of the generated code, on the native stack.
+
+    Instruction - The decoded I/O instruction.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PREGISTER_SET SavedRegisterSet;
+
+    //
+    // The I/O routine works on the active register set, which for generated
+    // code lives on the native stack.
+    //
+
+    SavedRegisterSet = ExecData->ActiveRegisterSet;
+    ExecData->ActiveRegisterSet = RegisterSet;
+    ExecIoInstruction(ExecData, Instruction);
+    ExecData->ActiveRegisterSet = SavedRegisterSet;
+}
+
+VOID
+JIT_ABI
+JitHelperReduction (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PREGISTER_SET RegisterSet,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine updates the thread's copy of a reduction variable for
+    generated code, which calls it instead of translating the instruction.
+
+ Arguments:
+
+    ExecData - The executing thread.
+
+    RegisterSet - The registers of the generated code, on the native stack.
+
+    Instruction - The decoded reduction instruction.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PREGISTER_SET SavedRegisterSet;
+
+    SavedRegisterSet = ExecData->ActiveRegisterSet;
+    ExecData->ActiveRegisterSet = RegisterSet;
+    ExecReductionInstruction(ExecData, Instruction);
+    ExecData->ActiveRegisterSet = SavedRegisterSet;
+}
+
+VOID
+JIT_ABI
+JitHelperInvalid (
+    VOID
+    )
+
+/*
+
+ Routine description:
+
+    This routine is called by generated code in place of a NOT, which the
+    interpreter refuses to run as well. It doesn't return.
+
+ Arguments:
+
+    VOID
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    VmFatal(ERR_STR_INVALIDINSTR);
+}
+
+VOID
+JIT_ABI
+JitHelperStackOverflow (
+    VOID
+    )
+
+/*
+
+ Routine description:
+
+    This routine is called by generated code whose call would push a frame
+    past the end of the thread's stack. It doesn't return.
+
+ Arguments:
+
+    VOID
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    VmFatal(ERR_STR_STACKOVERFLOW);
+}
+
+VOID
+JitEmit8 (
+    PJIT_COMPILER Jc,
+    UCHAR Value
+    )
+{
+    Jc->Code[Jc->Size] = Value;
+    Jc->Size += 1;
+}
+
+VOID
+JitEmit32 (
+    PJIT_COMPILER Jc,
+    ULONG Value
+    )
+{
+    memcpy(&Jc->Code[Jc->Size], &Value, sizeof(ULONG));
+    Jc->Size += sizeof(ULONG);
+}
+
+VOID
+JitEmit64 (
+    PJIT_COMPILER Jc,
+    ULONGLONG Value
+    )
+{
+    memcpy(&Jc->Code[Jc->Size], &Value, sizeof(ULONGLONG));
+    Jc->Size += sizeof(ULONGLONG);
+}
+
+VOID
+JitEmitRel32 (
+    PJIT_COMPILER Jc,
+    ULONG Target
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits the 32 bit displacement of a jump or call to the
+    machine code of a decoded instruction, to be patched once every
+    instruction has been translated.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    Target - Index of the target instruction.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    Jc->Fixups[Jc->FixupCount].Offset = Jc->Size;
+    Jc->Fixups[Jc->FixupCount].Target = Target;
+    Jc->FixupCount += 1;
+    JitEmit32(Jc, 0);
+}
+
+VOID
+JitEmitRegisterAccess (
+    PJIT_COMPILER Jc,
+    UCHAR Opcode,
+    ULONG HostRegister,
+    ULONG Register
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits an instruction whose memory operand is a VM register
+    in the pinned frame, [RBX + Register * 4].
+
+ Arguments:
+
+    Jc - The compiler.
+
+    Opcode - The x86 opcode byte.
+
+    HostRegister - The ModRM reg field.
+
+    Register - The VM register.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    JitEmit8(Jc, Opcode);
+    JitEmit8(Jc, JIT_MODRM(1, HostRegister, JIT_EBX));
+    JitEmit8(Jc, JIT_REGISTER_DISP(Register));
+}
+
+VOID
+JitEmitStackAddress (
+    PJIT_COMPILER Jc,
+    ULONG Register,
+    LONG Offset
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits code leaving the window offset of Register + Offset,
+    zero extended, in RDX.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    Register - The VM register the address is relative to.
+
+    Offset - Offset from the register.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    JitEmitRegisterAccess(Jc, 0x8B, JIT_EDX, Register);     // mov edx, [rbx+R]
+    if(Offset != 0) {
+        JitEmit8(Jc, 0x81);                                 // add edx, imm32
+        JitEmit8(Jc, 0xC2);
+        JitEmit32(Jc, (ULONG)Offset);
+    }
+}
+
+VOID
+JitEmitLoadOperand (
+    PJIT_COMPILER Jc,
+    ULONG HostRegister,
+    PDECODED_OPERAND Operand
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits code loading a decoded operand into EAX or ECX. It
+    may clobber RDX. Memory operands take a single move, which x86-64 orders
+    as an acquire load, and stores a release store, so atomic variables need
+    nothing more.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    HostRegister - JIT_EAX or JIT_ECX.
+
+    Operand - The operand to load.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    switch(Operand->Kind) {
+        case OPERAND_KIND_CONSTANT:
+            JitEmit8(Jc, 0xB8 + HostRegister);              // mov r32, imm32
+            JitEmit32(Jc, (ULONG)Operand->Offset);
+            break;
+
+        case OPERAND_KIND_GLOBAL:
+            JitEmit8(Jc, 0x41);                             // mov r32, [r12+disp32]
+            JitEmit8(Jc, 0x8B);
+            JitEmit8(Jc, JIT_MODRM(2, HostRegister, 4));
+            JitEmit8(Jc, 0x24);
+            JitEmit32(Jc, (ULONG)Operand->Offset);
+            break;
+
+        case OPERAND_KIND_STACK:
+            JitEmitStackAddress(Jc, Operand->Register, Operand->Offset);
+            JitEmit8(Jc, 0x41);                             // mov r32, [r13+rdx]
+            JitEmit8(Jc, 0x8B);
+            JitEmit8(Jc, JIT_MODRM(1, HostRegister, 4));
+            JitEmit8(Jc, JIT_SIB_R13_RDX);
+            JitEmit8(Jc, 0x00);
+            break;
+
+        default:
+            JitEmitRegisterAccess(Jc, 0x8B, HostRegister, Operand->Register);
+            break;
+    }
+}
+
+VOID
+JitEmitStoreOperand (
+    PJIT_COMPILER Jc,
+    PDECODED_OPERAND Operand
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits code storing EAX into a decoded destination operand.
+    It may clobber RDX.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    Operand - The destination operand.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    switch(Operand->Kind) {
+        case OPERAND_KIND_GLOBAL:
+            JitEmit8(Jc, 0x41);                             // mov [r12+disp32], eax
+            JitEmit8(Jc, 0x89);
+            JitEmit8(Jc, JIT_MODRM(2, JIT_EAX, 4));
+            JitEmit8(Jc, 0x24);
+            JitEmit32(Jc, (ULONG)Operand->Offset);
+            break;
+
+        case OPERAND_KIND_STACK:
+            JitEmitStackAddress(Jc, Operand->Register, Operand->Offset);
+            JitEmit8(Jc, 0x41);                             // mov [r13+rdx], eax
+            JitEmit8(Jc, 0x89);
+            JitEmit8(Jc, JIT_MODRM(1, JIT_EAX, 4));
+            JitEmit8(Jc, JIT_SIB_R13_RDX);
+            JitEmit8(Jc, 0x00);
+            break;
+
+        default:
+            JitEmitRegisterAccess(Jc, 0x89, JIT_EAX, Operand->Register);
+            break;
+    }
+}
+
+VOID
+JitEmitStackPush (
+    PJIT_COMPILER Jc
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits code pushing EAX onto the VM stack.
+
+ Arguments:
+
+    Jc - The compiler.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    JitEmitRegisterAccess(Jc, 0x83, 5, REG_RSB);            // sub [rbx+RSB], 4
+    JitEmit8(Jc, (UCHAR)Jc->Program->Header.StackAlignment);
+    JitEmitStackAddress(Jc, REG_RSB, 0);
+    JitEmit8(Jc, 0x41);                                     // mov [r13+rdx], eax
+    JitEmit8(Jc, 0x89);
+    JitEmit8(Jc, JIT_MODRM(1, JIT_EAX, 4));
+    JitEmit8(Jc, JIT_SIB_R13_RDX);
+    JitEmit8(Jc, 0x00);
+}
+
+VOID
+JitEmitStackPop (
+    PJIT_COMPILER Jc
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits code popping the top of the VM stack into EAX.
+
+ Arguments:
+
+    Jc - The compiler.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    JitEmitStackAddress(Jc, REG_RSB, 0);
+    JitEmit8(Jc, 0x41);                                     // mov eax, [r13+rdx]
+    JitEmit8(Jc, 0x8B);
+    JitEmit8(Jc, JIT_MODRM(1, JIT_EAX, 4));
+    JitEmit8(Jc, JIT_SIB_R13_RDX);
+    JitEmit8(Jc, 0x00);
+    JitEmitRegisterAccess(Jc, 0x83, 0, REG_RSB);            // add [rbx+RSB], 4
+    JitEmit8(Jc, (UCHAR)Jc->Program->Header.StackAlignment);
+}
+
+VOID
+JitEmitHelperCall (
+    PJIT_COMPILER Jc,
+    PVOID Helper,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits a call to a C helper taking the thread execution
+    data, the active register set and the instruction being executed.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    Helper - The helper to call, a JIT_ABI routine.
+
+    Instruction - The instruction to pass along.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    JitEmit8(Jc, 0x49);                                     // mov rcx, [r14+ExecData]
+    JitEmit8(Jc, 0x8B);
+    JitEmit8(Jc, 0x4E);
+    JitEmit8(Jc, (UCHAR)offsetof(JIT_CONTEXT, ExecData));
+    JitEmit8(Jc, 0x48);                                     // mov rdx, rbx
+    JitEmit8(Jc, 0x89);
+    JitEmit8(Jc, 0xDA);
+    JitEmit8(Jc, 0x49);                                     // mov r8, imm64
+    JitEmit8(Jc, 0xB8);
+    JitEmit64(Jc, (ULONGLONG)(uintptr_t)Instruction);
+    JitEmit8(Jc, 0x48);                                     // mov rax, imm64
+    JitEmit8(Jc, 0xB8);
+    JitEmit64(Jc, (ULONGLONG)(uintptr_t)Helper);
+    JitEmit8(Jc, 0xFF);                                     // call rax
+    JitEmit8(Jc, 0xD0);
+}
+
+VOID
+JitEmitArithmetic (
+    PJIT_COMPILER Jc,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits the arithmetic template: load both operands, apply
+    the operator, store the destination.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    Instruction - The arithmetic instruction.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    UCHAR Setcc;
+
+    JitEmitLoadOperand(Jc, JIT_EAX, &Instruction->Left);
+    JitEmitLoadOperand(Jc, JIT_ECX, &Instruction->Right);
+
+    Setcc = 0;
+    switch(Instruction->BaseOpcode) {
+        case OPC_ADDI:
+        case OPC_ADDF:
+            JitEmit8(Jc, 0x01);                             // add eax, ecx
+            JitEmit8(Jc, 0xC8);
+            break;
+
+        case OPC_SUBI:
+        case OPC_SUBF:
+            JitEmit8(Jc, 0x29);                             // sub eax, ecx
+            JitEmit8(Jc, 0xC8);
+            break;
+
+        case OPC_MULI:
+        case OPC_MULF:
+            JitEmit8(Jc, 0x0F);                             // imul eax, ecx
+            JitEmit8(Jc, 0xAF);
+            JitEmit8(Jc, 0xC1);
+            break;
+
+        case OPC_DIVI:
+        case OPC_DIVF:
+            JitEmit8(Jc, 0x99);                             // cdq
+            JitEmit8(Jc, 0xF7);                             // idiv ecx
+            JitEmit8(Jc, 0xF9);
+            break;
+
+        case OPC_XOR:
+            JitEmit8(Jc, 0x31);                             // xor eax, ecx
+            JitEmit8(Jc, 0xC8);
+            break;
+
+        case OPC_OR:
+            JitEmit8(Jc, 0x09);                             // or eax, ecx
+            JitEmit8(Jc, 0xC8);
+            break;
+
+        case OPC_AND:
+            JitEmit8(Jc, 0x21);                             // and eax, ecx
+            JitEmit8(Jc, 0xC8);
+            break;
+
+        case OPC_LOR:
+        case OPC_LAND:
+            JitEmit8(Jc, 0x85);                             // test eax, eax
+            JitEmit8(Jc, 0xC0);
+            JitEmit8(Jc, 0x0F);                             // setne al
+            JitEmit8(Jc, 0x95);
+            JitEmit8(Jc, 0xC0);
+            JitEmit8(Jc, 0x85);                             // test ecx, ecx
+            JitEmit8(Jc, 0xC9);
+            JitEmit8(Jc, 0x0F);                             // setne cl
+            JitEmit8(Jc, 0x95);
+            JitEmit8(Jc, 0xC1);
+            JitEmit8(Jc, Instruction->BaseOpcode == OPC_LOR ? 0x08 : 0x20);
+            JitEmit8(Jc, 0xC8);                             // or/and al, cl
+            JitEmit8(Jc, 0x0F);                             // movzx eax, al
+            JitEmit8(Jc, 0xB6);
+            JitEmit8(Jc, 0xC0);
+            break;
+
+        case OPC_EQ:
+            Setcc = 0x94;
+            break;
+
+        case OPC_NEQ:
+            Setcc = 0x95;
+            break;
+
+        case OPC_LT:
+            Setcc = 0x9C;
+            break;
+
+        case OPC_GT:
+            Setcc = 0x9F;
+            break;
+
+        case OPC_LTE:
+            Setcc = 0x9E;
+            break;
+
+        case OPC_GTE:
+            Setcc = 0x9D;
+            break;
+    }
+
+    if(Setcc != 0) {
+        JitEmit8(Jc, 0x39);                                 // cmp eax, ecx
+        JitEmit8(Jc, 0xC8);
+        JitEmit8(Jc, 0x0F);                                 // setcc al
+        JitEmit8(Jc, Setcc);
+        JitEmit8(Jc, 0xC0);
+        JitEmit8(Jc, 0x0F);                                 // movzx eax, al
+        JitEmit8(Jc, 0xB6);
+        JitEmit8(Jc, 0xC0);
+    }
+
+    JitEmitStoreOperand(Jc, &Instruction->Destination);
+}
+
+VOID
+JitEmitAtomicVariable (
+    PJIT_COMPILER Jc,
+    ULONG HostRegister,
+    PDECODED_OPERAND Operand
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits the ModRM and what follows it for an atomic variable,
+    [R12 + disp32] for a global and [R13 + RDX] for a stack slot, the
+    address already in RDX. The REX prefix in front of the opcode needs B
+    set for either.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    HostRegister - The ModRM reg field.
+
+    Operand - The atomic variable.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    if(Operand->Kind == OPERAND_KIND_GLOBAL) {
+        JitEmit8(Jc, JIT_MODRM(2, HostRegister, 4));
+        JitEmit8(Jc, 0x24);
+        JitEmit32(Jc, (ULONG)Operand->Offset);
+    } else {
+        JitEmit8(Jc, JIT_MODRM(1, HostRegister, 4));
+        JitEmit8(Jc, JIT_SIB_R13_RDX);
+        JitEmit8(Jc, 0x00);
+    }
+}
+
+VOID
+JitEmitAtomic (
+    PJIT_COMPILER Jc,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits the atomic read-modify-write template. Adds and
+    subtracts are a lock xadd and compare and swap a lock cmpxchg. x86 has
+    no form of or, and and xor that returns the old value, so those retry a
+    lock cmpxchg, with the new value in R8D, until no other thread got in
+    between. The result goes to the destination register.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    Instruction - The atomic instruction.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    ULONG Loop;
+
+    JitEmitLoadOperand(Jc, JIT_ECX, &Instruction->Right);
+    if(Instruction->Left.Kind == OPERAND_KIND_STACK) {
+        JitEmitStackAddress(Jc, Instruction->Left.Register, Instruction->Left.Offset);
+    }
+
+    switch(Instruction->BaseOpcode) {
+        case OPC_AADD:
+        case OPC_ASUB:
+            if(Instruction->BaseOpcode == OPC_ASUB) {
+                JitEmit8(Jc, 0xF7);                         // neg ecx
+                JitEmit8(Jc, 0xD9);
+            }
+
+            JitEmit8(Jc, 0x89);                             // mov eax, ecx
+            JitEmit8(Jc, 0xC8);
+            JitEmit8(Jc, 0xF0);                             // lock xadd [V], eax
+            JitEmit8(Jc, 0x41);
+            JitEmit8(Jc, 0x0F);
+            JitEmit8(Jc, 0xC1);
+            JitEmitAtomicVariable(Jc, JIT_EAX, &Instruction->Left);
+            JitEmit8(Jc, 0x01);                             // add eax, ecx
+            JitEmit8(Jc, 0xC8);
+            break;
+
+        case OPC_ACAS:
+            JitEmitRegisterAccess(Jc,                       // mov eax, [rbx+D]
+                                  0x8B,
+                                  JIT_EAX,
+                                  Instruction->Destination.Register);
+
+            JitEmit8(Jc, 0xF0);                             // lock cmpxchg [V], ecx
+            JitEmit8(Jc, 0x41);
+            JitEmit8(Jc, 0x0F);
+            JitEmit8(Jc, 0xB1);
+            JitEmitAtomicVariable(Jc, JIT_ECX, &Instruction->Left);
+            break;
+
+        default:
+            JitEmit8(Jc, 0x41);                             // mov eax, [V]
+            JitEmit8(Jc, 0x8B);
+            JitEmitAtomicVariable(Jc, JIT_EAX, &Instruction->Left);
+            Loop = Jc->Size;
+            JitEmit8(Jc, 0x41);                             // mov r8d, eax
+            JitEmit8(Jc, 0x89);
+            JitEmit8(Jc, 0xC0);
+            JitEmit8(Jc, 0x41);                             // or/and/xor r8d, ecx
+            switch(Instruction->BaseOpcode) {
+                case OPC_AOR:
+                    JitEmit8(Jc, 0x09);
+                    break;
+
+                case OPC_AAND:
+                    JitEmit8(Jc, 0x21);
+                    break;
+
+                default:
+                    JitEmit8(Jc, 0x31);
+                    break;
+            }
+
+            JitEmit8(Jc, 0xC8);
+            JitEmit8(Jc, 0xF0);                             // lock cmpxchg [V], r8d
+            JitEmit8(Jc, 0x45);
+            JitEmit8(Jc, 0x0F);
+            JitEmit8(Jc, 0xB1);
+            JitEmitAtomicVariable(Jc, JIT_EAX, &Instruction->Left);
+            JitEmit8(Jc, 0x75);                             // jne loop
+            JitEmit8(Jc, (UCHAR)(Loop - (Jc->Size + 1)));
+            JitEmit8(Jc, 0x44);                             // mov eax, r8d
+            JitEmit8(Jc, 0x89);
+            JitEmit8(Jc, 0xC0);
+            break;
+    }
+
+    JitEmitRegisterAccess(Jc,                               // mov [rbx+D], eax
+                          0x89,
+                          JIT_EAX,
+                          Instruction->Destination.Register);
+}
+
+VOID
+JitEmitCall (
+    PJIT_COMPILER Jc,
+    ULONG InstructionIndex,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits the call template. The stack depth the verifier left
+    with the call is checked against RSB, the return index is pushed onto
+    the VM stack as the interpreter would, the callee gets a zeroed register
+    set on the native stack inheriting RST and RSB, and on return RRV, RST
+    and RSB are copied back into the caller register set.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    InstructionIndex - Index of the call instruction.
+
+    Instruction - The call instruction.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    ULONG Offset;
+    ULONG Skip;
+
+    JitEmitRegisterAccess(Jc, 0x81, 7, REG_RSB);            // cmp [rbx+RSB], depth
+    JitEmit32(Jc, 
+              Jc->Program->Header.StackAlignment + 
+              (ULONG)Instruction->Left.Offset);
+              
+    JitEmit8(Jc, 0x73);                                     // jae over
+    Skip = Jc->Size;
+    JitEmit8(Jc, 0x00);
+    JitEmitHelperCall(Jc, (PVOID)JitHelperStackOverflow, Instruction);
+    Jc->Code[Skip] = (UCHAR)(Jc->Size - (Skip + 1));
+
+    JitEmit8(Jc, 0xB8);                                     // mov eax, index+1
+    JitEmit32(Jc, InstructionIndex + 1);
+    JitEmitStackPush(Jc);
+
+    JitEmit8(Jc, 0x53);                                     // push rbx
+    JitEmit8(Jc, 0x48);                                     // sub rsp, frame
+    JitEmit8(Jc, 0x83);
+    JitEmit8(Jc, 0xEC);
+    JitEmit8(Jc, JIT_CALL_FRAME_SIZE);
+    JitEmit8(Jc, 0x48);                                     // mov rcx, rbx
+    JitEmit8(Jc, 0x89);
+    JitEmit8(Jc, 0xD9);
+    JitEmit8(Jc, 0x48);                                     // lea rbx, [rsp+shadow]
+    JitEmit8(Jc, 0x8D);
+    JitEmit8(Jc, 0x5C);
+    JitEmit8(Jc, 0x24);
+    JitEmit8(Jc, JIT_SHADOW_SIZE);
+    JitEmit8(Jc, 0x31);                                     // xor eax, eax
+    JitEmit8(Jc, 0xC0);
+    for(Offset=0; Offset<sizeof(REGISTER_SET); Offset+=8) {
+        JitEmit8(Jc, 0x48);                                 // mov [rbx+off], rax
+        JitEmit8(Jc, 0x89);
+        JitEmit8(Jc, 0x43);
+        JitEmit8(Jc, (UCHAR)Offset);
+    }
+
+    JitEmit8(Jc, 0x8B);                                     // mov eax, [rcx+RST]
+    JitEmit8(Jc, 0x41);
+    JitEmit8(Jc, JIT_REGISTER_DISP(REG_RST));
+    JitEmitRegisterAccess(Jc, 0x89, JIT_EAX, REG_RST);
+    JitEmit8(Jc, 0x8B);                                     // mov eax, [rcx+RSB]
+    JitEmit8(Jc, 0x41);
+    JitEmit8(Jc, JIT_REGISTER_DISP(REG_RSB));
+    JitEmitRegisterAccess(Jc, 0x89, JIT_EAX, REG_RSB);
+
+    JitEmit8(Jc, 0xE8);                                     // call target
+    JitEmitRel32(Jc, Instruction->Target);
+
+    JitEmit8(Jc, 0x48);                                     // mov rcx, [rsp+frame]
+    JitEmit8(Jc, 0x8B);
+    JitEmit8(Jc, 0x4C);
+    JitEmit8(Jc, 0x24);
+    JitEmit8(Jc, JIT_CALL_FRAME_SIZE);
+    JitEmitRegisterAccess(Jc, 0x8B, JIT_EAX, REG_RRV);
+    JitEmit8(Jc, 0x89);                                     // mov [rcx+RRV], eax
+    JitEmit8(Jc, 0x41);
+    JitEmit8(Jc, JIT_REGISTER_DISP(REG_RRV));
+    JitEmitRegisterAccess(Jc, 0x8B, JIT_EAX, REG_RST);
+    JitEmit8(Jc, 0x89);                                     // mov [rcx+RST], eax
+    JitEmit8(Jc, 0x41);
+    JitEmit8(Jc, JIT_REGISTER_DISP(REG_RST));
+    JitEmitRegisterAccess(Jc, 0x8B, JIT_EAX, REG_RSB);
+    JitEmit8(Jc, 0x89);                                     // mov [rcx+RSB], eax
+    JitEmit8(Jc, 0x41);
+    JitEmit8(Jc, JIT_REGISTER_DISP(REG_RSB));
+    JitEmit8(Jc, 0x48);                                     // add rsp, frame
+    JitEmit8(Jc, 0x83);
+    JitEmit8(Jc, 0xC4);
+    JitEmit8(Jc, JIT_CALL_FRAME_SIZE);
+    JitEmit8(Jc, 0x5B);                                     // pop rbx
+}
+
+VOID
+JitEmitReturn (
+    PJIT_COMPILER Jc,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits the return template. A return at the stack depth the
+    thread entered generated code at ends the thread, like a return with an
+    empty register set stack does in the interpreter.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    Instruction - The return instruction.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    JitEmit8(Jc, 0x49);                                     // cmp rsp, [r14+EntryRsp]
+    JitEmit8(Jc, 0x3B);
+    JitEmit8(Jc, 0x66);
+    JitEmit8(Jc, (UCHAR)offsetof(JIT_CONTEXT, EntryRsp));
+    JitEmit8(Jc, 0x0F);                                     // je exit
+    JitEmit8(Jc, 0x84);
+    JitEmit32(Jc, Jc->ExitOffset - (Jc->Size + sizeof(ULONG)));
+    JitEmitRegisterAccess(Jc, 0x81, 0, REG_RSB);            // add [rbx+RSB], cleanup
+    JitEmit32(Jc, Instruction->StackCleanup);
+    JitEmit8(Jc, 0xC3);                                     // ret
+}
+
+VOID
+JitEmitEntry (
+    PJIT_COMPILER Jc
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits the JIT_ENTRY trampoline, which saves the host
+    registers, pins the thread state and jumps to Context->EntryCode, and
+    the exit stub returning from it.
+
+ Arguments:
+
+    Jc - The compiler.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    static const UCHAR Prologue[] = {
+        0x53,                                               // push rbx
+        0x55,                                               // push rbp
+        0x57,                                               // push rdi
+        0x56,                                               // push rsi
+        0x41, 0x54,                                         // push r12
+        0x41, 0x55,                                         // push r13
+        0x41, 0x56,                                         // push r14
+        0x41, 0x57,                                         // push r15
+        0x48, 0x83, 0xEC, 0x28,                             // sub rsp, 40
+        0x49, 0x89, 0xCE,                                   // mov r14, rcx
+        0x48, 0x89, 0xD3,                                   // mov rbx, rdx
+        0x4D, 0x89, 0xC4,                                   // mov r12, r8
+        0x4D, 0x89, 0xCD,                                   // mov r13, r9
+    };
+
+    static const UCHAR Epilogue[] = {
+        0x48, 0x83, 0xC4, 0x28,                             // add rsp, 40
+        0x41, 0x5F,                                         // pop r15
+        0x41, 0x5E,                                         // pop r14
+        0x41, 0x5D,                                         // pop r13
+        0x41, 0x5C,                                         // pop r12
+        0x5E,                                               // pop rsi
+        0x5F,                                               // pop rdi
+        0x5D,                                               // pop rbp
+        0x5B,                                               // pop rbx
+        0xC3,                                               // ret
+    };
+
+    memcpy(&Jc->Code[Jc->Size], Prologue, sizeof(Prologue));
+    Jc->Size += sizeof(Prologue);
+    JitEmit8(Jc, 0x49);                                     // mov [r14+EntryRsp], rsp
+    JitEmit8(Jc, 0x89);
+    JitEmit8(Jc, 0x66);
+    JitEmit8(Jc, (UCHAR)offsetof(JIT_CONTEXT, EntryRsp));
+    JitEmit8(Jc, 0x41);                                     // jmp [r14+EntryCode]
+    JitEmit8(Jc, 0xFF);
+    JitEmit8(Jc, 0x66);
+    JitEmit8(Jc, (UCHAR)offsetof(JIT_CONTEXT, EntryCode));
+
+    Jc->ExitOffset = Jc->Size;
+    memcpy(&Jc->Code[Jc->Size], Epilogue, sizeof(Epilogue));
+    Jc->Size += sizeof(Epilogue);
+}
+
+BOOL
+JitCompileInstruction (
+    PJIT_COMPILER Jc,
+    ULONG InstructionIndex
+    )
+
+/*
+
+ Routine description:
+
+    This routine translates a single decoded instruction through the
+    template for its opcode class. Quickened and fused instructions are
+    translated from their base opcode, the instructions a fused one covers
+    are still in place after it.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    InstructionIndex - Index of the instruction to translate.
+
+ Return value:
+
+    TRUE on success, FALSE if the instruction can't be translated.
+
+*/
+
+{
+    PDECODED_INSTRUCTION Instruction;
+
+    Instruction = &Jc->Program->Instructions[InstructionIndex];
+    switch(Instruction->BaseOpcode) {
+        case OPC_ADDI:
+        case OPC_ADDF:
+        case OPC_SUBI:
+        case OPC_SUBF:
+        case OPC_MULI:
+        case OPC_MULF:
+        case OPC_DIVI:
+        case OPC_DIVF:
+        case OPC_XOR:
+        case OPC_OR:
+        case OPC_AND:
+        case OPC_LOR:
+        case OPC_LAND:
+        case OPC_EQ:
+        case OPC_NEQ:
+        case OPC_LT:
+        case OPC_GT:
+        case OPC_LTE:
+        case OPC_GTE:
+            JitEmitArithmetic(Jc, Instruction);
+            break;
+
+        case OPC_AADD:
+        case OPC_ASUB:
+        case OPC_AOR:
+        case OPC_AAND:
+        case OPC_AXOR:
+        case OPC_ACAS:
+            JitEmitAtomic(Jc, Instruction);
+            break;
+
+        case OPC_NOT:
+            JitEmitHelperCall(Jc, (PVOID)JitHelperInvalid, Instruction);
+            break;
+
+        case OPC_RCOPYD:
+            JitEmitRegisterAccess(Jc, 0x8B, JIT_EAX, Instruction->Left.Register);
+            if(Instruction->Right.Kind == OPERAND_KIND_CONSTANT) {
+                JitEmit8(Jc, 0x05);                         // add eax, imm32
+                JitEmit32(Jc, (ULONG)Instruction->Right.Offset);
+            } else {
+                JitEmitRegisterAccess(Jc,                   // add eax, [rbx+R]
+                                      0x03,
+                                      JIT_EAX,
+                                      Instruction->Right.Register);
+            }
+
+            JitEmitRegisterAccess(Jc,
+                                  0x89,
+                                  JIT_EAX,
+                                  Instruction->Destination.Register);
+            break;
+
+        case OPC_STRI8:
+        case OPC_STRU8:
+        case OPC_STRI16:
+        case OPC_STRU16:
+        case OPC_STRI32:
+        case OPC_STRU32:
+        case OPC_STRF:
+            JitEmitLoadOperand(Jc, JIT_EAX, &Instruction->Right);
+            if(Instruction->StoreShift != 0) {
+                JitEmit8(Jc, 0xC1);                         // shl eax, shift
+                JitEmit8(Jc, 0xE0);
+                JitEmit8(Jc, (UCHAR)Instruction->StoreShift);
+                JitEmit8(Jc, 0xC1);                         // sar eax, shift
+                JitEmit8(Jc, 0xF8);
+                JitEmit8(Jc, (UCHAR)Instruction->StoreShift);
+            }
+
+            JitEmitStoreOperand(Jc, &Instruction->Destination);
+            break;
+
+        case OPC_JMP:
+            JitEmit8(Jc, 0xE9);                             // jmp target
+            JitEmitRel32(Jc, Instruction->Target);
+            break;
+
+        case OPC_JMPZ:
+            JitEmitRegisterAccess(Jc,                       // cmp [rbx+R], 0
+                                  0x83,
+                                  7,
+                                  Instruction->Left.Register);
+
+            JitEmit8(Jc, 0x00);
+            JitEmit8(Jc, 0x0F);                             // je target
+            JitEmit8(Jc, 0x84);
+            JitEmitRel32(Jc, Instruction->Target);
+            break;
+
+        case OPC_CALLNORM:
+            JitEmitCall(Jc, InstructionIndex, Instruction);
+            break;
+
+        case OPC_RETURN:
+            JitEmitReturn(Jc, Instruction);
+            break;
+
+        case OPC_PUSH:
+            JitEmitLoadOperand(Jc, JIT_EAX, &Instruction->Left);
+            JitEmitStackPush(Jc);
+            break;
+
+        case OPC_POP:
+            JitEmitStackPop(Jc);
+            JitEmitStoreOperand(Jc, &Instruction->Destination);
+            break;
+
+        case OPC_PRINT:
+        case OPC_READ:
+            JitEmitHelperCall(Jc, (PVOID)JitHelperIo, Instruction);
+            break;
+
+        case OPC_RADD:
+        case OPC_RSUB:
+        case OPC_ROR:
+        case OPC_RAND:
+        case OPC_RXOR:
+        case OPC_RMIN:
+        case OPC_RMAX:
+            JitEmitHelperCall(Jc, (PVOID)JitHelperReduction, Instruction);
+            break;
+
+        default:
+
+            //
+            // Parallel calls, parallel loops, joins, thread stores, barrier
+            // waits and channels stay with the interpreter.
+            //
+
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+DebugPrettyPrintJitReport (
+    PPROGRAM Program,
+    PJIT_PROGRAM Jit
+    )
+{
+    ULONG i;
+    ULONG Index;
+
+    printf("######################## JIT REPORT START ########################\n");
+    printf("Code bytes          : 0x%X\n", (unsigned int)Jit->CodeSize);
+    for(i=0; i<Program->FunctionSymbolsSize; ++i) {
+        Index = (Program->FunctionSymbols[i].FunctionAddress -
+                 Program->Header.CodeStart) / sizeof(INSTRUCTION);
+
+        if(Index < Program->InstructionCount) {
+            printf("Function %-11u: 0x%X -> native 0x%X\n",
+                   (unsigned int)i,
+                   (unsigned int)Index,
+                   (unsigned int)Jit->NativeOffsets[Index]);
+        }
+    }
+
+    printf("######################### JIT REPORT END #########################\n");
+}
+
+LONG
+JitCompileProgram (
+    PPROGRAM Program
+    )
+
+/*
+
+ Routine description:
+
+    This routine translates a decoded program into machine code. Programs
+    the JIT can't handle are left to the interpreter.
+
+ Arguments:
+
+    Program - The program to compile. Program->Jit is set on success.
+
+ Return value:
+
+    0 on success, -1 if the program will be interpreted.
+
+*/
+
+{
+    JIT_COMPILER Jc;
+    PJIT_PROGRAM Jit;
+    DWORD OldProtect;
+    LONG Displacement;
+    ULONG i;
+
+    Jit = NULL;
+    memset(&Jc, 0, sizeof(JIT_COMPILER));
+    Jc.Program = Program;
+
+    //
+    // Every VM memory access is a plain 32 bit load or store.
+    //
+
+    if(Program->Header.StackAlignment != sizeof(ULONG)) {
+        goto JitCompileProgramErr;
+    }
+
+    Jit = malloc(sizeof(JIT_PROGRAM));
+    if(Jit == NULL) {
+        goto JitCompileProgramErr;
+    }
+
+    memset(Jit, 0, sizeof(JIT_PROGRAM));
+    Jc.Capacity = (Program->InstructionCount + 1) * JIT_MAX_INSTRUCTION_SIZE;
+    Jc.Code = VirtualAlloc(NULL,
+                           Jc.Capacity,
+                           MEM_COMMIT | MEM_RESERVE,
+                           PAGE_READWRITE);
+
+    Jc.NativeOffsets = malloc(Program->InstructionCount * sizeof(ULONG));
+    Jc.Fixups = malloc(Program->InstructionCount * sizeof(JIT_FIXUP));
+    if(Jc.Code == NULL || Jc.NativeOffsets == NULL || Jc.Fixups == NULL) {
+        goto JitCompileProgramErr;
+    }
+
+    JitEmitEntry(&Jc);
+    for(i=0; i<Program->InstructionCount; ++i) {
+        Jc.NativeOffsets[i] = Jc.Size;
+        if(JitCompileInstruction(&Jc, i) == FALSE) {
+            goto JitCompileProgramErr;
+        }
+    }
+
+    //
+    // Every jump and call can now be pointed at its target.
+    //
+
+    for(i=0; i<Jc.FixupCount; ++i) {
+        if(Jc.Fixups[i].Target >= Program->InstructionCount) {
+            goto JitCompileProgramErr;
+        }
+
+        Displacement = (LONG)Jc.NativeOffsets[Jc.Fixups[i].Target] -
+                       (LONG)(Jc.Fixups[i].Offset + sizeof(ULONG));
+
+        memcpy(&Jc.Code[Jc.Fixups[i].Offset], &Displacement, sizeof(LONG));
+    }
+
+    if(VirtualProtect(Jc.Code,
+                      Jc.Capacity,
+                      PAGE_EXECUTE_READ,
+                      &OldProtect) == FALSE) {
+
+        goto JitCompileProgramErr;
+    }
+
+    FlushInstructionCache(GetCurrentProcess(), Jc.Code, Jc.Size);
+
+    free(Jc.Fixups);
+    Jit->Code = Jc.Code;
+    Jit->CodeSize = Jc.Size;
+    Jit->CodeCapacity = Jc.Capacity;
+    Jit->NativeOffsets = Jc.NativeOffsets;
+    Jit->Entry = (JIT_ENTRY)(PVOID)Jc.Code;
+    Program->Jit = Jit;
+    DebugPrettyPrintJitReport(Program, Jit);
+
+    return 0;
+
+JitCompileProgramErr:
+    if(Jc.Code != NULL) {
+        VirtualFree(Jc.Code, 0, MEM_RELEASE);
+    }
+
+    free(Jc.NativeOffsets);
+    free(Jc.Fixups);
+    free(Jit);
+
+    return -1;
+}
+
+VOID
+JitExecute (
+    PTHREAD_EXECUTION_DATA ExecData
+    )
+
+/*
+
+ Routine description:
+
+    This routine runs a thread in generated code, starting at the
+    instruction RIP indexes, until it returns from its entry function.
+
+ Arguments:
+
+    ExecData - The thread execution data for the calling thread.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    JIT_CONTEXT Context;
+    PJIT_PROGRAM Jit;
+
+    Jit = GProgram->Jit;
+    Context.EntryRsp = NULL;
+    Context.EntryCode =
+        Jit->Code +
+        Jit->NativeOffsets[ExecData->ActiveRegisterSet->Register[REG_RIP]];
+
+    Context.ExecData = ExecData;
+    Jit->Entry(&Context,
+               ExecData->ActiveRegisterSet,
+               GProgram->GlobalData,
+               ExecData->ThreadStack);
+}
+
+VOID
+JitFree (
+    PJIT_PROGRAM Jit
+    )
+{
+    VirtualFree(Jit->Code, 0, MEM_RELEASE);
+    free(Jit->NativeOffsets);
+    free(Jit);
+}
+
+LONG
+JitLoopCacheCreate (
+    PPROGRAM Program
+    )
+
+/*
+
+ Routine description:
+
+    This routine sets up the loop counters and trace cache of a program the
+    loop JIT can handle. Program->Loops is left NULL for any other program.
+
+ Arguments:
+
+    Program - The decoded program.
+
+ Return value:
+
+    0 on success, -1 if out of memory.
+
+*/
+
+{
+    PJIT_LOOP_CACHE Loops;
+
+    if(Program->Header.StackAlignment != sizeof(ULONG)) {
+        return 0;
+    }
+
+    Loops = malloc(sizeof(JIT_LOOP_CACHE));
+    if(Loops == NULL) {
+        return -1;
+    }
+
+    Loops->Counters = malloc(Program->InstructionCount * sizeof(ULONG));
+    Loops->Traces = malloc(Program->InstructionCount * sizeof(PJIT_LOOP_TRACE));
+    if(Loops->Counters == NULL || Loops->Traces == NULL) {
+        free(Loops->Counters);
+        free((PVOID)Loops->Traces);
+        free(Loops);
+        return -1;
+    }
+
+    memset(Loops->Counters, 0, Program->InstructionCount * sizeof(ULONG));
+    memset((PVOID)Loops->Traces,
+           0,
+           Program->InstructionCount * sizeof(PJIT_LOOP_TRACE));
+
+    Program->Loops = Loops;
+    return 0;
+}
+
+PJIT_LOOP_RECORDER
+JitLoopRecorderCreate (
+    ULONG Head
+    )
+{
+    PJIT_LOOP_RECORDER Recorder;
+
+    Recorder = malloc(sizeof(JIT_LOOP_RECORDER));
+    if(Recorder == NULL) {
+        return NULL;
+    }
+
+    Recorder->Head = Head;
+    Recorder->Length = 0;
+    return Recorder;
+}
+
+VOID
+JitLoopRecorderFree (
+    PJIT_LOOP_RECORDER Recorder
+    )
+{
+    free(Recorder);
+}
+
+VOID
+JitEmitLoopExit (
+    PJIT_COMPILER Jc,
+    ULONG ExitIndex
+    )
+
+/*
+
+ Routine description:
+
+    This routine emits a side exit from a trace. The interpreter resumes at
+    ExitIndex. The exit is always 13 bytes long.
+
+ Arguments:
+
+    Jc - The compiler.
+
+    ExitIndex - Index of the instruction to resume at.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    JitEmit8(Jc, 0x41);                                     // mov [r14+ExitIndex], index
+    JitEmit8(Jc, 0xC7);
+    JitEmit8(Jc, 0x46);
+    JitEmit8(Jc, (UCHAR)offsetof(JIT_CONTEXT, ExitIndex));
+    JitEmit32(Jc, ExitIndex);
+    JitEmit8(Jc, 0xE9);                                     // jmp exit
+    JitEmit32(Jc, Jc->ExitOffset - (Jc->Size + sizeof(ULONG)));
+}
+
+PJIT_LOOP_TRACE
+JitLoopCompile (
+    PJIT_LOOP_RECORDER Recorder
+    )
+
+/*
+
+ Routine description:
+
+    This routine translates a recorded loop iteration into a trace. The
+    recording holds the instructions the interpreter dispatched, the ones a
+    fused instruction covers are added back here so that every decoded
+    instruction is translated through its own template.
+
+ Arguments:
+
+    Recorder - The finished recording, starting at the loop head.
+
+ Return value:
+
+    The trace, NULL if the recording can't be translated.
+
+*/
+
+{
+    JIT_COMPILER Jc;
+    PJIT_LOOP_TRACE Trace;
+    PDECODED_INSTRUCTION Instruction;
+    PULONG Slots;
+    DWORD OldProtect;
+    ULONG SlotCount;
+    ULONG Span;
+    ULONG Next;
+    ULONG Body;
+    ULONG i;
+    ULONG j;
+
+    Trace = NULL;
+    memset(&Jc, 0, sizeof(JIT_COMPILER));
+    Jc.Program = GProgram;
+    Slots = malloc(Recorder->Length * FUSED_MAX_SPAN * sizeof(ULONG));
+    if(Slots == NULL) {
+        goto JitLoopCompileErr;
+    }
+
+    SlotCount = 0;
+    for(i=0; i<Recorder->Length; ++i) {
+        Span = FuseInstructionSpan(
+                   GProgram->Instructions[Recorder->Indices[i]].Opcode);
+
+        if(Recorder->Indices[i] + Span > GProgram->InstructionCount) {
+            goto JitLoopCompileErr;
+        }
+
+        for(j=0; j<Span; ++j) {
+            Slots[SlotCount] = Recorder->Indices[i] + j;
+            SlotCount += 1;
+        }
+    }
+
+    //
+    // Control has to flow through the slots in order. Anything else means
+    // the recording didn't follow the program, so don't trust it.
+    //
+
+    for(i=0; i<SlotCount; ++i) {
+        Next = (i + 1 < SlotCount) ? Slots[i + 1] : Recorder->Head;
+        Instruction = &GProgram->Instructions[Slots[i]];
+        if(Instruction->BaseOpcode == OPC_JMP) {
+            if(Next != Instruction->Target) {
+                goto JitLoopCompileErr;
+            }
+
+        } else if(Instruction->BaseOpcode == OPC_JMPZ) {
+            if(Next != Instruction->Target && Next != Slots[i] + 1) {
+                goto JitLoopCompileErr;
+            }
+
+        } else if(Next != Slots[i] + 1) {
+            goto JitLoopCompileErr;
+        }
+    }
+
+    Trace = malloc(sizeof(JIT_LOOP_TRACE));
+    if(Trace == NULL) {
+        goto JitLoopCompileErr;
+    }
+
+    Jc.Capacity = (SlotCount + 2) * JIT_MAX_INSTRUCTION_SIZE;
+    Jc.Code = VirtualAlloc(NULL,
+                           Jc.Capacity,
+                           MEM_COMMIT | MEM_RESERVE,
+                           PAGE_READWRITE);
+
+    if(Jc.Code == NULL) {
+        goto JitLoopCompileErr;
+    }
+
+    JitEmitEntry(&Jc);
+    Body = Jc.Size;
+    for(i=0; i<SlotCount; ++i) {
+        Next = (i + 1 < SlotCount) ? Slots[i + 1] : Recorder->Head;
+        Instruction = &GProgram->Instructions[Slots[i]];
+        switch(Instruction->BaseOpcode) {
+            case OPC_JMP:
+
+                //
+                // The trace already continues at the target.
+                //
+
+                break;
+
+            case OPC_JMPZ:
+                if(Instruction->Target == Slots[i] + 1) {
+                    break;
+                }
+
+                JitEmitRegisterAccess(&Jc,                  // cmp [rbx+R], 0
+                                      0x83,
+                                      7,
+                                      Instruction->Left.Register);
+
+                JitEmit8(&Jc, 0x00);
+                if(Next == Instruction->Target) {
+                    JitEmit8(&Jc, 0x74);                    // je trace
+                    JitEmit8(&Jc, 0x0D);
+                    JitEmitLoopExit(&Jc, Slots[i] + 1);
+
+                } else {
+                    JitEmit8(&Jc, 0x75);                    // jne trace
+                    JitEmit8(&Jc, 0x0D);
+                    JitEmitLoopExit(&Jc, Instruction->Target);
+                }
+
+                break;
+
+            default:
+                if(JitCompileInstruction(&Jc, Slots[i]) == FALSE) {
+                    goto JitLoopCompileErr;
+                }
+
+                break;
+        }
+    }
+
+    //
+    // Each trip round the loop is a backward jump taken from the time slice
+    // of the thread. The trace leaves at the loop head once it runs out.
+    //
+
+    JitEmit8(&Jc, 0x41);                                    // dec [r14+Budget]
+    JitEmit8(&Jc, 0xFF);
+    JitEmit8(&Jc, 0x4E);
+    JitEmit8(&Jc, (UCHAR)offsetof(JIT_CONTEXT, Budget));
+    JitEmit8(&Jc, 0x0F);                                    // jnz body
+    JitEmit8(&Jc, 0x85);
+    JitEmit32(&Jc, Body - (Jc.Size + sizeof(ULONG)));
+    JitEmitLoopExit(&Jc, Recorder->Head);
+
+    if(VirtualProtect(Jc.Code,
+                      Jc.Capacity,
+                      PAGE_EXECUTE_READ,
+                      &OldProtect) == FALSE) {
+
+        goto JitLoopCompileErr;
+    }
+
+    FlushInstructionCache(GetCurrentProcess(), Jc.Code, Jc.Size);
+
+    free(Slots);
+    Trace->Code = Jc.Code;
+    Trace->CodeCapacity = Jc.Capacity;
+    Trace->BodyOffset = Body;
+    return Trace;
+
+JitLoopCompileErr:
+    if(Jc.Code != NULL) {
+        VirtualFree(Jc.Code, 0, MEM_RELEASE);
+    }
+
+    free(Slots);
+    free(Trace);
+    return NULL;
+}
+
+BOOL
+JitLoopRecord (
+    PJIT_LOOP_RECORDER Recorder,
+    ULONG InstructionIndex
+    )
+
+/*
+
+ Routine description:
+
+    This routine adds the instruction the interpreter is about to execute to
+    a recording. Once the loop head comes round again the recording is
+    translated and the trace published. Loops that call, return or run too
+    long are abandoned, and as their counter stays at the threshold they are
+    never recorded again.
+
+ Arguments:
+
+    Recorder - The recording of the calling thread.
+
+    InstructionIndex - Index of the instruction about to execute.
+
+ Return value:
+
+    TRUE if the recording is finished and the recorder freed, FALSE if it
+    goes on.
+
+*/
+
+{
+    PJIT_LOOP_TRACE Trace;
+    ULONG Opcode;
+
+    if(Recorder->Length != 0 && InstructionIndex == Recorder->Head) {
+        Trace = JitLoopCompile(Recorder);
+        if(Trace != NULL &&
+           InterlockedCompareExchangePointer(
+               (PVOID volatile *)&GProgram->Loops->Traces[Recorder->Head],
+               Trace,
+               NULL) != NULL) {
+
+            //
+            // Another thread recorded the same loop first.
+            //
+
+            VirtualFree(Trace->Code, 0, MEM_RELEASE);
+            free(Trace);
+        }
+
+        goto JitLoopRecordEnd;
+    }
+
+    Opcode = GProgram->Instructions[InstructionIndex].BaseOpcode;
+    if(Opcode == OPC_CALLNORM ||
+       Opcode == OPC_CALLPLLS ||
+       Opcode == OPC_CALLPLLA ||
+       Opcode == OPC_RETURN ||
+       Opcode == OPC_JOIN ||
+       Opcode == OPC_STRTH ||
+       Opcode == OPC_PFOR ||
+       Opcode == OPC_WAIT ||
+       Opcode == OPC_SEND ||
+       Opcode == OPC_RECV ||
+       Recorder->Length == JIT_LOOP_MAX_RECORD) {
+
+        goto JitLoopRecordEnd;
+    }
+
+    Recorder->Indices[Recorder->Length] = InstructionIndex;
+    Recorder->Length += 1;
+    return FALSE;
+
+JitLoopRecordEnd:
+    JitLoopRecorderFree(Recorder);
+    return TRUE;
+}
+
+ULONG
+JitLoopExecute (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Head
+    )
+
+/*
+
+ Routine description:
+
+    This routine runs the trace of a hot loop until one of its guards fails
+    or the time slice of the thread runs out.
+
+ Arguments:
+
+    ExecData - The thread execution data for the calling thread.
+
+    Head - Index of the loop head. Its trace must have been published.
+
+ Return value:
+
+    Index of the instruction the interpreter resumes at.
+
+*/
+
+{
+    JIT_CONTEXT Context;
+    PJIT_LOOP_TRACE Trace;
+
+    Trace = GProgram->Loops->Traces[Head];
+    Context.EntryRsp = NULL;
+    Context.EntryCode = Trace->Code + Trace->BodyOffset;
+    Context.ExecData = ExecData;
+    Context.ExitIndex = Head;
+    Context.Budget = ExecData->Budget + 1;
+    ((JIT_ENTRY)(PVOID)Trace->Code)(&Context,
+                                    ExecData->ActiveRegisterSet,
+                                    GProgram->GlobalData,
+                                    ExecData->ThreadStack);
+
+    ExecData->Budget = (Context.Budget != 0) ? Context.Budget - 1 : 0;
+    return Context.ExitIndex;
+}
@@ -0,0 +1,163 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    jit.h
+
+ Abstract:
+
+    This module defines the template JIT, which translates the decoded
+    instruction stream into x86-64 machine code at load time, and the loop
+    JIT, which translates the hot loops of interpreted programs.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Hot loop traces
+    10/17/26        Loop traces count down the time slice
+
+**/
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <windows.h>
+#include "program.h"
+#include "exec.h"
+
+//
+// Generated code and the helpers it calls always use the Windows x64
+// calling convention, whatever the host compiler defaults to.
+//
+
+#define JIT_ABI                 __attribute__((ms_abi))
+
+//
+// Per thread state the generated code reaches through R14.
+//
+
+typedef struct _JIT_CONTEXT {
+    PVOID EntryRsp;                             // 0x00
+    PVOID EntryCode;                            // 0x08
+    PTHREAD_EXECUTION_DATA ExecData;            // 0x10
+    ULONG ExitIndex;                            // 0x18
+    ULONG Budget;                               // 0x1C
+} JIT_CONTEXT, *PJIT_CONTEXT;
+
+typedef
+VOID
+(JIT_ABI *JIT_ENTRY) (
+    PJIT_CONTEXT Context,
+    PREGISTER_SET RegisterSet,
+    PCHAR GlobalData,
+    PCHAR ThreadStack
+    );
+
+typedef struct _JIT_PROGRAM {
+    PUCHAR Code;
+    ULONG CodeSize;
+    ULONG CodeCapacity;
+
+    //
+    // Offset into Code of the machine code for each decoded instruction.
+    //
+
+    PULONG NativeOffsets;
+    JIT_ENTRY Entry;
+} JIT_PROGRAM, *PJIT_PROGRAM;
+
+//
+// A loop is hot once the jump back to its head has been taken
+// JIT_LOOP_THRESHOLD times. The interpreter then records the instructions
+// of one iteration, at most JIT_LOOP_MAX_RECORD of them, for the loop JIT.
+//
+
+#define JIT_LOOP_THRESHOLD      1000
+#define JIT_LOOP_MAX_RECORD     1024
+
+typedef struct _JIT_LOOP_TRACE {
+    PUCHAR Code;
+    ULONG CodeCapacity;
+    ULONG BodyOffset;
+} JIT_LOOP_TRACE, *PJIT_LOOP_TRACE;
+
+typedef struct _JIT_LOOP_CACHE {
+
+    //
+    // Both indexed by the instruction index of the loop head.
+    //
+
+    PULONG Counters;
+    PJIT_LOOP_TRACE volatile *Traces;
+} JIT_LOOP_CACHE, *PJIT_LOOP_CACHE;
+
+typedef struct _JIT_LOOP_RECORDER {
+    ULONG Head;
+    ULONG Length;
+    ULONG Indices[JIT_LOOP_MAX_RECORD];
+} JIT_LOOP_RECORDER, *PJIT_LOOP_RECORDER;
+
+LONG
+JitCompileProgram (
+    PPROGRAM Program
+    );
+
+VOID
+JitExecute (
+    PTHREAD_EXECUTION_DATA ExecData
+    );
+
+VOID
+JitFree (
+    PJIT_PROGRAM Jit
+    );
+
+LONG
+JitLoopCacheCreate (
+    PPROGRAM Program
+    );
+
+PJIT_LOOP_RECORDER
+JitLoopRecorderCreate (
+    ULONG Head
+    );
+
+BOOL
+JitLoopRecord (
+    PJIT_LOOP_RECORDER Recorder,
+    ULONG InstructionIndex
+    );
+
+VOID
+JitLoopRecorderFree (
+    PJIT_LOOP_RECORDER Recorder
+    );
+
+ULONG
+JitLoopExecute (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Head
+    );
+
+#endif // __JIT_H__
@@ -32,6 +32,7 @@
  Revision:
  
     11/24/15        Initial Creation
+    10/17/26        Drop the NUL trace stream
 
 **/
 
@@ -47,11 +48,6 @@
 #include "exec.h"
 #include "error.h"
 
-
-#ifndef COMPILE_VERBOSE
-FILE* _NUL;
-#endif
-
 PPROGRAM GProgram = NULL;
 
 INT 
@@ -62,24 +58,15 @@ main (
 {
     FILE *FileCompiled;
     
-#ifndef COMPILE_VERBOSE
-    _NUL = fopen("nul", "w");
-    if(_NUL == NULL) {
-        VmFatal(ERR_STR_NULOPENFAIL);
-    }
-#endif
-    
     FileCompiled = fopen("out.cut", "rb");
     if(FileCompiled == NULL) {
         VmFatal(ERR_STR_NOINPUTFILE);
     }
     
-    ProgramRead(FileCompiled, &GProgram);
+    if(ProgramRead(FileCompiled, &GProgram) != 0) {
+        VmFatal(ERR_STR_PROGRAMREADFAIL);
+    }
     
     ExecPrimeProgram( );
-    
-#ifndef COMPILE_VERBOSE
-    fclose(_NUL);
-#endif
     return 0;
 }
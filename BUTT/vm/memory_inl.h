@@ -32,6 +32,13 @@
  Revision:
  
     11/24/15        Initial Creation
+    10/17/26        Operate on decoded operands
+    10/17/26        Address the thread window directly
+    10/17/26        Explicit access width
+    10/17/26        Optional bounds checks
+    10/17/26        Acquire loads and release stores for atomic variables
+    10/17/26        Atomic read-modify-write
+    10/17/26        Atomic exchange
 
 **/
 
@@ -39,43 +46,317 @@
 #define __MEMORY_INL_H__
 
 #include <windows.h>
+#include <stdatomic.h>
 #include "program.h"
+#include "space.h"
+#include "exec.h"
+#include "error.h"
 
 extern PPROGRAM GProgram;
 
-extern ULONG GCodePointerBias;
-extern ULONG GDataPointerBias;
-extern ULONG GStackPointerBias;
+//
+// VM memory is accessed a stack slot at a time, and a slot is as wide as the
+// stack alignment of the program, 4 or 8 bytes. Every routine here takes that
+// width as an argument. The interpreter cores pass a constant, which reduces
+// each access to a single fixed width move once inlined, everything else
+// passes the program header value. Values are 32 bits, so 8 byte slots hold
+// them sign extended.
+//
+// Likewise the routines taking a Checked argument bounds check the access
+// when it is TRUE. The checked interpreter cores pass TRUE for programs the
+// verifier couldn't prove safe, the check compiles away everywhere else.
+//
+
+inline
+BOOL
+MemAddressValid (
+    PPROGRAM Program,
+    ULONG Address,
+    ULONG Width
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine decides whether an access through a thread window 
+    lands in its stack or in the global data.
+    
+ Arguments:
+ 
+    Program - The program.
+    
+    Address - VM address of the access.
+    
+    Width - Bytes accessed.
+    
+ Return value:
+ 
+    TRUE if the access is inside the address space, FALSE otherwise.
+
+*/
+    
+{
+    if(Address <= Program->Space->StackSize - Width) {
+        return TRUE;
+    }
+    
+    return Address >= Program->Header.DataStart &&
+           Program->Header.DataSize >= Width &&
+           Address - Program->Header.DataStart <= Program->Header.DataSize - Width;
+}
+
+inline
+BOOL
+MemGlobalValid (
+    PPROGRAM Program,
+    LONG Offset,
+    ULONG Width
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine decides whether a global operand is inside the
+    global data.
+    
+ Arguments:
+ 
+    Program - The program.
+    
+    Offset - Offset of the operand into the global data.
+    
+    Width - Bytes accessed.
+    
+ Return value:
+ 
+    TRUE if the operand is inside the global data, FALSE otherwise.
+
+*/
+    
+{
+    return Offset >= 0 &&
+           Program->Header.DataSize >= Width &&
+           (ULONG)Offset <= Program->Header.DataSize - Width;
+}
+
+inline
+PCHAR
+MemStackAddress (
+    PCHAR Window,
+    ULONG Address,
+    ULONG Width,
+    BOOL Checked
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine translates a VM address to a host address in the
+    window of the calling thread.
+    
+ Arguments:
+ 
+    Window - The window of the calling thread.
+    
+    Address - The VM address.
+    
+    Width - Bytes about to be accessed.
+    
+    Checked - TRUE to bounds check the access.
+    
+ Return value:
+ 
+    The host address.
+
+*/
+    
+{
+    if(Checked != FALSE && MemAddressValid(GProgram, Address, Width) == FALSE) {
+        VmFatal(ERR_STR_ACCESSVIOLATION);
+    }
+    
+    return Window + Address;
+}
+
+inline
+PCHAR
+MemGlobalAddress (
+    PCHAR GlobalData,
+    LONG Offset,
+    ULONG Width,
+    BOOL Checked
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine translates a global operand offset to a host
+    address.
+    
+ Arguments:
+ 
+    GlobalData - The global data of the program.
+    
+    Offset - Offset of the operand into the global data.
+    
+    Width - Bytes about to be accessed.
+    
+    Checked - TRUE to bounds check the access.
+    
+ Return value:
+ 
+    The host address.
+
+*/
+    
+{
+    if(Checked != FALSE && MemGlobalValid(GProgram, Offset, Width) == FALSE) {
+        VmFatal(ERR_STR_ACCESSVIOLATION);
+    }
+    
+    return GlobalData + Offset;
+}
+
+inline
+LONG
+MemLoad (
+    PCHAR Address,
+    ULONG Width
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine loads a stack slot from VM memory.
+    
+ Arguments:
+ 
+    Address - Host address of the slot.
+    
+    Width - Width of the slot, the stack alignment of the program.
+    
+ Return value:
+ 
+    The value.
+
+*/
+    
+{
+    LONG Value;
+    LONG64 Value64;
+    
+    if(Width == sizeof(LONG64)) {
+        memcpy(&Value64, Address, sizeof(LONG64));
+        return (LONG)Value64;
+    }
+    
+    memcpy(&Value, Address, sizeof(LONG));
+    return Value;
+}
 
 inline
 VOID
-MemRegisterValue (
-    PCHAR Stack,
-    PREGISTER_SET RegisterSet, 
-    ULONG Register,
-    LONG RegisterOffset,
-    PLONG Value
+MemStore (
+    PCHAR Address,
+    LONG Value,
+    ULONG Width
     )
     
 /*
 
  Routine description:
  
-    This inline routine obtains the value of a provided register according to
-    the register type. This function may make a memory access in the case the
-    register turns out be an index.
+    This inline routine stores a value into a stack slot of VM memory.
     
  Arguments:
  
-    Stack - A pointer to the execution threads stack.
+    Address - Host address of the slot.
+    
+    Value - The value to store.
+    
+    Width - Width of the slot, the stack alignment of the program.
+    
+ Return value:
+ 
+    VOID.
+
+*/
+    
+{
+    LONG64 Value64;
+    
+    if(Width == sizeof(LONG64)) {
+        Value64 = Value;
+        memcpy(Address, &Value64, sizeof(LONG64));
+        return;
+    }
     
-    RegisterSet - A pointer to the active register set.
+    memcpy(Address, &Value, sizeof(LONG));
+}
+
+inline
+LONG
+MemLoadAcquire (
+    PCHAR Address,
+    ULONG Width
+    )
     
-    Register - The register whose value is to be obtained
+/*
+
+ Routine description:
+ 
+    This inline routine loads a stack slot holding an atomic variable. No
+    access of the thread after it moves up ahead of it.
     
-    RegisterOffset - The offset into the register.
+ Arguments:
+ 
+    Address - Host address of the slot.
     
-    Value - A pointer receiving the register value.
+    Width - Width of the slot, the stack alignment of the program.
+    
+ Return value:
+ 
+    The value.
+
+*/
+    
+{
+    if(Width == sizeof(LONG64)) {
+        return (LONG)atomic_load_explicit((_Atomic LONG64 *)Address, 
+                                          memory_order_acquire);
+    }
+    
+    return atomic_load_explicit((_Atomic LONG *)Address, memory_order_acquire);
+}
+
+inline
+VOID
+MemStoreRelease (
+    PCHAR Address,
+    LONG Value,
+    ULONG Width
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine stores into a stack slot holding an atomic variable.
+    No access of the thread before it moves down past it, so a thread that
+    loads the value sees everything that came before.
+    
+ Arguments:
+ 
+    Address - Host address of the slot.
+    
+    Value - The value to store.
+    
+    Width - Width of the slot, the stack alignment of the program.
     
  Return value:
  
@@ -84,37 +365,571 @@ MemRegisterValue (
 */
     
 {
-    LONG StackOffset;
+    if(Width == sizeof(LONG64)) {
+        atomic_store_explicit((_Atomic LONG64 *)Address, 
+                              (LONG64)Value, 
+                              memory_order_release);
+        return;
+    }
+    
+    atomic_store_explicit((_Atomic LONG *)Address, Value, memory_order_release);
+}
+
+inline
+LONG
+MemAtomicUpdate (
+    PCHAR Address,
+    ULONG Opcode,
+    LONG Value,
+    ULONG Width
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine adds, subtracts, ors, ands or xors a value into a 
+    stack slot holding an atomic variable, as a single atomic operation. It
+    orders like both an acquire load and a release store.
+    
+ Arguments:
+ 
+    Address - Host address of the slot.
+    
+    Opcode - OPC_AADD, OPC_ASUB, OPC_AOR, OPC_AAND or OPC_AXOR.
+    
+    Value - The operand.
+    
+    Width - Width of the slot, the stack alignment of the program.
+    
+ Return value:
+ 
+    The new value of the variable.
+
+*/
+    
+{
+    LONG Old;
+    
+    //
+    // 8 byte slots hold the value sign extended. Carries into the upper half
+    // are of no concern, the value is only ever read back truncated.
+    //
+    
+    switch(Opcode) {
+        case OPC_AADD:
+        case OPC_ASUB:
+            if(Opcode == OPC_ASUB) {
+                Value = (LONG)(0 - (ULONG)Value);
+            }
+            
+            if(Width == sizeof(LONG64)) {
+                Old = (LONG)atomic_fetch_add_explicit((_Atomic LONG64 *)Address,
+                                                      (LONG64)Value,
+                                                      memory_order_acq_rel);
+            } else {
+                Old = atomic_fetch_add_explicit((_Atomic LONG *)Address,
+                                                Value,
+                                                memory_order_acq_rel);
+            }
+            
+            return (LONG)((ULONG)Old + (ULONG)Value);
+            
+        case OPC_AOR:
+            if(Width == sizeof(LONG64)) {
+                Old = (LONG)atomic_fetch_or_explicit((_Atomic LONG64 *)Address,
+                                                     (LONG64)Value,
+                                                     memory_order_acq_rel);
+            } else {
+                Old = atomic_fetch_or_explicit((_Atomic LONG *)Address,
+                                               Value,
+                                               memory_order_acq_rel);
+            }
+            
+            return Old | Value;
+            
+        case OPC_AAND:
+            if(Width == sizeof(LONG64)) {
+                Old = (LONG)atomic_fetch_and_explicit((_Atomic LONG64 *)Address,
+                                                      (LONG64)Value,
+                                                      memory_order_acq_rel);
+            } else {
+                Old = atomic_fetch_and_explicit((_Atomic LONG *)Address,
+                                                Value,
+                                                memory_order_acq_rel);
+            }
+            
+            return Old & Value;
+            
+        default:
+            if(Width == sizeof(LONG64)) {
+                Old = (LONG)atomic_fetch_xor_explicit((_Atomic LONG64 *)Address,
+                                                      (LONG64)Value,
+                                                      memory_order_acq_rel);
+            } else {
+                Old = atomic_fetch_xor_explicit((_Atomic LONG *)Address,
+                                                Value,
+                                                memory_order_acq_rel);
+            }
+            
+            return Old ^ Value;
+    }
+}
+
+inline
+LONG
+MemAtomicCompareSwap (
+    PCHAR Address,
+    LONG Expected,
+    LONG Desired,
+    ULONG Width
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine stores a value into a stack slot holding an atomic
+    variable if the variable holds the expected value, as a single atomic
+    operation. It orders like MemAtomicUpdate.
+    
+ Arguments:
+ 
+    Address - Host address of the slot.
+    
+    Expected - The value the variable has to hold.
+    
+    Desired - The value to store.
+    
+    Width - Width of the slot, the stack alignment of the program.
+    
+ Return value:
+ 
+    The old value of the variable. The store happened if it is Expected.
+
+*/
+    
+{
+    LONG64 Old64;
+    LONG Old;
+    
+    if(Width == sizeof(LONG64)) {
     
-    if(Register == REG_RGD) {
-        memcpy(Value, 
-               GProgram->GlobalData+RegisterOffset, 
-               GProgram->Header.StackAlignment);
+        //
+        // An atomic add may have left the upper half of the slot other than
+        // the sign extension, so only the lower half is compared.
+        //
+        
+        Old64 = atomic_load_explicit((_Atomic LONG64 *)Address, 
+                                     memory_order_acquire);
         
-    } else if(IS_REGISTER_INDEX(Register)) {
-        StackOffset = RegisterSet->Register[Register];
-        StackOffset = StackOffset - GStackPointerBias;
-        StackOffset = StackOffset + RegisterOffset;
-        memcpy(Value, 
-               Stack+StackOffset, 
-               GProgram->Header.StackAlignment);
-    
-    } else if(Register == REG_RCT) {
-        *Value = RegisterOffset;
-    } else {
-        *Value = RegisterSet->Register[Register];
+        while((LONG)Old64 == Expected) {
+            if(atomic_compare_exchange_weak_explicit((_Atomic LONG64 *)Address,
+                                                     &Old64,
+                                                     (LONG64)Desired,
+                                                     memory_order_acq_rel,
+                                                     memory_order_acquire)) {
+                break;
+            }
+        }
+        
+        return (LONG)Old64;
+    }
+    
+    Old = Expected;
+    atomic_compare_exchange_strong_explicit((_Atomic LONG *)Address,
+                                            &Old,
+                                            Desired,
+                                            memory_order_acq_rel,
+                                            memory_order_acquire);
+    
+    return Old;
+}
+
+inline
+LONG
+MemAtomicExchange (
+    PCHAR Address,
+    LONG Value,
+    ULONG Width
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine stores a value into a stack slot and gives back the
+    value it held, as a single atomic operation. It orders like 
+    MemAtomicUpdate.
+    
+ Arguments:
+ 
+    Address - Host address of the slot.
+    
+    Value - The value to store.
+    
+    Width - Width of the slot, the stack alignment of the program.
+    
+ Return value:
+ 
+    The old value of the slot.
+
+*/
+    
+{
+    if(Width == sizeof(LONG64)) {
+        return (LONG)atomic_exchange_explicit((_Atomic LONG64 *)Address,
+                                              (LONG64)Value,
+                                              memory_order_acq_rel);
+    }
+    
+    return atomic_exchange_explicit((_Atomic LONG *)Address, 
+                                    Value, 
+                                    memory_order_acq_rel);
+}
+
+inline
+LONG
+MemOperandValue (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_OPERAND Operand,
+    ULONG Width,
+    BOOL Checked
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine obtains the value of a decoded operand according to
+    its operand kind. This function may make a memory access in the case the
+    operand turns out be global data or an index into the stack.
+    
+ Arguments:
+ 
+    ExecData - The thread execution data for the calling thread.
+    
+    Operand - The decoded operand whose value is to be obtained.
+    
+    Width - The stack alignment of the program.
+    
+    Checked - TRUE to bounds check memory operands.
+    
+ Return value:
+ 
+    The operand value.
+
+*/
+    
+{
+    LONG Value;
+    PREGISTER_SET RegisterSet;
+    
+    RegisterSet = ExecData->ActiveRegisterSet;
+    switch(Operand->Kind) {
+        case OPERAND_KIND_GLOBAL:
+            Value = MemLoad(MemGlobalAddress(GProgram->GlobalData, 
+                                             Operand->Offset, 
+                                             Width, 
+                                             Checked),
+                            Width);
+            
+            break;
+            
+        case OPERAND_KIND_STACK:
+            Value = MemLoad(MemStackAddress(ExecData->ThreadStack,
+                                            RegisterSet->Register[Operand->Register]+Operand->Offset,
+                                            Width,
+                                            Checked),
+                            Width);
+            
+            break;
+            
+        case OPERAND_KIND_CONSTANT:
+            Value = Operand->Offset;
+            break;
+            
+        default:
+            Value = RegisterSet->Register[Operand->Register];
+            break;
     }
+    
+    return Value;
 }
 
 inline
 VOID
-MemRegisterSet (
-    PCHAR Stack,
-    ULONG Register,
-    LONG Value
+MemOperandStore (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_OPERAND Operand,
+    LONG Value,
+    ULONG Width,
+    BOOL Checked
     )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine stores a value into a decoded destination operand
+    according to its operand kind.
+    
+ Arguments:
+ 
+    ExecData - The thread execution data for the calling thread.
+    
+    Operand - The decoded destination operand.
+    
+    Value - The value to store.
+    
+    Width - The stack alignment of the program.
+    
+    Checked - TRUE to bounds check memory operands.
+    
+ Return value:
+ 
+    VOID.
+
+*/
+    
 {
+    PREGISTER_SET RegisterSet;
+    
+    RegisterSet = ExecData->ActiveRegisterSet;
+    switch(Operand->Kind) {
+        case OPERAND_KIND_GLOBAL:
+            MemStore(MemGlobalAddress(GProgram->GlobalData, 
+                                      Operand->Offset, 
+                                      Width, 
+                                      Checked),
+                     Value,
+                     Width);
+            
+            break;
+            
+        case OPERAND_KIND_STACK:
+            MemStore(MemStackAddress(ExecData->ThreadStack,
+                                     RegisterSet->Register[Operand->Register]+Operand->Offset,
+                                     Width,
+                                     Checked),
+                     Value,
+                     Width);
+            
+            break;
+            
+        default:
+            RegisterSet->Register[Operand->Register] = Value;
+            break;
+    }
+}
+
+inline
+LONG
+MemOperandValueAcquire (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_OPERAND Operand,
+    ULONG Width,
+    BOOL Checked
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine obtains the value of a decoded operand like 
+    MemOperandValue, with an acquire load if it is in memory.
+    
+ Arguments:
+ 
+    ExecData - The thread execution data for the calling thread.
+    
+    Operand - The decoded operand whose value is to be obtained.
+    
+    Width - The stack alignment of the program.
+    
+    Checked - TRUE to bounds check memory operands.
+    
+ Return value:
+ 
+    The operand value.
+
+*/
+    
+{
+    PREGISTER_SET RegisterSet;
+    
+    RegisterSet = ExecData->ActiveRegisterSet;
+    switch(Operand->Kind) {
+        case OPERAND_KIND_GLOBAL:
+            return MemLoadAcquire(MemGlobalAddress(GProgram->GlobalData, 
+                                                   Operand->Offset, 
+                                                   Width, 
+                                                   Checked),
+                                  Width);
+            
+        case OPERAND_KIND_STACK:
+            return MemLoadAcquire(MemStackAddress(ExecData->ThreadStack,
+                                                  RegisterSet->Register[Operand->Register]+Operand->Offset,
+                                                  Width,
+                                                  Checked),
+                                  Width);
+            
+        default:
+            return MemOperandValue(ExecData, Operand, Width, Checked);
+    }
+}
+
+inline
+VOID
+MemOperandStoreRelease (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PDECODED_OPERAND Operand,
+    LONG Value,
+    ULONG Width,
+    BOOL Checked
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine stores a value into a decoded destination operand
+    like MemOperandStore, with a release store if it is in memory.
+    
+ Arguments:
+ 
+    ExecData - The thread execution data for the calling thread.
+    
+    Operand - The decoded destination operand.
+    
+    Value - The value to store.
+    
+    Width - The stack alignment of the program.
+    
+    Checked - TRUE to bounds check memory operands.
+    
+ Return value:
+ 
+    VOID.
+
+*/
+    
+{
+    PREGISTER_SET RegisterSet;
+    
+    RegisterSet = ExecData->ActiveRegisterSet;
+    switch(Operand->Kind) {
+        case OPERAND_KIND_GLOBAL:
+            MemStoreRelease(MemGlobalAddress(GProgram->GlobalData, 
+                                             Operand->Offset, 
+                                             Width, 
+                                             Checked),
+                            Value,
+                            Width);
+            
+            break;
+            
+        case OPERAND_KIND_STACK:
+            MemStoreRelease(MemStackAddress(ExecData->ThreadStack,
+                                            RegisterSet->Register[Operand->Register]+Operand->Offset,
+                                            Width,
+                                            Checked),
+                            Value,
+                            Width);
+            
+            break;
+            
+        default:
+            MemOperandStore(ExecData, Operand, Value, Width, Checked);
+            break;
+    }
+}
+
+inline
+VOID
+MemStackPush (
+    PTHREAD_EXECUTION_DATA ExecData,
+    LONG Value,
+    ULONG Width,
+    BOOL Checked
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine pushes a value onto the stack of the calling thread.
+    
+ Arguments:
+ 
+    ExecData - The thread execution data for the calling thread.
+    
+    Value - The value to push.
+    
+    Width - The stack alignment of the program.
+    
+    Checked - TRUE to bounds check the push.
+    
+ Return value:
+ 
+    VOID.
+
+*/
+    
+{
+    PREGISTER_SET RegisterSet;
+    
+    RegisterSet = ExecData->ActiveRegisterSet;
+    RegisterSet->Register[REG_RSB] = RegisterSet->Register[REG_RSB] - Width;
+    MemStore(MemStackAddress(ExecData->ThreadStack,
+                             RegisterSet->Register[REG_RSB],
+                             Width,
+                             Checked),
+             Value,
+             Width);
+}
+
+inline
+LONG
+MemStackPop (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Width,
+    BOOL Checked
+    )
+    
+/*
+
+ Routine description:
+ 
+    This inline routine pops a value off the stack of the calling thread.
+    
+ Arguments:
+ 
+    ExecData - The thread execution data for the calling thread.
+    
+    Width - The stack alignment of the program.
+    
+    Checked - TRUE to bounds check the pop.
+    
+ Return value:
+ 
+    The popped value.
+
+*/
+    
+{
+    LONG Value;
+    PREGISTER_SET RegisterSet;
+    
+    RegisterSet = ExecData->ActiveRegisterSet;
+    Value = MemLoad(MemStackAddress(ExecData->ThreadStack,
+                                    RegisterSet->Register[REG_RSB],
+                                    Width,
+                                    Checked),
+                    Width);
     
+    RegisterSet->Register[REG_RSB] = RegisterSet->Register[REG_RSB] + Width;
+    return Value;
 }
 
 #endif // __MEMORY_INL_H__
@@ -0,0 +1,2029 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    pool.c
+
+ Abstract:
+
+    This module implements the pool of worker threads that runs BUTT
+    threads. A parallel call makes a thread runnable on the deque of the
+    worker that made it, where it waits for that worker or an idle one to
+    steal it. Workers run a thread until it stops, then pick the next.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Schedule green threads instead of tasks
+    10/17/26        Free the window caches on the way out
+    10/17/26        Futures for async calls, recycled once unreferenced
+    10/17/26        Parallel loops
+    10/17/26        Per thread copies of reduction variables
+    10/17/26        Barriers that spin and then park
+    10/17/26        Channels on bounded rings
+    10/17/26        Single channels
+
+**/
+
+#include "pool.h"
+#include "error.h"
+#include "memory_inl.h"
+#include <windows.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern PPROGRAM GProgram;
+extern void VmFatal(char* Error);
+
+BOOL
+PoolDequePush (
+    PPOOL_DEQUE Deque,
+    PTHREAD_EXECUTION_DATA Thread
+    )
+
+/*
+
+ Routine description:
+
+    This routine pushes a thread onto the bottom of a deque. Only the worker
+    owning the deque may push.
+
+ Arguments:
+
+    Deque - The deque of the calling worker.
+
+    Thread - The thread to push.
+
+ Return value:
+
+    TRUE if the thread was pushed, FALSE if the deque is full.
+
+*/
+
+{
+    LONG Bottom;
+    LONG Top;
+
+    Bottom = Deque->Bottom;
+    Top = Deque->Top;
+    if(Bottom - Top >= POOL_DEQUE_SIZE) {
+        return FALSE;
+    }
+
+    Deque->Threads[Bottom % POOL_DEQUE_SIZE] = Thread;
+
+    //
+    // The thread has to be there before a thief can see the new bottom.
+    //
+
+    MemoryBarrier( );
+    Deque->Bottom = Bottom + 1;
+    return TRUE;
+}
+
+PTHREAD_EXECUTION_DATA
+PoolDequePop (
+    PPOOL_DEQUE Deque
+    )
+
+/*
+
+ Routine description:
+
+    This routine pops the thread last pushed off the bottom of a deque. Only
+    the worker owning the deque may pop. The last thread may be stolen from
+    under it, in which case whoever moves the top first gets it.
+
+ Arguments:
+
+    Deque - The deque of the calling worker.
+
+ Return value:
+
+    The thread, NULL if the deque is empty.
+
+*/
+
+{
+    PTHREAD_EXECUTION_DATA Thread;
+    LONG Bottom;
+    LONG Top;
+
+    Bottom = Deque->Bottom - 1;
+    Deque->Bottom = Bottom;
+
+    //
+    // Thieves have to see the smaller bottom before we look at the top, or
+    // both of us could take the last thread.
+    //
+
+    MemoryBarrier( );
+    Top = Deque->Top;
+    if(Top > Bottom) {
+        Deque->Bottom = Bottom + 1;
+        return NULL;
+    }
+
+    Thread = Deque->Threads[Bottom % POOL_DEQUE_SIZE];
+    if(Top == Bottom) {
+        if(InterlockedCompareExchange(&Deque->Top, Top + 1, Top) != Top) {
+            Thread = NULL;
+        }
+
+        Deque->Bottom = Bottom + 1;
+    }
+
+    return Thread;
+}
+
+PTHREAD_EXECUTION_DATA
+PoolDequeSteal (
+    PPOOL_DEQUE Deque
+    )
+
+/*
+
+ Routine description:
+
+    This routine steals the oldest thread off the top of another worker's
+    deque.
+
+ Arguments:
+
+    Deque - The deque to steal from.
+
+ Return value:
+
+    The thread, NULL if the deque is empty or another thief got there first.
+
+*/
+
+{
+    PTHREAD_EXECUTION_DATA Thread;
+    LONG Bottom;
+    LONG Top;
+
+    Top = Deque->Top;
+    MemoryBarrier( );
+    Bottom = Deque->Bottom;
+    if(Top >= Bottom) {
+        return NULL;
+    }
+
+    Thread = Deque->Threads[Top % POOL_DEQUE_SIZE];
+    if(InterlockedCompareExchange(&Deque->Top, Top + 1, Top) != Top) {
+        return NULL;
+    }
+
+    return Thread;
+}
+
+VOID
+PoolEnqueue (
+    PPOOL Pool,
+    PTHREAD_EXECUTION_DATA Thread
+    )
+
+/*
+
+ Routine description:
+
+    This routine puts a thread at the tail of the shared run queue.
+
+ Arguments:
+
+    Pool - The pool.
+
+    Thread - The thread to queue.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    Thread->Next = NULL;
+    EnterCriticalSection(&Pool->QueueLock);
+    if(Pool->QueueTail == NULL) {
+        Pool->QueueHead = Thread;
+    } else {
+        Pool->QueueTail->Next = Thread;
+    }
+
+    Pool->QueueTail = Thread;
+    Pool->QueueLength = Pool->QueueLength + 1;
+    LeaveCriticalSection(&Pool->QueueLock);
+}
+
+PTHREAD_EXECUTION_DATA
+PoolDequeue (
+    PPOOL Pool
+    )
+
+/*
+
+ Routine description:
+
+    This routine takes the thread at the head of the shared run queue.
+
+ Arguments:
+
+    Pool - The pool.
+
+ Return value:
+
+    The thread, NULL if the queue is empty.
+
+*/
+
+{
+    PTHREAD_EXECUTION_DATA Thread;
+
+    //
+    // Not worth the lock when the queue looks empty. A thread queued right
+    // now is found on the next look.
+    //
+
+    if(Pool->QueueLength == 0) {
+        return NULL;
+    }
+
+    EnterCriticalSection(&Pool->QueueLock);
+    Thread = Pool->QueueHead;
+    if(Thread != NULL) {
+        Pool->QueueHead = Thread->Next;
+        if(Pool->QueueHead == NULL) {
+            Pool->QueueTail = NULL;
+        }
+
+        Pool->QueueLength = Pool->QueueLength - 1;
+    }
+
+    LeaveCriticalSection(&Pool->QueueLock);
+    return Thread;
+}
+
+PTHREAD_EXECUTION_DATA
+PoolFindThread (
+    PPOOL_WORKER Worker
+    )
+
+/*
+
+ Routine description:
+
+    This routine finds the next thread for a worker to run, the newest of
+    its own, else the oldest on the run queue, else the oldest of another
+    worker, starting from a random one.
+
+ Arguments:
+
+    Worker - The calling worker.
+
+ Return value:
+
+    The thread, NULL if none was found.
+
+*/
+
+{
+    PPOOL Pool;
+    PTHREAD_EXECUTION_DATA Thread;
+    ULONG Victim;
+    ULONG i;
+
+    Pool = Worker->Pool;
+    Worker->Ticks = Worker->Ticks + 1;
+    if((Worker->Ticks % POOL_QUEUE_INTERVAL) == 0) {
+        Thread = PoolDequeue(Pool);
+        if(Thread != NULL) {
+            return Thread;
+        }
+    }
+
+    Thread = PoolDequePop(&Worker->Deque);
+    if(Thread != NULL) {
+        return Thread;
+    }
+
+    Thread = PoolDequeue(Pool);
+    if(Thread != NULL) {
+        return Thread;
+    }
+
+    Worker->Seed ^= Worker->Seed << 13;
+    Worker->Seed ^= Worker->Seed >> 17;
+    Worker->Seed ^= Worker->Seed << 5;
+    Victim = Worker->Seed % Pool->WorkerCount;
+    for(i=0; i<Pool->WorkerCount; ++i) {
+        if(Victim != Worker->Index) {
+            Thread = PoolDequeSteal(&Pool->Workers[Victim].Deque);
+            if(Thread != NULL) {
+                return Thread;
+            }
+        }
+
+        Victim = (Victim + 1) % Pool->WorkerCount;
+    }
+
+    return NULL;
+}
+
+BOOL
+PoolHasThreads (
+    PPOOL Pool
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks whether any thread is waiting to run.
+
+ Arguments:
+
+    Pool - The pool.
+
+ Return value:
+
+    TRUE if a thread is waiting, FALSE otherwise.
+
+*/
+
+{
+    ULONG i;
+
+    if(Pool->QueueLength != 0) {
+        return TRUE;
+    }
+
+    for(i=0; i<Pool->WorkerCount; ++i) {
+        if(Pool->Workers[i].Deque.Top < Pool->Workers[i].Deque.Bottom) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+VOID
+PoolReady (
+    PPOOL_WORKER Worker,
+    PTHREAD_EXECUTION_DATA Thread
+    )
+
+/*
+
+ Routine description:
+
+    This routine makes a thread runnable, on the deque of the calling worker
+    if it has room and otherwise on the run queue, and wakes a sleeping
+    worker to take it.
+
+ Arguments:
+
+    Worker - The calling worker.
+
+    Thread - The thread.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PPOOL Pool;
+
+    Pool = Worker->Pool;
+    if(PoolDequePush(&Worker->Deque, Thread) == FALSE) {
+        PoolEnqueue(Pool, Thread);
+    }
+
+    //
+    // A worker going to sleep counts itself before it looks for threads one
+    // last time, so either it sees this one or we see it.
+    //
+
+    MemoryBarrier( );
+    if(Pool->Sleeping != 0) {
+        ReleaseSemaphore(Pool->Wake, 1, NULL);
+    }
+}
+
+VOID
+PoolSpawn (
+    PPOOL_WORKER Worker,
+    PTHREAD_EXECUTION_DATA Thread
+    )
+
+/*
+
+ Routine description:
+
+    This routine makes a new thread runnable. The caller must not touch the
+    thread afterwards.
+
+ Arguments:
+
+    Worker - The calling worker.
+
+    Thread - The thread to spawn.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    InterlockedIncrement(&Worker->Pool->Outstanding);
+    PoolReady(Worker, Thread);
+}
+
+PPOOL_FUTURE
+PoolFutureLookup (
+    PPOOL Pool,
+    ULONG Handle
+    )
+
+/*
+
+ Routine description:
+
+    This routine finds the slot a handle to a future points at. The future
+    in the slot may be of another generation than the handle by now.
+
+ Arguments:
+
+    Pool - The pool.
+
+    Handle - The handle to the future.
+
+ Return value:
+
+    The future in the slot, NULL if the handle points at no slot.
+
+*/
+
+{
+    PPOOL_FUTURE Chunk;
+    ULONG Index;
+
+    Index = Handle & POOL_FUTURE_INDEX_MASK;
+    if((Handle >> POOL_FUTURE_INDEX_BITS) == 0 ||
+       Index >= (ULONG)Pool->FutureCount) {
+
+        return NULL;
+    }
+
+    Chunk = Pool->FutureChunks[Index / POOL_FUTURE_CHUNK_SIZE];
+    if(Chunk == NULL) {
+        return NULL;
+    }
+
+    return &Chunk[Index % POOL_FUTURE_CHUNK_SIZE];
+}
+
+VOID
+PoolFutureDrop (
+    PPOOL Pool,
+    PPOOL_FUTURE Future,
+    ULONG Generation
+    )
+
+/*
+
+ Routine description:
+
+    This routine takes a reference to a future away, if the future is still
+    of the generation given. The last one moves the slot on to the next
+    generation and puts it on the free list.
+
+ Arguments:
+
+    Pool - The pool.
+
+    Future - The future.
+
+    Generation - The generation the reference was taken on.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    LONG64 State;
+    LONG64 Next;
+    LONG64 Head;
+
+    do {
+        State = Future->State;
+        if((ULONG)(State >> 32) != Generation || (LONG)State == 0) {
+            return;
+        }
+
+        if((LONG)State != 1) {
+            Next = State - 1;
+        } else {
+            Generation = Generation % (POOL_FUTURE_GENERATIONS - 1) + 1;
+            Next = (LONG64)Generation << 32;
+        }
+    } while(InterlockedCompareExchange64(&Future->State, Next, State) != State);
+
+    if((LONG)Next != 0) {
+        return;
+    }
+
+    //
+    // Every change to the head counts up its upper half, so a pop that read
+    // the link of a slot since taken and put back fails.
+    //
+
+    do {
+        Head = Pool->FutureFree;
+        Future->Next = (ULONG)Head;
+        Next = ((Head >> 32) + 1) << 32 | (Future->Index + 1);
+    } while(InterlockedCompareExchange64(&Pool->FutureFree, Next, Head) != Head);
+}
+
+ULONG
+PoolFutureCreate (
+    PPOOL Pool,
+    PPOOL_FUTURE *Future
+    )
+
+/*
+
+ Routine description:
+
+    This routine hands out a future for an async call to resolve once its
+    thread finishes, in a free slot if there is one. The future starts out
+    referenced by the thread and by the handle in flight.
+
+ Arguments:
+
+    Pool - The pool.
+
+    Future - Receives the future.
+
+ Return value:
+
+    The handle to the future.
+
+*/
+
+{
+    PPOOL_FUTURE Chunk;
+    PPOOL_FUTURE Slot;
+    LONG64 Head;
+    LONG64 Next;
+    ULONG Generation;
+    ULONG Index;
+
+    Head = Pool->FutureFree;
+    while((ULONG)Head != 0) {
+        Index = (ULONG)Head - 1;
+        Chunk = Pool->FutureChunks[Index / POOL_FUTURE_CHUNK_SIZE];
+        Slot = &Chunk[Index % POOL_FUTURE_CHUNK_SIZE];
+        Next = ((Head >> 32) + 1) << 32 | Slot->Next;
+        if(InterlockedCompareExchange64(&Pool->FutureFree, Next, Head) == Head) {
+            goto PoolFutureCreateSlot;
+        }
+
+        Head = Pool->FutureFree;
+    }
+
+    Index = (ULONG)InterlockedIncrement(&Pool->FutureCount) - 1;
+    if(Index >= POOL_FUTURE_CHUNKS * POOL_FUTURE_CHUNK_SIZE) {
+        VmFatal(ERR_STR_NOMEM);
+    }
+
+    //
+    // Whoever gets to a chunk first makes it, and a loser frees its own.
+    //
+
+    Chunk = Pool->FutureChunks[Index / POOL_FUTURE_CHUNK_SIZE];
+    if(Chunk == NULL) {
+        Chunk = calloc(POOL_FUTURE_CHUNK_SIZE, sizeof(POOL_FUTURE));
+        if(Chunk == NULL) {
+            VmFatal(ERR_STR_NOMEM);
+        }
+
+        if(InterlockedCompareExchangePointer(
+               (PVOID volatile *)&Pool->FutureChunks[Index / POOL_FUTURE_CHUNK_SIZE],
+               Chunk,
+               NULL) != NULL) {
+
+            free(Chunk);
+            Chunk = Pool->FutureChunks[Index / POOL_FUTURE_CHUNK_SIZE];
+        }
+    }
+
+    Slot = &Chunk[Index % POOL_FUTURE_CHUNK_SIZE];
+    Slot->Index = Index;
+    InterlockedExchange64(&Slot->State, (LONG64)1 << 32);
+
+PoolFutureCreateSlot:
+    Generation = (ULONG)(Slot->State >> 32);
+    Slot->Waiters = NULL;
+    Slot->Value = 0;
+    Slot->InFlight = 1;
+    InterlockedExchange64(&Slot->State, (LONG64)Generation << 32 | 2);
+    *Future = Slot;
+    return Generation << POOL_FUTURE_INDEX_BITS | Index;
+}
+
+VOID
+PoolFutureRetain (
+    PPOOL Pool,
+    ULONG Handle
+    )
+
+/*
+
+ Routine description:
+
+    This routine adds a reference to a future for a thread variable the
+    handle is stored into. A handle in flight hands its own reference over
+    instead. Anything other than a handle to a live future is left alone,
+    as thread variables can hold any number.
+
+ Arguments:
+
+    Pool - The pool.
+
+    Handle - The handle to the future.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PPOOL_FUTURE Future;
+    LONG64 State;
+    ULONG Generation;
+
+    Future = PoolFutureLookup(Pool, Handle);
+    if(Future == NULL) {
+        return;
+    }
+
+    Generation = Handle >> POOL_FUTURE_INDEX_BITS;
+    do {
+        State = Future->State;
+        if((ULONG)(State >> 32) != Generation || (LONG)State == 0) {
+            return;
+        }
+    } while(InterlockedCompareExchange64(&Future->State, State + 1, State) != State);
+
+    if(InterlockedExchange(&Future->InFlight, 0) != 0) {
+        PoolFutureDrop(Pool, Future, Generation);
+    }
+}
+
+VOID
+PoolFutureRelease (
+    PPOOL Pool,
+    ULONG Handle
+    )
+
+/*
+
+ Routine description:
+
+    This routine takes away the reference a thread variable holds to a 
+    future, once another handle is stored over it. Anything other than a
+    handle to a live future is left alone.
+
+ Arguments:
+
+    Pool - The pool.
+
+    Handle - The handle to the future.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PPOOL_FUTURE Future;
+
+    Future = PoolFutureLookup(Pool, Handle);
+    if(Future != NULL) {
+        PoolFutureDrop(Pool, Future, Handle >> POOL_FUTURE_INDEX_BITS);
+    }
+}
+
+BOOL
+PoolFutureJoin (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Handle,
+    BOOL InFlight,
+    PLONG Value
+    )
+
+/*
+
+ Routine description:
+
+    This routine joins the thread of a future. A thread that hasn't finished
+    after a short spin gets the joining one parked on its future, and the
+    worker moves on to other threads until it does. The join then runs again
+    from the start.
+
+ Arguments:
+
+    ExecData - The thread execution data for the joining thread.
+
+    Handle - The handle to the future, zero for no thread.
+
+    InFlight - TRUE if the handle is the one the call evaluated to, not read
+               from a variable. It lets go of its reference once joined, if
+               it still holds it.
+
+    Value - Receives the return value of the thread.
+
+ Return value:
+
+    TRUE if the thread had finished, FALSE if the joining thread is parked.
+
+*/
+
+{
+    PPOOL_FUTURE Future;
+    PPOOL Pool;
+    PTHREAD_EXECUTION_DATA Head;
+    LONG64 State;
+    ULONG Spin;
+
+    if(Handle == 0) {
+        *Value = 0;
+        return TRUE;
+    }
+
+    Pool = ExecData->Worker->Pool;
+    Future = PoolFutureLookup(Pool, Handle);
+    if(Future == NULL) {
+        VmFatal(ERR_STR_INVALIDTHREAD);
+    }
+
+    State = Future->State;
+    if((ULONG)(State >> 32) != Handle >> POOL_FUTURE_INDEX_BITS || 
+       (LONG)State == 0) {
+
+        VmFatal(ERR_STR_INVALIDTHREAD);
+    }
+
+    for(Spin = 0; Spin < POOL_JOIN_SPIN; ++Spin) {
+        if(Future->Waiters == POOL_FUTURE_RESOLVED) {
+            goto PoolFutureJoinResolved;
+        }
+
+        YieldProcessor( );
+    }
+
+    //
+    // Parking takes one off JoinCount and the thread finishing takes the
+    // other, like a sync call.
+    //
+
+    ExecData->JoinCount = 2;
+    do {
+        Head = Future->Waiters;
+        if(Head == POOL_FUTURE_RESOLVED) {
+            goto PoolFutureJoinResolved;
+        }
+
+        ExecData->Next = Head;
+    } while(InterlockedCompareExchangePointer((PVOID volatile *)&Future->Waiters,
+                                              ExecData,
+                                              Head) != Head);
+
+    ExecData->Status = EXEC_STATUS_PARKED;
+    return FALSE;
+
+PoolFutureJoinResolved:
+    MemoryBarrier( );
+    *Value = Future->Value;
+    if(InFlight != FALSE && InterlockedExchange(&Future->InFlight, 0) != 0) {
+        PoolFutureDrop(Pool, Future, Handle >> POOL_FUTURE_INDEX_BITS);
+    }
+
+    return TRUE;
+}
+
+VOID
+PoolFutureResolve (
+    PPOOL_WORKER Worker,
+    PPOOL_FUTURE Future
+    )
+
+/*
+
+ Routine description:
+
+    This routine resolves a future once its thread has finished and left
+    its return value there, makes the threads parked on it runnable and 
+    takes away the reference of the thread.
+
+ Arguments:
+
+    Worker - The calling worker.
+
+    Future - The future.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PTHREAD_EXECUTION_DATA Waiter;
+    PTHREAD_EXECUTION_DATA Next;
+
+    Waiter = InterlockedExchangePointer((PVOID volatile *)&Future->Waiters,
+                                        POOL_FUTURE_RESOLVED);
+
+    while(Waiter != NULL) {
+        Next = Waiter->Next;
+        if(InterlockedDecrement(&Waiter->JoinCount) == 0) {
+            PoolReady(Worker, Waiter);
+        }
+
+        Waiter = Next;
+    }
+
+    PoolFutureDrop(Worker->Pool, Future, (ULONG)(Future->State >> 32));
+}
+
+PPOOL_LOOP
+PoolLoopCreate (
+    PPOOL Pool,
+    ULONG JumpIndex,
+    ULONG Schedule,
+    LONG First,
+    LONG Bound,
+    LONG Stride,
+    LONG Chunk,
+    ULONG CaptureCount
+    )
+
+/*
+
+ Routine description:
+
+    This routine sets up a parallel loop over First up to Bound, stepping by
+    Stride. The chunk size of zero picks one for the schedule, an even share
+    of the iterations per worker for a static schedule and one otherwise.
+    Room for the captured values is kept after the loop, which the caller
+    fills in.
+
+ Arguments:
+
+    Pool - The pool.
+
+    JumpIndex - Index of the entry instruction of the loop body.
+
+    Schedule - How the chunks get handed out, one of LOOP_SCHEDULE.
+
+    First - The first index.
+
+    Bound - The bound of the index.
+
+    Stride - What the index steps by.
+
+    Chunk - The chunk size, 0 to pick one.
+
+    CaptureCount - The number of locals the body captured.
+
+ Return value:
+
+    The loop, NULL if it has no iterations.
+
+*/
+
+{
+    PPOOL_LOOP Loop;
+    LONG64 Chunks;
+
+    if(Stride <= 0 || Chunk < 0 || Schedule > LOOP_SCHEDULE_GUIDED) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+
+    if(Bound <= First) {
+        return NULL;
+    }
+
+    Loop = malloc(sizeof(POOL_LOOP) + CaptureCount * sizeof(LONG));
+    if(Loop == NULL) {
+        VmFatal(ERR_STR_NOMEM);
+    }
+
+    memset(Loop, 0, sizeof(POOL_LOOP));
+    Loop->CaptureCount = CaptureCount;
+    Loop->Captures = (PLONG)(Loop + 1);
+    Loop->JumpIndex = JumpIndex;
+    Loop->Schedule = Schedule;
+    Loop->First = First;
+    Loop->Bound = Bound;
+    Loop->Stride = Stride;
+    Loop->Count = ((LONG64)Bound - First + Stride - 1) / Stride;
+    Loop->Chunk = Chunk;
+    if(Loop->Chunk == 0) {
+        Loop->Chunk = 1;
+        if(Schedule == LOOP_SCHEDULE_STATIC) {
+            Loop->Chunk = (Loop->Count + Pool->WorkerCount - 1) / Pool->WorkerCount;
+        }
+    }
+
+    Chunks = (Loop->Count + Loop->Chunk - 1) / Loop->Chunk;
+    Loop->Runners = Pool->WorkerCount;
+    if(Chunks < Loop->Runners) {
+        Loop->Runners = Chunks;
+    }
+
+    Loop->Active = (LONG)Loop->Runners;
+    return Loop;
+}
+
+BOOL
+PoolLoopNext (
+    PPOOL_LOOP Loop,
+    PLONG64 Runner,
+    PLONG First,
+    PLONG Bound
+    )
+
+/*
+
+ Routine description:
+
+    This routine hands a runner of a parallel loop its next chunk.
+
+ Arguments:
+
+    Loop - The loop.
+
+    Runner - The next chunk of the runner under a static schedule. Starts
+             out as the index of the runner.
+
+    First - Receives the first index of the chunk.
+
+    Bound - Receives the bound of the chunk.
+
+ Return value:
+
+    TRUE if the runner got a chunk, FALSE if the loop is done.
+
+*/
+
+{
+    LONG64 Start;
+    LONG64 Size;
+    LONG64 Seen;
+
+    switch(Loop->Schedule) {
+        case LOOP_SCHEDULE_DYNAMIC:
+            Start = InterlockedExchangeAdd64(&Loop->Next, Loop->Chunk);
+            Size = Loop->Chunk;
+            break;
+
+        case LOOP_SCHEDULE_GUIDED:
+            Start = Loop->Next;
+            for(;;) {
+                if(Start >= Loop->Count) {
+                    return FALSE;
+                }
+
+                Size = (Loop->Count - Start + Loop->Runners - 1) / Loop->Runners;
+                if(Size < Loop->Chunk) {
+                    Size = Loop->Chunk;
+                }
+
+                Seen = InterlockedCompareExchange64(&Loop->Next, Start + Size, Start);
+                if(Seen == Start) {
+                    break;
+                }
+
+                Start = Seen;
+            }
+
+            break;
+
+        default:
+            Start = *Runner * Loop->Chunk;
+            Size = Loop->Chunk;
+            *Runner = *Runner + Loop->Runners;
+            break;
+    }
+
+    if(Start >= Loop->Count) {
+        return FALSE;
+    }
+
+    *First = (LONG)(Loop->First + Start * Loop->Stride);
+    if(Size >= Loop->Count - Start) {
+        *Bound = (LONG)Loop->Bound;
+    } else {
+        *Bound = (LONG)(Loop->First + (Start + Size) * Loop->Stride);
+    }
+
+    return TRUE;
+}
+
+LONG
+PoolReductionIdentity (
+    ULONG Opcode
+    )
+
+/*
+
+ Routine description:
+
+    This routine gives the identity of the operator of a reduction, the
+    value a copy starts out as and that folds into the variable as nothing.
+
+ Arguments:
+
+    Opcode - The update opcode of the variable.
+
+ Return value:
+
+    The identity.
+
+*/
+
+{
+    switch(Opcode) {
+        case OPC_RAND:
+            return -1;
+
+        case OPC_RMIN:
+            return MAXLONG;
+
+        case OPC_RMAX:
+            return -MAXLONG - 1;
+
+        default:
+            return 0;
+    }
+}
+
+VOID
+PoolReductionApply (
+    PCHAR Address,
+    ULONG Opcode,
+    LONG Value
+    )
+
+/*
+
+ Routine description:
+
+    This routine folds a value into a reduction variable as a single atomic
+    operation. Min and max have no hardware atomic, so they compare and swap
+    until the variable holds a value at least as far out as this one.
+
+ Arguments:
+
+    Address - Host address of the variable.
+
+    Opcode - The update opcode of the variable.
+
+    Value - The value to fold in.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    ULONG Width;
+    LONG Old;
+    LONG Seen;
+
+    Width = GProgram->Header.StackAlignment;
+    if(Opcode != OPC_RMIN && Opcode != OPC_RMAX) {
+        MemAtomicUpdate(Address, Opcode - OPC_RADD + OPC_AADD, Value, Width);
+        return;
+    }
+
+    Old = MemLoadAcquire(Address, Width);
+    for(;;) {
+        if((Opcode == OPC_RMIN && Old <= Value) ||
+           (Opcode == OPC_RMAX && Old >= Value)) {
+
+            return;
+        }
+
+        Seen = MemAtomicCompareSwap(Address, Old, Value, Width);
+        if(Seen == Old) {
+            return;
+        }
+
+        Old = Seen;
+    }
+}
+
+VOID
+PoolReductionUpdate (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Slot,
+    PCHAR Address,
+    LONG Value
+    )
+
+/*
+
+ Routine description:
+
+    This routine folds a value into the copy the thread keeps of a reduction
+    variable, creating the copies on the first update. Only the thread
+    touches its copies, so it needs no atomics, and each block of them lies
+    on cache lines of its own. The first thread keeps no copies and updates
+    the variable itself, so what it reads is always up to date.
+
+ Arguments:
+
+    ExecData - The thread.
+
+    Slot - The slot of the variable.
+
+    Address - Host address of the variable.
+
+    Value - The operand of the update.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    ULONG Opcode;
+    ULONG Size;
+    ULONG i;
+    PLONG Copy;
+
+    Opcode = GProgram->Reductions[Slot].Opcode;
+    if(ExecData->First != FALSE) {
+        PoolReductionApply(Address, Opcode, Value);
+        return;
+    }
+
+    if(ExecData->Reductions == NULL) {
+        Size = GProgram->ReductionCount * sizeof(LONG);
+        Size = (Size + POOL_REDUCTION_ALIGNMENT - 1) &
+               ~(ULONG)(POOL_REDUCTION_ALIGNMENT - 1);
+
+        ExecData->Reductions = _aligned_malloc(Size, POOL_REDUCTION_ALIGNMENT);
+        if(ExecData->Reductions == NULL) {
+            VmFatal(ERR_STR_NOMEM);
+        }
+
+        for(i=0; i<GProgram->ReductionCount; ++i) {
+            ExecData->Reductions[i] = PoolReductionIdentity(GProgram->Reductions[i].Opcode);
+        }
+    }
+
+    Copy = &ExecData->Reductions[Slot];
+    switch(Opcode) {
+        case OPC_RADD:
+            *Copy = (LONG)((ULONG)*Copy + (ULONG)Value);
+            break;
+
+        case OPC_ROR:
+            *Copy = *Copy | Value;
+            break;
+
+        case OPC_RAND:
+            *Copy = *Copy & Value;
+            break;
+
+        case OPC_RXOR:
+            *Copy = *Copy ^ Value;
+            break;
+
+        case OPC_RMIN:
+            *Copy = (Value < *Copy) ? Value : *Copy;
+            break;
+
+        case OPC_RMAX:
+            *Copy = (Value > *Copy) ? Value : *Copy;
+            break;
+    }
+}
+
+VOID
+PoolReductionFold (
+    PTHREAD_EXECUTION_DATA ExecData
+    )
+
+/*
+
+ Routine description:
+
+    This routine folds the copies a thread keeps of the reduction variables
+    into the variables and lets go of them. It runs when the thread finishes,
+    before whoever waits on it runs again, and when it starts a parallel
+    loop, so the variables are whole once the loop is done.
+
+ Arguments:
+
+    ExecData - The thread.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    ULONG Opcode;
+    ULONG i;
+
+    if(ExecData->Reductions == NULL) {
+        return;
+    }
+
+    for(i=0; i<GProgram->ReductionCount; ++i) {
+        Opcode = GProgram->Reductions[i].Opcode;
+        if(ExecData->Reductions[i] == PoolReductionIdentity(Opcode)) {
+            continue;
+        }
+
+        PoolReductionApply(MemGlobalAddress(GProgram->GlobalData,
+                                            GProgram->Reductions[i].Offset,
+                                            GProgram->Header.StackAlignment,
+                                            FALSE),
+                           Opcode,
+                           ExecData->Reductions[i]);
+    }
+
+    _aligned_free(ExecData->Reductions);
+    ExecData->Reductions = NULL;
+}
+
+BOOL
+PoolBarrierWait (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Slot,
+    PCHAR Address
+    )
+
+/*
+
+ Routine description:
+
+    This routine waits on a barrier until as many threads as its variable
+    holds have arrived. The phase can't move on before the calling thread
+    arrives, so the one read up front is the one to wait out. A thread still
+    waiting after a short spin gets parked on the barrier, and the worker
+    moves on to other threads until the last one arrives. The parked thread
+    picks up after the wait.
+
+ Arguments:
+
+    ExecData - The thread execution data for the waiting thread.
+
+    Slot - The slot of the barrier.
+
+    Address - Host address of the barrier variable.
+
+ Return value:
+
+    TRUE if the phase is over, FALSE if the waiting thread is parked.
+
+*/
+
+{
+    PPOOL_BARRIER Barrier;
+    PTHREAD_EXECUTION_DATA Waiter;
+    PTHREAD_EXECUTION_DATA Next;
+    LONG Phase;
+    ULONG Spin;
+
+    Barrier = &ExecData->Worker->Pool->Barriers[Slot];
+    Phase = Barrier->Phase;
+    if(InterlockedIncrement(&Barrier->Arrived) >=
+       MemLoadAcquire(Address, GProgram->Header.StackAlignment)) {
+
+        InterlockedExchange(&Barrier->Arrived, 0);
+        EnterCriticalSection(&Barrier->Lock);
+        InterlockedIncrement(&Barrier->Phase);
+        Waiter = Barrier->Waiters;
+        Barrier->Waiters = NULL;
+        LeaveCriticalSection(&Barrier->Lock);
+        while(Waiter != NULL) {
+            Next = Waiter->Next;
+            if(InterlockedDecrement(&Waiter->JoinCount) == 0) {
+                PoolReady(ExecData->Worker, Waiter);
+            }
+
+            Waiter = Next;
+        }
+
+        return TRUE;
+    }
+
+    for(Spin = 0; Spin < POOL_BARRIER_SPIN; ++Spin) {
+        if(Barrier->Phase != Phase) {
+            goto PoolBarrierWaitDone;
+        }
+
+        YieldProcessor( );
+    }
+
+    //
+    // Parking takes one off JoinCount and the last thread to arrive takes
+    // the other, like a join.
+    //
+
+    ExecData->JoinCount = 2;
+    EnterCriticalSection(&Barrier->Lock);
+    if(Barrier->Phase != Phase) {
+        LeaveCriticalSection(&Barrier->Lock);
+        goto PoolBarrierWaitDone;
+    }
+
+    ExecData->Next = Barrier->Waiters;
+    Barrier->Waiters = ExecData;
+    LeaveCriticalSection(&Barrier->Lock);
+    ExecData->Status = EXEC_STATUS_PARKED;
+    return FALSE;
+
+PoolBarrierWaitDone:
+    MemoryBarrier( );
+    return TRUE;
+}
+
+BOOL
+PoolChannelTrySingle (
+    PPOOL_CHANNEL Channel,
+    PLONG Value,
+    BOOL Receive
+    )
+
+/*
+
+ Routine description:
+
+    This routine sends a value into a channel with a single sender and 
+    receiver or receives one out of it, without waiting. Each end is only
+    moved by its owner, which publishes it with a release once the value is
+    in or out of its cell, and reads the other end with an acquire only when
+    the last it saw of it says the ring is full or empty.
+
+ Arguments:
+
+    Channel - The channel.
+
+    Value - The value to send, or receives the value received.
+
+    Receive - TRUE to receive, FALSE to send.
+
+ Return value:
+
+    TRUE if the value went through, FALSE if the channel is full for a send
+    or empty for a receive.
+
+*/
+
+{
+    LONG64 Current;
+
+    if(Receive != FALSE) {
+        Current = Channel->Head;
+        if(Current == Channel->TailSeen) {
+            Channel->TailSeen = ReadAcquire64(&Channel->Tail);
+            if(Current == Channel->TailSeen) {
+                return FALSE;
+            }
+        }
+
+        *Value = Channel->Cells[Current % Channel->Capacity].Value;
+        WriteRelease64(&Channel->Head, Current + 1);
+    } else {
+        Current = Channel->Tail;
+        if(Current - Channel->HeadSeen == Channel->Capacity) {
+            Channel->HeadSeen = ReadAcquire64(&Channel->Head);
+            if(Current - Channel->HeadSeen == Channel->Capacity) {
+                return FALSE;
+            }
+        }
+
+        Channel->Cells[Current % Channel->Capacity].Value = *Value;
+        WriteRelease64(&Channel->Tail, Current + 1);
+    }
+
+    return TRUE;
+}
+
+BOOL
+PoolChannelTry (
+    PPOOL_CHANNEL Channel,
+    PLONG Value,
+    BOOL Receive
+    )
+
+/*
+
+ Routine description:
+
+    This routine sends a value into a channel or receives one out of it, 
+    without waiting. The sequence of a cell is twice the position it is free
+    at for the sender, and one more once it is full for the receiver, which
+    keeps the two apart even when the ring has a single cell. A sequence 
+    behind that means the ring is full or empty, one ahead of it that another
+    thread claimed the position first. A channel with a single sender and
+    receiver goes to PoolChannelTrySingle instead.
+
+ Arguments:
+
+    Channel - The channel.
+
+    Value - The value to send, or receives the value received.
+
+    Receive - TRUE to receive, FALSE to send.
+
+ Return value:
+
+    TRUE if the value went through, FALSE if the channel is full for a send
+    or empty for a receive.
+
+*/
+
+{
+    PPOOL_CHANNEL_CELL Cell;
+    volatile LONG64 *Position;
+    LONG64 Current;
+    LONG64 Seen;
+    LONG64 Difference;
+
+    if(Channel->Single != FALSE) {
+        return PoolChannelTrySingle(Channel, Value, Receive);
+    }
+
+    Position = (Receive != FALSE) ? &Channel->Head : &Channel->Tail;
+    Current = *Position;
+    for(;;) {
+        Cell = &Channel->Cells[Current % Channel->Capacity];
+        Difference = Cell->Sequence - (2 * Current + (Receive != FALSE));
+        if(Difference < 0) {
+            return FALSE;
+        }
+
+        if(Difference > 0) {
+            Current = *Position;
+            continue;
+        }
+
+        Seen = InterlockedCompareExchange64(Position, Current + 1, Current);
+        if(Seen == Current) {
+            break;
+        }
+
+        Current = Seen;
+    }
+
+    //
+    // Exchanging the sequence in is a full barrier, so the value is in place
+    // for the next thread on the cell, and a thread counting itself waiting
+    // either sees the cell or gets seen by PoolChannelWake.
+    //
+
+    if(Receive != FALSE) {
+        *Value = Cell->Value;
+        InterlockedExchange64(&Cell->Sequence, 2 * (Current + Channel->Capacity));
+    } else {
+        Cell->Value = *Value;
+        InterlockedExchange64(&Cell->Sequence, 2 * Current + 1);
+    }
+
+    return TRUE;
+}
+
+VOID
+PoolChannelWake (
+    PTHREAD_EXECUTION_DATA ExecData,
+    PPOOL_CHANNEL Channel,
+    BOOL Receive
+    )
+
+/*
+
+ Routine description:
+
+    This routine wakes a thread parked on the other side of a channel after
+    a send or a receive went through, a receiver after a send and a sender
+    after a receive. The woken thread tries again, so a value taken from 
+    under it only parks it anew.
+
+ Arguments:
+
+    ExecData - The thread execution data for the thread that went through.
+
+    Channel - The channel.
+
+    Receive - TRUE after a receive, FALSE after a send.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PTHREAD_EXECUTION_DATA *Waiters;
+    PTHREAD_EXECUTION_DATA Waiter;
+
+    //
+    // A single channel moved its end with a release, which a read of Waiting
+    // may pass, so it takes a full barrier to either see a thread counting
+    // itself waiting or be seen by its last try.
+    //
+
+    if(Channel->Single != FALSE) {
+        MemoryBarrier( );
+    }
+
+    if(Channel->Waiting == 0) {
+        return;
+    }
+
+    Waiters = (Receive != FALSE) ? &Channel->Senders : &Channel->Receivers;
+    EnterCriticalSection(&Channel->Lock);
+    Waiter = *Waiters;
+    if(Waiter != NULL) {
+        *Waiters = Waiter->Next;
+        InterlockedDecrement(&Channel->Waiting);
+    }
+
+    LeaveCriticalSection(&Channel->Lock);
+    if(Waiter != NULL && InterlockedDecrement(&Waiter->JoinCount) == 0) {
+        PoolReady(ExecData->Worker, Waiter);
+    }
+}
+
+BOOL
+PoolChannelTransfer (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Slot,
+    PLONG Value,
+    BOOL Receive
+    )
+
+/*
+
+ Routine description:
+
+    This routine sends a value into a channel or receives one out of it, 
+    waiting while the channel is full or empty. A thread still waiting after
+    a short spin gets parked on the channel, and the worker moves on to other
+    threads until a thread on the other side wakes it. The parked thread 
+    runs the send or receive again.
+
+ Arguments:
+
+    ExecData - The thread execution data for the calling thread.
+
+    Slot - The slot of the channel.
+
+    Value - The value to send, or receives the value received.
+
+    Receive - TRUE to receive, FALSE to send.
+
+ Return value:
+
+    TRUE if the value went through, FALSE if the calling thread is parked.
+
+*/
+
+{
+    PPOOL_CHANNEL Channel;
+    PTHREAD_EXECUTION_DATA *Waiters;
+    ULONG Spin;
+
+    Channel = &ExecData->Worker->Pool->Channels[Slot];
+    for(Spin = 0; Spin < POOL_CHANNEL_SPIN; ++Spin) {
+        if(PoolChannelTry(Channel, Value, Receive) != FALSE) {
+            goto PoolChannelTransferDone;
+        }
+
+        YieldProcessor( );
+    }
+
+    //
+    // Parking takes one off JoinCount and the thread waking it takes the
+    // other, like a join. The thread counts itself waiting before the last
+    // try, under the lock so nobody looks for it before it is on the list.
+    //
+
+    ExecData->JoinCount = 2;
+    EnterCriticalSection(&Channel->Lock);
+    InterlockedIncrement(&Channel->Waiting);
+    if(PoolChannelTry(Channel, Value, Receive) != FALSE) {
+        InterlockedDecrement(&Channel->Waiting);
+        LeaveCriticalSection(&Channel->Lock);
+        goto PoolChannelTransferDone;
+    }
+
+    Waiters = (Receive != FALSE) ? &Channel->Receivers : &Channel->Senders;
+    ExecData->Next = *Waiters;
+    *Waiters = ExecData;
+    LeaveCriticalSection(&Channel->Lock);
+    ExecData->Status = EXEC_STATUS_PARKED;
+    return FALSE;
+
+PoolChannelTransferDone:
+    PoolChannelWake(ExecData, Channel, Receive);
+    return TRUE;
+}
+
+BOOL
+PoolChannelSend (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Slot,
+    LONG Value
+    )
+
+/*
+
+ Routine description:
+
+    This routine sends a value into a channel, waiting for room.
+
+ Arguments:
+
+    ExecData - The thread execution data for the sending thread.
+
+    Slot - The slot of the channel.
+
+    Value - The value to send.
+
+ Return value:
+
+    TRUE if the value was sent, FALSE if the sending thread is parked.
+
+*/
+
+{
+    return PoolChannelTransfer(ExecData, Slot, &Value, FALSE);
+}
+
+BOOL
+PoolChannelReceive (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Slot,
+    PLONG Value
+    )
+
+/*
+
+ Routine description:
+
+    This routine receives the oldest value out of a channel, waiting for one.
+
+ Arguments:
+
+    ExecData - The thread execution data for the receiving thread.
+
+    Slot - The slot of the channel.
+
+    Value - Receives the value.
+
+ Return value:
+
+    TRUE if a value was received, FALSE if the receiving thread is parked.
+
+*/
+
+{
+    return PoolChannelTransfer(ExecData, Slot, Value, TRUE);
+}
+
+VOID
+PoolRunThread (
+    PPOOL_WORKER Worker,
+    PTHREAD_EXECUTION_DATA Thread
+    )
+
+/*
+
+ Routine description:
+
+    This routine runs a thread on the calling worker until it stops, and
+    puts it wherever it has to wait next. A finished thread folds its copies
+    of the reduction variables in and is freed, and the threads parked on it
+    or its future made runnable.
+
+ Arguments:
+
+    Worker - The calling worker.
+
+    Thread - The thread to run.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PPOOL Pool;
+    PTHREAD_EXECUTION_DATA Joiner;
+    PPOOL_FUTURE Future;
+
+    Pool = Worker->Pool;
+    switch(ExecRunThread(Worker, Thread)) {
+        case EXEC_STATUS_YIELDED:
+            PoolEnqueue(Pool, Thread);
+            break;
+
+        case EXEC_STATUS_PARKED:
+            if(InterlockedDecrement(&Thread->JoinCount) == 0) {
+                PoolReady(Worker, Thread);
+            }
+
+            break;
+
+        case EXEC_STATUS_FINISHED:
+            PoolReductionFold(Thread);
+            Joiner = Thread->Joiner;
+            Future = Thread->Future;
+            ExecThreadFree(Thread);
+            if(Joiner != NULL && InterlockedDecrement(&Joiner->JoinCount) == 0) {
+                PoolReady(Worker, Joiner);
+            }
+
+            if(Future != NULL) {
+                PoolFutureResolve(Worker, Future);
+            }
+
+            if(InterlockedDecrement(&Pool->Outstanding) == 0) {
+                ReleaseSemaphore(Pool->Finished, 1, NULL);
+            }
+
+            break;
+    }
+}
+
+DWORD
+WINAPI
+PoolWorkerFunc (
+    LPVOID Param
+    )
+
+/*
+
+ Routine description:
+
+    This routine is the loop of each worker thread. It runs threads until it
+    runs out, then sleeps until a thread becomes runnable or the shutdown
+    wakes it.
+
+ Arguments:
+
+    Param - The worker.
+
+ Return value:
+
+    0.
+
+*/
+
+{
+    PPOOL_WORKER Worker;
+    PTHREAD_EXECUTION_DATA Thread;
+    PPOOL Pool;
+
+    Worker = Param;
+    Pool = Worker->Pool;
+    while(Pool->Shutdown == FALSE) {
+        Thread = PoolFindThread(Worker);
+        if(Thread != NULL) {
+            PoolRunThread(Worker, Thread);
+            continue;
+        }
+
+        InterlockedIncrement(&Pool->Sleeping);
+        if(PoolHasThreads(Pool) == FALSE && Pool->Shutdown == FALSE) {
+            WaitForSingleObject(Pool->Wake, INFINITE);
+        }
+
+        InterlockedDecrement(&Pool->Sleeping);
+    }
+
+    return 0;
+}
+
+VOID
+PoolRun (
+    PTHREAD_CREATION_DATA FirstThread
+    )
+
+/*
+
+ Routine description:
+
+    This routine starts the workers, runs the first thread on them and
+    returns once it and every thread spawned after it are done.
+
+ Arguments:
+
+    FirstThread - The creation data for the first thread.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    POOL Pool;
+    PPOOL_WORKER Worker;
+    PTHREAD_EXECUTION_DATA Thread;
+    SYSTEM_INFO SystemInfo;
+    ULONG i;
+    ULONG j;
+
+    memset(&Pool, 0, sizeof(POOL));
+    GetSystemInfo(&SystemInfo);
+    Pool.WorkerCount = SystemInfo.dwNumberOfProcessors;
+#ifdef POOL_WORKERS
+    Pool.WorkerCount = POOL_WORKERS;
+#endif
+
+    if(Pool.WorkerCount == 0) {
+        Pool.WorkerCount = 1;
+    } else if(Pool.WorkerCount > POOL_MAX_WORKERS) {
+        Pool.WorkerCount = POOL_MAX_WORKERS;
+    }
+
+    Pool.Workers = malloc(Pool.WorkerCount * sizeof(POOL_WORKER));
+    Pool.Finished = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+    Pool.Wake = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+    if(Pool.Workers == NULL || Pool.Finished == NULL || Pool.Wake == NULL) {
+        VmFatal(ERR_STR_NOMEM);
+    }
+
+    InitializeCriticalSection(&Pool.QueueLock);
+    memset(Pool.Workers, 0, Pool.WorkerCount * sizeof(POOL_WORKER));
+    for(i=0; i<Pool.WorkerCount; ++i) {
+        Worker = &Pool.Workers[i];
+        Worker->Pool = &Pool;
+        Worker->Index = i;
+        Worker->Seed = 2463534242UL + i * 0x9E3779B9UL;
+    }
+
+    //
+    // Min and max reductions start out as the identity of their operator,
+    // the others at zero like any global.
+    //
+
+    for(i=0; i<GProgram->ReductionCount; ++i) {
+        if(GProgram->Reductions[i].Opcode == OPC_RMIN ||
+           GProgram->Reductions[i].Opcode == OPC_RMAX) {
+
+            MemStore(MemGlobalAddress(GProgram->GlobalData,
+                                      GProgram->Reductions[i].Offset,
+                                      GProgram->Header.StackAlignment,
+                                      FALSE),
+                     PoolReductionIdentity(GProgram->Reductions[i].Opcode),
+                     GProgram->Header.StackAlignment);
+        }
+    }
+
+    if(GProgram->BarrierCount != 0) {
+        Pool.Barriers = calloc(GProgram->BarrierCount, sizeof(POOL_BARRIER));
+        if(Pool.Barriers == NULL) {
+            VmFatal(ERR_STR_NOMEM);
+        }
+    }
+
+    for(i=0; i<GProgram->BarrierCount; ++i) {
+        InitializeCriticalSection(&Pool.Barriers[i].Lock);
+    }
+
+    //
+    // Every cell of a channel starts out free for the sender at its own
+    // position.
+    //
+
+    if(GProgram->ChannelCount != 0) {
+        Pool.Channels = _aligned_malloc(GProgram->ChannelCount * sizeof(POOL_CHANNEL),
+                                        POOL_CHANNEL_ALIGNMENT);
+
+        if(Pool.Channels == NULL) {
+            VmFatal(ERR_STR_NOMEM);
+        }
+
+        memset(Pool.Channels, 0, GProgram->ChannelCount * sizeof(POOL_CHANNEL));
+    }
+
+    for(i=0; i<GProgram->ChannelCount; ++i) {
+        Pool.Channels[i].Capacity = GProgram->Channels[i].Capacity;
+        Pool.Channels[i].Single = GProgram->Channels[i].Single;
+        Pool.Channels[i].Cells = _aligned_malloc(GProgram->Channels[i].Capacity *
+                                                 sizeof(POOL_CHANNEL_CELL),
+                                                 POOL_CHANNEL_ALIGNMENT);
+
+        if(Pool.Channels[i].Cells == NULL) {
+            VmFatal(ERR_STR_NOMEM);
+        }
+
+        for(j=0; j<GProgram->Channels[i].Capacity; ++j) {
+            Pool.Channels[i].Cells[j].Sequence = 2 * (LONG64)j;
+        }
+
+        InitializeCriticalSection(&Pool.Channels[i].Lock);
+    }
+
+    //
+    // The first thread waits on the first worker's deque before any of the
+    // workers run. It updates reduction variables in place.
+    //
+
+    Pool.Outstanding = 1;
+    Thread = ExecThreadCreate(FirstThread, NULL);
+    Thread->First = TRUE;
+    PoolDequePush(&Pool.Workers[0].Deque, Thread);
+
+    for(i=0; i<Pool.WorkerCount; ++i) {
+        Worker = &Pool.Workers[i];
+        Worker->Thread = CreateThread(NULL,
+                                      0,
+                                      PoolWorkerFunc,
+                                      (LPVOID)Worker,
+                                      0,
+                                      NULL);
+
+        if(Worker->Thread == NULL) {
+            VmFatal(ERR_STR_NOMEM);
+        }
+    }
+
+    WaitForSingleObject(Pool.Finished, INFINITE);
+
+    InterlockedExchange(&Pool.Shutdown, TRUE);
+    ReleaseSemaphore(Pool.Wake, Pool.WorkerCount, NULL);
+    for(i=0; i<Pool.WorkerCount; ++i) {
+        WaitForSingleObject(Pool.Workers[i].Thread, INFINITE);
+        CloseHandle(Pool.Workers[i].Thread);
+        SpaceCacheFree(GProgram, &Pool.Workers[i].Windows);
+    }
+
+    for(i=0; i<POOL_FUTURE_CHUNKS; ++i) {
+        free(Pool.FutureChunks[i]);
+    }
+
+    for(i=0; i<GProgram->BarrierCount; ++i) {
+        DeleteCriticalSection(&Pool.Barriers[i].Lock);
+    }
+
+    free(Pool.Barriers);
+
+    for(i=0; i<GProgram->ChannelCount; ++i) {
+        DeleteCriticalSection(&Pool.Channels[i].Lock);
+        _aligned_free(Pool.Channels[i].Cells);
+    }
+
+    _aligned_free(Pool.Channels);
+
+    DeleteCriticalSection(&Pool.QueueLock);
+    CloseHandle(Pool.Finished);
+    CloseHandle(Pool.Wake);
+    free(Pool.Workers);
+}
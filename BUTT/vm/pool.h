@@ -0,0 +1,385 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    pool.h
+
+ Abstract:
+
+    This module defines the pool of worker threads that runs BUTT threads,
+    the first one and every parallel call after it, switching between them
+    as they stop.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Schedule green threads instead of tasks
+    10/17/26        Per worker window cache
+    10/17/26        Futures for async calls and their recycling
+    10/17/26        Parallel loops
+    10/17/26        Per thread reduction copies
+    10/17/26        Barriers
+    10/17/26        Channels
+    10/17/26        Single channels
+
+**/
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <windows.h>
+#include "exec.h"
+#include "space.h"
+
+//
+// One worker per processor unless POOL_WORKERS says otherwise.
+//
+
+#define POOL_MAX_WORKERS        64
+
+//
+// Each worker keeps the threads it makes runnable in a deque of its own. It
+// pushes and pops at the bottom, idle workers steal from the top. Threads
+// that used up their time slice, or don't fit in a full deque, go on the run
+// queue every worker shares.
+//
+
+#define POOL_DEQUE_SIZE         4096
+
+//
+// A worker looks at the run queue before its own deque every so often, so a
+// preempted thread gets back on even while the worker keeps itself busy.
+//
+
+#define POOL_QUEUE_INTERVAL     61
+
+//
+// A thread joining another spins this many times waiting for it to finish
+// before it parks and gives the worker up.
+//
+
+#define POOL_JOIN_SPIN          256
+
+//
+// An async call whose thread gets joined hands out a handle to a future, the
+// index of its slot tagged with the generation of the slot, so zero is no
+// thread and a handle to a future since recycled is told apart from one to
+// the future in its slot now. Futures come in chunks that stay put until the
+// program ends.
+//
+
+#define POOL_FUTURE_CHUNK_SIZE  4096
+#define POOL_FUTURE_CHUNKS      1024
+#define POOL_FUTURE_INDEX_BITS  22
+#define POOL_FUTURE_INDEX_MASK  ((1UL << POOL_FUTURE_INDEX_BITS) - 1)
+#define POOL_FUTURE_GENERATIONS (1UL << (32 - POOL_FUTURE_INDEX_BITS))
+
+//
+// Joiners park on the future in a list through their run queue link. The
+// thread finishing swaps the list for POOL_FUTURE_RESOLVED, so no joiner
+// gets on once it has taken the list.
+//
+
+#define POOL_FUTURE_RESOLVED    ((PTHREAD_EXECUTION_DATA)(ULONG_PTR)1)
+
+//
+// A future is counted in State, under the generation of its slot in the 
+// upper half so a count through a stale handle fails. The thread running 
+// holds a reference, and so does every thread variable holding the handle.
+// The handle the call evaluates to holds one too while it is in flight, 
+// until it is stored into a thread variable or joined right away. Once 
+// nothing references the future its slot moves on to the next generation 
+// and goes on the free list, linked through Next.
+//
+
+typedef struct _POOL_FUTURE {
+    PTHREAD_EXECUTION_DATA volatile Waiters;
+    volatile LONG64 State;
+    volatile LONG InFlight;
+    LONG Value;
+    ULONG Index;
+    ULONG Next;
+} POOL_FUTURE, *PPOOL_FUTURE;
+
+//
+// A parallel loop runs its body on up to one thread per worker, each taking
+// chunks of the iterations until there are none left. A static schedule
+// deals the chunks out round robin up front, a dynamic one hands them out in
+// order as runners ask, and a guided one does too with chunks shrinking
+// from the share of each runner of what's left down to Chunk. The body gets
+// the values of the locals it captured after its index and bound, the same
+// for every chunk. The last runner to finish frees the loop.
+//
+
+typedef struct _POOL_LOOP {
+    ULONG JumpIndex;
+    ULONG Schedule;
+    LONG64 First;
+    LONG64 Bound;
+    LONG64 Stride;
+    LONG64 Count;
+    LONG64 Chunk;
+    LONG64 Runners;
+    volatile LONG64 Next;
+    volatile LONG Active;
+    ULONG CaptureCount;
+    PLONG Captures;
+} POOL_LOOP, *PPOOL_LOOP;
+
+//
+// Each thread updating a reduction variable keeps a copy of every one, in a
+// block of its own on cache lines no other thread writes.
+//
+
+#define POOL_REDUCTION_ALIGNMENT    64
+
+//
+// A barrier counts the threads that have arrived in the current phase, and
+// the last one to arrive moves the phase on. The others spin this many times
+// watching for it, then park on the barrier and give the worker up. Parking
+// and the move to the next phase take the lock, so no thread parks on a
+// phase that is already over.
+//
+
+#define POOL_BARRIER_SPIN       1024
+
+typedef struct _POOL_BARRIER {
+    volatile LONG Arrived;
+    volatile LONG Phase;
+    CRITICAL_SECTION Lock;
+    PTHREAD_EXECUTION_DATA Waiters;
+} POOL_BARRIER, *PPOOL_BARRIER;
+
+//
+// A channel is a bounded ring of cells, each holding a value and the 
+// position it is next free or full at. Senders claim a position off Tail and
+// receivers off Head with a compare and swap, each counter on a line of its
+// own, so a lone sender and receiver never share one. A channel declared 
+// single has one sender owning Tail and one receiver owning Head, which 
+// move them with a release and no compare and swap, and only use the cells
+// for their values. Each keeps the last it saw of the other end on its own
+// line, and reads the other end only when the ring looks full or empty. A
+// thread finding the channel full or empty spins this many times and then
+// parks on it. Parked threads are counted in Waiting before their last try,
+// so a send or receive only takes the lock to wake one when someone is 
+// waiting.
+//
+
+#define POOL_CHANNEL_SPIN       256
+#define POOL_CHANNEL_ALIGNMENT  64
+
+typedef struct _POOL_CHANNEL_CELL {
+    volatile LONG64 Sequence;
+    volatile LONG Value;
+} POOL_CHANNEL_CELL, *PPOOL_CHANNEL_CELL;
+
+typedef struct _POOL_CHANNEL {
+    volatile LONG64 Tail;
+    LONG64 HeadSeen;
+    UCHAR TailPad[POOL_CHANNEL_ALIGNMENT - 2 * sizeof(LONG64)];
+    volatile LONG64 Head;
+    LONG64 TailSeen;
+    UCHAR HeadPad[POOL_CHANNEL_ALIGNMENT - 2 * sizeof(LONG64)];
+    LONG64 Capacity;
+    BOOL Single;
+    PPOOL_CHANNEL_CELL Cells;
+    volatile LONG Waiting;
+    CRITICAL_SECTION Lock;
+    PTHREAD_EXECUTION_DATA Senders;
+    PTHREAD_EXECUTION_DATA Receivers;
+} POOL_CHANNEL, *PPOOL_CHANNEL;
+
+typedef struct _POOL_DEQUE {
+    volatile LONG Top;
+    volatile LONG Bottom;
+    PTHREAD_EXECUTION_DATA volatile Threads[POOL_DEQUE_SIZE];
+} POOL_DEQUE, *PPOOL_DEQUE;
+
+typedef struct _POOL_WORKER {
+    struct _POOL *Pool;
+    ULONG Index;
+    ULONG Seed;
+    ULONG Ticks;
+    HANDLE Thread;
+    SPACE_CACHE Windows;
+    POOL_DEQUE Deque;
+} POOL_WORKER, *PPOOL_WORKER;
+
+typedef struct _POOL {
+    ULONG WorkerCount;
+    PPOOL_WORKER Workers;
+
+    //
+    // Threads that haven't finished yet, parked ones included. The program
+    // is over when the last one finishes.
+    //
+
+    volatile LONG Outstanding;
+    HANDLE Finished;
+
+    //
+    // The shared run queue, first in first out.
+    //
+
+    CRITICAL_SECTION QueueLock;
+    PTHREAD_EXECUTION_DATA QueueHead;
+    PTHREAD_EXECUTION_DATA QueueTail;
+    volatile LONG QueueLength;
+
+    //
+    // Workers out of threads sleep on Wake. Making a thread runnable only
+    // releases it when someone is sleeping.
+    //
+
+    volatile LONG Sleeping;
+    volatile LONG Shutdown;
+    HANDLE Wake;
+
+    //
+    // Slots handed out so far, and the free ones. The free list head holds
+    // the index of the first slot plus one in its lower half and a count of
+    // the changes made to it in the upper half.
+    //
+
+    volatile LONG FutureCount;
+    volatile LONG64 FutureFree;
+    PPOOL_FUTURE volatile FutureChunks[POOL_FUTURE_CHUNKS];
+
+    //
+    // One per barrier of the program.
+    //
+
+    PPOOL_BARRIER Barriers;
+
+    //
+    // One per channel of the program.
+    //
+
+    PPOOL_CHANNEL Channels;
+} POOL, *PPOOL;
+
+VOID
+PoolSpawn (
+    PPOOL_WORKER Worker,
+    PTHREAD_EXECUTION_DATA Thread
+    );
+
+ULONG
+PoolFutureCreate (
+    PPOOL Pool,
+    PPOOL_FUTURE *Future
+    );
+
+VOID
+PoolFutureRetain (
+    PPOOL Pool,
+    ULONG Handle
+    );
+
+VOID
+PoolFutureRelease (
+    PPOOL Pool,
+    ULONG Handle
+    );
+
+BOOL
+PoolFutureJoin (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Handle,
+    BOOL InFlight,
+    PLONG Value
+    );
+
+PPOOL_LOOP
+PoolLoopCreate (
+    PPOOL Pool,
+    ULONG JumpIndex,
+    ULONG Schedule,
+    LONG First,
+    LONG Bound,
+    LONG Stride,
+    LONG Chunk,
+    ULONG CaptureCount
+    );
+
+BOOL
+PoolLoopNext (
+    PPOOL_LOOP Loop,
+    PLONG64 Runner,
+    PLONG First,
+    PLONG Bound
+    );
+
+LONG
+PoolReductionIdentity (
+    ULONG Opcode
+    );
+
+VOID
+PoolReductionApply (
+    PCHAR Address,
+    ULONG Opcode,
+    LONG Value
+    );
+
+VOID
+PoolReductionUpdate (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Slot,
+    PCHAR Address,
+    LONG Value
+    );
+
+VOID
+PoolReductionFold (
+    PTHREAD_EXECUTION_DATA ExecData
+    );
+
+BOOL
+PoolBarrierWait (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Slot,
+    PCHAR Address
+    );
+
+BOOL
+PoolChannelSend (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Slot,
+    LONG Value
+    );
+
+BOOL
+PoolChannelReceive (
+    PTHREAD_EXECUTION_DATA ExecData,
+    ULONG Slot,
+    PLONG Value
+    );
+
+VOID
+PoolRun (
+    PTHREAD_CREATION_DATA FirstThread
+    );
+
+#endif // __POOL_H__
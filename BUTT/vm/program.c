@@ -32,10 +32,27 @@
  Revision:
  
     11/24/15        Initial Creation
+    10/17/26        Decode the code section at load time
+    10/17/26        Fuse superinstructions at load time
+    10/17/26        Translate to machine code with EXEC_JIT
+    10/17/26        Set up hot loop traces with EXEC_LOOP_JIT
+    10/17/26        Global data lives in the flat address space
+    10/17/26        Reject stack alignments without an interpreter core
+    10/17/26        Verify programs before running them
+    10/17/26        Constant time function symbol lookup
+    10/17/26        Check the version
+    10/17/26        Bad function symbols fail the load
+    10/17/26        Free the space and decode tables of a failed load
 
 **/
 
 #include "program.h"
+#include "fuse.h"
+#include "space.h"
+#include "verify.h"
+#if defined(EXEC_JIT) || defined(EXEC_LOOP_JIT)
+#include "jit.h"
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -63,6 +80,100 @@ DebugPrettyPrintProgramHeader (
     printf("###################### PROGRAM HDR END ######################\n");
 }
 
+LONG
+ProgramIndexFunctions (
+    PPROGRAM Program
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine builds the table that finds the symbol of a function from
+    the decoded instruction index of its entry, which is what calls and 
+    spawns carry.
+    
+ Arguments:
+ 
+    Program - The program. The code must be decoded and the function 
+              symbols read.
+    
+ Return value:
+ 
+    0 on success, -1 otherwise.
+
+*/
+    
+{
+    ULONG Address;
+    ULONG i;
+    
+    Program->FunctionIndex = malloc(Program->InstructionCount * sizeof(ULONG));
+    if(Program->FunctionIndex == NULL) {
+        return -1;
+    }
+    
+    for(i=0; i<Program->InstructionCount; ++i) {
+        Program->FunctionIndex[i] = PROGRAM_NO_FUNCTION;
+    }
+    
+    for(i=0; i<Program->FunctionSymbolsSize; ++i) {
+        Address = Program->FunctionSymbols[i].FunctionAddress - 
+                  Program->Header.CodeStart;
+                  
+        if(Program->FunctionSymbols[i].FunctionAddress < Program->Header.CodeStart ||
+           (Address % sizeof(INSTRUCTION)) != 0 ||
+           Address / sizeof(INSTRUCTION) >= Program->InstructionCount) {
+           
+            return -1;
+        }
+        
+        Program->FunctionIndex[Address / sizeof(INSTRUCTION)] = i;
+    }
+    
+    return 0;
+}
+
+PFUNCTION_SYMBOL
+ProgramLookupFunction (
+    PPROGRAM Program,
+    ULONG InstructionIndex
+    )
+    
+/*
+
+ Routine description:
+ 
+    This routine finds the symbol of the function entered at a decoded
+    instruction.
+    
+ Arguments:
+ 
+    Program - The program.
+    
+    InstructionIndex - Index of the entry instruction of the function.
+    
+ Return value:
+ 
+    The function symbol, NULL if no function is entered there.
+
+*/
+    
+{
+    ULONG Function;
+    
+    if(InstructionIndex >= Program->InstructionCount) {
+        return NULL;
+    }
+    
+    Function = Program->FunctionIndex[InstructionIndex];
+    if(Function == PROGRAM_NO_FUNCTION) {
+        return NULL;
+    }
+    
+    return &Program->FunctionSymbols[Function];
+}
+
 LONG
 ProgramRead (
     FILE *ProgramFile,
@@ -75,13 +186,14 @@ ProgramRead (
     PFUNCTION_SYMBOL FunctionSymbolBuffer;
     ULONG FunctionSymbolBufferSize;
     ULONG FunctionSymbolBufferCount;
-    PCHAR ProgramCode;
+    PINSTRUCTION ProgramCode;
     ULONG ProgramCodeSize;
     ULONG ProgramCodeCount;
-    PCHAR ProgramData;
     ULONG BytesRead;
     
     *ProgramOut = NULL;
+    FunctionSymbolBuffer = NULL;
+    ProgramCode = NULL;
     Program = malloc(sizeof(PROGRAM));
     if(Program == NULL) {
         goto ProgramReadErr;
@@ -100,14 +212,29 @@ ProgramRead (
     DebugPrettyPrintProgramHeader(&Program->Header);
     
     //
-    // It would be absolutely lovely if we could use a hashmap for the 
-    // function symbols. However the SHASHMAP class takes a char* as the key
-    // and we don't have that and I currently lack the time to modify it to 
-    // take a hashing function as an initialization parameter to have it be
-    // able to hash any data type. 
+    // The layout of the function symbols changed with the minor version.
+    //
+    
+    if(Program->Header.MagicNumber != HEADER_MAGIC_NUMBER ||
+       Program->Header.VersionMajor != COMPILER_VERSION_MAJOR ||
+       Program->Header.VersionMinor != COMPILER_VERSION_MINOR) {
+       
+        goto ProgramReadErr;
+    }
+    
+    //
+    // There is an interpreter core for each stack alignment we support.
+    //
+    
+    if(Program->Header.StackAlignment != sizeof(LONG) &&
+       Program->Header.StackAlignment != sizeof(LONG64)) {
+       
+        goto ProgramReadErr;
+    }
+    
     //
-    // With that in mind, we have an array of the symbols and do a linear
-    // search whenever we need one.
+    // The symbols are read into an array and indexed by the decoded
+    // instruction of their entry once the code is in.
     //
     
     FunctionSymbolBufferSize = Program->Header.SymbolSize;
@@ -126,7 +253,8 @@ ProgramRead (
     assert(BytesRead == FunctionSymbolBufferCount);
     
     //
-    // Ok, finally read the instructions.
+    // Ok, finally read the instructions. They are only needed long enough to
+    // build the decoded stream the interpreter runs from.
     //
     
     //
@@ -145,17 +273,63 @@ ProgramRead (
                       sizeof(INSTRUCTION),
                       ProgramCodeCount,
                       ProgramFile);
+                      
+    assert(BytesRead == ProgramCodeCount);
     
-    ProgramData = malloc(Program->Header.DataSize);
-    if(ProgramData == NULL) {
+    if(DecodeProgram(Program, ProgramCode, ProgramCodeCount) != 0) {
         goto ProgramReadErr;
     }
-    
-    memset(ProgramData, 0, Program->Header.DataSize);
+
     Program->FunctionSymbols = FunctionSymbolBuffer;
     Program->FunctionSymbolsSize = FunctionSymbolBufferCount;
-    Program->GlobalData = ProgramData;
-    Program->Code = ProgramCode;
+    FunctionSymbolBuffer = NULL;
+    if(ProgramIndexFunctions(Program) != 0) {
+        goto ProgramReadErr;
+    }
+    
+    if(SpaceCreate(Program) != 0) {
+        goto ProgramReadErr;
+    }
+    
+    //
+    // The verifier works on the instructions as the translator emitted them,
+    // so it runs before they are fused.
+    //
+    
+    if(VerifyProgram(Program) != 0) {
+        goto ProgramReadErr;
+    }
+    
+    if(FuseProgram(Program) != 0) {
+        goto ProgramReadErr;
+    }
+    
+#ifdef EXEC_JIT
+
+    //
+    // Whatever the JIT can't translate is interpreted instead. Translated
+    // code doesn't check its accesses, so only verified programs get it.
+    //
+    
+    if(Program->Verified != FALSE) {
+        JitCompileProgram(Program);
+    }
+#endif
+
+#ifdef EXEC_LOOP_JIT
+
+    //
+    // Hot loops of an interpreted program are translated as they are found.
+    //
+
+    if(Program->Verified != FALSE && 
+       Program->Jit == NULL && 
+       JitLoopCacheCreate(Program) != 0) {
+        
+        goto ProgramReadErr;
+    }
+#endif
+
     *ProgramOut = Program;    
     
     RetVal = 0;
@@ -163,18 +337,43 @@ ProgramRead (
     
 ProgramReadErr:
     if(Program != NULL) {
+        SpaceDestroy(Program);
+        if(Program->Instructions != NULL) {
+            DecodeFree(Program->Instructions);
+        }
+        
+        if(Program->FunctionSymbols != NULL) {
+            free(Program->FunctionSymbols);
+        }
+        
+        if(Program->FunctionIndex != NULL) {
+            free(Program->FunctionIndex);
+        }
+        
+        if(Program->Reductions != NULL) {
+            free(Program->Reductions);
+        }
+        
+        if(Program->Barriers != NULL) {
+            free(Program->Barriers);
+        }
+        
+        if(Program->Channels != NULL) {
+            free(Program->Channels);
+        }
+        
         free(Program);
     }
     
-    if(ProgramCode != NULL) {
-        free(ProgramCode);
+    if(FunctionSymbolBuffer != NULL) {
+        free(FunctionSymbolBuffer);
     }
     
     RetVal = -1;
     
 ProgramReadEnd:
-    if(FunctionSymbolBuffer != NULL) {
-        free(FunctionSymbolBuffer);
+    if(ProgramCode != NULL) {
+        free(ProgramCode);
     }
     
     return RetVal;
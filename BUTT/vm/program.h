@@ -32,6 +32,17 @@
  Revision:
  
     11/24/15        Initial Creation
+    10/17/26        Run from a decoded instruction stream
+    10/17/26        Hot loop trace cache
+    10/17/26        Optional JIT translation
+    10/17/26        Flat address space
+    10/17/26        Verified flag
+    10/17/26        Function symbols indexed by entry instruction
+    10/17/26        Fixed stack reads flag
+    10/17/26        Reduction variables
+    10/17/26        Barriers
+    10/17/26        Channels
+    10/17/26        Single channels
 
 **/
 
@@ -43,16 +54,82 @@
 #include "../Common/instrdef.h"
 #include "../Common/opcodedef.h"
 #include "../Common/registerdef.h"
+#include "decode.h"
 #include <windows.h>
 #include <stdio.h>
 
+#define PROGRAM_NO_FUNCTION     ((ULONG)-1)
+
+//
+// A reduction variable by its offset in the global data, and the update
+// opcode folding into it, RSUB counting as RADD. Its slot in the copies a
+// thread keeps is its index in the table.
+//
+
+typedef struct _PROGRAM_REDUCTION {
+    LONG Offset;
+    ULONG Opcode;
+} PROGRAM_REDUCTION, *PPROGRAM_REDUCTION;
+
+//
+// A channel by its offset in the global data, the number of values it holds
+// and whether it has a single sender and receiver. The pool keeps the ring
+// of each at its index in the table.
+//
+
+typedef struct _PROGRAM_CHANNEL {
+    LONG Offset;
+    ULONG Capacity;
+    BOOL Single;
+} PROGRAM_CHANNEL, *PPROGRAM_CHANNEL;
+
 typedef struct _PROGRAM {
 	PROGRAM_HEADER Header;
-    //PSHASHMAP FunctionSymbols;
     PFUNCTION_SYMBOL FunctionSymbols;
     ULONG FunctionSymbolsSize;
+    
+    //
+    // The function symbol index for each decoded instruction that is the 
+    // entry of a function, PROGRAM_NO_FUNCTION for the others.
+    //
+    
+    PULONG FunctionIndex;
     PCHAR GlobalData;
-    PCHAR Code;
+    PDECODED_INSTRUCTION Instructions;
+    ULONG InstructionCount;
+    struct _JIT_PROGRAM *Jit;
+    struct _JIT_LOOP_CACHE *Loops;
+    struct _SPACE *Space;
+    BOOL Verified;
+
+    //
+    // Set by the verifier when a function other than the start block reads
+    // a fixed stack address. Such a read could land anywhere on the stack.
+    //
+
+    BOOL FixedStackReads;
+
+    //
+    // Reduction variables, filled in as the updates get decoded.
+    //
+
+    PPROGRAM_REDUCTION Reductions;
+    ULONG ReductionCount;
+
+    //
+    // Offsets of the barriers in the global data, filled in as the waits get
+    // decoded. The pool keeps the state of each at the same index.
+    //
+
+    PLONG Barriers;
+    ULONG BarrierCount;
+
+    //
+    // Channels, filled in as the sends and receives get decoded.
+    //
+
+    PPROGRAM_CHANNEL Channels;
+    ULONG ChannelCount;
 } PROGRAM, *PPROGRAM;
 
 LONG
@@ -61,4 +138,10 @@ ProgramRead (
 	PPROGRAM *ProgramOut
 	);
 
+PFUNCTION_SYMBOL
+ProgramLookupFunction (
+    PPROGRAM Program,
+    ULONG InstructionIndex
+    );
+
 #endif // __PROGRAM_H__
@@ -0,0 +1,429 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    space.c
+
+ Abstract:
+
+    This module implements the VM address space and the per thread windows
+    onto it.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Guard page and per worker window cache
+    10/17/26        Commit only as much stack as the thread needs
+    10/17/26        Tear down the space of a program that fails to load
+
+**/
+
+#include "space.h"
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Finding a free range and mapping into it are separate steps, another
+// thread may allocate in between. That many times we try again.
+//
+
+#define SPACE_WINDOW_ATTEMPTS   16
+
+#define SPACE_ROUND(X, A)       (((X) + (A) - 1) / (A) * (A))
+
+LONG
+SpaceCreate (
+    PPROGRAM Program
+    )
+
+/*
+
+ Routine description:
+
+    This routine creates the global data of a program and sets up the layout
+    of its windows. The data is a pagefile backed section, so it costs 
+    nothing until touched and replaces clearing a heap block at load time.
+    Program->GlobalData receives a view of it for operands that address 
+    global data directly.
+
+ Arguments:
+
+    Program - The program being loaded.
+
+ Return value:
+
+    0 on success, -1 if the compiled layout can't be mirrored.
+
+*/
+
+{
+    SYSTEM_INFO SystemInfo;
+    PPROGRAM_HEADER Header;
+    PSPACE Space;
+
+    Header = &Program->Header;
+    Space = malloc(sizeof(SPACE));
+    if(Space == NULL) {
+        return -1;
+    }
+
+    memset(Space, 0, sizeof(SPACE));
+    GetSystemInfo(&SystemInfo);
+    Space->PageSize = SystemInfo.dwPageSize;
+    Space->StackSize = SPACE_ROUND(Header->StackTop, SystemInfo.dwPageSize);
+
+    Space->DataSize = SPACE_ROUND(Header->DataSize + Header->StackAlignment,
+                                  SystemInfo.dwAllocationGranularity);
+
+    Space->WindowSize = Header->DataStart + Space->DataSize;
+
+    //
+    // A reservation starts at allocation granularity, so that is what the
+    // guard under the stack takes up.
+    //
+
+    Space->GuardSize = SystemInfo.dwAllocationGranularity;
+
+    //
+    // Views can only be mapped at allocation granularity, and the stack has
+    // to end before the data begins.
+    //
+
+    if((Header->DataStart % SystemInfo.dwAllocationGranularity) != 0 ||
+       Space->StackSize > Header->DataStart) {
+
+        goto SpaceCreateErr;
+    }
+
+    Space->DataSection = CreateFileMapping(INVALID_HANDLE_VALUE,
+                                           NULL,
+                                           PAGE_READWRITE,
+                                           0,
+                                           Space->DataSize,
+                                           NULL);
+
+    if(Space->DataSection == NULL) {
+        goto SpaceCreateErr;
+    }
+
+    Program->GlobalData = MapViewOfFile(Space->DataSection,
+                                        FILE_MAP_WRITE,
+                                        0,
+                                        0,
+                                        Space->DataSize);
+
+    if(Program->GlobalData == NULL) {
+        goto SpaceCreateErr;
+    }
+
+    Program->Space = Space;
+    return 0;
+
+SpaceCreateErr:
+    if(Space->DataSection != NULL) {
+        CloseHandle(Space->DataSection);
+    }
+
+    free(Space);
+    return -1;
+}
+
+VOID
+SpaceDestroy (
+    PPROGRAM Program
+    )
+
+/*
+
+ Routine description:
+
+    This routine undoes SpaceCreate, for a program that fails to load after
+    its global data was created. No window may be left.
+
+ Arguments:
+
+    Program - The program being loaded.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PSPACE Space;
+
+    Space = Program->Space;
+    if(Space == NULL) {
+        return;
+    }
+
+    UnmapViewOfFile(Program->GlobalData);
+    CloseHandle(Space->DataSection);
+    free(Space);
+    Program->GlobalData = NULL;
+    Program->Space = NULL;
+}
+
+PCHAR
+SpaceWindowReserve (
+    PPROGRAM Program
+    )
+
+/*
+
+ Routine description:
+
+    This routine reserves a new window with the global data mapped in. Its
+    stack is only reserved, under it lies a reserved guard that faults on
+    any access.
+
+ Arguments:
+
+    Program - The running program.
+
+ Return value:
+
+    Host address of VM address 0 in the window, NULL on failure.
+
+*/
+
+{
+    PSPACE Space;
+    PCHAR Guard;
+    PCHAR Window;
+    PVOID Data;
+    ULONG i;
+
+    Space = Program->Space;
+    for(i=0; i<SPACE_WINDOW_ATTEMPTS; ++i) {
+        Guard = VirtualAlloc(NULL, 
+                             Space->GuardSize + Space->WindowSize, 
+                             MEM_RESERVE, 
+                             PAGE_NOACCESS);
+
+        if(Guard == NULL) {
+            return NULL;
+        }
+
+        VirtualFree(Guard, 0, MEM_RELEASE);
+        if(VirtualAlloc(Guard, Space->GuardSize, MEM_RESERVE, PAGE_NOACCESS) == NULL) {
+            continue;
+        }
+
+        Window = Guard + Space->GuardSize;
+        if(VirtualAlloc(Window, Space->StackSize, MEM_RESERVE, PAGE_NOACCESS) == NULL) {
+            VirtualFree(Guard, 0, MEM_RELEASE);
+            continue;
+        }
+
+        Data = MapViewOfFileEx(Space->DataSection,
+                               FILE_MAP_WRITE,
+                               0,
+                               0,
+                               Space->DataSize,
+                               Window + Program->Header.DataStart);
+
+        if(Data != NULL) {
+            return Window;
+        }
+
+        VirtualFree(Window, 0, MEM_RELEASE);
+        VirtualFree(Guard, 0, MEM_RELEASE);
+    }
+
+    return NULL;
+}
+
+VOID
+SpaceWindowRelease (
+    PPROGRAM Program,
+    PCHAR Window
+    )
+
+/*
+
+ Routine description:
+
+    This routine gives a window back, guard and all.
+
+ Arguments:
+
+    Program - The running program.
+
+    Window - The window.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    UnmapViewOfFile(Window + Program->Header.DataStart);
+    VirtualFree(Window, 0, MEM_RELEASE);
+    VirtualFree(Window - Program->Space->GuardSize, 0, MEM_RELEASE);
+}
+
+PCHAR
+SpaceWindowCreate (
+    PPROGRAM Program,
+    PSPACE_CACHE Cache,
+    ULONG StackDepth,
+    PULONG StackLimit
+    )
+
+/*
+
+ Routine description:
+
+    This routine creates a window for a new thread, or takes one off the
+    cache. The thread addresses its stack and, through index registers, the
+    global data as offsets from the returned base. Only the top of the
+    stack the thread needs is committed, the rest faults like the guard.
+    What is committed is only backed once touched, like the data.
+
+ Arguments:
+
+    Program - The running program.
+
+    Cache - The window cache of the calling worker, NULL for none.
+
+    StackDepth - Bytes of stack the thread needs below StackTop, 0 for all
+                 of it.
+
+    StackLimit - Receives the lowest VM address of the committed stack.
+
+ Return value:
+
+    Host address of VM address 0 in the window, NULL on failure.
+
+*/
+
+{
+    PSPACE Space;
+    PCHAR Window;
+    ULONG Limit;
+
+    Space = Program->Space;
+    if(Cache != NULL && Cache->Count != 0) {
+        Cache->Count = Cache->Count - 1;
+        Window = Cache->Windows[Cache->Count];
+    } else {
+        Window = SpaceWindowReserve(Program);
+        if(Window == NULL) {
+            return NULL;
+        }
+    }
+
+    Limit = 0;
+    if(StackDepth != 0 && StackDepth < Program->Header.StackTop) {
+        Limit = (Program->Header.StackTop - StackDepth) / 
+                Space->PageSize * 
+                Space->PageSize;
+    }
+
+    if(VirtualAlloc(Window + Limit,
+                    Space->StackSize - Limit,
+                    MEM_COMMIT,
+                    PAGE_READWRITE) == NULL) {
+
+        SpaceWindowRelease(Program, Window);
+        return NULL;
+    }
+
+    *StackLimit = Limit;
+    return Window;
+}
+
+VOID
+SpaceWindowFree (
+    PPROGRAM Program,
+    PSPACE_CACHE Cache,
+    PCHAR Window
+    )
+
+/*
+
+ Routine description:
+
+    This routine frees the window of a finished thread, or caches it. The
+    stack of a cached window is decommitted, which gives its touched pages
+    back and leaves it zero filled for the next thread.
+
+ Arguments:
+
+    Program - The running program.
+
+    Cache - The window cache of the calling worker, NULL for none.
+
+    Window - The window.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    if(Cache != NULL && Cache->Count < SPACE_CACHED_WINDOWS) {
+        VirtualFree(Window, Program->Space->StackSize, MEM_DECOMMIT);
+        Cache->Windows[Cache->Count] = Window;
+        Cache->Count = Cache->Count + 1;
+        return;
+    }
+
+    SpaceWindowRelease(Program, Window);
+}
+
+VOID
+SpaceCacheFree (
+    PPROGRAM Program,
+    PSPACE_CACHE Cache
+    )
+
+/*
+
+ Routine description:
+
+    This routine frees the windows in a cache.
+
+ Arguments:
+
+    Program - The running program.
+
+    Cache - The cache.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    while(Cache->Count != 0) {
+        Cache->Count = Cache->Count - 1;
+        SpaceWindowRelease(Program, Cache->Windows[Cache->Count]);
+    }
+}
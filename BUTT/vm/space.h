@@ -0,0 +1,109 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    space.h
+
+ Abstract:
+
+    This module defines the VM address space. Every thread sees the program
+    through a window laid out the way the translator compiled it.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Guard page and per worker window cache
+    10/17/26        Commit only as much stack as the thread needs
+    10/17/26        Tear down the space of a program that fails to load
+
+**/
+
+#ifndef __SPACE_H__
+#define __SPACE_H__
+
+#include <windows.h>
+#include "program.h"
+
+//
+// A window holds the thread's own stack from VM address 0 up to StackTop
+// and a view of the global data, shared by every window, at DataStart. A VM
+// address is an offset into the window, so translating one to a host
+// pointer is a single add. Both parts are zero filled as they are touched.
+//
+
+typedef struct _SPACE {
+    HANDLE DataSection;
+    ULONG DataSize;
+    ULONG StackSize;
+    ULONG WindowSize;
+    ULONG GuardSize;
+    ULONG PageSize;
+} SPACE, *PSPACE;
+
+//
+// The windows of finished threads are kept for the next ones to start on the
+// same worker, up to this many. Their stacks are decommitted on the way in,
+// so a cached window holds on to no pages and the next thread still finds
+// its stack zero filled.
+//
+
+#define SPACE_CACHED_WINDOWS    32
+
+typedef struct _SPACE_CACHE {
+    ULONG Count;
+    PCHAR Windows[SPACE_CACHED_WINDOWS];
+} SPACE_CACHE, *PSPACE_CACHE;
+
+LONG
+SpaceCreate (
+    PPROGRAM Program
+    );
+
+VOID
+SpaceDestroy (
+    PPROGRAM Program
+    );
+
+PCHAR
+SpaceWindowCreate (
+    PPROGRAM Program,
+    PSPACE_CACHE Cache,
+    ULONG StackDepth,
+    PULONG StackLimit
+    );
+
+VOID
+SpaceWindowFree (
+    PPROGRAM Program,
+    PSPACE_CACHE Cache,
+    PCHAR Window
+    );
+
+VOID
+SpaceCacheFree (
+    PPROGRAM Program,
+    PSPACE_CACHE Cache
+    );
+
+#endif // __SPACE_H__
@@ -0,0 +1,210 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    trace.c
+
+ Abstract:
+
+    This module implements creation and flushing of the per thread trace
+    rings.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+
+**/
+
+#include "trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_FILE_NAME_FORMAT  "butvm.%lu.trace"
+
+extern
+inline
+VOID
+TraceWrite (
+    PTRACE_RING Ring,
+    ULONG Type,
+    ULONG Index,
+    ULONG Register,
+    LONG Value0,
+    LONG Value1,
+    LONG Value2,
+    LONG Value3
+    );
+
+PTRACE_RING
+TraceRingCreate (
+    ULONG ThreadId
+    )
+
+/*
+
+ Routine description:
+
+    This routine allocates an empty trace ring for a thread.
+
+ Arguments:
+
+    ThreadId - The id of the thread that will own the ring.
+
+ Return value:
+
+    The ring, NULL if out of memory.
+
+*/
+
+{
+    PTRACE_RING Ring;
+
+    Ring = malloc(sizeof(TRACE_RING));
+    if(Ring == NULL) {
+        return NULL;
+    }
+
+    atomic_init(&Ring->Head, 0);
+    Ring->ThreadId = ThreadId;
+    Ring->Reserved = 0;
+    return Ring;
+}
+
+LONG
+TraceRingFlush (
+    PTRACE_RING Ring
+    )
+
+/*
+
+ Routine description:
+
+    This routine writes the records currently in a ring to the thread's
+    trace file, oldest first. It takes no locks, so it may run while the
+    owning thread is still writing. Any record the writer may have lapped
+    during the copy is left out.
+
+ Arguments:
+
+    Ring - The ring to flush.
+
+ Return value:
+
+    0 on success, -1 otherwise.
+
+*/
+
+{
+    TRACE_FILE_HEADER Header;
+    PTRACE_RECORD Records;
+    FILE *TraceFile;
+    CHAR FileName[32];
+    ULONG64 First;
+    ULONG64 Head;
+    ULONG64 Lapped;
+    ULONG64 i;
+    ULONG Count;
+    LONG RetVal;
+
+    RetVal = -1;
+    TraceFile = NULL;
+    Records = malloc(sizeof(Ring->Records));
+    if(Records == NULL) {
+        goto TraceRingFlushEnd;
+    }
+
+    Head = atomic_load_explicit(&Ring->Head, memory_order_acquire);
+    First = 0;
+    if(Head > TRACE_RING_RECORDS) {
+        First = Head - TRACE_RING_RECORDS;
+    }
+
+    for(i=First; i<Head; ++i) {
+        Records[i - First] = Ring->Records[i & (TRACE_RING_RECORDS - 1)];
+    }
+
+    //
+    // Whatever the writer got to while we were copying is suspect.
+    //
+
+    atomic_thread_fence(memory_order_acquire);
+    Lapped = atomic_load_explicit(&Ring->Head, memory_order_relaxed);
+    if(Lapped > TRACE_RING_RECORDS &&
+       Lapped - TRACE_RING_RECORDS > First) {
+
+        Count = (ULONG)(Lapped - TRACE_RING_RECORDS - First);
+        if(Count > Head - First) {
+            Count = (ULONG)(Head - First);
+        }
+
+        memmove(Records,
+                Records + Count,
+                (size_t)(Head - First - Count) * sizeof(TRACE_RECORD));
+
+        First = First + Count;
+    }
+
+    Count = (ULONG)(Head - First);
+    snprintf(FileName,
+             sizeof(FileName),
+             TRACE_FILE_NAME_FORMAT,
+             (unsigned long)Ring->ThreadId);
+
+    TraceFile = fopen(FileName, "wb");
+    if(TraceFile == NULL) {
+        goto TraceRingFlushEnd;
+    }
+
+    memset(&Header, 0, sizeof(TRACE_FILE_HEADER));
+    Header.MagicNumber = TRACE_MAGIC_NUMBER;
+    Header.Version = TRACE_VERSION;
+    Header.Level = TRACE_LEVEL;
+    Header.ThreadId = Ring->ThreadId;
+    Header.RecordCount = Count;
+    Header.Written = Head;
+    if(fwrite(&Header, sizeof(TRACE_FILE_HEADER), 1, TraceFile) != 1 ||
+       fwrite(Records, sizeof(TRACE_RECORD), Count, TraceFile) != Count) {
+
+        goto TraceRingFlushEnd;
+    }
+
+    RetVal = 0;
+
+TraceRingFlushEnd:
+    if(TraceFile != NULL) {
+        fclose(TraceFile);
+    }
+
+    free(Records);
+    return RetVal;
+}
+
+VOID
+TraceRingFree (
+    PTRACE_RING Ring
+    )
+{
+    free(Ring);
+}
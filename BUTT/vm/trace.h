@@ -0,0 +1,180 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    trace.h
+
+ Abstract:
+
+    This module defines the VM tracing subsystem. Each execution thread
+    writes fixed size binary records into its own ring buffer, which is
+    flushed to a trace file when the thread exits and decoded offline.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+
+**/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <windows.h>
+#include <stdatomic.h>
+#include <x86intrin.h>
+#include "../Common/tracedef.h"
+
+//
+// TRACE_LEVEL picks which trace points get compiled in. Verbose builds get
+// all of them, everything else gets none unless the Makefile says so.
+//
+
+#ifndef TRACE_LEVEL
+#ifdef COMPILE_VERBOSE
+#define TRACE_LEVEL             TRACE_LEVEL_INSTRUCTION
+#else
+#define TRACE_LEVEL             TRACE_LEVEL_NONE
+#endif
+#endif
+
+//
+// Records per thread. Must be a power of 2.
+//
+
+#ifndef TRACE_RING_RECORDS
+#define TRACE_RING_RECORDS      0x10000
+#endif
+
+static_assert((TRACE_RING_RECORDS & (TRACE_RING_RECORDS - 1)) == 0,
+              "TRACE_RING_RECORDS isn't a power of 2.");
+
+//
+// The owning thread is the only writer, so the ring needs no locks. Head
+// counts every record ever written and is published with release semantics
+// after the record itself, so a reader that loads it with acquire semantics
+// sees complete records below it. Once the ring is full the oldest records
+// are overwritten.
+//
+
+typedef struct _TRACE_RING {
+    _Atomic ULONG64 Head;
+    ULONG ThreadId;
+    ULONG Reserved;
+    TRACE_RECORD Records[TRACE_RING_RECORDS];
+} TRACE_RING, *PTRACE_RING;
+
+inline
+VOID
+TraceWrite (
+    PTRACE_RING Ring,
+    ULONG Type,
+    ULONG Index,
+    ULONG Register,
+    LONG Value0,
+    LONG Value1,
+    LONG Value2,
+    LONG Value3
+    )
+
+/*
+
+ Routine description:
+
+    This inline routine appends a record to the calling thread's ring.
+
+ Arguments:
+
+    Ring - The calling thread's trace ring.
+
+    Type - The TRACE_TYPE of the record.
+
+    Index - The instruction index the record belongs to.
+
+    Register - The register the record refers to, if any.
+
+    Value0-3 - Record specific values, see TRACE_TYPE.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    ULONG64 Head;
+    PTRACE_RECORD Record;
+
+    Head = atomic_load_explicit(&Ring->Head, memory_order_relaxed);
+    Record = &Ring->Records[Head & (TRACE_RING_RECORDS - 1)];
+    Record->Timestamp = __rdtsc();
+    Record->Index = Index;
+    Record->Type = (USHORT)Type;
+    Record->Register = (UCHAR)Register;
+    Record->Reserved = 0;
+    Record->Value[0] = Value0;
+    Record->Value[1] = Value1;
+    Record->Value[2] = Value2;
+    Record->Value[3] = Value3;
+    atomic_store_explicit(&Ring->Head, Head + 1, memory_order_release);
+}
+
+//
+// The trace points. Arguments match TraceWrite. Below their level they are
+// discarded by the preprocessor, arguments and all.
+//
+
+#if TRACE_LEVEL >= TRACE_LEVEL_CONTROL
+#define TRACE_CONTROL(...)      TraceWrite(__VA_ARGS__)
+#else
+#define TRACE_CONTROL(...)      ((VOID)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_MEMORY
+#define TRACE_MEMORY(...)       TraceWrite(__VA_ARGS__)
+#else
+#define TRACE_MEMORY(...)       ((VOID)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INSTRUCTION
+#define TRACE_INSTRUCTION(...)  TraceWrite(__VA_ARGS__)
+#else
+#define TRACE_INSTRUCTION(...)  ((VOID)0)
+#endif
+
+PTRACE_RING
+TraceRingCreate (
+    ULONG ThreadId
+    );
+
+LONG
+TraceRingFlush (
+    PTRACE_RING Ring
+    );
+
+VOID
+TraceRingFree (
+    PTRACE_RING Ring
+    );
+
+#endif // __TRACE_H__
@@ -0,0 +1,2298 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    verify.c
+
+ Abstract:
+
+    This module implements the load time verifier.
+
+    Every function is walked over its control flow graph, with each register
+    and saved stack slot tracked as a range of constants, of offsets from
+    the stack pointer on entry, of offsets from the caller's RST, or as
+    unknown. Branches on a comparison narrow the range of what was compared,
+    so an index a loop keeps in bounds stays in bounds. An access through a
+    known offset from the entry stack pointer stays inside the function's
+    frame, so it only has to be checked against how deep the frame goes.
+    That is known once the walk is done, and the only check left for the
+    interpreter is at calls, against the depth of the callee.
+
+    Any access the verifier can't pin down, an array element indexed by a
+    variable nothing bounds for one, makes the whole program run in the
+    bounds checked interpreter instead.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+    10/17/26        Parallel calls
+    10/17/26        Note reads of fixed stack addresses
+    10/17/26        Atomic read-modify-write
+    10/17/26        Thread joins
+    10/17/26        Parallel loops
+    10/17/26        Reductions
+    10/17/26        Barrier waits
+    10/17/26        Channel sends and receives
+
+**/
+
+#include "verify.h"
+#include "memory_inl.h"
+#include "space.h"
+#include "error.h"
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define VERIFY_VALUE_IS_EXACT(V)    ((V).Low == (V).High)
+
+#define VERIFY_LONG_MIN             (-0x7FFFFFFFLL - 1)
+#define VERIFY_LONG_MAX             0x7FFFFFFFLL
+
+VOID
+DebugPrettyPrintVerifyReport (
+    PVERIFY_CONTEXT Vc
+    )
+{
+    printf("###################### VERIFY REPORT START ######################\n");
+    printf("Functions           : 0x%X\n", (unsigned int)Vc->FunctionCount);
+    printf("Verified            : 0x%X\n", (unsigned int)Vc->Program->Verified);
+    if(Vc->FailReason != NULL) {
+        printf("Failed at           : 0x%X: %s\n",
+               (unsigned int)Vc->FailIndex,
+               Vc->FailReason);
+    }
+
+    printf("####################### VERIFY REPORT END #######################\n");
+}
+
+BOOL
+VerifyFail (
+    PVERIFY_CONTEXT Vc,
+    PCHAR Reason
+    )
+
+/*
+
+ Routine description:
+
+    This routine records why the program can't be verified.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Reason - What couldn't be proven.
+
+ Return value:
+
+    FALSE, always.
+
+*/
+
+{
+    if(Vc->FailReason == NULL) {
+        Vc->FailReason = Reason;
+        Vc->FailIndex = Vc->Index;
+    }
+
+    return FALSE;
+}
+
+VERIFY_VALUE
+VerifyMakeRange (
+    ULONG Kind,
+    LONG64 Low,
+    LONG64 High
+    )
+
+/*
+
+ Routine description:
+
+    This routine builds a tracked value, giving up on it if either end
+    doesn't fit a VM word. The VM wraps around there.
+
+ Arguments:
+
+    Kind - The value kind.
+
+    Low - The lowest offset the value can have.
+
+    High - The highest offset the value can have.
+
+ Return value:
+
+    The value.
+
+*/
+
+{
+    VERIFY_VALUE Value;
+
+    if(Low < VERIFY_LONG_MIN || High > VERIFY_LONG_MAX || Low > High) {
+        Kind = VERIFY_VALUE_UNKNOWN;
+    }
+
+    Value.Kind = Kind;
+    Value.Low = (Kind == VERIFY_VALUE_UNKNOWN) ? 0 : (LONG)Low;
+    Value.High = (Kind == VERIFY_VALUE_UNKNOWN) ? 0 : (LONG)High;
+    return Value;
+}
+
+VERIFY_VALUE
+VerifyMakeValue (
+    ULONG Kind,
+    LONG64 Offset
+    )
+{
+    return VerifyMakeRange(Kind, Offset, Offset);
+}
+
+BOOL
+VerifyValueEqual (
+    VERIFY_VALUE Left,
+    VERIFY_VALUE Right
+    )
+{
+    return Left.Kind == Right.Kind &&
+           Left.Low == Right.Low &&
+           Left.High == Right.High;
+}
+
+VERIFY_VALUE
+VerifyArithmetic (
+    ULONG Opcode,
+    VERIFY_VALUE Left,
+    VERIFY_VALUE Right
+    )
+
+/*
+
+ Routine description:
+
+    This routine computes the tracked result of an arithmetic instruction.
+    Only what address computations need is followed: constants fold, adding
+    or subtracting a constant moves an offset, and a mask bounds whatever it
+    is applied to.
+
+ Arguments:
+
+    Opcode - The base opcode.
+
+    Left - The tracked left operand.
+
+    Right - The tracked right operand.
+
+ Return value:
+
+    The tracked result.
+
+*/
+
+{
+    BOOL LeftConstant;
+    BOOL RightConstant;
+    LONG64 Products[4];
+    LONG64 Low;
+    LONG64 High;
+    ULONG i;
+
+    LeftConstant = Left.Kind == VERIFY_VALUE_CONSTANT;
+    RightConstant = Right.Kind == VERIFY_VALUE_CONSTANT;
+    switch(Opcode) {
+        case OPC_ADDI:
+        case OPC_ADDF:
+        case OPC_RCOPYD:
+            if(LeftConstant != FALSE && Right.Kind != VERIFY_VALUE_UNKNOWN) {
+                return VerifyMakeRange(Right.Kind,
+                                       (LONG64)Left.Low + Right.Low,
+                                       (LONG64)Left.High + Right.High);
+            }
+
+            if(RightConstant != FALSE && Left.Kind != VERIFY_VALUE_UNKNOWN) {
+                return VerifyMakeRange(Left.Kind,
+                                       (LONG64)Left.Low + Right.Low,
+                                       (LONG64)Left.High + Right.High);
+            }
+
+            break;
+
+        case OPC_SUBI:
+        case OPC_SUBF:
+            if(RightConstant != FALSE && Left.Kind != VERIFY_VALUE_UNKNOWN) {
+                return VerifyMakeRange(Left.Kind,
+                                       (LONG64)Left.Low - Right.High,
+                                       (LONG64)Left.High - Right.Low);
+            }
+
+            break;
+
+        case OPC_MULI:
+        case OPC_MULF:
+            if(LeftConstant != FALSE && RightConstant != FALSE) {
+                Products[0] = (LONG64)Left.Low * Right.Low;
+                Products[1] = (LONG64)Left.Low * Right.High;
+                Products[2] = (LONG64)Left.High * Right.Low;
+                Products[3] = (LONG64)Left.High * Right.High;
+                Low = Products[0];
+                High = Products[0];
+                for(i=1; i<4; ++i) {
+                    Low = (Products[i] < Low) ? Products[i] : Low;
+                    High = (Products[i] > High) ? Products[i] : High;
+                }
+
+                return VerifyMakeRange(VERIFY_VALUE_CONSTANT, Low, High);
+            }
+
+            break;
+
+        case OPC_AND:
+            High = VERIFY_LONG_MAX + 1;
+            if(LeftConstant != FALSE && Left.Low >= 0) {
+                High = Left.High;
+            }
+
+            if(RightConstant != FALSE && Right.Low >= 0 && Right.High < High) {
+                High = Right.High;
+            }
+
+            if(High <= VERIFY_LONG_MAX) {
+                return VerifyMakeRange(VERIFY_VALUE_CONSTANT, 0, High);
+            }
+
+            break;
+
+        case OPC_EQ:
+        case OPC_NEQ:
+        case OPC_LT:
+        case OPC_GT:
+        case OPC_LTE:
+        case OPC_GTE:
+            return VerifyMakeRange(VERIFY_VALUE_CONSTANT, 0, 1);
+    }
+
+    return VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0);
+}
+
+VOID
+VerifyInvalidateSlots (
+    PVERIFY_STATE State,
+    LONG64 Offset,
+    LONG64 Size,
+    ULONG Alignment
+    )
+
+/*
+
+ Routine description:
+
+    This routine forgets the saved slots overlapping a range of the frame.
+
+ Arguments:
+
+    State - The state to update.
+
+    Offset - Start of the range, relative to the stack pointer on entry.
+
+    Size - Size of the range in bytes.
+
+    Alignment - The stack alignment of the program, the size of a slot.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    ULONG i;
+
+    i = 0;
+    while(i < State->SlotCount) {
+        if(State->Slot[i].Offset < Offset + Size &&
+           State->Slot[i].Offset + (LONG64)Alignment > Offset) {
+
+            State->SlotCount -= 1;
+            State->Slot[i] = State->Slot[State->SlotCount];
+        } else {
+            i += 1;
+        }
+    }
+}
+
+VERIFY_VALUE
+VerifyLoadSlot (
+    PVERIFY_STATE State,
+    VERIFY_VALUE Address
+    )
+{
+    ULONG i;
+
+    if(Address.Kind == VERIFY_VALUE_FRAME && VERIFY_VALUE_IS_EXACT(Address)) {
+        for(i=0; i<State->SlotCount; ++i) {
+            if(State->Slot[i].Offset == Address.Low) {
+                return State->Slot[i].Value;
+            }
+        }
+    }
+
+    return VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0);
+}
+
+VOID
+VerifySetSlot (
+    PVERIFY_STATE State,
+    LONG Offset,
+    VERIFY_VALUE Value
+    )
+
+/*
+
+ Routine description:
+
+    This routine records the value of a saved slot, replacing what was known
+    about it. Slots past VERIFY_MAX_SLOTS aren't tracked.
+
+ Arguments:
+
+    State - The state to update.
+
+    Offset - The slot, relative to the stack pointer on entry.
+
+    Value - The value of the slot.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    ULONG i;
+
+    for(i=0; i<State->SlotCount; ++i) {
+        if(State->Slot[i].Offset == Offset) {
+            break;
+        }
+    }
+
+    if(Value.Kind == VERIFY_VALUE_UNKNOWN) {
+        if(i < State->SlotCount) {
+            State->SlotCount -= 1;
+            State->Slot[i] = State->Slot[State->SlotCount];
+        }
+
+        return;
+    }
+
+    if(i == State->SlotCount) {
+        if(State->SlotCount == VERIFY_MAX_SLOTS) {
+            return;
+        }
+
+        State->SlotCount += 1;
+    }
+
+    State->Slot[i].Offset = Offset;
+    State->Slot[i].Value = Value;
+}
+
+BOOL
+VerifyAccess (
+    PVERIFY_CONTEXT Vc,
+    PVERIFY_FUNCTION Function,
+    PVERIFY_STATE State,
+    VERIFY_VALUE Base,
+    LONG64 Offset,
+    ULONG Width,
+    BOOL Write
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks an access to VM memory through the window, at any
+    of the addresses Base can hold.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Function - The function being verified.
+
+    State - The state before the access. Writes forget the slots they hit.
+
+    Base - The tracked address the access is relative to.
+
+    Offset - Offset from Base.
+
+    Width - Bytes accessed.
+
+    Write - TRUE for a write.
+
+ Return value:
+
+    TRUE if the access is safe, FALSE otherwise.
+
+*/
+
+{
+    LONG64 Low;
+    LONG64 High;
+
+    Low = Base.Low + Offset;
+    High = Base.High + Offset;
+    switch(Base.Kind) {
+        case VERIFY_VALUE_FRAME:
+            if(Low < -(LONG64)Vc->StackSize || High > (LONG64)Vc->StackSize) {
+                return VerifyFail(Vc, "Frame access out of the stack.");
+            }
+
+            //
+            // The return address belongs to the call. Returns jump to it
+            // without looking.
+            //
+
+            if(Write != FALSE &&
+               Low < (LONG64)Vc->Alignment &&
+               High + Width > 0) {
+
+                return VerifyFail(Vc, "Write to the return address.");
+            }
+
+            if(Low < Function->MinOffset) {
+                Function->MinOffset = (LONG)Low;
+            }
+
+            if(High + Width > Function->MaxOffset) {
+                Function->MaxOffset = (LONG)(High + Width);
+            }
+
+            if(Write != FALSE) {
+                VerifyInvalidateSlots(State, Low, High - Low + Width, Vc->Alignment);
+            }
+
+            return TRUE;
+
+        case VERIFY_VALUE_CONSTANT:
+
+            //
+            // Both ends have to be on the same side of the gap between the
+            // stack and the data.
+            //
+
+            if(Low < 0 ||
+               High > 0xFFFFFFFFLL ||
+               MemAddressValid(Vc->Program, (ULONG)Low, Width) == FALSE ||
+               MemAddressValid(Vc->Program, (ULONG)High, Width) == FALSE ||
+               (Low < Vc->StackSize) != (High < Vc->StackSize)) {
+
+                return VerifyFail(Vc, "Access out of the address space.");
+            }
+
+            //
+            // Below a fixed stack address there could be anybody's frame.
+            // Only the start block, which runs before any, may write there.
+            //
+
+            if(Write != FALSE && Low < Vc->StackSize) {
+                if(Function->Root == FALSE) {
+                    return VerifyFail(Vc, "Write to a fixed stack address.");
+                }
+
+                State->SlotCount = 0;
+            }
+
+            if(Low < Vc->StackSize && Function->Root == FALSE) {
+                Vc->Program->FixedStackReads = TRUE;
+            }
+
+            return TRUE;
+
+        default:
+            return VerifyFail(Vc, "Unprovable memory access.");
+    }
+}
+
+BOOL
+VerifyLoadOperand (
+    PVERIFY_CONTEXT Vc,
+    PVERIFY_FUNCTION Function,
+    PVERIFY_STATE State,
+    PDECODED_OPERAND Operand,
+    PVERIFY_VALUE Value
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks reading a decoded operand and tracks its value.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Function - The function being verified.
+
+    State - The current state.
+
+    Operand - The operand.
+
+    Value - Receives the tracked value of the operand.
+
+ Return value:
+
+    TRUE if the read is safe, FALSE otherwise.
+
+*/
+
+{
+    VERIFY_VALUE Address;
+
+    *Value = VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0);
+    switch(Operand->Kind) {
+        case OPERAND_KIND_CONSTANT:
+            *Value = VerifyMakeValue(VERIFY_VALUE_CONSTANT, Operand->Offset);
+            return TRUE;
+
+        case OPERAND_KIND_GLOBAL:
+            if(MemGlobalValid(Vc->Program, Operand->Offset, Vc->Alignment) == FALSE) {
+                return VerifyFail(Vc, "Global access out of the data.");
+            }
+
+            return TRUE;
+
+        case OPERAND_KIND_STACK:
+            Address = State->Register[Operand->Register];
+            if(VerifyAccess(Vc,
+                            Function,
+                            State,
+                            Address,
+                            Operand->Offset,
+                            Vc->Alignment,
+                            FALSE) == FALSE) {
+
+                return FALSE;
+            }
+
+            *Value = VerifyLoadSlot(State,
+                                   VerifyArithmetic(OPC_ADDI,
+                                                    Address,
+                                                    VerifyMakeValue(VERIFY_VALUE_CONSTANT,
+                                                                    Operand->Offset)));
+
+            return TRUE;
+
+        default:
+            *Value = State->Register[Operand->Register];
+            return TRUE;
+    }
+}
+
+BOOL
+VerifyStoreOperand (
+    PVERIFY_CONTEXT Vc,
+    PVERIFY_FUNCTION Function,
+    PVERIFY_STATE State,
+    PDECODED_OPERAND Operand,
+    VERIFY_VALUE Value
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks writing a decoded operand and tracks the value
+    written.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Function - The function being verified.
+
+    State - The current state.
+
+    Operand - The destination operand.
+
+    Value - The tracked value written.
+
+ Return value:
+
+    TRUE if the write is safe, FALSE otherwise.
+
+*/
+
+{
+    VERIFY_VALUE Address;
+
+    switch(Operand->Kind) {
+        case OPERAND_KIND_GLOBAL:
+            if(MemGlobalValid(Vc->Program, Operand->Offset, Vc->Alignment) == FALSE) {
+                return VerifyFail(Vc, "Global access out of the data.");
+            }
+
+            return TRUE;
+
+        case OPERAND_KIND_STACK:
+            Address = State->Register[Operand->Register];
+            if(VerifyAccess(Vc,
+                            Function,
+                            State,
+                            Address,
+                            Operand->Offset,
+                            Vc->Alignment,
+                            TRUE) == FALSE) {
+
+                return FALSE;
+            }
+
+            if(Address.Kind == VERIFY_VALUE_FRAME && VERIFY_VALUE_IS_EXACT(Address)) {
+                VerifySetSlot(State, Address.Low + Operand->Offset, Value);
+            }
+
+            return TRUE;
+
+        case OPERAND_KIND_REGISTER:
+            if(Operand->Register == REG_RIP) {
+                return VerifyFail(Vc, "Write to RIP.");
+            }
+
+            State->Register[Operand->Register] = Value;
+            return TRUE;
+
+        default:
+            return VerifyFail(Vc, "Write to a constant.");
+    }
+}
+
+BOOL
+VerifyRefine (
+    PVERIFY_STATE State,
+    PVERIFY_CONDITION Condition,
+    ULONG Register,
+    BOOL Outcome
+    )
+
+/*
+
+ Routine description:
+
+    This routine narrows the range of a compared value along one side of a
+    branch on the comparison.
+
+ Arguments:
+
+    State - The state along the branch, updated.
+
+    Condition - The comparison the state carries, if any.
+
+    Register - The register the branch tests.
+
+    Outcome - TRUE along the side where the comparison held.
+
+ Return value:
+
+    FALSE if the comparison can't come out that way, TRUE otherwise.
+
+*/
+
+{
+    VERIFY_VALUE Value;
+    VERIFY_VALUE Bound;
+    LONG64 Low;
+    LONG64 High;
+    ULONG Operator;
+
+    if(Condition->Register != Register) {
+        return TRUE;
+    }
+
+    Operator = Condition->Operator;
+    if(Outcome == FALSE) {
+        switch(Operator) {
+            case OPC_LT:    Operator = OPC_GTE; break;
+            case OPC_GTE:   Operator = OPC_LT;  break;
+            case OPC_GT:    Operator = OPC_LTE; break;
+            case OPC_LTE:   Operator = OPC_GT;  break;
+            case OPC_EQ:    Operator = OPC_NEQ; break;
+            case OPC_NEQ:   Operator = OPC_EQ;  break;
+        }
+    }
+
+    if(Condition->Slot != FALSE) {
+        Value = VerifyLoadSlot(State,
+                               VerifyMakeValue(VERIFY_VALUE_FRAME,
+                                               Condition->Location));
+    } else {
+        Value = State->Register[Condition->Location];
+    }
+
+    //
+    // Only plain numbers are narrowed. Where a frame address is relative to
+    // has no particular value.
+    //
+
+    if(Value.Kind == VERIFY_VALUE_UNKNOWN) {
+        Value = VerifyMakeRange(VERIFY_VALUE_CONSTANT,
+                                VERIFY_LONG_MIN,
+                                VERIFY_LONG_MAX);
+    }
+
+    if(Value.Kind != VERIFY_VALUE_CONSTANT) {
+        return TRUE;
+    }
+
+    Bound = Condition->Bound;
+    Low = Value.Low;
+    High = Value.High;
+    switch(Operator) {
+        case OPC_LT:
+            High = (High < (LONG64)Bound.High - 1) ? High : (LONG64)Bound.High - 1;
+            break;
+
+        case OPC_LTE:
+            High = (High < Bound.High) ? High : Bound.High;
+            break;
+
+        case OPC_GT:
+            Low = (Low > (LONG64)Bound.Low + 1) ? Low : (LONG64)Bound.Low + 1;
+            break;
+
+        case OPC_GTE:
+            Low = (Low > Bound.Low) ? Low : Bound.Low;
+            break;
+
+        case OPC_EQ:
+            Low = (Low > Bound.Low) ? Low : Bound.Low;
+            High = (High < Bound.High) ? High : Bound.High;
+            break;
+    }
+
+    if(Low > High) {
+        return FALSE;
+    }
+
+    Value = VerifyMakeRange(VERIFY_VALUE_CONSTANT, Low, High);
+    if(Condition->Slot != FALSE) {
+        VerifySetSlot(State, Condition->Location, Value);
+    } else {
+        State->Register[Condition->Location] = Value;
+    }
+
+    return TRUE;
+}
+
+VOID
+VerifyCompare (
+    PVERIFY_STATE State,
+    PDECODED_INSTRUCTION Instruction,
+    VERIFY_VALUE Left,
+    VERIFY_VALUE Right
+    )
+
+/*
+
+ Routine description:
+
+    This routine records a comparison of a slot or register against a
+    constant range, for the branch on it that follows.
+
+ Arguments:
+
+    State - The state after the comparison.
+
+    Instruction - The comparison.
+
+    Left - The tracked left operand.
+
+    Right - The tracked right operand.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PVERIFY_CONDITION Condition;
+    PDECODED_OPERAND Compared;
+    VERIFY_VALUE Address;
+    ULONG Operator;
+
+    Condition = &State->Condition;
+    Condition->Register = REG_MAX;
+    if(Instruction->Destination.Kind != OPERAND_KIND_REGISTER) {
+        return;
+    }
+
+    Operator = Instruction->BaseOpcode;
+    if(Right.Kind == VERIFY_VALUE_CONSTANT) {
+        Compared = &Instruction->Left;
+        Condition->Bound = Right;
+    } else if(Left.Kind == VERIFY_VALUE_CONSTANT) {
+        Compared = &Instruction->Right;
+        Condition->Bound = Left;
+        switch(Operator) {
+            case OPC_LT:    Operator = OPC_GT;  break;
+            case OPC_GT:    Operator = OPC_LT;  break;
+            case OPC_LTE:   Operator = OPC_GTE; break;
+            case OPC_GTE:   Operator = OPC_LTE; break;
+        }
+    } else {
+        return;
+    }
+
+    switch(Compared->Kind) {
+        case OPERAND_KIND_STACK:
+            Address = State->Register[Compared->Register];
+            if(Address.Kind != VERIFY_VALUE_FRAME ||
+               VERIFY_VALUE_IS_EXACT(Address) == FALSE) {
+
+                return;
+            }
+
+            Condition->Slot = TRUE;
+            Condition->Location = Address.Low + Compared->Offset;
+            break;
+
+        case OPERAND_KIND_REGISTER:
+            if(Compared->Register == Instruction->Destination.Register) {
+                return;
+            }
+
+            Condition->Slot = FALSE;
+            Condition->Location = Compared->Register;
+            break;
+
+        default:
+            return;
+    }
+
+    Condition->Register = Instruction->Destination.Register;
+    Condition->Operator = Operator;
+}
+
+VOID
+VerifyJoinValue (
+    PVERIFY_VALUE Into,
+    VERIFY_VALUE From,
+    BOOL Widen,
+    PBOOL Changed
+    )
+
+/*
+
+ Routine description:
+
+    This routine merges a tracked value into another. The range grows to
+    cover both.
+
+ Arguments:
+
+    Into - The value merged into.
+
+    From - The value merged in.
+
+    Widen - TRUE to give up on any bound that still moves instead.
+
+    Changed - Set to TRUE if Into changed.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    VERIFY_VALUE Joined;
+
+    if(Into->Kind == VERIFY_VALUE_UNKNOWN) {
+        return;
+    }
+
+    if(From.Kind != Into->Kind) {
+        Joined = VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0);
+    } else {
+        Joined.Kind = Into->Kind;
+        Joined.Low = (From.Low < Into->Low) ? From.Low : Into->Low;
+        Joined.High = (From.High > Into->High) ? From.High : Into->High;
+        if(Widen != FALSE && Joined.Low != Into->Low) {
+            Joined.Low = (LONG)VERIFY_LONG_MIN;
+        }
+
+        if(Widen != FALSE && Joined.High != Into->High) {
+            Joined.High = (LONG)VERIFY_LONG_MAX;
+        }
+    }
+
+    if(VerifyValueEqual(Joined, *Into) == FALSE) {
+        *Into = Joined;
+        *Changed = TRUE;
+    }
+}
+
+VOID
+VerifyJoin (
+    PVERIFY_STATE Target,
+    PVERIFY_STATE State,
+    BOOL Widen,
+    PBOOL Changed
+    )
+
+/*
+
+ Routine description:
+
+    This routine merges a state into another, keeping what holds in both.
+
+ Arguments:
+
+    Target - The state merged into.
+
+    State - The state merged in.
+
+    Widen - TRUE to give up on any bound that still moves.
+
+    Changed - Set to TRUE if Target changed.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PVERIFY_CONDITION Into;
+    PVERIFY_CONDITION From;
+    VERIFY_VALUE Value;
+    ULONG i;
+    ULONG j;
+
+    for(i=0; i<REG_MAX; ++i) {
+        VerifyJoinValue(&Target->Register[i], State->Register[i], Widen, Changed);
+    }
+
+    //
+    // Slots nothing is known about anymore go.
+    //
+
+    i = 0;
+    while(i < Target->SlotCount) {
+        Value = VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0);
+        for(j=0; j<State->SlotCount; ++j) {
+            if(State->Slot[j].Offset == Target->Slot[i].Offset) {
+                Value = State->Slot[j].Value;
+                break;
+            }
+        }
+
+        VerifyJoinValue(&Target->Slot[i].Value, Value, Widen, Changed);
+        if(Target->Slot[i].Value.Kind == VERIFY_VALUE_UNKNOWN) {
+            Target->SlotCount -= 1;
+            Target->Slot[i] = Target->Slot[Target->SlotCount];
+        } else {
+            i += 1;
+        }
+    }
+
+    //
+    // A comparison of the same thing against either bound holds against
+    // the range covering both.
+    //
+
+    Into = &Target->Condition;
+    From = &State->Condition;
+    if(Into->Register == REG_MAX) {
+        return;
+    }
+
+    if(Into->Register != From->Register ||
+       Into->Operator != From->Operator ||
+       Into->Slot != From->Slot ||
+       Into->Location != From->Location) {
+
+        Into->Register = REG_MAX;
+        *Changed = TRUE;
+        return;
+    }
+
+    VerifyJoinValue(&Into->Bound, From->Bound, Widen, Changed);
+    if(Into->Bound.Kind == VERIFY_VALUE_UNKNOWN) {
+        Into->Register = REG_MAX;
+    }
+}
+
+VOID
+VerifyEntryState (
+    PVERIFY_STATE State,
+    PVERIFY_STATE Entry
+    )
+
+/*
+
+ Routine description:
+
+    This routine builds the state a function starts in. A call hands the
+    callee a zeroed register set. A jump, from State, leaves the registers
+    as they are, but only constants mean the same thing in the new frame.
+
+ Arguments:
+
+    State - The state at the jump, NULL for a call.
+
+    Entry - Receives the entry state.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    ULONG i;
+
+    memset(Entry, 0, sizeof(VERIFY_STATE));
+    Entry->Reached = TRUE;
+    Entry->Condition.Register = REG_MAX;
+    for(i=0; i<REG_MAX; ++i) {
+        if(State == NULL) {
+            Entry->Register[i] = VerifyMakeValue(VERIFY_VALUE_CONSTANT, 0);
+        } else if(State->Register[i].Kind == VERIFY_VALUE_CONSTANT) {
+            Entry->Register[i] = State->Register[i];
+        }
+    }
+
+    Entry->Register[REG_RIP] = VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0);
+    Entry->Register[REG_RST] = VerifyMakeValue(VERIFY_VALUE_CALLER, 0);
+    Entry->Register[REG_RSB] = VerifyMakeValue(VERIFY_VALUE_FRAME, 0);
+}
+
+BOOL
+VerifyTransfer (
+    PVERIFY_CONTEXT Vc,
+    PVERIFY_STATE State,
+    ULONG Target,
+    BOOL Call
+    )
+
+/*
+
+ Routine description:
+
+    This routine records a call, or a jump into another function, for the
+    checks that need the callee verified, and merges what the registers
+    hold into the state the callee starts in.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    State - The state at the transfer.
+
+    Target - Index of the instruction transferred to.
+
+    Call - TRUE for a call, FALSE for a jump.
+
+ Return value:
+
+    TRUE if the transfer is well formed, FALSE otherwise.
+
+*/
+
+{
+    PVERIFY_TRANSFER Transfer;
+    PVERIFY_FUNCTION Callee;
+    VERIFY_STATE Entry;
+    VERIFY_VALUE Rsb;
+    BOOL Changed;
+
+    if(Vc->EntryFunction[Target] == VERIFY_NO_FUNCTION) {
+        return VerifyFail(Vc, "Transfer into the middle of a function.");
+    }
+
+    //
+    // A jump leaves the stack pointer as is for the function it enters, so
+    // that has to be a fixed address. It only ever happens from the start
+    // block into main.
+    //
+
+    Rsb = State->Register[REG_RSB];
+    if(VERIFY_VALUE_IS_EXACT(Rsb) == FALSE ||
+       (Call != FALSE && Rsb.Kind != VERIFY_VALUE_CONSTANT && Rsb.Kind != VERIFY_VALUE_FRAME) ||
+       (Call == FALSE && Rsb.Kind != VERIFY_VALUE_CONSTANT)) {
+
+        return VerifyFail(Vc, "Unprovable stack pointer at transfer.");
+    }
+
+    Callee = &Vc->Functions[Vc->EntryFunction[Target]];
+    VerifyEntryState((Call != FALSE) ? NULL : State, &Entry);
+    if(Callee->Entered == FALSE) {
+        memcpy(&Callee->EntryState, &Entry, sizeof(VERIFY_STATE));
+        Callee->Entered = TRUE;
+        Changed = TRUE;
+    } else {
+        Changed = FALSE;
+        VerifyJoin(&Callee->EntryState, &Entry, FALSE, &Changed);
+    }
+
+    if(Changed != FALSE && Callee->Walked != FALSE) {
+        return VerifyFail(Vc, "Function entered differently after it was verified.");
+    }
+
+    //
+    // An instruction is walked again whenever its state changes, the last
+    // walk has the state that holds.
+    //
+
+    Transfer = &Vc->Transfers[Vc->Index];
+    Transfer->Valid = TRUE;
+    Transfer->Function = Vc->EntryFunction[Target];
+    Transfer->Call = Call;
+    Transfer->Rsb = Rsb;
+    return TRUE;
+}
+
+BOOL
+VerifyParallelCall (
+    PVERIFY_CONTEXT Vc,
+    PVERIFY_FUNCTION Function,
+    PVERIFY_STATE State,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks a parallel call. The caller's parameters are read
+    and popped, and the callee starts a thread of its own, called with them
+    at the top of a fresh stack. A sync call comes back with whatever the
+    thread returned in RRV, an async one with 0. A parallel loop pops the 
+    loop parameters instead, calls the body with an index and a bound, and
+    leaves RRV alone.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Function - The calling function.
+
+    State - The state at the call, updated to the state after it.
+
+    Instruction - The call instruction.
+
+ Return value:
+
+    TRUE if the call is safe as far as the caller goes, FALSE otherwise.
+
+*/
+
+{
+    PVERIFY_FUNCTION Callee;
+    VERIFY_STATE Thread;
+    VERIFY_VALUE Rsb;
+    LONG64 Parameters;
+    ULONG Popped;
+    ULONG i;
+
+    if(Vc->EntryFunction[Instruction->Target] == VERIFY_NO_FUNCTION) {
+        return VerifyFail(Vc, "Transfer into the middle of a function.");
+    }
+
+    Callee = &Vc->Functions[Vc->EntryFunction[Instruction->Target]];
+    Popped = Callee->ParameterCount;
+    if(Instruction->BaseOpcode == OPC_PFOR) {
+        if(Callee->ParameterCount < LOOP_BODY_PARAMETER_COUNT) {
+            return VerifyFail(Vc, "Parallel loop body takes the wrong parameters.");
+        }
+
+        Popped = LOOP_PARAMETER_COUNT - LOOP_BODY_PARAMETER_COUNT + 
+                 Callee->ParameterCount;
+    }
+
+    Rsb = State->Register[REG_RSB];
+    Parameters = (LONG64)Vc->Alignment * Callee->ParameterCount;
+    if(Rsb.Kind == VERIFY_VALUE_FRAME && Rsb.Low + (LONG64)Vc->Alignment * Popped > 0) {
+        return VerifyFail(Vc, "Call parameters above the frame.");
+    }
+
+    for(i=0; i<Popped; ++i) {
+        if(VerifyAccess(Vc,
+                        Function,
+                        State,
+                        Rsb,
+                        (LONG64)i * Vc->Alignment,
+                        Vc->Alignment,
+                        FALSE) == FALSE) {
+
+            return FALSE;
+        }
+    }
+
+    memcpy(&Thread, State, sizeof(VERIFY_STATE));
+    Thread.Register[REG_RSB] = 
+        VerifyMakeValue(VERIFY_VALUE_CONSTANT, 
+                        (LONG64)Vc->Program->Header.StackTop - Parameters);
+
+    if(VerifyTransfer(Vc, &Thread, Instruction->Target, TRUE) == FALSE) {
+        return FALSE;
+    }
+
+    State->Register[REG_RSB] = VerifyMakeValue(Rsb.Kind, 
+                                               (LONG64)Rsb.Low + 
+                                               (LONG64)Vc->Alignment * Popped);
+
+    if(Instruction->BaseOpcode == OPC_PFOR) {
+        return TRUE;
+    }
+
+    if(Instruction->BaseOpcode == OPC_CALLPLLA &&
+       (Instruction->Flags & DECODED_FLAG_FUTURE) == 0) {
+        State->Register[REG_RRV] = VerifyMakeValue(VERIFY_VALUE_CONSTANT, 0);
+    } else {
+        State->Register[REG_RRV] = VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0);
+    }
+
+    return TRUE;
+}
+
+BOOL
+VerifyCall (
+    PVERIFY_CONTEXT Vc,
+    PVERIFY_FUNCTION Function,
+    PVERIFY_STATE State,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks a call and applies its effect on the caller: the
+    return address is pushed, the callee cleans it and its parameters up
+    and may write to both, and RRV comes back changed. The callee restoring
+    RST is proven when the callee is verified.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Function - The calling function.
+
+    State - The state at the call, updated to the state after it.
+
+    Instruction - The call instruction.
+
+ Return value:
+
+    TRUE if the call is safe as far as the caller goes, FALSE otherwise.
+
+*/
+
+{
+    PVERIFY_FUNCTION Callee;
+    VERIFY_VALUE Rsb;
+    LONG64 Parameters;
+
+    if(Instruction->BaseOpcode != OPC_CALLNORM) {
+        return VerifyParallelCall(Vc, Function, State, Instruction);
+    }
+
+    if(VerifyTransfer(Vc, State, Instruction->Target, TRUE) == FALSE) {
+        return FALSE;
+    }
+
+    Callee = &Vc->Functions[Vc->EntryFunction[Instruction->Target]];
+    if(Callee->Cleanup == 0) {
+        return VerifyFail(Vc, "Callee doesn't return consistently.");
+    }
+
+    Rsb = State->Register[REG_RSB];
+    Parameters = (LONG64)Vc->Alignment * Callee->ParameterCount;
+    if(VerifyAccess(Vc,
+                    Function,
+                    State,
+                    Rsb,
+                    -(LONG64)Vc->Alignment,
+                    Vc->Alignment,
+                    TRUE) == FALSE) {
+
+        return FALSE;
+    }
+
+    //
+    // The parameters have to be inside the caller's frame, below its own
+    // return address.
+    //
+
+    if(Rsb.Kind == VERIFY_VALUE_FRAME && Rsb.Low + Parameters > 0) {
+        return VerifyFail(Vc, "Call parameters above the frame.");
+    }
+
+    if(Rsb.Kind == VERIFY_VALUE_FRAME) {
+        VerifyInvalidateSlots(State,
+                              (LONG64)Rsb.Low - Vc->Alignment,
+                              Parameters + Vc->Alignment,
+                              Vc->Alignment);
+    }
+
+    State->Register[REG_RSB] = VerifyMakeValue(Rsb.Kind,
+                                               (LONG64)Rsb.Low -
+                                               Vc->Alignment +
+                                               Callee->Cleanup);
+
+    State->Register[REG_RRV] = VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0);
+    return TRUE;
+}
+
+BOOL
+VerifyIo (
+    PVERIFY_CONTEXT Vc,
+    PVERIFY_FUNCTION Function,
+    PVERIFY_STATE State,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks a print or read, which pop their operands off the
+    stack. A read writes to the address each operand holds.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Function - The function being verified.
+
+    State - The current state.
+
+    Instruction - The I/O instruction.
+
+ Return value:
+
+    TRUE if the instruction is safe, FALSE otherwise.
+
+*/
+
+{
+    VERIFY_VALUE Rsb;
+    VERIFY_VALUE Address;
+    ULONG i;
+
+    Rsb = State->Register[REG_RSB];
+    for(i=0; i<Instruction->PopCount; ++i) {
+        if(VerifyAccess(Vc,
+                        Function,
+                        State,
+                        Rsb,
+                        (LONG64)i * Vc->Alignment,
+                        Vc->Alignment,
+                        FALSE) == FALSE) {
+
+            return FALSE;
+        }
+
+        if(Instruction->BaseOpcode == OPC_READ) {
+            Address = VerifyLoadSlot(State,
+                                     VerifyMakeRange(Rsb.Kind,
+                                                     (LONG64)Rsb.Low + i * Vc->Alignment,
+                                                     (LONG64)Rsb.High + i * Vc->Alignment));
+
+            if(VerifyAccess(Vc,
+                            Function,
+                            State,
+                            Address,
+                            0,
+                            sizeof(LONG),
+                            TRUE) == FALSE) {
+
+                return FALSE;
+            }
+        }
+    }
+
+    State->Register[REG_RSB] =
+        VerifyMakeRange(Rsb.Kind,
+                        (LONG64)Rsb.Low + (LONG64)Instruction->PopCount * Vc->Alignment,
+                        (LONG64)Rsb.High + (LONG64)Instruction->PopCount * Vc->Alignment);
+
+    return TRUE;
+}
+
+BOOL
+VerifyInstruction (
+    PVERIFY_CONTEXT Vc,
+    PVERIFY_FUNCTION Function,
+    PVERIFY_STATE State,
+    PDECODED_INSTRUCTION Instruction
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks a single instruction and applies it to the state.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Function - The function being verified.
+
+    State - The state before the instruction, updated to the state after.
+
+    Instruction - The instruction.
+
+ Return value:
+
+    TRUE if the instruction is safe, FALSE otherwise.
+
+*/
+
+{
+    VERIFY_VALUE Left;
+    VERIFY_VALUE Right;
+    VERIFY_VALUE Rsb;
+    DECODED_OPERAND StackTop;
+    LONG64 Limit;
+
+    //
+    // Pushes and pops access the stack through RSB.
+    //
+
+    memset(&StackTop, 0, sizeof(DECODED_OPERAND));
+    StackTop.Kind = OPERAND_KIND_STACK;
+    StackTop.Register = REG_RSB;
+    switch(Instruction->BaseOpcode) {
+        case OPC_ADDI:
+        case OPC_ADDF:
+        case OPC_SUBI:
+        case OPC_SUBF:
+        case OPC_MULI:
+        case OPC_MULF:
+        case OPC_DIVI:
+        case OPC_DIVF:
+        case OPC_XOR:
+        case OPC_OR:
+        case OPC_AND:
+        case OPC_NOT:
+        case OPC_LOR:
+        case OPC_LAND:
+        case OPC_EQ:
+        case OPC_NEQ:
+        case OPC_LT:
+        case OPC_GT:
+        case OPC_LTE:
+        case OPC_GTE:
+        case OPC_RCOPYD:
+            if(VerifyLoadOperand(Vc, Function, State, &Instruction->Left, &Left) == FALSE ||
+               VerifyLoadOperand(Vc, Function, State, &Instruction->Right, &Right) == FALSE) {
+
+                return FALSE;
+            }
+
+            if(VerifyStoreOperand(Vc,
+                                  Function,
+                                  State,
+                                  &Instruction->Destination,
+                                  VerifyArithmetic(Instruction->BaseOpcode,
+                                                   Left,
+                                                   Right)) == FALSE) {
+
+                return FALSE;
+            }
+
+            switch(Instruction->BaseOpcode) {
+                case OPC_EQ:
+                case OPC_NEQ:
+                case OPC_LT:
+                case OPC_GT:
+                case OPC_LTE:
+                case OPC_GTE:
+                    VerifyCompare(State, Instruction, Left, Right);
+                    break;
+            }
+
+            return TRUE;
+
+        case OPC_STRI8:
+        case OPC_STRU8:
+        case OPC_STRI16:
+        case OPC_STRU16:
+        case OPC_STRI32:
+        case OPC_STRU32:
+        case OPC_STRF:
+        case OPC_STRTH:
+            if(VerifyLoadOperand(Vc, Function, State, &Instruction->Right, &Right) == FALSE) {
+                return FALSE;
+            }
+
+            //
+            // Narrow stores sign extend what they store. A number that fits
+            // comes through as is, anything else ends up somewhere in the
+            // range of the width.
+            //
+
+            if(Instruction->StoreShift != 0) {
+                Limit = 1LL << (31 - Instruction->StoreShift);
+                if(Right.Kind != VERIFY_VALUE_CONSTANT ||
+                   Right.Low < -Limit ||
+                   Right.High >= Limit) {
+
+                    Right = VerifyMakeRange(VERIFY_VALUE_CONSTANT, -Limit, Limit - 1);
+                }
+            }
+
+            return VerifyStoreOperand(Vc,
+                                      Function,
+                                      State,
+                                      &Instruction->Destination,
+                                      Right);
+
+        case OPC_AADD:
+        case OPC_ASUB:
+        case OPC_AOR:
+        case OPC_AAND:
+        case OPC_AXOR:
+        case OPC_ACAS:
+
+            //
+            // The variable is read and written in place. Other threads write
+            // it too, so nothing is known of what it or the result hold.
+            //
+
+            if(VerifyLoadOperand(Vc, Function, State, &Instruction->Left, &Left) == FALSE ||
+               VerifyLoadOperand(Vc, Function, State, &Instruction->Right, &Right) == FALSE ||
+               VerifyLoadOperand(Vc, Function, State, &Instruction->Destination, &Right) == FALSE) {
+
+                return FALSE;
+            }
+
+            if(VerifyStoreOperand(Vc,
+                                  Function,
+                                  State,
+                                  &Instruction->Left,
+                                  VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0)) == FALSE) {
+
+                return FALSE;
+            }
+
+            return VerifyStoreOperand(Vc,
+                                      Function,
+                                      State,
+                                      &Instruction->Destination,
+                                      VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0));
+
+        case OPC_RADD:
+        case OPC_RSUB:
+        case OPC_ROR:
+        case OPC_RAND:
+        case OPC_RXOR:
+        case OPC_RMIN:
+        case OPC_RMAX:
+
+            //
+            // The variable itself is only written atomically, by the first
+            // thread or a fold, and the operand is left in the destination
+            // as is.
+            //
+
+            if(VerifyLoadOperand(Vc, Function, State, &Instruction->Left, &Left) == FALSE ||
+               VerifyLoadOperand(Vc, Function, State, &Instruction->Right, &Right) == FALSE) {
+
+                return FALSE;
+            }
+
+            return VerifyStoreOperand(Vc,
+                                      Function,
+                                      State,
+                                      &Instruction->Destination,
+                                      Right);
+
+        case OPC_WAIT:
+        case OPC_SEND:
+            return VerifyLoadOperand(Vc, Function, State, &Instruction->Left, &Left);
+
+        case OPC_RECV:
+            return VerifyStoreOperand(Vc,
+                                      Function,
+                                      State,
+                                      &Instruction->Destination,
+                                      VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0));
+
+        case OPC_JOIN:
+
+            //
+            // The return value of the thread could be anything.
+            //
+
+            if(VerifyLoadOperand(Vc, Function, State, &Instruction->Left, &Left) == FALSE) {
+                return FALSE;
+            }
+
+            return VerifyStoreOperand(Vc,
+                                      Function,
+                                      State,
+                                      &Instruction->Destination,
+                                      VerifyMakeValue(VERIFY_VALUE_UNKNOWN, 0));
+
+        case OPC_JMP:
+        case OPC_JMPZ:
+            return TRUE;
+
+        case OPC_CALLNORM:
+        case OPC_CALLPLLS:
+        case OPC_CALLPLLA:
+        case OPC_PFOR:
+            return VerifyCall(Vc, Function, State, Instruction);
+
+        case OPC_RETURN:
+            if(VerifyValueEqual(State->Register[REG_RSB],
+                                VerifyMakeValue(VERIFY_VALUE_FRAME, 0)) == FALSE ||
+               VerifyValueEqual(State->Register[REG_RST],
+                                VerifyMakeValue(VERIFY_VALUE_CALLER, 0)) == FALSE) {
+
+                return VerifyFail(Vc, "Unbalanced stack at return.");
+            }
+
+            return TRUE;
+
+        case OPC_PUSH:
+            if(VerifyLoadOperand(Vc, Function, State, &Instruction->Left, &Left) == FALSE) {
+                return FALSE;
+            }
+
+            Rsb = VerifyArithmetic(OPC_SUBI,
+                                   State->Register[REG_RSB],
+                                   VerifyMakeValue(VERIFY_VALUE_CONSTANT,
+                                                   Vc->Alignment));
+
+            State->Register[REG_RSB] = Rsb;
+            return VerifyStoreOperand(Vc, Function, State, &StackTop, Left);
+
+        case OPC_POP:
+            if(VerifyLoadOperand(Vc, Function, State, &StackTop, &Left) == FALSE) {
+
+                return FALSE;
+            }
+
+            State->Register[REG_RSB] =
+                VerifyArithmetic(OPC_ADDI,
+                                 State->Register[REG_RSB],
+                                 VerifyMakeValue(VERIFY_VALUE_CONSTANT,
+                                                 Vc->Alignment));
+
+            return VerifyStoreOperand(Vc,
+                                      Function,
+                                      State,
+                                      &Instruction->Destination,
+                                      Left);
+
+        case OPC_PRINT:
+        case OPC_READ:
+            return VerifyIo(Vc, Function, State, Instruction);
+
+        default:
+            return VerifyFail(Vc, "Unknown instruction.");
+    }
+}
+
+VOID
+VerifyMerge (
+    PVERIFY_CONTEXT Vc,
+    ULONG Index,
+    PVERIFY_STATE State,
+    BOOL Backward
+    )
+
+/*
+
+ Routine description:
+
+    This routine merges a state into the state on entry to an instruction
+    and queues the instruction if its entry state changed. Every loop has a
+    backward branch, so past VERIFY_WIDEN_AFTER backward merges into an
+    instruction any bound that still moves there is given up on, and loops
+    settle.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Index - Index of the instruction.
+
+    State - The state arriving at the instruction.
+
+    Backward - TRUE if the state arrives by a backward branch.
+
+ Return value:
+
+    VOID.
+
+*/
+
+{
+    PVERIFY_STATE Target;
+    BOOL Changed;
+
+    Target = &Vc->States[Index];
+    Changed = FALSE;
+    if(Target->Reached == FALSE) {
+        memcpy(Target, State, sizeof(VERIFY_STATE));
+        Target->Reached = TRUE;
+        Target->Joins = 0;
+        Changed = TRUE;
+    } else {
+        VerifyJoin(Target,
+                   State,
+                   Backward != FALSE && Target->Joins >= VERIFY_WIDEN_AFTER,
+                   &Changed);
+
+        if(Changed != FALSE && Backward != FALSE) {
+            Target->Joins += 1;
+        }
+    }
+
+    if(Changed != FALSE && Vc->Queued[Index] == 0) {
+        Vc->Queued[Index] = 1;
+        Vc->Worklist[Vc->WorklistSize] = Index;
+        Vc->WorklistSize += 1;
+    }
+}
+
+BOOL
+VerifyFunction (
+    PVERIFY_CONTEXT Vc,
+    PVERIFY_FUNCTION Function
+    )
+
+/*
+
+ Routine description:
+
+    This routine walks a function until the state on entry to each of its
+    instructions settles, checking every instruction on the way.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+    Function - The function to verify.
+
+ Return value:
+
+    TRUE if the function is safe, FALSE otherwise.
+
+*/
+
+{
+    PDECODED_INSTRUCTION Instruction;
+    VERIFY_CONDITION Condition;
+    VERIFY_STATE State;
+    VERIFY_STATE Branch;
+    BOOL Taken;
+    BOOL Falls;
+    ULONG Index;
+    ULONG Next;
+    ULONG i;
+
+    //
+    // Threads start in the root with a zeroed register set and the stack
+    // pointer at the top of the stack. A function nothing has entered yet
+    // is only ever called, or never runs.
+    //
+
+    if(Function->Root != FALSE) {
+        VerifyEntryState(NULL, &State);
+        State.Register[REG_RST] =
+            VerifyMakeValue(VERIFY_VALUE_CONSTANT, Vc->Program->Header.StackTop);
+
+        State.Register[REG_RSB] = State.Register[REG_RST];
+    } else {
+        if(Function->Entered == FALSE) {
+            VerifyEntryState(NULL, &Function->EntryState);
+            Function->Entered = TRUE;
+        }
+
+        memcpy(&State, &Function->EntryState, sizeof(VERIFY_STATE));
+    }
+
+    Function->Walked = TRUE;
+    Vc->WorklistSize = 0;
+    VerifyMerge(Vc, Function->Entry, &State, FALSE);
+    while(Vc->WorklistSize != 0) {
+        Vc->WorklistSize -= 1;
+        Index = Vc->Worklist[Vc->WorklistSize];
+        Vc->Queued[Index] = 0;
+        Vc->Index = Index;
+        Instruction = &Vc->Program->Instructions[Index];
+        memcpy(&State, &Vc->States[Index], sizeof(VERIFY_STATE));
+
+        //
+        // A comparison only holds up to the next instruction.
+        //
+
+        memcpy(&Condition, &State.Condition, sizeof(VERIFY_CONDITION));
+        State.Condition.Register = REG_MAX;
+        if(VerifyInstruction(Vc, Function, &State, Instruction) == FALSE) {
+            return FALSE;
+        }
+
+        //
+        // Successors. The jump target of an unconditional jump out of the
+        // function enters another function. Each side of a conditional
+        // branch knows which way the comparison went.
+        //
+
+        Next = Index + 1;
+        switch(Instruction->BaseOpcode) {
+            case OPC_JMP:
+            case OPC_JMPZ:
+                memcpy(&Branch, &State, sizeof(VERIFY_STATE));
+                Taken = TRUE;
+                Falls = FALSE;
+                if(Instruction->BaseOpcode == OPC_JMPZ) {
+                    Taken = VerifyRefine(&Branch,
+                                         &Condition,
+                                         Instruction->Left.Register,
+                                         FALSE);
+
+                    Falls = VerifyRefine(&State,
+                                         &Condition,
+                                         Instruction->Left.Register,
+                                         TRUE);
+                }
+
+                if(Instruction->Target >= Function->Entry &&
+                   Instruction->Target < Function->End) {
+
+                    if(Taken != FALSE) {
+                        VerifyMerge(Vc,
+                                    Instruction->Target,
+                                    &Branch,
+                                    Instruction->Target <= Index);
+                    }
+
+                } else if(Instruction->BaseOpcode == OPC_JMP) {
+                    if(VerifyTransfer(Vc, &State, Instruction->Target, FALSE) == FALSE) {
+                        return FALSE;
+                    }
+
+                } else {
+                    return VerifyFail(Vc, "Branch out of the function.");
+                }
+
+                if(Falls == FALSE) {
+                    continue;
+                }
+
+                break;
+
+            case OPC_RETURN:
+                continue;
+        }
+
+        if(Next >= Function->End) {
+            return VerifyFail(Vc, "Execution falls out of the function.");
+        }
+
+        VerifyMerge(Vc, Next, &State, FALSE);
+    }
+
+    for(i=Function->Entry; i<Function->End; ++i) {
+        Vc->States[i].Reached = FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL
+VerifyTransfers (
+    PVERIFY_CONTEXT Vc
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks that each function fits where it is entered, now
+    that the extent of every frame is known. The callee's own frame must not
+    reach past its parameters into the caller's. A fixed stack pointer must
+    leave room for the whole frame. Frames below a stack pointer only known
+    relative to the caller are checked at run time, by the call.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+ Return value:
+
+    TRUE if every transfer is safe, FALSE otherwise.
+
+*/
+
+{
+    PVERIFY_TRANSFER Transfer;
+    PVERIFY_FUNCTION Callee;
+    LONG64 Entry;
+    ULONG i;
+
+    for(i=0; i<=Vc->Program->InstructionCount; ++i) {
+        Transfer = &Vc->Transfers[i];
+        if(Transfer->Valid == FALSE) {
+            continue;
+        }
+
+        Callee = &Vc->Functions[Transfer->Function];
+        Vc->Index = i;
+        Entry = Transfer->Rsb.Low;
+        if(Transfer->Call != FALSE) {
+            Entry -= Vc->Alignment;
+            if(Callee->MaxOffset >
+               (LONG64)Vc->Alignment * (1 + Callee->ParameterCount)) {
+
+                return VerifyFail(Vc, "Callee reaches past its parameters.");
+            }
+        }
+
+        if(Transfer->Rsb.Kind == VERIFY_VALUE_CONSTANT &&
+           (Entry + Callee->MinOffset < 0 ||
+            Entry + Callee->MaxOffset > (LONG64)Vc->StackSize)) {
+
+            return VerifyFail(Vc, "Function doesn't fit the stack.");
+        }
+    }
+
+    return TRUE;
+}
+
+VOID
+VerifyStructure (
+    PVERIFY_CONTEXT Vc
+    )
+
+/*
+
+ Routine description:
+
+    This routine checks what every program has to get right to be run at
+    all, verified or not. Control must stay inside the instruction stream.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+ Return value:
+
+    VOID. Malformed programs are fatal.
+
+*/
+
+{
+    PDECODED_INSTRUCTION Instruction;
+    PPROGRAM Program;
+    ULONG i;
+
+    Program = Vc->Program;
+    if(Program->InstructionCount == 0) {
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+
+    for(i=0; i<Program->InstructionCount; ++i) {
+        Instruction = &Program->Instructions[i];
+        switch(Instruction->BaseOpcode) {
+            case OPC_JMP:
+            case OPC_JMPZ:
+            case OPC_CALLNORM:
+            case OPC_CALLPLLS:
+            case OPC_CALLPLLA:
+            case OPC_PFOR:
+                if(Instruction->Target >= Program->InstructionCount) {
+                    VmFatal(ERR_STR_INVALIDINSTR);
+                }
+
+                break;
+        }
+    }
+
+    Instruction = &Program->Instructions[Program->InstructionCount - 1];
+    if(Instruction->BaseOpcode != OPC_JMP &&
+       Instruction->BaseOpcode != OPC_RETURN) {
+
+        VmFatal(ERR_STR_INVALIDINSTR);
+    }
+}
+
+INT
+VerifyCompareFunctions (
+    const void *Left,
+    const void *Right
+    )
+{
+    ULONG LeftEntry;
+    ULONG RightEntry;
+
+    LeftEntry = ((PVERIFY_FUNCTION)Left)->Entry;
+    RightEntry = ((PVERIFY_FUNCTION)Right)->Entry;
+    return (LeftEntry > RightEntry) - (LeftEntry < RightEntry);
+}
+
+LONG
+VerifyBuildFunctions (
+    PVERIFY_CONTEXT Vc
+    )
+
+/*
+
+ Routine description:
+
+    This routine splits the instruction stream into functions at the entry
+    points in the symbol table. Whatever comes before the first function is
+    the start block, the root every thread of the program begins in.
+
+ Arguments:
+
+    Vc - The verifier context.
+
+ Return value:
+
+    0 on success, -1 if out of memory.
+
+*/
+
+{
+    PPROGRAM Program;
+    PVERIFY_FUNCTION Function;
+    PDECODED_INSTRUCTION Instruction;
+    ULONG Address;
+    ULONG Count;
+    ULONG i;
+    ULONG j;
+
+    Program = Vc->Program;
+    Vc->Functions = malloc((Program->FunctionSymbolsSize + 1) * sizeof(VERIFY_FUNCTION));
+    if(Vc->Functions == NULL) {
+        return -1;
+    }
+
+    memset(Vc->Functions, 0, (Program->FunctionSymbolsSize + 1) * sizeof(VERIFY_FUNCTION));
+    Count = 0;
+    Function = &Vc->Functions[Count];
+    Function->Entry = 0;
+    Function->Root = TRUE;
+    Count += 1;
+    for(i=0; i<Program->FunctionSymbolsSize; ++i) {
+        Address = Program->FunctionSymbols[i].FunctionAddress -
+                  Program->Header.CodeStart;
+
+        if((Address % sizeof(INSTRUCTION)) != 0 ||
+           Address / sizeof(INSTRUCTION) >= Program->InstructionCount) {
+
+            VmFatal(ERR_STR_INVALIDINSTR);
+        }
+
+        Function = &Vc->Functions[Count];
+        Function->Entry = Address / sizeof(INSTRUCTION);
+        Function->ParameterCount = Program->FunctionSymbols[i].ParameterCount;
+        Count += 1;
+    }
+
+    //
+    // A program without a start block starts straight in its first
+    // function.
+    //
+
+    qsort(Vc->Functions, Count, sizeof(VERIFY_FUNCTION), VerifyCompareFunctions);
+    j = 0;
+    for(i=0; i<Count; ++i) {
+        if(j != 0 && Vc->Functions[i].Entry == Vc->Functions[j - 1].Entry) {
+            if(Vc->Functions[i].Root == FALSE) {
+                Vc->Functions[j - 1] = Vc->Functions[i];
+            }
+
+            continue;
+        }
+
+        Vc->Functions[j] = Vc->Functions[i];
+        j += 1;
+    }
+
+    Vc->FunctionCount = j;
+    for(i=0; i<Vc->FunctionCount; ++i) {
+        Function = &Vc->Functions[i];
+        Function->End = (i + 1 < Vc->FunctionCount) ?
+                        Vc->Functions[i + 1].Entry :
+                        Program->InstructionCount;
+
+        if(Function->Root == FALSE) {
+            Vc->EntryFunction[Function->Entry] = i;
+        }
+
+        for(j=Function->Entry; j<Function->End; ++j) {
+            Instruction = &Program->Instructions[j];
+            if(Instruction->BaseOpcode != OPC_RETURN) {
+                continue;
+            }
+
+            if(Function->Cleanup == 0) {
+                Function->Cleanup = Instruction->StackCleanup;
+            } else if(Function->Cleanup != Instruction->StackCleanup) {
+                Function->Cleanup = 0;
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+LONG
+VerifyProgram (
+    PPROGRAM Program
+    )
+
+/*
+
+ Routine description:
+
+    This routine verifies a decoded program, setting Program->Verified if
+    every memory access it makes is proven to stay inside its address space.
+    Calls then carry the stack depth of the callee in Left.Offset, for the
+    one check the interpreter is left with.
+
+    Must run before fusion, on the plain decoded stream, and after the
+    address space is laid out.
+
+ Arguments:
+
+    Program - The program to verify.
+
+ Return value:
+
+    0 on success, whether or not the program could be verified. -1 if out
+    of memory.
+
+*/
+
+{
+    VERIFY_CONTEXT Vc;
+    VERIFY_STATE State;
+    PVERIFY_TRANSFER Transfer;
+    PVERIFY_FUNCTION Function;
+    LONG RetVal;
+    ULONG Count;
+    ULONG i;
+
+    RetVal = -1;
+    memset(&Vc, 0, sizeof(VERIFY_CONTEXT));
+    Vc.Program = Program;
+    Vc.Alignment = Program->Header.StackAlignment;
+    Vc.StackSize = Program->Space->StackSize;
+    Program->Verified = FALSE;
+    Program->FixedStackReads = FALSE;
+    VerifyStructure(&Vc);
+
+    Count = Program->InstructionCount;
+    Vc.EntryFunction = malloc(Count * sizeof(ULONG));
+    Vc.States = malloc(Count * sizeof(VERIFY_STATE));
+    Vc.Worklist = malloc(Count * sizeof(ULONG));
+    Vc.Queued = malloc(Count);
+    Vc.Transfers = malloc((Count + 1) * sizeof(VERIFY_TRANSFER));
+    if(Vc.EntryFunction == NULL ||
+       Vc.States == NULL ||
+       Vc.Worklist == NULL ||
+       Vc.Queued == NULL ||
+       Vc.Transfers == NULL) {
+
+        goto VerifyProgramEnd;
+    }
+
+    memset(Vc.EntryFunction, 0xFF, Count * sizeof(ULONG));
+    memset(Vc.States, 0, Count * sizeof(VERIFY_STATE));
+    memset(Vc.Queued, 0, Count);
+    memset(Vc.Transfers, 0, (Count + 1) * sizeof(VERIFY_TRANSFER));
+    if(VerifyBuildFunctions(&Vc) != 0) {
+        goto VerifyProgramEnd;
+    }
+
+    RetVal = 0;
+    for(i=0; i<Vc.FunctionCount; ++i) {
+        Function = &Vc.Functions[i];
+
+        //
+        // Threads start at the first instruction with the stack pointer at
+        // the top of the stack. That's a jump into the function there when
+        // there is no start block.
+        //
+
+        if(Function->Root == FALSE && Function->Entry == 0) {
+            VerifyEntryState(NULL, &State);
+            State.Register[REG_RSB] =
+                VerifyMakeValue(VERIFY_VALUE_CONSTANT, Program->Header.StackTop);
+
+            Vc.Index = Count;
+            if(VerifyTransfer(&Vc, &State, 0, FALSE) == FALSE) {
+                goto VerifyProgramEnd;
+            }
+        }
+
+        if(VerifyFunction(&Vc, Function) == FALSE) {
+            goto VerifyProgramEnd;
+        }
+    }
+
+    if(VerifyTransfers(&Vc) == FALSE) {
+        goto VerifyProgramEnd;
+    }
+
+    for(i=0; i<Count; ++i) {
+        Transfer = &Vc.Transfers[i];
+        if(Transfer->Valid != FALSE && Transfer->Call != FALSE) {
+            Program->Instructions[i].Left.Offset =
+                -Vc.Functions[Transfer->Function].MinOffset;
+        }
+    }
+
+    Program->Verified = TRUE;
+
+VerifyProgramEnd:
+    if(RetVal == 0) {
+        DebugPrettyPrintVerifyReport(&Vc);
+    }
+
+    free(Vc.EntryFunction);
+    free(Vc.States);
+    free(Vc.Worklist);
+    free(Vc.Queued);
+    free(Vc.Transfers);
+    free(Vc.Functions);
+    return RetVal;
+}
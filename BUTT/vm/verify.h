@@ -0,0 +1,166 @@
+/**
+
+ Copyright 2015 Omar Carey.
+
+ This file is part of BUTT.
+
+ BUTT is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ BUTT is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with BUTT.  If not, see <http://www.gnu.org/licenses/>.
+
+ Translation Unit:
+
+    verify.h
+
+ Abstract:
+
+    This module defines the load time verifier, which proves that every
+    memory access of a program stays inside its address space so that the
+    interpreter can run it without bounds checks.
+
+ Author:
+
+    Omar Carey      Carey403@gmail.com      10/17/26
+
+ Revision:
+
+    10/17/26        Initial Creation
+
+**/
+
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+#include <windows.h>
+#include "program.h"
+
+//
+// The verifier follows the values of the registers through each function,
+// relative to the stack pointer on entry to the function, and of the stack
+// slots the function saves registers and locals into. A value is a range of
+// offsets from its base, a single one for most.
+//
+
+#define VERIFY_MAX_SLOTS        16
+
+//
+// Merging into an instruction by a backward branch more often than this
+// gives up on the bounds that keep moving, so loops settle.
+//
+
+#define VERIFY_WIDEN_AFTER      2
+
+typedef enum _VERIFY_VALUE_KIND {
+    VERIFY_VALUE_UNKNOWN    = 0,    // Anything
+    VERIFY_VALUE_CONSTANT   = 1,    // Low..High
+    VERIFY_VALUE_FRAME      = 2,    // RSB on entry + Low..High
+    VERIFY_VALUE_CALLER     = 3,    // RST on entry + Low..High
+} VERIFY_VALUE_KIND;
+
+typedef struct _VERIFY_VALUE {
+    ULONG Kind;
+    LONG Low;
+    LONG High;
+} VERIFY_VALUE, *PVERIFY_VALUE;
+
+typedef struct _VERIFY_SLOT {
+    LONG Offset;                    // RSB on entry + Offset
+    VERIFY_VALUE Value;
+} VERIFY_SLOT, *PVERIFY_SLOT;
+
+//
+// The comparison the last instruction left in a register, so the branch on
+// it can narrow the range of what was compared.
+//
+
+typedef struct _VERIFY_CONDITION {
+    ULONG Register;                 // Holding the result, REG_MAX for none
+    ULONG Operator;                 // Compared value on the left
+    BOOL Slot;                      // Compared value is a frame slot
+    LONG Location;                  // Slot offset or register
+    VERIFY_VALUE Bound;             // A constant range
+} VERIFY_CONDITION, *PVERIFY_CONDITION;
+
+typedef struct _VERIFY_STATE {
+    BOOL Reached;
+    ULONG Joins;
+    ULONG SlotCount;
+    VERIFY_VALUE Register[REG_MAX];
+    VERIFY_SLOT Slot[VERIFY_MAX_SLOTS];
+    VERIFY_CONDITION Condition;
+} VERIFY_STATE, *PVERIFY_STATE;
+
+typedef struct _VERIFY_FUNCTION {
+    ULONG Entry;
+    ULONG End;
+    ULONG ParameterCount;
+    BOOL Root;
+
+    //
+    // Bytes the function cleans up on return, zero if its returns don't
+    // agree on it. The range of VM memory it accesses, relative to the stack
+    // pointer on entry.
+    //
+
+    ULONG Cleanup;
+    LONG MinOffset;
+    LONG MaxOffset;
+
+    //
+    // What the registers hold on entry, from every call and jump into the
+    // function seen so far. Walked once the function has been verified.
+    //
+
+    BOOL Entered;
+    BOOL Walked;
+    VERIFY_STATE EntryState;
+} VERIFY_FUNCTION, *PVERIFY_FUNCTION;
+
+//
+// A call, or a jump from one function straight into another. Whether the
+// callee fits where it is entered is only known once every function has
+// been through the verifier. Kept per instruction, with one more for the
+// start of a program without a start block.
+//
+
+typedef struct _VERIFY_TRANSFER {
+    BOOL Valid;
+    ULONG Function;
+    BOOL Call;
+    VERIFY_VALUE Rsb;
+} VERIFY_TRANSFER, *PVERIFY_TRANSFER;
+
+#define VERIFY_NO_FUNCTION      ((ULONG)-1)
+
+typedef struct _VERIFY_CONTEXT {
+    PPROGRAM Program;
+    ULONG Alignment;
+    ULONG StackSize;
+    PVERIFY_FUNCTION Functions;
+    ULONG FunctionCount;
+    PULONG EntryFunction;
+    PVERIFY_STATE States;
+    PULONG Worklist;
+    ULONG WorklistSize;
+    PUCHAR Queued;
+    PVERIFY_TRANSFER Transfers;
+    ULONG Index;
+    ULONG FailIndex;
+    PCHAR FailReason;
+} VERIFY_CONTEXT, *PVERIFY_CONTEXT;
+
+LONG
+VerifyProgram (
+    PPROGRAM Program
+    );
+
+#endif // __VERIFY_H__